@@ -25,6 +25,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include "adapters_config.h"
+#include "instr.h"
+#include <driver.h>
 
 #ifdef ADAPTER_PARAPORT
 #include <paraport.h>
@@ -42,6 +44,22 @@
 #include <lxi.h>
 #endif
 
+#ifdef ADAPTER_SHM
+#include <shmbus.h>
+#endif
+
+#ifdef ADAPTER_REMOTE
+#include <remote.h>
+#endif
+
+#ifdef ADAPTER_SIM
+#include <sim.h>
+#endif
+
+#ifdef ADAPTER_REPLAY
+#include <replay.h>
+#endif
+
 static regex_t preg;            /* Compiled regular expression for generic
                                    part of adapter-string parsing */
 
@@ -132,6 +150,30 @@ int adapters_parse(const char *adapterstr, struct adapter *adapter)
                   lxi_parse(adapterstr, adapter)) == 0,
                  goto adapters_parse_err);
 #endif
+#ifdef ADAPTER_SHM
+    if (strcasecmp(adapter_str, "shm") == 0)
+        ASSURE_E((rc =
+                  shmbus_parse(adapterstr, adapter)) == 0,
+                 goto adapters_parse_err);
+#endif
+#ifdef ADAPTER_REMOTE
+    if (strcasecmp(adapter_str, "remote") == 0)
+        ASSURE_E((rc =
+                  remote_parse(adapterstr, adapter)) == 0,
+                 goto adapters_parse_err);
+#endif
+#ifdef ADAPTER_SIM
+    if (strcasecmp(adapter_str, "sim") == 0)
+        ASSURE_E((rc =
+                  sim_parse(adapterstr, adapter)) == 0,
+                 goto adapters_parse_err);
+#endif
+#ifdef ADAPTER_REPLAY
+    if (strcasecmp(adapter_str, "replay") == 0)
+        ASSURE_E((rc =
+                  replay_parse(adapterstr, adapter)) == 0,
+                 goto adapters_parse_err);
+#endif
 #ifdef ADAPTER_HIF
     if (strcasecmp(adapter_str, "hif") == 0)
         ASSURE_E((rc =
@@ -172,6 +214,26 @@ int adapters_init_adapter(struct adapter *adapter)
             rc = lxi_init_adapter(adapter);
             break;
 #endif
+#ifdef ADAPTER_SHM
+        case SHM:
+            rc = shmbus_init_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_REMOTE
+        case REMOTE:
+            rc = remote_init_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_SIM
+        case SIM:
+            rc = sim_init_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_REPLAY
+        case REPLAY:
+            rc = replay_init_adapter(adapter);
+            break;
+#endif
 #ifdef DEVICE_HIF
         case HIF:
             rc = ftdi_mpsse_init_device(device);
@@ -180,6 +242,8 @@ int adapters_init_adapter(struct adapter *adapter)
         default:
             LOGE("Unsupported adapter [%d] in [%s]\n", adapter->devid, __func__);
     }
+    if (rc == 0)
+        rc = instr_wrap_adapter(adapter);
 
     return rc;
 }
@@ -191,6 +255,7 @@ int adapters_deinit_adapter(struct adapter *adapter)
     ASSERT(adapter);
     ASSERT(adapter->driver.any);
     LOGD("{%d,%d,%d}\n", adapter->devid, adapter->role, adapter->index);
+    instr_unwrap_adapter(adapter);
     switch (adapter->devid) {
 #ifdef ADAPTER_PARAPORT
         case PARAPORT:
@@ -207,6 +272,26 @@ int adapters_deinit_adapter(struct adapter *adapter)
             rc = lxi_deinit_adapter(adapter);
             break;
 #endif
+#ifdef ADAPTER_SHM
+        case SHM:
+            rc = shmbus_deinit_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_REMOTE
+        case REMOTE:
+            rc = remote_deinit_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_SIM
+        case SIM:
+            rc = sim_deinit_adapter(adapter);
+            break;
+#endif
+#ifdef ADAPTER_REPLAY
+        case REPLAY:
+            rc = replay_deinit_adapter(adapter);
+            break;
+#endif
 #ifdef DEVICE_HIF
         case HIF:
             rc = ftdi_mpsse_deinit_device(device);
@@ -218,6 +303,73 @@ int adapters_deinit_adapter(struct adapter *adapter)
     return rc;
 }
 
+int adapters_i2c_scan(struct adapter *adapter, uint8_t first, uint8_t last,
+                      uint8_t *present)
+{
+    struct driverAPI_i2c *i2c = adapter->driver.i2c;
+    struct ddata *ddata = i2c->ddata;
+    int a, ack, n = 0;
+
+    ASSURE_E(adapter->role == ROLE_I2C, return -1);
+    ASSURE_E(first <= last && last < 0x80, return -1);
+    memset(present, 0, I2C_SCAN_BYTES);
+
+    if (i2c->scan && (n = i2c->scan(ddata, first, last, present)) != -1)
+        return n;
+
+    /* Adapters queueing messages until stop don't know of any ACK before
+     * that, they need a probe method */
+    if (!i2c->probe && (driver_caps(i2c)->flags & DCAP_MULTI_MSG))
+        return -1;
+
+    for (n = 0, a = first; a <= last; a++) {
+        if (i2c->probe) {
+            ack = i2c->probe(ddata, a);
+        } else {
+            i2c->start(ddata);
+            ack = i2c->sendByte(ddata, a << 1);
+            i2c->stop(ddata);
+        }
+        if (ack == -1)
+            return -1;
+        if (ack) {
+            I2C_SCAN_SET(present, a);
+            n++;
+        }
+    }
+    return n;
+}
+
+int adapters_serve(struct adapter **adapters, int nadapters,
+                   const char *sockname)
+{
+#ifdef ADAPTER_SHM
+    int i;
+
+    for (i = 0; i < nadapters; i++) {
+        if (adapters[i]->devid == SHM) {
+            LOGE("Can't serve adapter [%d], it's a client itself\n", i);
+            return -1;
+        }
+    }
+    return shmbus_serve(adapters, nadapters, sockname);
+#else
+    LOGE("Daemon mode requires ADAPTER_SHM\n");
+    return -1;
+#endif
+}
+
+int adapters_serve_remote(struct adapter **adapters, int nadapters,
+                          const char *addr)
+{
+#ifdef ADAPTER_REMOTE
+    return remote_serve(adapters, nadapters, addr);
+#else
+    LOGE("Serving remote clients requires ADAPTER_REMOTE\n");
+    return -1;
+#endif
+}
+
 /***************************************************************************
  * INIT/FINI mechanism
  ***************************************************************************/
@@ -20,6 +20,7 @@
 #ifndef adapters_h
 #define adapters_h
 #include <config.h>
+#include <stdint.h>
 
 #define REXP_ESTRSZ 80
 
@@ -48,6 +49,10 @@ typedef enum {
     BUSPIRATE = 101,
     HIF = 102,
     LXI = 103,
+    SHM = 104,                  /* Client of an adapter daemon */
+    REMOTE = 105,               /* Adapter of another (remote) ehwe */
+    SIM = 106,                  /* In-process simulated devices */
+    REPLAY = 107,               /* Recorded adapter calls (ehwe -R) */
 } devid_t;
 
 /* Note: Not all adapters can have variations in clock-owners */
@@ -59,7 +64,7 @@ typedef enum {
 } clkownr_t;
 
 // Valid regex-i patterns for adapters
-#define ADAPTERS "PP|BP|HIF|LXI"
+#define ADAPTERS "PP|BP|HIF|LXI|SHM|REMOTE|SIM|REPLAY"
 
 // Valid regex-i patterns for "direction"
 #define DIRECTIONS "MASTER|SLAVE"
@@ -73,6 +78,10 @@ struct paraport;
 struct buspirate;
 struct ftdi_mpsse;
 struct lxi;
+struct shmbus;
+struct remote;
+struct sim;
+struct replay;
 
 struct adapter {
     devid_t devid;
@@ -83,6 +92,10 @@ struct adapter {
         struct buspirate *buspirate;
         struct ftdi_mpsse *ftdi_mpsse;
         struct lxi *lxi;
+        struct shmbus *shmbus;
+        struct remote *remote;
+        struct sim *sim;
+        struct replay *replay;
     };
     union {
         struct driverAPI_any *any;
@@ -96,4 +109,23 @@ int adapters_parse(const char *adapterstr, struct adapter *adapter);
 int adapters_init_adapter(struct adapter *adapter);
 int adapters_deinit_adapter(struct adapter *adapter);
 
+/* Probe I2C addresses first..last of adapter, by its scan method if it has
+ * one, else one by one. Bits of those that ACK are set in present
+ * (I2C_SCAN_BYTES, see driver.h). Returns number found, -1 if the adapter
+ * can't tell. */
+int adapters_i2c_scan(struct adapter *adapter, uint8_t first, uint8_t last,
+                      uint8_t *present);
+
+/* Default Unix socket of adapter daemon (ehwe -z) */
+#define ADAPTERS_DFLT_SOCKET "/tmp/ehwe.sock"
+
+/* Serve adapters to other processes until terminated (ehwe -z) */
+int adapters_serve(struct adapter **adapters, int nadapters,
+                   const char *sockname);
+
+/* Serve adapters to REMOTE clients on [host]:port or Unix socket path
+ * until terminated (ehwe -L) */
+int adapters_serve_remote(struct adapter **adapters, int nadapters,
+                          const char *addr);
+
 #endif                          //adapters_h
@@ -52,18 +52,34 @@ struct ddata;
 
 #define REGEX_NSUB (5+1)
 
+/* Methods doing I/O, framed by session.c if the BP may be shared */
+#ifdef BUSPIRATE_SHARED_SESSION
+#define BPSPI(F) bpsspi_ ## F
+#define BPI2C(F) bpsi2c_ ## F
+#else
+#define BPSPI(F) bpspi_ ## F
+#define BPI2C(F) bpi2c_ ## F
+#endif
+
 /* Convenience variables: */
 #ifdef BUSPIRATE_ENABLE_SPI
 /*    SPI driver */
+static const struct driver_caps bpspi_caps = {
+    .max_xfer = BP_SPI_MAX_XFER,
+    .latency_us = 2000,         /* A command round-trip over USB-serial */
+    .flags = DCAP_WRITE_READ,
+};
+
 static struct driverAPI_spi bpspi_driver = {
     .ddata = NULL,
-    .sendData = bpspi_sendData,
-    .sendrecieveData = bpspi_sendrecieveData,
-    .sendrecieveData_ncs = bpspi_sendrecieveData_ncs,
-    .setCS = bpspi_setCS,
-    .receiveData = bpspi_receiveData,
+    .caps = &bpspi_caps,
+    .sendData = BPSPI(sendData),
+    .sendrecieveData = BPSPI(sendrecieveData),
+    .sendrecieveData_ncs = BPSPI(sendrecieveData_ncs),
+    .setCS = BPSPI(setCS),
+    .receiveData = BPSPI(receiveData),
     .getStatus = bpspi_getStatus,
-    .actuate_config = bpspi_configure,
+    .actuate_config = BPSPI(actuate),
     .newddata = bpspi_newddata,
     .config = {
                .set = {
@@ -93,18 +109,24 @@ static struct driverAPI_spi bpspi_driver = {
 #endif
 #ifdef BUSPIRATE_ENABLE_I2C
 /*    I2C driver */
+static const struct driver_caps bpi2c_caps = {
+    .latency_us = 2000,         /* Per byte, each is a round-trip */
+};
+
 static struct driverAPI_i2c bpi2c_driver = {
     .ddata = NULL,
-    .sendByte = bpi2c_sendByte,
-    .receiveByte = bpi2c_receiveByte,
-    .sendData = bpi2c_sendData,
-    .receiveData = bpi2c_receiveData,
-    .sendrecieveData = bpi2c_sendrecieveData,
-    .start = bpi2c_start,
-    .stop = bpi2c_stop,
+    .caps = &bpi2c_caps,
+    .sendByte = BPI2C(sendByte),
+    .receiveByte = BPI2C(receiveByte),
+    .sendData = BPI2C(sendData),
+    .receiveData = BPI2C(receiveData),
+    .sendrecieveData = BPI2C(sendrecieveData),
+    .start = BPI2C(start),
+    .stop = BPI2C(stop),
+    .scan = BPI2C(scan),
     .autoAck = bpi2c_autoAck,
     .getStatus = bpi2c_getStatus,
-    .actuate_config = bpi2c_configure,
+    .actuate_config = BPI2C(actuate),
     .newddata = bpi2c_newddata,
     .config = {
                .set = {
@@ -300,6 +322,7 @@ int buspirate_init_adapter(struct adapter *adapter)
 {
     struct driverAPI_any *driver;
     struct ddata *ddata;
+    bpcmd_raw_t mode;
 
     LOGI("BP: Initializing adapter ID [%d]\n", adapter->devid);
 
@@ -309,12 +332,14 @@ int buspirate_init_adapter(struct adapter *adapter)
         case ROLE_SPI:
             memcpy(driver, &bpspi_driver, sizeof(struct driverAPI_spi));
             ddata = bpspi_newddata(NULL);
+            mode = ENTER_SPI;
             break;
 #endif
 #ifdef BUSPIRATE_ENABLE_I2C
         case ROLE_I2C:
             memcpy(driver, &bpi2c_driver, sizeof(struct driverAPI_spi));
             ddata = bpi2c_newddata(NULL);
+            mode = ENTER_I2C;
             break;
 #endif
         default:
@@ -322,6 +347,24 @@ int buspirate_init_adapter(struct adapter *adapter)
             return -1;
     }
 
+    driver->ddata = ddata;
+    driver->adapter = adapter;
+    adapter->driver.any = driver;
+    ddata->driver.any = driver;
+
+#ifdef BUSPIRATE_SHARED_SESSION
+    {
+        struct bp_session *session;
+
+        /* Already initialized by an adapter in another role */
+        if ((session = bp_session_find(adapter->buspirate->name))) {
+            bp_session_attach(ddata, session);
+            goto buspirate_init_ready;
+        }
+    }
+#endif
+
+    ddata->baud = BP_BAUD_DFLT;
     ASSURE((ddata->fd =
             open(adapter->buspirate->name, O_RDWR | O_NONBLOCK)) != -1);
 
@@ -332,33 +375,33 @@ int buspirate_init_adapter(struct adapter *adapter)
 #endif
 
     empty_inbuff(ddata->fd);
-    driver->ddata = ddata;
-    driver->adapter = adapter;
-    adapter->driver.any = driver;
-    ddata->driver.any = driver;
-
-    ASSURE(rawMode_enter(adapter) == 0);
 
-    switch (adapter->role) {
-#ifdef BUSPIRATE_ENABLE_SPI
-        case ROLE_SPI:
-            ASSURE(rawMode_toMode(adapter, ENTER_SPI) == 0);
-            break;
+#ifdef BUSPIRATE_PERSISTENT_SESSION
+    /* BP left in binary mode by previous session: skip the reset cycle and
+     * go straight to configuration */
+    if (rawMode_probe_bauds(adapter, mode) == 0) {
+        LOGI("BP: Adapter [%s] re-attached in mode %d at %d baud\n",
+             adapter->buspirate->name, mode, ddata->baud);
+    } else
 #endif
-#ifdef BUSPIRATE_ENABLE_I2C
-        case ROLE_I2C:
-            ASSURE(rawMode_toMode(adapter, ENTER_I2C) == 0);
-            break;
+    {
+        empty_inbuff(ddata->fd);
+        ASSURE(rawMode_enter(adapter) == 0);
+#if BUSPIRATE_BAUD > BP_BAUD_DFLT
+        /* Leaves BP in console mode, at whatever baud it ended up */
+        rawMode_baud(adapter);
+        ASSURE(rawMode_enter(adapter) == 0);
 #endif
-        default:
-            LOGE("Adapter BusPirate can't handle role %d (yet)\n", adapter->role);
-            ASSURE("Bad adapter->role" == 0);
+        ASSURE(rawMode_toMode(adapter, mode) == 0);
     }
     close(ddata->fd);
     ASSURE((ddata->fd = open(adapter->buspirate->name, O_RDWR)) != -1);
 #ifdef HAVE_POSIX_TERMIO
     stio_bp_raw(ddata->fd);
 #endif
+    if (ddata->baud != BP_BAUD_DFLT)
+        ASSURE(bp_host_baud(ddata->fd, ddata->baud) == 0);
+    bp_lowlat_apply(ddata, adapter->buspirate->name);
 
     LOGI("Adapter [%s] is now state-initialized and re-opened blocking r/w\n",
          adapter->buspirate->name);
@@ -380,6 +423,15 @@ int buspirate_init_adapter(struct adapter *adapter)
             LOGE("Adapter BusPirate can't handle role %d (yet)\n", adapter->role);
             ASSURE("Bad adapter->role" == 0);
     }
+#ifdef BUSPIRATE_SHARED_SESSION
+    bp_session_new(ddata, adapter->buspirate->name);
+buspirate_init_ready:
+#endif
+#if defined(BUSPIRATE_ENABLE_SPI) && defined(BUSPIRATE_SPI_CALIBRATE)
+    /* Through the driver, the BP may be shared already */
+    if (adapter->role == ROLE_SPI)
+        ASSURE(bpspi_calibrate(adapter) == 0);
+#endif
 
     return 0;
 }
@@ -390,12 +442,31 @@ int buspirate_deinit_adapter(struct adapter *adapter)
     struct ddata *ddata = driver->ddata;
     struct buspirate *buspirate = adapter->buspirate;
 
+#ifdef BUSPIRATE_SHARED_SESSION
+    /* Only the last adapter leaving the BP resets it */
+    if (bp_session_detach(ddata) > 0) {
+        LOGI("BP: Destroying adapter ID [%d], [%s] still in use\n",
+             adapter->devid, adapter->buspirate->name);
+        goto buspirate_deinit_free;
+    }
+#endif
+#ifdef BUSPIRATE_PERSISTENT_SESSION
+    /* Leave BP in current binary mode so that next session can re-attach
+     * without a reset cycle (see rawMode_probe) */
+    LOGI("BP: Destroying adapter ID [%d], leaving [%s] in mode %d\n",
+         adapter->devid, adapter->buspirate->name, ddata->state);
+    bp_lowlat_restore(ddata);
+#else
+    bp_lowlat_restore(ddata);
     close(ddata->fd);
     ASSURE((ddata->fd =
             open(adapter->buspirate->name, O_RDWR | O_NONBLOCK)) != -1);
 #ifdef HAVE_POSIX_TERMIO
     stio_bp_terminal(ddata->fd);
 #endif
+    /* Back to BP_BAUD_DFLT by the reset below */
+    if (ddata->baud != BP_BAUD_DFLT)
+        ASSURE(bp_host_baud(ddata->fd, ddata->baud) == 0);
 
     LOGD("Adapter [%s] re-opened non-blocking r/w\n", adapter->buspirate->name);
 
@@ -406,8 +477,12 @@ int buspirate_deinit_adapter(struct adapter *adapter)
     empty_inbuff(ddata->fd);
     ASSURE(rawMode_toMode(adapter, RESET_BUSPIRATE) == 0);
     msleep(100);
+#endif
 
     close(ddata->fd);
+#ifdef BUSPIRATE_SHARED_SESSION
+buspirate_deinit_free:
+#endif
     free(ddata);
     free(driver);
     free(buspirate);
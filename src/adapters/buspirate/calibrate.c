@@ -0,0 +1,194 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * SPI clock calibration.
+ *
+ * Steps the SPI speed up from the slowest setting. At each step it reads a
+ * known region repeatedly: the JEDEC ID and the first bytes of the array,
+ * as read at the slowest speed. The fastest step where all reads and all
+ * slower steps matched, less a margin, is used. It's cached per device
+ * path, so each rig is calibrated once. Remove its line from the cache
+ * file to calibrate again.
+ *
+ * Assumes an SPI NOR flash (or something else as harmless to 0x9F and 0x03)
+ * on the bus.
+ */
+#include "config.h"
+#include "buspirate_config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include <driver.h>
+#include <buspirate.h>
+#include "local.h"
+
+/* Reads per speed step */
+#define CAL_READS 32
+
+/* Bytes of array read, from address 0 */
+#define CAL_ARRAY 64
+
+#define CAL_MAXLINE (PATH_MAX + 16)
+
+/* Known region: JEDEC ID followed by start of array */
+struct cal_region {
+    uint8_t id[3];
+    uint8_t array[CAL_ARRAY];
+};
+
+static void cal_read(struct driverAPI_spi *drv, struct cal_region *r)
+{
+    drv->sendrecieveData(drv->ddata, (uint8_t[]){0x9F}, 1, r->id,
+                         sizeof(r->id));
+    drv->sendrecieveData(drv->ddata, (uint8_t[]){0x03, 0, 0, 0}, 4,
+                         r->array, sizeof(r->array));
+}
+
+static int cal_speed(struct driverAPI_spi *drv, int speed)
+{
+    ASSURE_E(drv->config.set.speed(speed, drv->ddata) == CONFIG_DRIVER_OK,
+             return -1);
+    return drv->actuate_config(drv->ddata);
+}
+
+/***************************************************************************
+ * Cache, one "<device-path>\t<speed>" per line
+ ***************************************************************************/
+static int cache_path(char *path, size_t sz, int mkdirs)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+
+    if (xdg && xdg[0])
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    else if (home && home[0])
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else
+        return -1;
+    if (mkdirs)
+        mkdir(dir, 0755);
+    strncat(dir, "/" PROJ_NAME, sizeof(dir) - strlen(dir) - 1);
+    if (mkdirs)
+        mkdir(dir, 0755);
+    snprintf(path, sz, "%s/bp-spi-speed", dir);
+    return 0;
+}
+
+static int cache_get(const char *name)
+{
+    char path[PATH_MAX], line[CAL_MAXLINE], *tab;
+    int speed = -1;
+    FILE *f;
+
+    if (cache_path(path, sizeof(path), 0) || !(f = fopen(path, "r")))
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (!(tab = strrchr(line, '\t')))
+            continue;
+        *tab = 0;
+        if (strcmp(line, name) == 0)
+            speed = atoi(tab + 1);
+    }
+    fclose(f);
+    return speed;
+}
+
+static void cache_put(const char *name, int speed)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 4], line[CAL_MAXLINE], *tab;
+    FILE *in, *out;
+
+    if (cache_path(path, sizeof(path), 1))
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.new", path);
+    ASSURE_E(out = fopen(tmp, "w"), goto cache_err);
+    if ((in = fopen(path, "r"))) {
+        while (fgets(line, sizeof(line), in)) {
+            if ((tab = strrchr(line, '\t'))
+                && (size_t)(tab - line) == strlen(name)
+                && strncmp(line, name, tab - line) == 0)
+                continue;
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s\t%d\n", name, speed);
+    ASSURE_E(fclose(out) == 0, goto cache_err);
+    ASSURE_E(rename(tmp, path) == 0, goto cache_err);
+    return;
+cache_err:
+    LOGW("BP: Can't cache SPI speed in [%s]: %s\n", path, strerror(errno));
+}
+
+/***************************************************************************
+ * Calibration
+ ***************************************************************************/
+int bpspi_calibrate(struct adapter *adapter)
+{
+    struct driverAPI_spi *drv = adapter->driver.spi;
+    const char *name = adapter->buspirate->name;
+    struct cal_region ref, r;
+    int speed, best = -1, i;
+
+    if ((speed = cache_get(name)) >= SPISPEED_30kHz
+        && speed <= SPISPEED_8MHz) {
+        LOGI("BP: [%s] SPI speed %d (cached)\n", name, speed);
+        return cal_speed(drv, speed);
+    }
+
+    ASSURE_E(cal_speed(drv, SPISPEED_30kHz) == 0, return -1);
+    cal_read(drv, &ref);
+    if ((ref.id[0] == 0x00 || ref.id[0] == 0xFF) && ref.id[0] == ref.id[1]
+        && ref.id[1] == ref.id[2]) {
+        LOGW("BP: [%s] No JEDEC ID read back, SPI speed not calibrated\n",
+             name);
+        return cal_speed(drv, BUSPIRATE_SPI_DFLT_SPEED);
+    }
+
+    for (speed = SPISPEED_30kHz; speed <= SPISPEED_8MHz; speed++) {
+        ASSURE_E(cal_speed(drv, speed) == 0, return -1);
+        for (i = 0; i < CAL_READS; i++) {
+            cal_read(drv, &r);
+            if (memcmp(&r, &ref, sizeof(r)) != 0)
+                break;
+        }
+        LOGD("BP: [%s] SPI speed %d: %d/%d reads good\n", name, speed, i,
+             CAL_READS);
+        if (i < CAL_READS)
+            break;
+        best = speed;
+    }
+    best -= BUSPIRATE_SPI_CALIBRATE_MARGIN;
+    if (best < SPISPEED_30kHz)
+        best = SPISPEED_30kHz;
+
+    LOGI("BP: [%s] SPI speed calibrated to %d (margin %d)\n", name, best,
+         BUSPIRATE_SPI_CALIBRATE_MARGIN);
+    cache_put(name, best);
+    return cal_speed(drv, best);
+}
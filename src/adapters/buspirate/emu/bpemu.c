@@ -0,0 +1,782 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * ehwe-bp-emu: Bus Pirate emulator on a pseudo-terminal.
+ *
+ * Speaks the binary (BBIO) protocol of a Bus Pirate v3 in SPI and I2C
+ * mode on the slave side of a pty, with SIM device models on the buses.
+ * The unmodified Bus Pirate adapter can be pointed at the pty to test or
+ * measure the driver without hardware:
+ *
+ *   ehwe-bp-emu -l /tmp/ttyBP -s nor=4M -i eeprom@50 &
+ *   ehwe -d spi:1:bp:master:/tmp/ttyBP ...
+ *
+ * Optionally the serial line (-b) and the USB-serial bridge (-u) are
+ * modelled by holding back each reply until it would have reached the host:
+ * the time to clock command and reply over the line, rounded up to the next
+ * USB frame.
+ *
+ * Protocol reference:
+ * http://dangerousprototypes.com/docs/Bitbang
+ * http://dangerousprototypes.com/docs/SPI_(binary)
+ * http://dangerousprototypes.com/docs/I2C_(binary)
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <termios.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <sim_model.h>
+
+#define EMU_NZEROS_RAW 20       /* 0x00:s entering binary mode */
+#define EMU_MAX_XFER 4096       /* Longest WR_RD transfer either way */
+#define EMU_I2C_ADDRS 128
+#define EMU_MAX_DEVS 16
+#define EMU_DFLT_SPI "nor"
+#define EMU_DFLT_I2C "eeprom@50"
+
+/* Modes. Reply to the mode-command is the mode's version string */
+typedef enum {
+    EMU_CONSOLE,
+    EMU_BBIO,
+    EMU_SPI,
+    EMU_I2C
+} emu_mode_t;
+
+/* Commands, any binary mode */
+typedef enum {
+    BBIO_RESET = 0x00,
+    BBIO_SPI = 0x01,
+    BBIO_I2C = 0x02,
+    BBIO_HWRESET = 0x0F
+} bbio_cmd_t;
+
+/* Commands in SPI mode. Upper nibble 1, 4, 6 and 8 carry an argument */
+typedef enum {
+    SPI_CS_LOW = 0x02,
+    SPI_CS_HIGH = 0x03,
+    SPI_WR_RD = 0x04,
+    SPI_WR_RD_NOCS = 0x05,
+    SPI_BULK = 0x10,
+    SPI_PEREPH = 0x40,
+    SPI_SPEED = 0x60,
+    SPI_BUS = 0x80
+} spi_cmd_t;
+
+/* Commands in I2C mode */
+typedef enum {
+    I2C_START = 0x02,
+    I2C_STOP = 0x03,
+    I2C_READ_BYTE = 0x04,
+    I2C_ACK = 0x06,
+    I2C_NACK = 0x07,
+    I2C_WR_RD = 0x08,
+    I2C_BULK = 0x10,
+    I2C_PEREPH = 0x40,
+    I2C_SPEED = 0x60
+} i2c_cmd_t;
+
+/* Console dialogues. Only the baud menu is known. */
+typedef enum {
+    EMUCON_PROMPT,
+    EMUCON_BAUD,                /* Baud menu, waiting for choice */
+    EMUCON_BRG,                 /* Waiting for BRG value */
+    EMUCON_SPACE                /* Baud changed, waiting for space */
+} emucon_state_t;
+
+typedef enum {
+    EMUI2C_IDLE,
+    EMUI2C_ADDR,                /* Next byte written is an address */
+    EMUI2C_WRITE,
+    EMUI2C_READ,
+    EMUI2C_NACKED               /* Nobody answered, wait for stop/start */
+} emui2c_state_t;
+
+struct emu_dev {
+    const struct sim_model *model;
+    struct sim_dev *dev;
+    int addr;
+};
+
+struct emu {
+    int master;                 /* Our side of the pty */
+    int slave;                  /* Kept open so driver re-opens don't HUP */
+    emu_mode_t mode;
+    int nzeros;                 /* Consecutive 0x00 in console mode */
+    struct {
+        emucon_state_t state;
+        char line[16];
+        int n;
+    } con;
+
+    struct emu_dev devs[EMU_MAX_DEVS];
+    int ndevs;
+    struct {
+        struct emu_dev *dev;
+        int cs;                 /* Electrical, 0 selects */
+    } spi;
+    struct {
+        struct emu_dev *addr[EMU_I2C_ADDRS];
+        struct emu_dev *cur;
+        emui2c_state_t state;
+    } i2c;
+
+    /* Line model. 0 disables */
+    long baud;
+    long baud0;                 /* As given, i.e. after reset */
+    long usb_us;
+
+    /* Reply being built for current command */
+    uint8_t out[EMU_MAX_XFER + 8];
+    int nout;
+    int nin;                    /* Bytes the command consumed */
+
+    /* Statistics */
+    unsigned long ncmds;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+};
+
+static volatile sig_atomic_t emu_quit = 0;
+
+static void emu_sighandler(int sig)
+{
+    emu_quit = 1;
+}
+
+/***************************************************************************
+ * Line
+ ***************************************************************************/
+/* Read exactly sz bytes of command. Returns -1 on error or if asked to quit */
+static int emu_get(struct emu *emu, uint8_t *buf, int sz)
+{
+    int rc, n = 0;
+
+    while (n < sz) {
+        rc = read(emu->master, &buf[n], sz - n);
+        if (rc == -1 && errno == EINTR && !emu_quit)
+            continue;
+        if (rc <= 0)
+            return -1;
+        n += rc;
+    }
+    emu->nin += sz;
+    return 0;
+}
+
+static void emu_put(struct emu *emu, const uint8_t *buf, int sz)
+{
+    ASSERT(emu->nout + sz <= sizeof(emu->out));
+    memcpy(&emu->out[emu->nout], buf, sz);
+    emu->nout += sz;
+}
+
+static void emu_put1(struct emu *emu, uint8_t c)
+{
+    emu_put(emu, &c, 1);
+}
+
+static void emu_puts(struct emu *emu, const char *s)
+{
+    emu_put(emu, (const uint8_t *)s, strlen(s));
+}
+
+/* Hold the reply back as long as it would take to reach the host: command
+ * and reply clocked over the serial line (10 bits per byte), then waiting
+ * for the next USB frame the bridge can send it in. */
+static void emu_delay(struct emu *emu)
+{
+    struct timespec ts;
+    uint64_t now_us, at_us;
+
+    if (emu->baud == 0 && emu->usb_us == 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    at_us = now_us;
+    if (emu->baud)
+        at_us += (uint64_t)(emu->nin + emu->nout) * 10 * 1000000 / emu->baud;
+    if (emu->usb_us)
+        at_us = (at_us / emu->usb_us + 1) * emu->usb_us;
+
+    ts.tv_sec = at_us / 1000000;
+    ts.tv_nsec = (at_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR && !emu_quit) ;
+}
+
+/* Send the reply of a command in one piece */
+static int emu_flush(struct emu *emu)
+{
+    int rc, n = 0;
+
+    emu->ncmds++;
+    emu->bytes_in += emu->nin;
+    emu->bytes_out += emu->nout;
+
+    if (emu->nout)
+        emu_delay(emu);
+    while (n < emu->nout) {
+        rc = write(emu->master, &emu->out[n], emu->nout - n);
+        if (rc == -1 && errno == EINTR)
+            continue;
+        if (rc == -1) {
+            LOGE("EMU: Write to pty failed: %s\n", strerror(errno));
+            return -1;
+        }
+        n += rc;
+    }
+    emu->nout = 0;
+    emu->nin = 0;
+    return 0;
+}
+
+/***************************************************************************
+ * Devices
+ ***************************************************************************/
+static int emu_attach(struct emu *emu, int bus, const char *spec)
+{
+    char *cpy = strdup(spec);
+    char *item, *saveptr = NULL;
+    struct emu_dev *d;
+    int i, n, rc = 0;
+
+    for (item = strtok_r(cpy, ",", &saveptr); item && rc == 0;
+         item = strtok_r(NULL, ",", &saveptr)) {
+        if (emu->ndevs >= EMU_MAX_DEVS) {
+            LOGE("EMU: Too many devices (max %d)\n", EMU_MAX_DEVS);
+            rc = -1;
+            break;
+        }
+        d = &emu->devs[emu->ndevs];
+        if ((d->dev = sim_model_create(item, bus, &d->model,
+                                       &d->addr)) == NULL) {
+            rc = -1;
+            break;
+        }
+        emu->ndevs++;
+        if (bus == SIM_SPI) {
+            if (emu->spi.dev) {
+                LOGE("EMU: Only one SPI device (one CS)\n");
+                rc = -1;
+            }
+            emu->spi.dev = d;
+            LOGI("EMU: SPI: %s\n", d->model->name);
+        } else {
+            n = sim_model_i2c_addrs(d->model, d->dev);
+            for (i = 0; i < n; i++) {
+                if (emu->i2c.addr[d->addr + i]) {
+                    LOGE("EMU: I2C address 0x%02X is taken\n", d->addr + i);
+                    rc = -1;
+                }
+                emu->i2c.addr[d->addr + i] = d;
+            }
+            LOGI("EMU: I2C: %s at 0x%02X\n", d->model->name, d->addr);
+        }
+    }
+    free(cpy);
+    return rc;
+}
+
+static void emu_detach(struct emu *emu)
+{
+    int i;
+
+    for (i = 0; i < emu->ndevs; i++)
+        emu->devs[i].model->destroy(emu->devs[i].dev);
+    emu->ndevs = 0;
+}
+
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+static void spi_cs(struct emu *emu, int cs)
+{
+    struct emu_dev *d = emu->spi.dev;
+
+    if (cs == emu->spi.cs)
+        return;
+    emu->spi.cs = cs;
+    if (d && d->model->select)
+        d->model->select(d->dev, cs == 0);
+}
+
+static void spi_xfer(struct emu *emu, const uint8_t *out, uint8_t *in, int sz)
+{
+    struct emu_dev *d = emu->spi.dev;
+
+    if (sz <= 0)
+        return;
+    if (d && emu->spi.cs == 0)
+        d->model->xfer(d->dev, out, in, sz);
+    else if (in)
+        memset(in, 0xFF, sz);
+}
+
+static int spi_command(struct emu *emu, uint8_t cmd)
+{
+    uint8_t buf[EMU_MAX_XFER], hdr[4];
+    int wsz, rsz;
+
+    switch (cmd & 0xF0) {
+        case SPI_BULK:
+            /* 0001xxxx: 1-16 bytes full-duplex */
+            wsz = (cmd & 0x0F) + 1;
+            ASSURE_E(emu_get(emu, buf, wsz) == 0, return -1);
+            emu_put1(emu, 0x01);
+            spi_xfer(emu, buf, &emu->out[emu->nout], wsz);
+            emu->nout += wsz;
+            return 0;
+        case SPI_PEREPH:
+            /* 0100wxyz: power, pull-ups, AUX, CS */
+            spi_cs(emu, cmd & 0x01);
+            emu_put1(emu, 0x01);
+            return 0;
+        case SPI_SPEED:
+        case SPI_BUS:
+            /* No timing or electrical model, just accept */
+            emu_put1(emu, 0x01);
+            return 0;
+    }
+
+    switch (cmd) {
+        case BBIO_SPI:
+            /* As in BBIO, but here it only repeats the version */
+            emu_puts(emu, "SPI1");
+            break;
+        case SPI_CS_LOW:
+        case SPI_CS_HIGH:
+            spi_cs(emu, cmd & 0x01);
+            emu_put1(emu, 0x01);
+            break;
+        case SPI_WR_RD:
+        case SPI_WR_RD_NOCS:
+            ASSURE_E(emu_get(emu, hdr, 4) == 0, return -1);
+            wsz = (hdr[0] << 8) | hdr[1];
+            rsz = (hdr[2] << 8) | hdr[3];
+            if (wsz > EMU_MAX_XFER || rsz > EMU_MAX_XFER) {
+                emu_put1(emu, 0x00);
+                break;
+            }
+            ASSURE_E(emu_get(emu, buf, wsz) == 0, return -1);
+            if (cmd == SPI_WR_RD)
+                spi_cs(emu, 0);
+            spi_xfer(emu, buf, NULL, wsz);
+            emu_put1(emu, 0x01);
+            spi_xfer(emu, NULL, &emu->out[emu->nout], rsz);
+            emu->nout += rsz;
+            if (cmd == SPI_WR_RD)
+                spi_cs(emu, 1);
+            break;
+        default:
+            LOGW("EMU: Unsupported SPI command 0x%02X\n", cmd);
+            emu_put1(emu, 0x00);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+static void i2c_stop(struct emu *emu)
+{
+    struct emu_dev *d = emu->i2c.cur;
+
+    if (d && d->model->i2c_stop)
+        d->model->i2c_stop(d->dev);
+    emu->i2c.cur = NULL;
+    emu->i2c.state = EMUI2C_IDLE;
+}
+
+/* Returns 1 if ACK:ed */
+static int i2c_write(struct emu *emu, uint8_t data)
+{
+    struct emu_dev *d;
+
+    switch (emu->i2c.state) {
+        case EMUI2C_ADDR:
+            d = emu->i2c.addr[data >> 1];
+            if (d == NULL || !d->model->i2c_start(d->dev, data >> 1, data & 1)) {
+                emu->i2c.cur = NULL;
+                emu->i2c.state = EMUI2C_NACKED;
+                return 0;
+            }
+            emu->i2c.cur = d;
+            emu->i2c.state = (data & 1) ? EMUI2C_READ : EMUI2C_WRITE;
+            return 1;
+        case EMUI2C_WRITE:
+            return emu->i2c.cur->model->i2c_write(emu->i2c.cur->dev, data);
+        default:
+            return 0;
+    }
+}
+
+/* ACK/NACK is a separate command on the BP, the model can't know it yet */
+static uint8_t i2c_read(struct emu *emu)
+{
+    if (emu->i2c.state != EMUI2C_READ)
+        return 0xFF;
+    return emu->i2c.cur->model->i2c_read(emu->i2c.cur->dev, 1);
+}
+
+static int i2c_command(struct emu *emu, uint8_t cmd)
+{
+    uint8_t buf[EMU_MAX_XFER], hdr[4];
+    int i, wsz, rsz, ack;
+
+    switch (cmd & 0xF0) {
+        case I2C_BULK:
+            /* 0001xxxx: 1-16 bytes, one ACK (0x00) or NACK (0x01) each */
+            wsz = (cmd & 0x0F) + 1;
+            ASSURE_E(emu_get(emu, buf, wsz) == 0, return -1);
+            emu_put1(emu, 0x01);
+            for (i = 0; i < wsz; i++)
+                emu_put1(emu, i2c_write(emu, buf[i]) ? 0x00 : 0x01);
+            return 0;
+        case I2C_PEREPH:
+        case I2C_SPEED:
+            emu_put1(emu, 0x01);
+            return 0;
+    }
+
+    switch (cmd) {
+        case BBIO_SPI:
+            /* 0x01 repeats the version in any mode (see rawMode_probe) */
+            emu_puts(emu, "I2C1");
+            break;
+        case I2C_START:
+            /* Repeated start goes to the same device */
+            emu->i2c.state = EMUI2C_ADDR;
+            emu_put1(emu, 0x01);
+            break;
+        case I2C_STOP:
+            i2c_stop(emu);
+            emu_put1(emu, 0x01);
+            break;
+        case I2C_READ_BYTE:
+            emu_put1(emu, i2c_read(emu));
+            break;
+        case I2C_ACK:
+            emu_put1(emu, 0x01);
+            break;
+        case I2C_NACK:
+            /* Slave lets go of SDA after a NACK */
+            if (emu->i2c.state == EMUI2C_READ)
+                emu->i2c.state = EMUI2C_NACKED;
+            emu_put1(emu, 0x01);
+            break;
+        case I2C_WR_RD:
+            /* start, write, read (last NACK:ed), stop. 0x00 if any write
+             * is NACK:ed */
+            ASSURE_E(emu_get(emu, hdr, 4) == 0, return -1);
+            wsz = (hdr[0] << 8) | hdr[1];
+            rsz = (hdr[2] << 8) | hdr[3];
+            if (wsz > EMU_MAX_XFER || rsz > EMU_MAX_XFER) {
+                emu_put1(emu, 0x00);
+                break;
+            }
+            ASSURE_E(emu_get(emu, buf, wsz) == 0, return -1);
+            emu->i2c.state = EMUI2C_ADDR;
+            for (ack = 1, i = 0; i < wsz && ack; i++)
+                ack = i2c_write(emu, buf[i]);
+            if (!ack) {
+                i2c_stop(emu);
+                emu_put1(emu, 0x00);
+                break;
+            }
+            emu_put1(emu, 0x01);
+            if (rsz && emu->i2c.state == EMUI2C_WRITE) {
+                /* Reads continue from the address written */
+                emu->i2c.state = EMUI2C_ADDR;
+                i2c_write(emu, (emu->i2c.cur->addr << 1) | 1);
+            }
+            for (i = 0; i < rsz; i++)
+                emu_put1(emu, i2c_read(emu));
+            i2c_stop(emu);
+            break;
+        default:
+            LOGW("EMU: Unsupported I2C command 0x%02X\n", cmd);
+            emu_put1(emu, 0x00);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Console
+ *
+ * Enough of the console for the driver's baud negotiation: the 'b' menu
+ * with a raw BRG value (BP v3: 16MHz / (4 * (BRG + 1)) baud), '#' and an
+ * empty line. A pty has no baud, the new one only changes the line model.
+ ***************************************************************************/
+#define EMUCON_PROMPT_STR "\r\nHiZ>"
+
+static void con_line(struct emu *emu, const char *line)
+{
+    long brg;
+
+    switch (emu->con.state) {
+        case EMUCON_PROMPT:
+            if (strcmp(line, "b") == 0) {
+                emu_puts(emu, "\r\nSet serial port speed: (bps)\r\n"
+                         " 1. 300\r\n 2. 1200\r\n 3. 2400\r\n"
+                         " 4. 4800\r\n 5. 9600\r\n 6. 19200\r\n"
+                         " 7. 38400\r\n 8. 57600\r\n 9. 115200\r\n"
+                         "10. BRG raw value\r\n\r\n(9)>");
+                emu->con.state = EMUCON_BAUD;
+                return;
+            }
+            if (strcmp(line, "#") == 0) {
+                emu->baud = emu->baud0;
+                emu_puts(emu, "RESET\r\n\r\nBus Pirate v3 (ehwe-bp-emu)");
+            } else if (line[0]) {
+                emu_puts(emu, "\r\nSyntax error");
+            }
+            break;
+        case EMUCON_BAUD:
+            if (strcmp(line, "10") == 0) {
+                emu_puts(emu, "\r\nEnter raw value for BRG\r\n\r\n(34)>");
+                emu->con.state = EMUCON_BRG;
+                return;
+            }
+            break;
+        case EMUCON_BRG:
+            brg = line[0] ? atol(line) : 34;
+            emu_puts(emu, "\r\nAdjust your terminal\r\nSpace to continue");
+            if (emu->baud)
+                emu->baud = 16000000 / (4 * (brg + 1));
+            LOGI("EMU: BRG %ld (%ld baud)\n", brg, 16000000 / (4 * (brg + 1)));
+            emu->con.state = EMUCON_SPACE;
+            return;
+        default:
+            break;
+    }
+    emu->con.state = EMUCON_PROMPT;
+    emu_puts(emu, EMUCON_PROMPT_STR);
+}
+
+static void con_char(struct emu *emu, uint8_t c)
+{
+    if (emu->con.state == EMUCON_SPACE) {
+        if (c == ' ') {
+            emu->con.state = EMUCON_PROMPT;
+            emu_puts(emu, EMUCON_PROMPT_STR);
+        }
+        return;
+    }
+    if (c == '\r' || c == '\n') {
+        emu->con.line[emu->con.n] = '\0';
+        emu->con.n = 0;
+        con_line(emu, emu->con.line);
+        return;
+    }
+    if (c < ' ' || emu->con.n >= sizeof(emu->con.line) - 1)
+        return;
+    emu->con.line[emu->con.n++] = c;
+    emu_put1(emu, c);          /* Echo */
+}
+
+/***************************************************************************
+ * Mode handling
+ ***************************************************************************/
+static void emu_mode(struct emu *emu, emu_mode_t mode)
+{
+    if (emu->mode == EMU_SPI)
+        spi_cs(emu, 1);
+    if (emu->mode == EMU_I2C)
+        i2c_stop(emu);
+    if (mode != emu->mode)
+        LOGD("EMU: Mode %d -> %d\n", emu->mode, mode);
+    emu->mode = mode;
+}
+
+static int emu_command(struct emu *emu)
+{
+    uint8_t cmd;
+
+    ASSURE_E(emu_get(emu, &cmd, 1) == 0, return -1);
+    LOGV("EMU: [%d] 0x%02X\n", emu->mode, cmd);
+
+    if (emu->mode == EMU_CONSOLE) {
+        /* Only way out of the console is 20 0x00 */
+        if (cmd != BBIO_RESET) {
+            emu->nzeros = 0;
+            con_char(emu, cmd);
+        } else if (++emu->nzeros >= EMU_NZEROS_RAW) {
+            emu->nzeros = 0;
+            emu_mode(emu, EMU_BBIO);
+            emu_puts(emu, "BBIO1");
+        }
+        return emu_flush(emu);
+    }
+
+    if (cmd == BBIO_RESET) {
+        emu_mode(emu, EMU_BBIO);
+        emu_puts(emu, "BBIO1");
+        return emu_flush(emu);
+    }
+
+    switch (emu->mode) {
+        case EMU_BBIO:
+            switch (cmd) {
+                case BBIO_SPI:
+                    emu_mode(emu, EMU_SPI);
+                    emu_puts(emu, "SPI1");
+                    break;
+                case BBIO_I2C:
+                    emu_mode(emu, EMU_I2C);
+                    emu_puts(emu, "I2C1");
+                    break;
+                case BBIO_HWRESET:
+                    emu_mode(emu, EMU_CONSOLE);
+                    emu_put1(emu, 0x01);
+                    emu->baud = emu->baud0;
+                    emu->con.state = EMUCON_PROMPT;
+                    emu->con.n = 0;
+                    break;
+                default:
+                    LOGW("EMU: Unsupported mode 0x%02X\n", cmd);
+            }
+            break;
+        case EMU_SPI:
+            ASSURE_E(spi_command(emu, cmd) == 0, return -1);
+            break;
+        case EMU_I2C:
+            ASSURE_E(i2c_command(emu, cmd) == 0, return -1);
+            break;
+        default:
+            ASSERT("Bad mode" == NULL);
+    }
+    return emu_flush(emu);
+}
+
+/***************************************************************************
+ * Main
+ ***************************************************************************/
+static int emu_open(struct emu *emu)
+{
+    struct termios tio;
+    const char *name;
+
+    ASSURE_E((emu->master = posix_openpt(O_RDWR | O_NOCTTY)) != -1,
+             return -1);
+    ASSURE_E(grantpt(emu->master) == 0, return -1);
+    ASSURE_E(unlockpt(emu->master) == 0, return -1);
+    ASSURE_E((name = ptsname(emu->master)) != NULL, return -1);
+    ASSURE_E((emu->slave = open(name, O_RDWR | O_NOCTTY)) != -1,
+             return -1);
+
+    /* Binary clean until the driver sets its own terminal settings */
+    ASSURE_E(tcgetattr(emu->slave, &tio) == 0, return -1);
+    cfmakeraw(&tio);
+    ASSURE_E(tcsetattr(emu->slave, TCSANOW, &tio) == 0, return -1);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-s SPEC] [-i SPEC] [-b BAUD] [-u USEC] [-l LINK]\n"
+            "  -s SPEC  SPI device, model[=arg] (default %s)\n"
+            "  -i SPEC  I2C devices, model[@addr][=arg][,...] (default %s)\n"
+            "  -b BAUD  Model a serial line of BAUD bps (default off)\n"
+            "  -u USEC  Model USB frames of USEC us (default off, FTDI "
+            "bridges 1000)\n"
+            "  -l LINK  Symlink LINK to the pty\n", prog, EMU_DFLT_SPI,
+            EMU_DFLT_I2C);
+}
+
+int main(int argc, char **argv)
+{
+    static struct emu emu = {.master = -1,.slave = -1,.spi = {.cs = 1} };
+    const char *spi_spec = EMU_DFLT_SPI;
+    const char *i2c_spec = EMU_DFLT_I2C;
+    const char *link = NULL;
+    struct sigaction sa;
+    int c, rc = 0;
+
+    while ((c = getopt(argc, argv, "s:i:b:u:l:h")) != -1) {
+        switch (c) {
+            case 's':
+                spi_spec = optarg;
+                break;
+            case 'i':
+                i2c_spec = optarg;
+                break;
+            case 'b':
+                emu.baud = emu.baud0 = atol(optarg);
+                break;
+            case 'u':
+                emu.usb_us = atol(optarg);
+                break;
+            case 'l':
+                link = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    sim_models_init();
+    if ((spi_spec[0] && emu_attach(&emu, SIM_SPI, spi_spec)) ||
+        (i2c_spec[0] && emu_attach(&emu, SIM_I2C, i2c_spec))) {
+        emu_detach(&emu);
+        return 1;
+    }
+    if (emu_open(&emu)) {
+        emu_detach(&emu);
+        return 1;
+    }
+    if (link) {
+        unlink(link);
+        ASSURE_E(symlink(ptsname(emu.master), link) == 0, link = NULL);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = emu_sighandler;     /* No SA_RESTART: break read() */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("%s\n", link ? link : ptsname(emu.master));
+    fflush(stdout);
+
+    while (!emu_quit && rc == 0)
+        rc = emu_command(&emu);
+
+    LOGI("EMU: %lu commands, %lu bytes in, %lu bytes out\n", emu.ncmds,
+         emu.bytes_in, emu.bytes_out);
+
+    if (link)
+        unlink(link);
+    close(emu.slave);
+    close(emu.master);
+    emu_detach(&emu);
+    return emu_quit ? 0 : 1;
+}
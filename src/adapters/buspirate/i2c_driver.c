@@ -34,6 +34,8 @@
 #include <stdlib.h>
 #include <liblog/assure.h>
 #include <arpa/inet.h>
+#include <instr.h>
+#include <hlog.h>
 
 struct config_I2C bp_dflt_config_I2C = {
     .autoAck = BUSPIRATE_I2C_DFLT_AUTOACK,
@@ -78,9 +80,9 @@ void bpi2c_start(struct ddata *ddata)
 
     LOGD("BP: Interface %s sends i2c-start: (0x%02X)\n", __func__, tmp[0]);
 
-    ASSURE_E(write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     memset(tmp, 0, sizeof(tmp));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp[0] == 0x01);
 }
 
@@ -90,9 +92,9 @@ void bpi2c_stop(struct ddata *ddata)
 
     LOGD("BP: Interface %s sends i2c-stop: (0x%02X)\n", __func__, tmp[0]);
 
-    ASSURE_E(write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     memset(tmp, 0, sizeof(tmp));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp[0] == 0x01);
 }
 
@@ -105,19 +107,19 @@ void bpi2c_receiveByte(struct ddata *ddata, uint8_t *data)
 {
     uint8_t tmp;
 
-    ASSURE_E(write(ddata->fd, (uint8_t[]) {
+    ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                    CMD_READ_BYTE}, 1) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, data, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, data, 1) != -1, LOGE_IOERROR(errno));
 
     if (AUTOACK) {
-        ASSURE_E(write(ddata->fd, (uint8_t[]) {
+        ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                        CMD_ACK_BIT}, 1) != -1, LOGE_IOERROR(errno));
-        ASSURE_E(read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
+        ASSURE_E(instr_read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
         ASSERT(tmp == 0x01);
     } else {
-        ASSURE_E(write(ddata->fd, (uint8_t[]) {
+        ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                        CMD_NACK_BIT}, 1) != -1, LOGE_IOERROR(errno));
-        ASSURE_E(read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
+        ASSURE_E(instr_read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
         ASSERT(tmp == 0x01);
     }
 }
@@ -126,11 +128,11 @@ int bpi2c_sendByte(struct ddata *ddata, uint8_t data)
 {
     uint8_t tmp;
 
-    ASSURE_E(write(ddata->fd, (uint8_t[]) {
+    ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                    CMD_BULK, data}, 2) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp == 0x01);
-    ASSURE_E(read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, &tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp == 0x00 || tmp == 0x01);
     return !tmp;
 }
@@ -149,6 +151,66 @@ void bpi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
     }
 }
 
+/* Bus time of probing one address (start, address and ACK-bit, stop) in
+ * I2C bit-times, the firmware's own included */
+#define SCAN_BITS 24
+
+/* Addresses to send per burst. Start, address for write and stop of an
+ * address take 4 bytes, as many as the BP's UART holds while it's busy on
+ * the bus. If the bus is done with them before 4 more characters arrive
+ * on the host link, the UART never fills and the whole scan goes in one
+ * burst. Else (5 and 50kHz at 115200 baud) one address at a time. */
+static int scan_burst(struct ddata *ddata)
+{
+    static const int khz[] = { 5, 50, 100, 400 };
+    int baud = ddata->baud ? ddata->baud : BP_BAUD_DFLT;
+    long bus_us = SCAN_BITS * 1000L / khz[ddata->config.i2c.speed.speed];
+    long fifo_us = BP_RX_FIFO * 10 * 1000000L / baud;
+
+    return bus_us <= fifo_us ? 128 : 1;
+}
+
+/* The replies (0x01 for start, bulk and stop, the ACK-bit in between) of
+ * a burst are read and parsed once all are done, i.e. one round-trip per
+ * burst instead of three per address. */
+int bpi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+               uint8_t *present)
+{
+    uint8_t burst[4 * 128], reply[4 * 128];
+    int a, i, na, max, n = 0;
+
+    ASSERT(first <= last && last < 0x80);
+    max = scan_burst(ddata);
+    LOGD("BP: Interface %s probes 0x%02X-0x%02X, %d per burst\n", __func__,
+         first, last, max);
+
+    for (a = first; a <= last; a += na) {
+        na = last - a + 1 < max ? last - a + 1 : max;
+        for (i = 0; i < na; i++) {
+            burst[4 * i] = CMD_START_BIT;
+            burst[4 * i + 1] = CMD_BULK;        /* One byte */
+            burst[4 * i + 2] = (a + i) << 1;
+            burst[4 * i + 3] = CMD_STOP_BIT;
+        }
+        ASSURE_E(instr_write(ddata->fd, burst, 4 * na) == 4 * na,
+                 goto scan_err);
+        ASSURE_E(bp_read(ddata, reply, 4 * na) == 4 * na, goto scan_err);
+
+        for (i = 0; i < na; i++) {
+            ASSURE_E(reply[4 * i] == 0x01 && reply[4 * i + 1] == 0x01 &&
+                     reply[4 * i + 3] == 0x01, goto scan_err);
+            if (reply[4 * i + 2] == 0x00) {
+                I2C_SCAN_SET(present, a + i);
+                n++;
+            }
+        }
+    }
+    return n;
+scan_err:
+    LOGE_IOERROR(errno);
+    return -1;
+}
+
 void bpi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
 {
     int wasAutoAck = AUTOACK;
@@ -169,31 +231,56 @@ uint16_t bpi2c_getStatus(struct ddata *ddata, uint16_t flags)
     return flags;
 }
 
-int bpi2c_configure(struct ddata *ddata)
+/* Send the parts of the configuration in mask as one burst, then check
+ * all acks */
+static int apply(struct ddata *ddata, unsigned mask)
 {
-    int ret;
-    uint8_t tmp[8] = { 0 };
-
-    struct confi2c_pereph *pereph = &(ddata->config.i2c.pereph);
-    struct confi2c_speed *speed = &(ddata->config.i2c.speed);
-
-    tmp[0] = 0;
-    ASSURE_E((ret =
-              write(ddata->fd, speed, sizeof(struct confi2c_speed))) != -1,
-             LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
-    ASSERT(tmp[0] == 0x01);
-    memcpy(&ddata->config.i2c.speed, speed, sizeof(struct confi2c_speed));
+    uint8_t burst[2], ack[2];
+    int i, n = 0;
+
+    if (mask & BP_DIRTY_SPEED)
+        burst[n++] = ddata->config.i2c.speed.raw;
+    if (mask & BP_DIRTY_PEREPH)
+        burst[n++] = ddata->config.i2c.pereph.raw;
+    if (n == 0)
+        return 0;
+
+    LOGD("BP: Interface %s sends %d config bytes\n", __func__, n);
+    ASSURE_E(instr_write(ddata->fd, burst, n) == n, goto apply_err);
+    ASSURE_E(bp_read(ddata, ack, n) == n, goto apply_err);
+    for (i = 0; i < n; i++)
+        ASSURE_E(ack[i] == 0x01, goto apply_err);
+
+    ddata->dirty &= ~mask;
+    return 0;
+apply_err:
+    LOGE_IOERROR(errno);
+    return -1;
+}
 
-    tmp[0] = 0;
-    ASSURE_E((ret =
-              write(ddata->fd, pereph, sizeof(struct confi2c_pereph))) != -1,
-             LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
-    ASSERT(tmp[0] == 0x01);
-    memcpy(&ddata->config.i2c.pereph, pereph, sizeof(struct confi2c_pereph));
+/* Configure everything, for a known state */
+int bpi2c_configure(struct ddata *ddata)
+{
+    return apply(ddata, BP_DIRTY_ALL);
+}
 
-    return 0;
+/* Configure what has changed. ddata may be a copy (see newddata), its
+ * changes are then taken over by the adapter's own first. */
+int bpi2c_actuate(struct ddata *ddata)
+{
+    struct ddata *live;
+
+    ASSURE_E(ddata->driver.any, return -1);
+    live = ddata->driver.any->ddata;
+    if (live != ddata) {
+        if (ddata->dirty & BP_DIRTY_SPEED)
+            live->config.i2c.speed = ddata->config.i2c.speed;
+        if (ddata->dirty & BP_DIRTY_PEREPH)
+            live->config.i2c.pereph = ddata->config.i2c.pereph;
+        live->dirty |= ddata->dirty;
+        ddata->dirty = 0;
+    }
+    return apply(live, live->dirty);
 }
 
 /* Create a new adapter/driver-data object for external manipulation without
@@ -210,58 +297,85 @@ struct ddata *bpi2c_newddata(struct adapter *adapter)
 
     memcpy(&(ddata->config.i2c), &bp_dflt_config_I2C,
            sizeof(struct config_I2C));
+    ddata->dirty = BP_DIRTY_ALL;
+    ddata->driver.any = NULL;
+    ddata->session = NULL;
     return ddata;
 }
 
 /***************************************************************************
  * Configuration  api
- ***************************************************************************/
+ ***************************************************************************
+ * Changes ddata's configuration, sent to BP by actuate_config. A ddata is
+ * needed, there's nothing to affect directly.
+ */
+#define SET(PART, FIELD, MAX, DIRTY) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        if (setval < 0 || setval > (MAX)) \
+            return E_BAD_VALUE; \
+        if (dd->config.i2c.PART.FIELD != setval) { \
+            dd->config.i2c.PART.FIELD = setval; \
+            dd->dirty |= (DIRTY); \
+        } \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
+#define GET(PART, FIELD) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        *retval = dd->config.i2c.PART.FIELD; \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
 config_etype_t bpi2c_set_speed(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(speed, speed, I2CSPEED_400kHz, BP_DIRTY_SPEED);
 }
 
 config_etype_t bpi2c_set_power_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, power_on, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpi2c_set_pullups(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, pullups, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpi2c_set_aux_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, aux, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpi2c_set_cs_active(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, cs_active, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpi2c_get_speed(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(speed, speed);
 }
 
 config_etype_t bpi2c_get_power_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, power_on);
 }
 
 config_etype_t bpi2c_get_pullups(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, pullups);
 }
 
 config_etype_t bpi2c_get_aux_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, aux);
 }
 
 config_etype_t bpi2c_get_cs_active(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, cs_active);
 }
@@ -230,20 +230,53 @@ struct config_I2C {
 /* Convenience-variable pre-set with build-system configuration */
 extern struct config_SPI bp_dflt_config_SPI;
 
+/* What the low-latency profile changed and must restore (lowlat.c) */
+struct bp_lowlat {
+    int vmin;                   /* Current VMIN, 0 if profile not applied */
+    int serial_flags;           /* Original TIOCGSERIAL flags, or -1 */
+    int latency_timer;          /* Original latency_timer (ms), or -1 */
+    char latency_path[128];
+};
+
+/* Longest transfer either way of one SPI write-then-read command */
+#define BP_SPI_MAX_XFER 4095
+
+/* Host-side baud of a Bus-pirate after reset */
+#define BP_BAUD_DFLT 115200
+
+/* Command bytes the BP's UART holds while the firmware is busy on the bus
+ * (PIC24 RX FIFO). Bursts of commands that each take bus time must not be
+ * longer, or the UART overruns when the bus is slower than the host link. */
+#define BP_RX_FIFO 4
+
+/* Parts of config that have changed since last sent to BP. I2C has no bus
+ * part. */
+#define BP_DIRTY_SPEED  0x01
+#define BP_DIRTY_BUS    0x02
+#define BP_DIRTY_PEREPH 0x04
+#define BP_DIRTY_ALL    0x07
+
+/* A BP shared by adapters in different roles (session.c) */
+struct bp_session;
+
 /* Driver companion - NOTE: unique for each driver. Must NOT be public */
 struct ddata {
     int fd;
     bpcmd_raw_t state;
+    struct bp_session *session; /* NULL unless BUSPIRATE_SHARED_SESSION */
+    int baud;                   /* Current host-side baud */
     union {
         struct config_I2C i2c;
         struct config_SPI spi;
     } config;
+    unsigned dirty;             /* BP_DIRTY_ bits */
     /* Owned by driver */
     union {
         struct driverAPI_any *any;
         struct driverAPI_spi *spi;
         struct driverAPI_i2c *i2c;
     } driver;
+    struct bp_lowlat lowlat;
 };
 
 struct adapter;
@@ -252,6 +285,34 @@ void log_ioerror(int ecode, log_level llevel);
 void empty_inbuff(int fd);
 int rawMode_enter(struct adapter *);
 int rawMode_toMode(struct adapter *, bpcmd_raw_t bpcmd);
+int rawMode_probe(struct adapter *, bpcmd_raw_t bpcmd);
+int rawMode_baud(struct adapter *);
+int rawMode_probe_bauds(struct adapter *, bpcmd_raw_t bpcmd);
+int rawMode_switch(struct ddata *ddata, bpcmd_raw_t bpcmd);
+int bp_host_baud(int fd, int baud);
+
+/* Low-latency tty profile (BUSPIRATE_LOW_LATENCY, else no-ops). Applied
+ * once the tty is opened blocking in raw mode, restored before it's
+ * closed. bp_read() reads a reply of known size in as few wake-ups as the
+ * tty allows. */
+void bp_lowlat_apply(struct ddata *ddata, const char *devname);
+void bp_lowlat_restore(struct ddata *ddata);
+void bp_lowlat_expect(struct ddata *ddata, int sz);
+int bp_read(struct ddata *ddata, void *buf, int sz);
+
+/* Time-sharing of one BP between adapters (BUSPIRATE_SHARED_SESSION).
+ * The first adapter of a device creates the session once initialized, later
+ * ones attach to it instead of opening and resetting the BP again. Each
+ * driverAPI call is framed by acquire/release, which switches binary mode
+ * and replays the caller's cached configuration when needed. pin keeps
+ * other adapters out between calls (CS active, I2C transaction open): 1
+ * pins, 0 unpins, -1 leaves as is. */
+struct bp_session *bp_session_find(const char *name);
+void bp_session_new(struct ddata *ddata, const char *name);
+void bp_session_attach(struct ddata *ddata, struct bp_session *session);
+int bp_session_detach(struct ddata *ddata);
+void bp_session_acquire(struct ddata *ddata);
+void bp_session_release(struct ddata *ddata, int pin);
 
 /***************************************************************************
  * Main driver apis
@@ -263,6 +324,8 @@ void bpspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
 void bpspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
 uint16_t bpspi_getStatus(struct ddata *ddata, uint16_t flags);
 int bpspi_configure(struct ddata *ddata);
+int bpspi_actuate(struct ddata *ddata);
+int bpspi_calibrate(struct adapter *adapter);
 struct ddata *bpspi_newddata(struct adapter *adapter);
 /* High level */
 void bpspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
@@ -277,14 +340,39 @@ void bpi2c_stop(struct ddata *ddata);
 void bpi2c_autoAck(struct ddata *ddata, int state);
 void bpi2c_receiveByte(struct ddata *ddata, uint8_t *data);
 int bpi2c_sendByte(struct ddata *ddata, uint8_t data);
+int bpi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+               uint8_t *present);
 void bpi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
 void bpi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
 uint16_t bpi2c_getStatus(struct ddata *ddata, uint16_t flags);
 int bpi2c_configure(struct ddata *ddata);
+int bpi2c_actuate(struct ddata *ddata);
 struct ddata *bpi2c_newddata(struct adapter *adapter);
 /* High level */
 void bpi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
                            int outsz, uint8_t *indata, int insz);
+/***************************************************************************
+ * Session-framed (session.c), same as above but for a shared BP
+ ***************************************************************************/
+void bpsspi_setCS(struct ddata *ddata, int state);
+void bpsspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void bpsspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+int bpsspi_actuate(struct ddata *ddata);
+void bpsspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz);
+void bpsspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz);
+void bpsi2c_start(struct ddata *ddata);
+void bpsi2c_stop(struct ddata *ddata);
+void bpsi2c_receiveByte(struct ddata *ddata, uint8_t *data);
+int bpsi2c_sendByte(struct ddata *ddata, uint8_t data);
+int bpsi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present);
+void bpsi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void bpsi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+int bpsi2c_actuate(struct ddata *ddata);
+void bpsi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz);
 /***************************************************************************
  * Configuration  api
  ***************************************************************************
@@ -0,0 +1,213 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Low-latency tty profile for the Bus-pirate's USB-serial port.
+ *
+ * Every Bus-pirate command is a short write answered by a short reply, so
+ * the round-trip time is what limits throughput. Most of it isn't spent on
+ * the wire but waiting: for the FTDI chip's latency timer (16ms by
+ * default) to flush a not full USB packet, and for the tty layer to pass
+ * on what has arrived. This profile shortens both waits.
+ */
+#include "config.h"
+#include "buspirate_config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <termios.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#include <instr.h>
+#include "local.h"
+
+/* Largest reply waited for in one read. VMIN is a cc_t. */
+#define VMIN_MAX 255
+
+#ifdef BUSPIRATE_LOW_LATENCY
+static int set_vmin(struct ddata *ddata, int vmin)
+{
+    struct termios tio;
+
+    ASSURE_E(tcgetattr(ddata->fd, &tio) == 0, return -1);
+    tio.c_cc[VMIN] = vmin;
+    /* Inter-byte timer: once a reply has started, a stalled one returns
+     * what has arrived after 100ms instead of blocking */
+    tio.c_cc[VTIME] = 1;
+    ASSURE_E(tcsetattr(ddata->fd, TCSANOW, &tio) == 0, return -1);
+    ddata->lowlat.vmin = vmin;
+    return 0;
+}
+
+/* sysfs file of the tty's USB-serial driver, e.g. ftdi_sio, if it has one */
+static int latency_timer_path(char *path, size_t sz, const char *devname)
+{
+    char real[PATH_MAX];
+
+    if (realpath(devname, real) == NULL)
+        return -1;
+    snprintf(path, sz, "/sys/class/tty/%s/device/latency_timer",
+             basename(real));
+    return access(path, R_OK) == 0 ? 0 : -1;
+}
+
+static int latency_timer_rw(const char *path, int *ms, int wr)
+{
+    FILE *f;
+    int rc;
+
+    if ((f = fopen(path, wr ? "w" : "r")) == NULL)
+        return -1;
+    rc = wr ? fprintf(f, "%d\n", *ms) : fscanf(f, "%d", ms);
+    if (fclose(f) != 0)
+        rc = -1;
+    return rc > 0 ? 0 : -1;
+}
+#endif
+
+void bp_lowlat_apply(struct ddata *ddata, const char *devname)
+{
+#ifdef BUSPIRATE_LOW_LATENCY
+    struct bp_lowlat *ll = &ddata->lowlat;
+    struct termios tio;
+    int ms;
+
+    ll->vmin = 0;
+    ll->serial_flags = -1;
+    ll->latency_timer = -1;
+
+#ifdef __linux__
+    {
+        struct serial_struct ss;
+
+        /* Not all tty drivers know it (e.g. a pty), that's fine */
+        if (instr_ioctl(ddata->fd, TIOCGSERIAL, &ss) == 0) {
+            int flags = ss.flags;
+
+            ss.flags |= ASYNC_LOW_LATENCY;
+            if (instr_ioctl(ddata->fd, TIOCSSERIAL, &ss) == 0)
+                ll->serial_flags = flags;
+            else
+                LOGD("BP: [%s] ASYNC_LOW_LATENCY not set: %s\n", devname,
+                     strerror(errno));
+        }
+    }
+#endif
+
+    /* Binary protocol: no line discipline processing in either direction */
+    ASSURE_E(tcgetattr(ddata->fd, &tio) == 0, return);
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
+                     ICRNL | IXON | IXOFF | IXANY);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    ASSURE_E(tcsetattr(ddata->fd, TCSANOW, &tio) == 0, return);
+    if (set_vmin(ddata, 1) != 0)
+        return;
+
+    if (latency_timer_path(ll->latency_path, sizeof(ll->latency_path),
+                           devname) == 0
+        && latency_timer_rw(ll->latency_path, &ms, 0) == 0 && ms > 1) {
+        int one = 1;
+
+        if (latency_timer_rw(ll->latency_path, &one, 1) == 0) {
+            ll->latency_timer = ms;
+            LOGI("BP: [%s] latency_timer %dms -> 1ms\n", devname, ms);
+        } else {
+            LOGW("BP: Can't write [%s]: %s\n", ll->latency_path,
+                 strerror(errno));
+        }
+    }
+#endif
+}
+
+void bp_lowlat_restore(struct ddata *ddata)
+{
+#ifdef BUSPIRATE_LOW_LATENCY
+    struct bp_lowlat *ll = &ddata->lowlat;
+
+    if (ll->latency_timer != -1) {
+        if (latency_timer_rw(ll->latency_path, &ll->latency_timer, 1) != 0)
+            LOGW("BP: Can't restore [%s]: %s\n", ll->latency_path,
+                 strerror(errno));
+        ll->latency_timer = -1;
+    }
+#ifdef __linux__
+    if (ll->serial_flags != -1) {
+        struct serial_struct ss;
+
+        if (instr_ioctl(ddata->fd, TIOCGSERIAL, &ss) == 0) {
+            ss.flags = ll->serial_flags;
+            instr_ioctl(ddata->fd, TIOCSSERIAL, &ss);
+        }
+        ll->serial_flags = -1;
+    }
+#endif
+    ll->vmin = 0;
+#endif
+}
+
+/* Have the next read return first when sz bytes are in. Costs a syscall
+ * only when it changes anything. */
+void bp_lowlat_expect(struct ddata *ddata, int sz)
+{
+#ifdef BUSPIRATE_LOW_LATENCY
+    if (sz > VMIN_MAX)
+        sz = VMIN_MAX;
+    if (sz < 1)
+        sz = 1;
+    if (ddata->lowlat.vmin && ddata->lowlat.vmin != sz)
+        set_vmin(ddata, sz);
+#endif
+}
+
+/* Read a reply of sz bytes. Returns number of bytes read, short only if
+ * the adapter stopped sending, or -1 on error. */
+int bp_read(struct ddata *ddata, void *buf, int sz)
+{
+    uint8_t *p = buf;
+    int rc, idx = 0, m_errno;
+
+    bp_lowlat_expect(ddata, sz);
+    while (idx < sz) {
+        rc = instr_read(ddata->fd, &p[idx], sz - idx);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            idx = -1;
+            break;
+        }
+        if (rc == 0)
+            break;
+        idx += rc;
+    }
+    /* Back to what single byte acks need */
+    m_errno = errno;
+    bp_lowlat_expect(ddata, 1);
+    errno = m_errno;
+    return idx;
+}
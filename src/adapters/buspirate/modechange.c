@@ -17,8 +17,10 @@
  *   Free Software Foundation, Inc.,                                       *
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
+#include "buspirate_config.h"
 #include <sys/types.h>
 #include <regex.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -30,6 +32,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <liblog/assure.h>
+#include <poll.h>
+#include <termios.h>
+#include <instr.h>
 #include "local.h"
 
 /* Lookup-table: Expected replies for command */
@@ -56,11 +61,11 @@ struct cmdrply_s cmdrply[] = {
 #define US_BPCMD_RESPONSE_TIME 725
                                 /* Time in uS for BusPirate to process a
                                  * command. Machine constant.*/
-#define US_CHAR_TIME 100        /* Time in uS to propagate one character
-                                 * over the serial adapter. Note: Baud-rate
-                                 * dependent. TBD: detect baud-rate to
-                                 * release this dependency, current constant
-                                 * assumes 9K6 bps
+#define US_CHAR_TIME (100 * BP_BAUD_DFLT / ddata->baud)
+                                /* Time in uS to propagate one character
+                                 * over the serial adapter. Scaled from what
+                                 * is known to work at BP_BAUD_DFLT to the
+                                 * current baud (see rawMode_baud)
                                  */
 #define MAX_ONGOING_CHARS 6     /* Number of character possibly coming */
 #define US_DELAY_RETRY (20*(MAX_ONGOING_CHARS * US_CHAR_TIME))
@@ -70,8 +75,35 @@ struct cmdrply_s cmdrply[] = {
                                  * Baud-rate > 115kb make sure this doesn't
                                  * evaluate to 0.
                                  */
+#define MS_PROBE_TIMEOUT 50     /* Max time to wait for reply to a mode
+                                 * probe. Only fully spent if BP is not in
+                                 * the probed mode. */
+#define MS_CONSOLE_TIMEOUT 200  /* Max silence in a console dialogue */
+#define MS_BP_BOOT 100          /* Time for BP to boot after a reset */
+
+/* Host-side bauds to try for rawMode_baud, fastest first, and the value of
+ * the BP UART's baud rate generator for each. BP v3: 16MHz / (4 * (BRG +
+ * 1)). Only those not faster than BUSPIRATE_BAUD are tried. */
+static const struct {
+    int baud;
+    int brg;
+    speed_t speed;
+} bauds[] = {
+#ifdef B1000000
+    {1000000, 3, B1000000},
+#endif
+#ifdef B500000
+    {500000, 7, B500000},
+#endif
+    {230400, 16, B230400},
+    {BP_BAUD_DFLT, 34, B115200}
+};
+
+#define NBAUDS (sizeof(bauds) / sizeof(bauds[0]))
 
 static int read_2err(int fd, char *rbuff, int len);
+static int read_tmo(int fd, char *rbuff, int len, int ms_tmo);
+static int console_expect(int fd, const char *cmd, const char *expect);
 static char *expected_rply(int cmd);
 static unsigned int lookup_cmd(char *rply);
 
@@ -83,7 +115,7 @@ static int read_2err(int fd, char *rbuff, int len)
     log_level llevel;
 
     do {
-        rc = read(fd, tmp, 1);
+        rc = instr_read(fd, tmp, 1);
         m_errno = errno;
         if (rc != -1)
             rbuff[idx++] = tmp[0];
@@ -101,6 +133,36 @@ static int read_2err(int fd, char *rbuff, int len)
     return 0;
 }
 
+/* Reads fd until len characters are read or until no more arrive within
+ * ms_tmo. Returns number of characters read, -1 on error. Works with both
+ * blocking and non-blocking fd. */
+static int read_tmo(int fd, char *rbuff, int len, int ms_tmo)
+{
+    int rc, idx = 0;
+    struct pollfd pfd = {.fd = fd,.events = POLLIN };
+
+    while (idx < len) {
+        rc = poll(&pfd, 1, ms_tmo);
+        if (rc == 0)
+            break;
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        rc = instr_read(fd, &rbuff[idx], len - idx);
+        if (rc == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (rc == 0)
+            break;
+        idx += rc;
+    }
+    return idx;
+}
+
 /* Empty (i.e. flush) any remaining stdlib-level in-buffer characters. This
    could be necessary when BP and host are not in sync, i.e. reply from a
    previous command is already in in-buffer (resulting in that current
@@ -203,14 +265,14 @@ int rawMode_enter(struct adapter *adapter)
         LOGD("Sending 0x%02X to port\n", tmp[0]);
         usleep(20 * (US_CHAR_TIME * (slen + 2) + US_CHAR_TIME +
                      US_BPCMD_RESPONSE_TIME));
-        ASSURE_E((ret = write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
+        ASSURE_E((ret = instr_write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
     }
 
     /*loop up to 25 more times, send 0x00 each time and pause briefly for a reply (BBIO1) */
     while (!done) {
         tmp[0] = 0x00;
         LOGD("Sending 0x%02X to port\n", tmp[0]);
-        ASSURE_E((ret = write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
+        ASSURE_E((ret = instr_write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
         tries++;
         LOGD("tries: %i Ret %i\n", tries, ret);
         usleep(US_CHAR_TIME * (slen + 2) + US_CHAR_TIME +
@@ -260,7 +322,7 @@ int rawMode_toMode(struct adapter *adapter, bpcmd_raw_t bpcmd)
         tmp[0] = bpcmd;
         LOGD("Sending 0x%02X to port. Expecting response %s\n", tmp[0],
              expRply);
-        ASSURE_E((ret = write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
+        ASSURE_E((ret = instr_write(*fd, tmp, 1)) != -1, LOGE_IOERROR(errno));
         usleep(20 * (US_CHAR_TIME * (slen + 2) + US_CHAR_TIME +
                      US_BPCMD_RESPONSE_TIME));
         ASSURE_E((ret = read_2err(*fd, tmp, slen)) != -1, LOGE_IOERROR(errno));
@@ -284,3 +346,222 @@ int rawMode_toMode(struct adapter *adapter, bpcmd_raw_t bpcmd)
     LOGE("  Reply matches:     0x%02X\n", corr_cmd);
     return -1;
 }
+
+/* Switch between binary modes of an initialized BP, i.e. with the tty
+ * opened blocking in raw mode. Via BBIO unless already there. Unlike
+ * rawMode_toMode, waits for the exact replies instead of sleeping, so a
+ * switch costs two round-trips. */
+int rawMode_switch(struct ddata *ddata, bpcmd_raw_t bpcmd)
+{
+    char tmp[BUF_SZ] = { '\0' };
+    char *expRply;
+    int slen;
+
+    if (ddata->state != ENTER_RESET) {
+        tmp[0] = ENTER_RESET;
+        expRply = expected_rply(ENTER_RESET);
+        slen = strlen(expRply);
+        ASSURE_E(instr_write(ddata->fd, tmp, 1) == 1, goto switch_err);
+        ASSURE_E(bp_read(ddata, tmp, slen) == slen, goto switch_err);
+        ASSURE_E(strncmp(tmp, expRply, slen) == 0, goto switch_err);
+        ddata->state = ENTER_RESET;
+    }
+    if (bpcmd == ENTER_RESET)
+        return 0;
+
+    tmp[0] = bpcmd;
+    expRply = expected_rply(bpcmd);
+    slen = strlen(expRply);
+    ASSURE_E(instr_write(ddata->fd, tmp, 1) == 1, goto switch_err);
+    ASSURE_E(bp_read(ddata, tmp, slen) == slen, goto switch_err);
+    ASSURE_E(strncmp(tmp, expRply, slen) == 0, goto switch_err);
+    ddata->state = bpcmd;
+    return 0;
+switch_err:
+    LOGE("BP: Switch from mode %d to %d failed\n", ddata->state, bpcmd);
+    return -1;
+}
+
+/* Probe if BusPirate already is in binary mode bpcmd (ENTER_SPI or
+ * ENTER_I2C). Command 0x01 is used as it's harmless in all binary modes: In
+ * SPI and I2C mode it returns the mode's version string, in BBIO it enters
+ * SPI. In console-mode it's just a (non-echoed) control character.
+ *
+ * Returns 0 if BP answered as expected for bpcmd, i.e. configuration can
+ * start directly. Any other return-value means full reset cycle is needed.
+ */
+int rawMode_probe(struct adapter *adapter, bpcmd_raw_t bpcmd)
+{
+    int ret, slen;
+    char tmp[BUF_SZ] = { '\0' };
+    char *expRply = NULL;
+    struct ddata *ddata = adapter->driver.any->ddata;
+    int *fd = &ddata->fd;
+
+    expRply = expected_rply(bpcmd);
+    ASSURE_E(expRply, return -1);
+    slen = strlen(expRply);
+
+    tmp[0] = ENTER_SPI;
+    LOGD("Probing BP mode with 0x%02X. Hoping for response %s\n", tmp[0],
+         expRply);
+    ASSURE_E(instr_write(*fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E((ret = read_tmo(*fd, tmp, slen, MS_PROBE_TIMEOUT)) != -1,
+             LOGE_IOERROR(errno));
+
+    if ((ret == slen) && (strncmp(tmp, expRply, slen) == 0)) {
+        ddata->state = bpcmd;
+        return 0;
+    }
+
+    LOGI("BusPirate not in mode %d (%i,%.*s). Full reset cycle needed.\n",
+         bpcmd, ret, ret > 0 ? ret : 0, tmp);
+    return -1;
+}
+
+/***************************************************************************
+ * Baud negotiation
+ ***************************************************************************/
+/* Set host side of the tty to baud. Returns -1 if the tty doesn't take it */
+int bp_host_baud(int fd, int baud)
+{
+    struct termios tio;
+    int i;
+
+    for (i = 0; i < NBAUDS && bauds[i].baud != baud; i++) ;
+    ASSURE_E(i < NBAUDS, return -1);
+
+    ASSURE_E(tcgetattr(fd, &tio) == 0, return -1);
+    cfsetispeed(&tio, bauds[i].speed);
+    cfsetospeed(&tio, bauds[i].speed);
+    if (tcsetattr(fd, TCSADRAIN, &tio) != 0)
+        return -1;
+    /* tcsetattr succeeds if any change was made, check it was this one */
+    ASSURE_E(tcgetattr(fd, &tio) == 0, return -1);
+    return cfgetospeed(&tio) == bauds[i].speed ? 0 : -1;
+}
+
+/* Console dialogue: send cmd (unless NULL), then read until expect has been
+ * seen. Returns -1 if it isn't within MS_CONSOLE_TIMEOUT of silence. */
+static int console_expect(int fd, const char *cmd, const char *expect)
+{
+    char buf[BUF_SZ * 3];
+    int n = 0, keep, elen = strlen(expect);
+
+    if (cmd)
+        ASSURE_E(instr_write(fd, cmd, strlen(cmd)) != -1, return -1);
+    while (read_tmo(fd, &buf[n], 1, MS_CONSOLE_TIMEOUT) == 1) {
+        buf[++n] = '\0';
+        if (strstr(buf, expect))
+            return 0;
+        if (n == sizeof(buf) - 1) {
+            keep = elen;
+            memmove(buf, &buf[n - keep], keep);
+            n = keep;
+        }
+    }
+    LOGD("BP: Console: no [%s] after [%s]\n", expect, cmd ? cmd : "");
+    return -1;
+}
+
+/* Try one baud. BP in console mode at BP_BAUD_DFLT in, BP in console mode
+ * at either baud out. Returns 0 if BP answers at the new one. */
+static int console_baud(struct ddata *ddata, int i)
+{
+    char cmd[16];
+    int fd = ddata->fd;
+
+    snprintf(cmd, sizeof(cmd), "%d\n", bauds[i].brg);
+    if (console_expect(fd, "b\n", "BRG") || console_expect(fd, NULL, ">") ||
+        console_expect(fd, "10\n", "BRG") || console_expect(fd, NULL, ">") ||
+        console_expect(fd, cmd, "Space")) {
+        /* Not the firmware we think. Empty line: menu default, i.e. no
+         * change */
+        console_expect(fd, "\n", ">");
+        return -1;
+    }
+
+    /* BP has switched, now the host. Space makes BP show its prompt. */
+    tcdrain(fd);
+    if (bp_host_baud(fd, bauds[i].baud) == 0) {
+        msleep(1);
+        empty_inbuff(fd);
+        if (console_expect(fd, " ", ">") == 0)
+            return 0;
+    }
+
+    /* Unusable. Reset BP back to BP_BAUD_DFLT, blindly */
+    LOGW("BP: No answer at %d baud, resetting\n", bauds[i].baud);
+    instr_write(fd, " \n#\n", 4);
+    tcdrain(fd);
+    bp_host_baud(fd, BP_BAUD_DFLT);
+    msleep(MS_BP_BOOT);
+    empty_inbuff(fd);
+    return -1;
+}
+
+/* Raise the host-side baud from BP_BAUD_DFLT to the fastest both the host's
+ * tty and BP can do, up to BUSPIRATE_BAUD. Binary mode has no command for
+ * it, so BP is reset to console mode and uses its 'b' menu. BP must be in
+ * binary mode. It's in console mode when returning, at ddata->baud.
+ *
+ * Returns 0 if the baud was raised.
+ */
+int rawMode_baud(struct adapter *adapter)
+{
+    struct ddata *ddata = adapter->driver.any->ddata;
+    int fd = ddata->fd;
+    int i;
+
+    ASSURE_E(ddata->baud == BP_BAUD_DFLT, return -1);
+    ASSURE_E(rawMode_toMode(adapter, RESET_BUSPIRATE) == 0, return -1);
+    msleep(MS_BP_BOOT);
+    empty_inbuff(fd);
+    if (console_expect(fd, "\n", ">")) {
+        LOGW("BP: Console not answering, keeping %d baud\n", ddata->baud);
+        return -1;
+    }
+
+    for (i = 0; i < NBAUDS && bauds[i].baud != BP_BAUD_DFLT; i++) {
+        if (bauds[i].baud > BUSPIRATE_BAUD)
+            continue;
+        /* Host can't, no need to ask BP */
+        if (bp_host_baud(fd, bauds[i].baud) != 0) {
+            LOGD("BP: Host tty can't do %d baud\n", bauds[i].baud);
+            continue;
+        }
+        ASSURE_E(bp_host_baud(fd, BP_BAUD_DFLT) == 0, return -1);
+
+        if (console_baud(ddata, i) == 0) {
+            ddata->baud = bauds[i].baud;
+            LOGI("BP: Host-side baud is now %d\n", ddata->baud);
+            return 0;
+        }
+        /* Still there? Else give up. */
+        if (console_expect(fd, "\n", ">"))
+            return -1;
+    }
+    LOGI("BP: Keeping %d baud\n", ddata->baud);
+    return -1;
+}
+
+/* rawMode_probe at BP_BAUD_DFLT, then at each baud rawMode_baud could have
+ * left BP at in a previous session. ddata->baud is where BP answered. */
+int rawMode_probe_bauds(struct adapter *adapter, bpcmd_raw_t bpcmd)
+{
+    struct ddata *ddata = adapter->driver.any->ddata;
+    int i;
+
+    for (i = NBAUDS - 1; i >= 0; i--) {
+        if (bauds[i].baud > BUSPIRATE_BAUD && bauds[i].baud != BP_BAUD_DFLT)
+            continue;
+        if (bp_host_baud(ddata->fd, bauds[i].baud) != 0)
+            continue;
+        ddata->baud = bauds[i].baud;
+        if (rawMode_probe(adapter, bpcmd) == 0)
+            return 0;
+    }
+    ddata->baud = BP_BAUD_DFLT;
+    bp_host_baud(ddata->fd, ddata->baud);
+    return -1;
+}
@@ -0,0 +1,355 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * One Bus-pirate shared by several adapters, e.g. spi:0:bp:... and
+ * i2c:0:bp:... on the same tty.
+ *
+ * The BP firmware is in one binary mode at a time and a mode change resets
+ * its configuration, so the session keeps track of which mode it's in and
+ * whose configuration was last sent. A driverAPI call by an adapter for
+ * which either is wrong first switches mode and replays that adapter's
+ * cached config_SPI/config_I2C. Calls of one thread keep their order. Calls
+ * waiting in other threads are served mode by mode, i.e. those needing no
+ * switch first, up to SESSION_MAX_STREAK in a row.
+ */
+#include "config.h"
+#include "buspirate_config.h"
+#include "local.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include <driver.h>
+
+/* Calls served without a switch while others wait for one */
+#define SESSION_MAX_STREAK 16
+
+/* Index of waiting[] */
+#define WIX(mode) ((mode) == ENTER_I2C)
+
+struct bp_session {
+    struct bp_session *next;
+    const char *name;           /* Device, as in adapter-string */
+    int fd;
+    int baud;
+    struct bp_lowlat lowlat;    /* To restore when last adapter leaves */
+    int users;
+    bpcmd_raw_t mode;           /* Binary mode BP is in */
+    struct ddata *configured;   /* Whose configuration BP has */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int busy;                   /* A call is in progress */
+    struct ddata *pinned;       /* Owns the BP between calls too */
+    pthread_t pinner;
+    int waiting[2];             /* Waiting calls per mode */
+    int streak;                 /* Calls since last switch */
+    unsigned long switches;
+};
+
+static struct bp_session *sessions = NULL;
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bpcmd_raw_t role_mode(struct ddata *ddata)
+{
+    return ddata->driver.any->adapter->role == ROLE_I2C ?
+        ENTER_I2C : ENTER_SPI;
+}
+
+static int configure(struct ddata *ddata, bpcmd_raw_t mode)
+{
+    switch (mode) {
+#ifdef BUSPIRATE_ENABLE_SPI
+        case ENTER_SPI:
+            return bpspi_configure(ddata);
+#endif
+#ifdef BUSPIRATE_ENABLE_I2C
+        case ENTER_I2C:
+            return bpi2c_configure(ddata);
+#endif
+        default:
+            return -1;
+    }
+}
+
+/***************************************************************************
+ * Sessions
+ ***************************************************************************/
+struct bp_session *bp_session_find(const char *name)
+{
+    struct bp_session *s;
+
+    pthread_mutex_lock(&sessions_lock);
+    for (s = sessions; s; s = s->next)
+        if (strcmp(s->name, name) == 0)
+            break;
+    pthread_mutex_unlock(&sessions_lock);
+    return s;
+}
+
+/* ddata is initialized: opened, in its mode and configured */
+void bp_session_new(struct ddata *ddata, const char *name)
+{
+    struct bp_session *s;
+
+    ASSERT(s = calloc(1, sizeof(struct bp_session)));
+    s->name = name;
+    s->fd = ddata->fd;
+    s->baud = ddata->baud;
+    s->lowlat = ddata->lowlat;
+    s->users = 1;
+    s->mode = ddata->state;
+    s->configured = ddata;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    ddata->session = s;
+
+    pthread_mutex_lock(&sessions_lock);
+    s->next = sessions;
+    sessions = s;
+    pthread_mutex_unlock(&sessions_lock);
+}
+
+/* Share the BP of session with ddata, then bring it in ddata's mode and
+ * configuration */
+void bp_session_attach(struct ddata *ddata, struct bp_session *s)
+{
+    pthread_mutex_lock(&s->lock);
+    ddata->fd = s->fd;
+    ddata->baud = s->baud;
+    /* tty state is the creator's to restore. VMIN is 1 between calls */
+    ddata->lowlat = s->lowlat;
+    ddata->lowlat.serial_flags = -1;
+    ddata->lowlat.latency_timer = -1;
+    ddata->session = s;
+    s->users++;
+    pthread_mutex_unlock(&s->lock);
+
+    bp_session_acquire(ddata);
+    bp_session_release(ddata, -1);
+    LOGI("BP: Adapter [%s] shared by %d adapters\n", s->name, s->users);
+}
+
+/* Returns number of adapters still using the BP. When 0, the session is
+ * gone and ddata has what's needed to reset the BP and restore the tty. */
+int bp_session_detach(struct ddata *ddata)
+{
+    struct bp_session *s = ddata->session, **sp;
+    int users;
+
+    pthread_mutex_lock(&s->lock);
+    ASSURE(s->pinned != ddata);
+    if (s->configured == ddata)
+        s->configured = NULL;
+    users = --s->users;
+    pthread_mutex_unlock(&s->lock);
+    ddata->session = NULL;
+    if (users)
+        return users;
+
+    pthread_mutex_lock(&sessions_lock);
+    for (sp = &sessions; *sp != s; sp = &(*sp)->next) ;
+    *sp = s->next;
+    pthread_mutex_unlock(&sessions_lock);
+
+    LOGD("BP: Session [%s] ends after %lu mode switches\n", s->name,
+         s->switches);
+    ddata->state = s->mode;
+    ddata->lowlat = s->lowlat;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+    return 0;
+}
+
+/***************************************************************************
+ * Call framing
+ ***************************************************************************/
+void bp_session_acquire(struct ddata *ddata)
+{
+    struct bp_session *s = ddata->session;
+    bpcmd_raw_t mode = role_mode(ddata);
+
+    pthread_mutex_lock(&s->lock);
+    if (s->pinned && s->pinned != ddata &&
+        pthread_equal(s->pinner, pthread_self())) {
+        /* Would wait for itself forever. Methods are void, so no error
+         * can be returned: stop here whatever the ASSURE level */
+        LOGE("BP: [%s] used in mode %d while held in mode %d by the same "
+             "thread (CS active or I2C transaction not stopped)\n",
+             s->name, mode, s->mode);
+        ASSERT("Bus-pirate held by other adapter" == NULL);
+    }
+    s->waiting[WIX(mode)]++;
+    while (s->busy || (s->pinned && s->pinned != ddata) ||
+           (!s->pinned && s->mode != mode && s->waiting[WIX(s->mode)] &&
+            s->streak < SESSION_MAX_STREAK))
+        pthread_cond_wait(&s->cond, &s->lock);
+    s->waiting[WIX(mode)]--;
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    /* Alone on the BP from here until released */
+    if (s->mode != mode) {
+        ddata->state = s->mode;
+        ASSURE(rawMode_switch(ddata, mode) == 0);
+        s->mode = mode;
+        s->configured = NULL;
+        s->streak = 0;
+        s->switches++;
+    }
+    if (s->configured != ddata) {
+        ASSURE(configure(ddata, mode) == 0);
+        s->configured = ddata;
+    }
+    ddata->state = mode;
+    s->streak++;
+}
+
+void bp_session_release(struct ddata *ddata, int pin)
+{
+    struct bp_session *s = ddata->session;
+
+    pthread_mutex_lock(&s->lock);
+    s->busy = 0;
+    if (pin == 1) {
+        s->pinned = ddata;
+        s->pinner = pthread_self();
+    } else if (pin == 0 && s->pinned == ddata) {
+        s->pinned = NULL;
+    }
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/***************************************************************************
+ * Session-framed driver apis
+ ***************************************************************************/
+#define FRAMED(DD, PIN, CALL) \
+    do { \
+        bp_session_acquire(DD); \
+        CALL; \
+        bp_session_release(DD, PIN); \
+    } while (0)
+
+#ifdef BUSPIRATE_ENABLE_SPI
+void bpsspi_setCS(struct ddata *ddata, int state)
+{
+    /* Others must wait while CS is active */
+    FRAMED(ddata, state ? 0 : 1, bpspi_setCS(ddata, state));
+}
+
+void bpsspi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    FRAMED(ddata, -1, bpspi_receiveData(ddata, data, sz));
+}
+
+void bpsspi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    FRAMED(ddata, -1, bpspi_sendData(ddata, data, sz));
+}
+
+void bpsspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz)
+{
+    FRAMED(ddata, -1,
+           bpspi_sendrecieveData(ddata, outbuf, outsz, indata, insz));
+}
+
+void bpsspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz)
+{
+    FRAMED(ddata, -1,
+           bpspi_sendrecieveData_ncs(ddata, outbuf, outsz, indata, insz));
+}
+
+int bpsspi_actuate(struct ddata *ddata)
+{
+    int rc;
+
+    ASSURE_E(ddata->driver.any, return -1);
+    FRAMED(ddata->driver.any->ddata, -1, rc = bpspi_actuate(ddata));
+    return rc;
+}
+#endif
+
+#ifdef BUSPIRATE_ENABLE_I2C
+void bpsi2c_start(struct ddata *ddata)
+{
+    /* Others must wait until the transaction is stopped */
+    FRAMED(ddata, 1, bpi2c_start(ddata));
+}
+
+void bpsi2c_stop(struct ddata *ddata)
+{
+    FRAMED(ddata, 0, bpi2c_stop(ddata));
+}
+
+void bpsi2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    FRAMED(ddata, -1, bpi2c_receiveByte(ddata, data));
+}
+
+int bpsi2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    int rc;
+
+    FRAMED(ddata, -1, rc = bpi2c_sendByte(ddata, data));
+    return rc;
+}
+
+void bpsi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    FRAMED(ddata, -1, bpi2c_receiveData(ddata, data, sz));
+}
+
+void bpsi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    FRAMED(ddata, -1, bpi2c_sendData(ddata, data, sz));
+}
+
+void bpsi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz)
+{
+    FRAMED(ddata, -1,
+           bpi2c_sendrecieveData(ddata, outbuf, outsz, indata, insz));
+}
+
+int bpsi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present)
+{
+    int rc;
+
+    FRAMED(ddata, 0, rc = bpi2c_scan(ddata, first, last, present));
+    return rc;
+}
+
+int bpsi2c_actuate(struct ddata *ddata)
+{
+    int rc;
+
+    ASSURE_E(ddata->driver.any, return -1);
+    FRAMED(ddata->driver.any->ddata, -1, rc = bpi2c_actuate(ddata));
+    return rc;
+}
+#endif
@@ -34,6 +34,8 @@
 #include <stdlib.h>
 #include <liblog/assure.h>
 #include <arpa/inet.h>
+#include <instr.h>
+#include <hlog.h>
 
 struct config_SPI bp_dflt_config_SPI = {
     .speed = {
@@ -78,8 +80,9 @@ void bpspi_sendrecieveData(struct ddata *ddata, const uint8_t *obuf,
 
     nsz_send = htons(osz);
     nsz_receive = htons(isz);
-    ASSERT((osz < 4096) && (osz >= 0)); /* Primitive handling for now (TBD) */
-    ASSERT(isz < 4096);
+    /* Callers chunk by the driver's caps (BP_SPI_MAX_XFER) */
+    ASSERT((osz <= BP_SPI_MAX_XFER) && (osz >= 0));
+    ASSERT(isz <= BP_SPI_MAX_XFER);
 
 #ifndef NDEBUG
     memset(ibuf, 0, isz);
@@ -89,24 +92,24 @@ void bpspi_sendrecieveData(struct ddata *ddata, const uint8_t *obuf,
          isz);
 
     //tmp[0] = 0;
-    ASSURE_E(write(ddata->fd, (uint8_t[]) {
+    ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                    CMD_WR_RD}, 1) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(write(ddata->fd, &nsz_send, 2) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(write(ddata->fd, &nsz_receive, 2) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, &nsz_send, 2) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, &nsz_receive, 2) != -1, LOGE_IOERROR(errno));
     //We need another solution for reading that can
     //timeout if blocked-on-read (TBD)
     //ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     //ASSERT(tmp[0] == 0x00);
 
-    ASSURE_E((ret = write(ddata->fd, obuf, osz)) >= -1, LOGE_IOERROR(errno));
+    ASSURE_E((ret = instr_write(ddata->fd, obuf, osz)) >= -1, LOGE_IOERROR(errno));
     LOGD("BP: %d bytes written to adapter\n", ret);
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     //n_sent=ntohs(*(int16_t*)(tmp));
     //LOGD("BP: %d bytes written SPI\n", n_sent);
     ASSERT(tmp[0] == 0x01);
 
     if (isz > 0) {
-        ASSURE_E((ret = read(ddata->fd, ibuf, isz)) != -1, LOGE_IOERROR(errno));
+        ASSURE_E((ret = bp_read(ddata, ibuf, isz)) != -1, LOGE_IOERROR(errno));
         LOGD("BP: %d bytes read from adapter\n", ret);
     }
 }
@@ -120,8 +123,9 @@ void bpspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *obuf,
 
     nsz_send = htons(osz);
     nsz_receive = htons(isz);
-    ASSERT((osz < 4096) && (osz >= 0)); /* Primitive handling for now (TBD) */
-    ASSERT(isz < 4096);
+    /* Callers chunk by the driver's caps (BP_SPI_MAX_XFER) */
+    ASSERT((osz <= BP_SPI_MAX_XFER) && (osz >= 0));
+    ASSERT(isz <= BP_SPI_MAX_XFER);
 
 #ifndef NDEBUG
     memset(ibuf, 0, isz);
@@ -130,18 +134,18 @@ void bpspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *obuf,
     LOGD("BP: Interface %s sending-receiving %d,%d bytes (NO CS)\n", __func__,
          osz, isz);
 
-    ASSURE_E(write(ddata->fd, (uint8_t[]) {
+    ASSURE_E(instr_write(ddata->fd, (uint8_t[]) {
                    CMD_WR_RD_NOCS}, 1) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(write(ddata->fd, &nsz_send, 2) != -1, LOGE_IOERROR(errno));
-    ASSURE_E(write(ddata->fd, &nsz_receive, 2) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, &nsz_send, 2) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, &nsz_receive, 2) != -1, LOGE_IOERROR(errno));
 
-    ASSURE_E((ret = write(ddata->fd, obuf, osz)) >= -1, LOGE_IOERROR(errno));
+    ASSURE_E((ret = instr_write(ddata->fd, obuf, osz)) >= -1, LOGE_IOERROR(errno));
     LOGD("BP: %d bytes written to adapter\n", ret);
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp[0] == 0x01);
 
     if (isz > 0) {
-        ASSURE_E((ret = read(ddata->fd, ibuf, isz)) != -1, LOGE_IOERROR(errno));
+        ASSURE_E((ret = bp_read(ddata, ibuf, isz)) != -1, LOGE_IOERROR(errno));
         LOGD("BP: %d bytes read from adapter\n", ret);
     }
 }
@@ -165,9 +169,9 @@ void bpspi_setCS(struct ddata *ddata, int state)
     tmp[0] = CMD_CS | mstate;
     LOGD("BP: Interface %s sets CS to: (0x%02X)\n", __func__, mstate, tmp[0]);
 
-    ASSURE_E(write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_write(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     memset(tmp, 0, sizeof(tmp));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
+    ASSURE_E(instr_read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
     ASSERT(tmp[0] == 0x01);
 
 }
@@ -187,40 +191,60 @@ uint16_t bpspi_getStatus(struct ddata *ddata, uint16_t flags)
     return flags;
 }
 
-int bpspi_configure(struct ddata *ddata)
+/* Send the parts of the configuration in mask as one burst, then check
+ * all acks */
+static int apply(struct ddata *ddata, unsigned mask)
 {
-    int ret;
-    uint8_t tmp[8] = { 0 };
-
-    struct confspi_pereph *pereph = &(ddata->config.spi.pereph);
-    struct confspi_speed *speed = &(ddata->config.spi.speed);
-    struct confspi_bus *bus = &(ddata->config.spi.bus);
-
-    tmp[0] = 0;
-    ASSURE_E((ret =
-              write(ddata->fd, speed, sizeof(struct confspi_speed))) != -1,
-             LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
-    ASSERT(tmp[0] == 0x01);
-    memcpy(&ddata->config.spi.speed, speed, sizeof(struct confspi_speed));
-
-    tmp[0] = 0;
-    ASSURE_E((ret =
-              write(ddata->fd, bus, sizeof(struct confspi_bus))) != -1,
-             LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
-    ASSERT(tmp[0] == 0x01);
-    memcpy(&ddata->config.spi.bus, bus, sizeof(struct confspi_bus));
+    uint8_t burst[3], ack[3];
+    int i, n = 0;
+
+    if (mask & BP_DIRTY_SPEED)
+        burst[n++] = ddata->config.spi.speed.raw;
+    if (mask & BP_DIRTY_BUS)
+        burst[n++] = ddata->config.spi.bus.raw;
+    if (mask & BP_DIRTY_PEREPH)
+        burst[n++] = ddata->config.spi.pereph.raw;
+    if (n == 0)
+        return 0;
+
+    LOGD("BP: Interface %s sends %d config bytes\n", __func__, n);
+    ASSURE_E(instr_write(ddata->fd, burst, n) == n, goto apply_err);
+    ASSURE_E(bp_read(ddata, ack, n) == n, goto apply_err);
+    for (i = 0; i < n; i++)
+        ASSURE_E(ack[i] == 0x01, goto apply_err);
+
+    ddata->dirty &= ~mask;
+    return 0;
+apply_err:
+    LOGE_IOERROR(errno);
+    return -1;
+}
 
-    tmp[0] = 0;
-    ASSURE_E((ret =
-              write(ddata->fd, pereph, sizeof(struct confspi_pereph))) != -1,
-             LOGE_IOERROR(errno));
-    ASSURE_E(read(ddata->fd, tmp, 1) != -1, LOGE_IOERROR(errno));
-    ASSERT(tmp[0] == 0x01);
-    memcpy(&ddata->config.spi.pereph, pereph, sizeof(struct confspi_pereph));
+/* Configure everything, for a known state */
+int bpspi_configure(struct ddata *ddata)
+{
+    return apply(ddata, BP_DIRTY_ALL);
+}
 
-    return 0;
+/* Configure what has changed. ddata may be a copy (see newddata), its
+ * changes are then taken over by the adapter's own first. */
+int bpspi_actuate(struct ddata *ddata)
+{
+    struct ddata *live;
+
+    ASSURE_E(ddata->driver.any, return -1);
+    live = ddata->driver.any->ddata;
+    if (live != ddata) {
+        if (ddata->dirty & BP_DIRTY_SPEED)
+            live->config.spi.speed = ddata->config.spi.speed;
+        if (ddata->dirty & BP_DIRTY_BUS)
+            live->config.spi.bus = ddata->config.spi.bus;
+        if (ddata->dirty & BP_DIRTY_PEREPH)
+            live->config.spi.pereph = ddata->config.spi.pereph;
+        live->dirty |= ddata->dirty;
+        ddata->dirty = 0;
+    }
+    return apply(live, live->dirty);
 }
 
 /* Create a new adapter/driver-data object for external manipulation without
@@ -237,98 +261,125 @@ struct ddata *bpspi_newddata(struct adapter *adapter)
 
     memcpy(&(ddata->config.spi), &bp_dflt_config_SPI,
            sizeof(struct config_SPI));
+    ddata->dirty = BP_DIRTY_ALL;
+    ddata->driver.any = NULL;
+    ddata->session = NULL;
     return ddata;
 }
 
 /***************************************************************************
  * Configuration  api
- ***************************************************************************/
+ ***************************************************************************
+ * Changes ddata's configuration, sent to BP by actuate_config. A ddata is
+ * needed, there's nothing to affect directly.
+ */
+#define SET(PART, FIELD, MAX, DIRTY) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        if (setval < 0 || setval > (MAX)) \
+            return E_BAD_VALUE; \
+        if (dd->config.spi.PART.FIELD != setval) { \
+            dd->config.spi.PART.FIELD = setval; \
+            dd->dirty |= (DIRTY); \
+        } \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
+#define GET(PART, FIELD) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        *retval = dd->config.spi.PART.FIELD; \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
 config_etype_t bpspi_set_speed(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(speed, speed, SPISPEED_8MHz, BP_DIRTY_SPEED);
 }
 
 config_etype_t bpspi_set_power_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, power_on, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpspi_set_pullups(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, pullups, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpspi_set_aux_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, aux, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpspi_set_cs_active(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(pereph, cs_active, 1, BP_DIRTY_PEREPH);
 }
 
 config_etype_t bpspi_set_output_type(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, output_type, 1, BP_DIRTY_BUS);
 }
 
 config_etype_t bpspi_set_clk_pol_idle(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, clk_pol_idle, 1, BP_DIRTY_BUS);
 }
 
 config_etype_t bpspi_set_output_clk_edge(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, output_clk_edge, 1, BP_DIRTY_BUS);
 }
 
 config_etype_t bpspi_set_input_sample_end(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, input_sample_end, 1, BP_DIRTY_BUS);
 }
 
 config_etype_t bpspi_get_speed(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(speed, speed);
 }
 
 config_etype_t bpspi_get_power_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, power_on);
 }
 
 config_etype_t bpspi_get_pullups(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, pullups);
 }
 
 config_etype_t bpspi_get_aux_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, aux);
 }
 
 config_etype_t bpspi_get_cs_active(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(pereph, cs_active);
 }
 
 config_etype_t bpspi_get_output_type(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, output_type);
 }
 
 config_etype_t bpspi_get_clk_pol_idle(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, clk_pol_idle);
 }
 
 config_etype_t bpspi_get_output_clk_edge(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, output_clk_edge);
 }
 
 config_etype_t bpspi_get_input_sample_end(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, input_sample_end);
 }
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdint.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "adapters.h"
+#include <driver.h>
+#include "dop.h"
+
+static const char *dop_names[DOP_LAST] = {
+    [DOP_NONE] = "none",
+    [DOP_SPI_SENDDATA] = "spi_sendData",
+    [DOP_SPI_RECEIVEDATA] = "spi_receiveData",
+    [DOP_SPI_SENDRECIEVEDATA] = "spi_sendrecieveData",
+    [DOP_SPI_SENDRECIEVEDATA_NCS] = "spi_sendrecieveData_ncs",
+    [DOP_SPI_SETCS] = "spi_setCS",
+    [DOP_I2C_RECEIVEBYTE] = "i2c_receiveByte",
+    [DOP_I2C_SENDBYTE] = "i2c_sendByte",
+    [DOP_I2C_SENDDATA] = "i2c_sendData",
+    [DOP_I2C_RECEIVEDATA] = "i2c_receiveData",
+    [DOP_I2C_SENDRECIEVEDATA] = "i2c_sendrecieveData",
+    [DOP_I2C_START] = "i2c_start",
+    [DOP_I2C_STOP] = "i2c_stop",
+    [DOP_I2C_AUTOACK] = "i2c_autoAck",
+    [DOP_GETSTATUS] = "getStatus",
+    [DOP_I2C_PROBE] = "i2c_probe",
+    [DOP_I2C_SCAN] = "i2c_scan",
+};
+
+const char *dop_name(dop_t op)
+{
+    if (op >= DOP_LAST || dop_names[op] == NULL)
+        return "invalid";
+    return dop_names[op];
+}
+
+int dop_posted(const struct dop *dop)
+{
+    switch (dop->op) {
+        case DOP_SPI_SENDDATA:
+        case DOP_SPI_SETCS:
+        case DOP_I2C_SENDDATA:
+        case DOP_I2C_START:
+        case DOP_I2C_STOP:
+        case DOP_I2C_AUTOACK:
+            return 1;
+        case DOP_SPI_SENDRECIEVEDATA:
+        case DOP_SPI_SENDRECIEVEDATA_NCS:
+        case DOP_I2C_SENDRECIEVEDATA:
+            return dop->isz == 0;
+        default:
+            return 0;
+    }
+}
+
+int dop_supported(const struct adapter *adapter, dop_t op)
+{
+    const struct driverAPI_spi *spi = adapter->driver.spi;
+    const struct driverAPI_i2c *i2c = adapter->driver.i2c;
+
+    if (adapter->role == ROLE_SPI) {
+        switch (op) {
+            case DOP_SPI_SENDDATA:
+                return spi->sendData != NULL;
+            case DOP_SPI_RECEIVEDATA:
+                return spi->receiveData != NULL;
+            case DOP_SPI_SENDRECIEVEDATA:
+                return spi->sendrecieveData != NULL;
+            case DOP_SPI_SENDRECIEVEDATA_NCS:
+                return spi->sendrecieveData_ncs != NULL;
+            case DOP_SPI_SETCS:
+                return spi->setCS != NULL;
+            case DOP_GETSTATUS:
+                return spi->getStatus != NULL;
+            default:
+                return 0;
+        }
+    }
+    if (adapter->role == ROLE_I2C) {
+        switch (op) {
+            case DOP_I2C_RECEIVEBYTE:
+                return i2c->receiveByte != NULL;
+            case DOP_I2C_SENDBYTE:
+                return i2c->sendByte != NULL;
+            case DOP_I2C_SENDDATA:
+                return i2c->sendData != NULL;
+            case DOP_I2C_RECEIVEDATA:
+                return i2c->receiveData != NULL;
+            case DOP_I2C_SENDRECIEVEDATA:
+                return i2c->sendrecieveData != NULL;
+            case DOP_I2C_START:
+                return i2c->start != NULL;
+            case DOP_I2C_STOP:
+                return i2c->stop != NULL;
+            case DOP_I2C_AUTOACK:
+                return i2c->autoAck != NULL;
+            case DOP_I2C_PROBE:
+                return i2c->probe != NULL;
+            case DOP_I2C_SCAN:
+                return i2c->scan != NULL;
+            case DOP_GETSTATUS:
+                return i2c->getStatus != NULL;
+            default:
+                return 0;
+        }
+    }
+    return 0;
+}
+
+int dop_exec(struct adapter *adapter, const struct dop *dop,
+             const uint8_t *obuf, uint8_t *ibuf)
+{
+    struct driverAPI_spi *spi = adapter->driver.spi;
+    struct driverAPI_i2c *i2c = adapter->driver.i2c;
+    struct ddata *ddata = adapter->driver.any->ddata;
+
+    ASSERT(dop->osz <= DOP_MAX_XFER && dop->isz <= DOP_MAX_XFER);
+
+    if (!dop_supported(adapter, dop->op)) {
+        LOGE("Adapter [%d] can't do %s\n", adapter->devid, dop_name(dop->op));
+        return -1;
+    }
+
+    switch (dop->op) {
+        case DOP_SPI_SENDDATA:
+            spi->sendData(ddata, obuf, dop->osz);
+            break;
+        case DOP_SPI_RECEIVEDATA:
+            spi->receiveData(ddata, ibuf, dop->isz);
+            break;
+        case DOP_SPI_SENDRECIEVEDATA:
+            spi->sendrecieveData(ddata, obuf, dop->osz, ibuf, dop->isz);
+            break;
+        case DOP_SPI_SENDRECIEVEDATA_NCS:
+            spi->sendrecieveData_ncs(ddata, obuf, dop->osz, ibuf, dop->isz);
+            break;
+        case DOP_SPI_SETCS:
+            spi->setCS(ddata, dop->arg);
+            break;
+        case DOP_I2C_RECEIVEBYTE:
+            i2c->receiveByte(ddata, ibuf);
+            break;
+        case DOP_I2C_SENDBYTE:
+            return i2c->sendByte(ddata, dop->arg);
+        case DOP_I2C_SENDDATA:
+            i2c->sendData(ddata, obuf, dop->osz);
+            break;
+        case DOP_I2C_RECEIVEDATA:
+            i2c->receiveData(ddata, ibuf, dop->isz);
+            break;
+        case DOP_I2C_SENDRECIEVEDATA:
+            i2c->sendrecieveData(ddata, obuf, dop->osz, ibuf, dop->isz);
+            break;
+        case DOP_I2C_START:
+            i2c->start(ddata);
+            break;
+        case DOP_I2C_STOP:
+            i2c->stop(ddata);
+            break;
+        case DOP_I2C_AUTOACK:
+            i2c->autoAck(ddata, dop->arg);
+            break;
+        case DOP_I2C_PROBE:
+            return i2c->probe(ddata, dop->arg);
+        case DOP_I2C_SCAN:
+            memset(ibuf, 0, dop->isz);
+            return i2c->scan(ddata, dop->arg & 0xFF, dop->arg >> 8, ibuf);
+        case DOP_GETSTATUS:
+            if (adapter->role == ROLE_I2C)
+                return i2c->getStatus(ddata, dop->arg);
+            return spi->getStatus(ddata, dop->arg);
+        default:
+            LOGE("Unknown driver operation [%d] in [%s]\n", dop->op, __func__);
+            return -1;
+    }
+    return 0;
+}
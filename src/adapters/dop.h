@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef dop_h
+#define dop_h
+/***************************************************************************
+ * Driver operations (dop)
+ *
+ * Each driverAPI method that moves data or changes bus-state expressed as
+ * data. Used where calls have to be serialized, queued or passed between
+ * processes instead of being invoked directly.
+ ***************************************************************************/
+#include <stdint.h>
+
+struct adapter;
+
+/* Largest payload in any direction of one operation. Same as the largest
+ * transfer any current adapter accepts in one go. */
+#define DOP_MAX_XFER 4096
+
+typedef enum {
+    DOP_NONE = 0,
+    /* SPI */
+    DOP_SPI_SENDDATA,
+    DOP_SPI_RECEIVEDATA,
+    DOP_SPI_SENDRECIEVEDATA,
+    DOP_SPI_SENDRECIEVEDATA_NCS,
+    DOP_SPI_SETCS,
+    /* I2C */
+    DOP_I2C_RECEIVEBYTE,
+    DOP_I2C_SENDBYTE,
+    DOP_I2C_SENDDATA,
+    DOP_I2C_RECEIVEDATA,
+    DOP_I2C_SENDRECIEVEDATA,
+    DOP_I2C_START,
+    DOP_I2C_STOP,
+    DOP_I2C_AUTOACK,
+    /* Common */
+    DOP_GETSTATUS,
+    /* I2C, added later. Numbers are in recordings and on the wire */
+    DOP_I2C_PROBE,
+    DOP_I2C_SCAN,
+    DOP_LAST
+} dop_t;
+
+/* Operation header. Followed by <osz> bytes out-data when serialized.
+ * Multi-byte fields are in host byte-order unless stated otherwise by the
+ * transport using it. */
+struct dop {
+    uint8_t op;                 /* dop_t */
+    uint8_t flags;              /* Transport specific */
+    uint16_t arg;               /* CS-state, autoAck-state, byte to send,
+                                   address to probe, range to scan (first
+                                   | last << 8) or getStatus flags
+                                   depending on op */
+    uint16_t osz;               /* Number of bytes out */
+    uint16_t isz;               /* Number of bytes expected in */
+} __attribute__ ((packed));
+
+/* True if op has no result for the caller, i.e. caller doesn't need to wait
+ * for it to complete */
+int dop_posted(const struct dop *dop);
+
+/* True if adapter's driver implements the method behind op */
+int dop_supported(const struct adapter *adapter, dop_t op);
+
+/* Execute dop on adapter. Out-data in obuf, in-data (isz bytes) returned in
+ * ibuf. Returns the methods return-value if it has one (sendByte, probe,
+ * scan, getStatus), else 0. Returns -1 if op isn't supported. */
+int dop_exec(struct adapter *adapter, const struct dop *dop,
+             const uint8_t *obuf, uint8_t *ibuf);
+
+const char *dop_name(dop_t op);
+
+#endif                          //dop_h
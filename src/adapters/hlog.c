@@ -0,0 +1,291 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Deferred hot-path logging. See hlog.h
+ *
+ * The ring is a bounded multi-producer queue: slot i is free for the
+ * producer reserving position pos when its seq is pos, holds a message
+ * once seq is pos + 1 and is handed back by the consumer setting seq to
+ * pos + HLOG_RING.
+ */
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <liblog/log.h>
+#define HLOG_INTERNAL
+#include "hlog.h"
+
+static struct hlog_ent ring[HLOG_RING];
+static uint64_t head = 0;       /* Next position to reserve */
+static uint64_t tail = 0;       /* Next position to output */
+static unsigned long dropped = 0;
+static int running = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***************************************************************************
+ * Formatting
+ ***************************************************************************/
+/* Integer argument truncated to what the length modifier says it is */
+static long long arg_int(const struct hlog_ent *e, int a, const char *len,
+                         int sgn)
+{
+    unsigned long long u = e->a[a].u;
+
+    if (e->type[a] == 'f')
+        return (long long)e->a[a].f;
+    if (strcmp(len, "hh") == 0)
+        return sgn ? (signed char)u : (long long)(unsigned char)u;
+    if (strcmp(len, "h") == 0)
+        return sgn ? (short)u : (long long)(unsigned short)u;
+    if (len[0] == 0)
+        return sgn ? (int)u : (long long)(unsigned int)u;
+    if (strcmp(len, "l") == 0)
+        return sgn ? (long)u : (long long)(unsigned long)u;
+    return u;
+}
+
+static size_t format(const struct hlog_ent *e, char *buf, size_t sz)
+{
+    const char *f = e->fmt;
+    char spec[24], len[4];
+    size_t n = 0;
+    int a = 0, r, l;
+
+    while (*f && n < sz - 1) {
+        const char *s = f;
+        char conv;
+
+        if (*f != '%') {
+            buf[n++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            buf[n++] = '%';
+            f += 2;
+            continue;
+        }
+        for (f++; *f && strchr("-+ #0", *f); f++) ;
+        for (; *f && (isdigit((unsigned char)*f) || *f == '.'); f++) ;
+        for (l = 0; *f && strchr("hlLqjzt", *f); f++, l++) {
+            if (l < (int)sizeof(len) - 1)
+                len[l] = *f;
+        }
+        len[l < (int)sizeof(len) - 1 ? l : (int)sizeof(len) - 1] = 0;
+        conv = *f ? *f++ : 0;
+
+        /* Unknown, unsupported (e.g. '*') or missing argument: as is */
+        if (!conv || !strchr("diuxXocfFeEgGaAsp", conv) || a >= e->nargs ||
+            (size_t)(f - s) + 3 > sizeof(spec) || memchr(s, '*', f - s)) {
+            r = snprintf(&buf[n], sz - n, "%.*s", (int)(f - s), s);
+            n += r > 0 ? r : 0;
+            continue;
+        }
+        /* Spec up to length modifier, then own modifier and conversion */
+        memcpy(spec, s, f - s - 1 - l);
+        spec[f - s - 1 - l] = 0;
+        switch (conv) {
+            case 'd':
+            case 'i':
+                strcat(spec, (char[]){'l', 'l', conv, 0});
+                r = snprintf(&buf[n], sz - n, spec, arg_int(e, a, len, 1));
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                strcat(spec, (char[]){'l', 'l', conv, 0});
+                r = snprintf(&buf[n], sz - n, spec,
+                             (unsigned long long)arg_int(e, a, len, 0));
+                break;
+            case 'c':
+                strcat(spec, "c");
+                r = snprintf(&buf[n], sz - n, spec, (int)e->a[a].u);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                strcat(spec, (char[]){conv, 0});
+                r = snprintf(&buf[n], sz - n, spec, e->type[a] == 'f' ?
+                             e->a[a].f : (double)(long long)e->a[a].u);
+                break;
+            case 's':
+                strcat(spec, "s");
+                r = snprintf(&buf[n], sz - n, spec, e->type[a] == 's' ?
+                             &e->str[e->a[a].s] : "(?)");
+                break;
+            case 'p':
+                strcat(spec, "p");
+                r = snprintf(&buf[n], sz - n, spec, e->a[a].p);
+                break;
+            default:
+                r = 0;
+                break;
+        }
+        a++;
+        n += r > 0 ? r : 0;
+    }
+    if (n > sz - 1)
+        n = sz - 1;
+    buf[n] = 0;
+    return n;
+}
+
+/***************************************************************************
+ * Ring
+ ***************************************************************************/
+static void start(void);
+
+struct hlog_ent *hlog_reserve(log_level level, const char *fmt)
+{
+    uint64_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    struct hlog_ent *e;
+
+    if (!__atomic_load_n(&running, __ATOMIC_RELAXED))
+        start();
+    while (1) {
+        int64_t diff;
+
+        e = &ring[pos & (HLOG_RING - 1)];
+        diff = (int64_t)(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+    e->pos = pos;
+    e->fmt = fmt;
+    e->level = level;
+    e->nargs = 0;
+    e->slen = 0;
+    return e;
+}
+
+static void output(log_level level, const char *msg)
+{
+    switch (level) {
+        case LOG_LEVEL_VERBOSE:
+            LOGV("%s", msg);
+            break;
+        default:
+            LOGD("%s", msg);
+            break;
+    }
+}
+
+/* Output all messages ready. Returns how many. */
+static int drain(void)
+{
+    char buf[512];
+    unsigned long nd;
+    int n = 0;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        struct hlog_ent *e = &ring[tail & (HLOG_RING - 1)];
+
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        format(e, buf, sizeof(buf));
+        output(e->level, buf);
+        __atomic_store_n(&e->seq, tail + HLOG_RING, __ATOMIC_RELEASE);
+        tail++;
+        n++;
+    }
+    if ((nd = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED)))
+        LOGW("%lu deferred log messages dropped\n", nd);
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+static void *hlog_thread(void *arg)
+{
+    struct timespec idle = {.tv_sec = 0,.tv_nsec = 1000000 };
+
+    while (1) {
+        if (drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+static void start(void)
+{
+    pthread_t thread;
+
+    if (__atomic_exchange_n(&running, 1, __ATOMIC_ACQ_REL))
+        return;
+    if (pthread_create(&thread, NULL, hlog_thread, NULL) != 0) {
+        /* Messages stay in the ring until drained at exit */
+        LOGW("Deferred logging: can't start thread\n");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+/* Threads don't survive fork (e.g. daemonizing), the child starts its own
+ * on the next message */
+static void atfork_child(void)
+{
+    pthread_mutex_init(&lock, NULL);
+    running = 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __hlog_init(void)
+{
+    int i;
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    for (i = 0; i < HLOG_RING; i++)
+        ring[i].seq = i;
+    pthread_atfork(NULL, NULL, atfork_child);
+}
+
+void __fini __hlog_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+    drain();
+}
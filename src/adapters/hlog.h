@@ -0,0 +1,226 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef hlog_h
+#define hlog_h
+/***************************************************************************
+ * Hot-path logging
+ *
+ * Included after <liblog/log.h> by code run on every transfer, replaces
+ * the LOGx macros there:
+ *
+ * - Levels below LOG_LEVEL_MIN (build option) are compiled out. Their
+ *   arguments are still type-checked, but never evaluated.
+ * - With ENABLE_LOG_DEFERRED, LOGV and LOGD only store the format pointer
+ *   and the raw arguments in a ring. A background thread formats and
+ *   outputs them. Formats must be string literals. Strings (%s) are copied,
+ *   at most HLOG_STRBUF bytes per message. Messages are dropped and counted
+ *   when the ring is full, and may come out after immediate ones (LOGI and
+ *   above) made later.
+ ***************************************************************************/
+#include "config.h"
+#include <stdint.h>
+#include <liblog/log.h>
+
+/* Levels as numbers for the preprocessor, i.e. values of LOG_LEVEL_MIN */
+#define HLOG_VERBOSE    0
+#define HLOG_DEBUG      1
+#define HLOG_INFO       2
+#define HLOG_WARNING    3
+#define HLOG_ERROR      4
+
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN HLOG_VERBOSE
+#endif
+
+static inline void __attribute__ ((format(printf, 1, 2)))
+    hlog_nop(const char *fmt, ...)
+{
+}
+
+/* Compiled out */
+#define HLOG_OUT(...) do { if (0) hlog_nop(__VA_ARGS__); } while (0)
+
+#if LOG_LEVEL_MIN > HLOG_VERBOSE
+#undef LOGV
+#define LOGV(...) HLOG_OUT(__VA_ARGS__)
+#endif
+#if LOG_LEVEL_MIN > HLOG_DEBUG
+#undef LOGD
+#define LOGD(...) HLOG_OUT(__VA_ARGS__)
+#endif
+#if LOG_LEVEL_MIN > HLOG_INFO
+#undef LOGI
+#define LOGI(...) HLOG_OUT(__VA_ARGS__)
+#endif
+#if LOG_LEVEL_MIN > HLOG_WARNING
+#undef LOGW
+#define LOGW(...) HLOG_OUT(__VA_ARGS__)
+#endif
+
+#ifdef ENABLE_LOG_DEFERRED
+#define HLOG_RING       1024    /* Messages, power of 2 */
+#define HLOG_MAXARGS    8
+#define HLOG_STRBUF     64
+
+union hlog_arg {
+    unsigned long long u;       /* Integers, sign-extended if signed */
+    double f;
+    const void *p;
+    uint8_t s;                  /* Offset of string in str */
+};
+
+struct hlog_ent {
+    uint64_t seq;               /* Ring protocol, see hlog.c */
+    uint64_t pos;
+    const char *fmt;
+    log_level level;
+    uint8_t nargs;
+    uint8_t slen;
+    char type[HLOG_MAXARGS];    /* 'i', 'u', 'f', 's' or 'p' */
+    union hlog_arg a[HLOG_MAXARGS];
+    char str[HLOG_STRBUF];
+};
+
+extern log_level log_filter_level;
+
+/* Slot for a message, NULL if the ring is full */
+struct hlog_ent *hlog_reserve(log_level level, const char *fmt);
+
+static inline void hlog_commit(struct hlog_ent *e)
+{
+    __atomic_store_n(&e->seq, e->pos + 1, __ATOMIC_RELEASE);
+}
+
+static inline void hlog_put_i(struct hlog_ent *e, long long x)
+{
+    if (e->nargs < HLOG_MAXARGS) {
+        e->type[e->nargs] = 'i';
+        e->a[e->nargs++].u = x;
+    }
+}
+
+static inline void hlog_put_u(struct hlog_ent *e, unsigned long long x)
+{
+    if (e->nargs < HLOG_MAXARGS) {
+        e->type[e->nargs] = 'u';
+        e->a[e->nargs++].u = x;
+    }
+}
+
+static inline void hlog_put_f(struct hlog_ent *e, double x)
+{
+    if (e->nargs < HLOG_MAXARGS) {
+        e->type[e->nargs] = 'f';
+        e->a[e->nargs++].f = x;
+    }
+}
+
+static inline void hlog_put_p(struct hlog_ent *e, const void *x)
+{
+    if (e->nargs < HLOG_MAXARGS) {
+        e->type[e->nargs] = 'p';
+        e->a[e->nargs++].p = x;
+    }
+}
+
+/* Copies, truncating when out of room. str[HLOG_STRBUF - 1] stays 0. */
+static inline void hlog_put_s(struct hlog_ent *e, const char *x)
+{
+    int n = 0, room = HLOG_STRBUF - 1 - e->slen;
+
+    if (e->nargs >= HLOG_MAXARGS)
+        return;
+    if (!x)
+        x = "(null)";
+    e->type[e->nargs] = 's';
+    e->a[e->nargs++].s = room > 0 ? e->slen : HLOG_STRBUF - 1;
+    if (room <= 0)
+        return;
+    while (x[n] && n < room - 1) {
+        e->str[e->slen + n] = x[n];
+        n++;
+    }
+    e->str[e->slen + n] = 0;
+    e->slen += n + 1;
+}
+
+#define HLOG_PUT(e, x) _Generic((x), \
+    char: hlog_put_i, signed char: hlog_put_i, short: hlog_put_i, \
+    int: hlog_put_i, long: hlog_put_i, long long: hlog_put_i, \
+    _Bool: hlog_put_u, unsigned char: hlog_put_u, \
+    unsigned short: hlog_put_u, unsigned int: hlog_put_u, \
+    unsigned long: hlog_put_u, unsigned long long: hlog_put_u, \
+    float: hlog_put_f, double: hlog_put_f, long double: hlog_put_f, \
+    char *: hlog_put_s, const char *: hlog_put_s, \
+    default: hlog_put_p)(e, x)
+
+/* HLOG_PUTn(e, fmt, args...) puts the n - 1 args. Those beyond
+ * HLOG_MAXARGS are output as unformatted conversions. */
+#define HLOG_PUT1(e, f)
+#define HLOG_PUT2(e, f, x) HLOG_PUT(e, x)
+#define HLOG_PUT3(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT2(e, f, __VA_ARGS__)
+#define HLOG_PUT4(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT3(e, f, __VA_ARGS__)
+#define HLOG_PUT5(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT4(e, f, __VA_ARGS__)
+#define HLOG_PUT6(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT5(e, f, __VA_ARGS__)
+#define HLOG_PUT7(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT6(e, f, __VA_ARGS__)
+#define HLOG_PUT8(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT7(e, f, __VA_ARGS__)
+#define HLOG_PUT9(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT8(e, f, __VA_ARGS__)
+#define HLOG_PUT10(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT9(e, f, __VA_ARGS__)
+#define HLOG_PUT11(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT10(e, f, __VA_ARGS__)
+#define HLOG_PUT12(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT11(e, f, __VA_ARGS__)
+#define HLOG_PUT13(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT12(e, f, __VA_ARGS__)
+#define HLOG_PUT14(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT13(e, f, __VA_ARGS__)
+#define HLOG_PUT15(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT14(e, f, __VA_ARGS__)
+#define HLOG_PUT16(e, f, x, ...) HLOG_PUT(e, x); HLOG_PUT15(e, f, __VA_ARGS__)
+
+#define HLOG_NARG(...) HLOG_NARG_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, \
+                                  9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define HLOG_NARG_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, \
+                   _14, _15, _16, N, ...) N
+#define HLOG_FIRST(...) HLOG_FIRST_(__VA_ARGS__, 0)
+#define HLOG_FIRST_(f, ...) f
+#define HLOG_CAT(a, b) HLOG_CAT_(a, b)
+#define HLOG_CAT_(a, b) a##b
+
+#define HLOG_DEFER(L, ...) do { \
+    struct hlog_ent *_he; \
+    if (0) \
+        hlog_nop(__VA_ARGS__); \
+    if ((L) >= log_filter_level && \
+        (_he = hlog_reserve((L), HLOG_FIRST(__VA_ARGS__)))) { \
+        HLOG_CAT(HLOG_PUT, HLOG_NARG(__VA_ARGS__))(_he, __VA_ARGS__); \
+        hlog_commit(_he); \
+    } \
+} while (0)
+
+/* hlog.c outputs with the original ones */
+#ifndef HLOG_INTERNAL
+#if LOG_LEVEL_MIN <= HLOG_VERBOSE
+#undef LOGV
+#define LOGV(...) HLOG_DEFER(LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#endif
+#if LOG_LEVEL_MIN <= HLOG_DEBUG
+#undef LOGD
+#define LOGD(...) HLOG_DEFER(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+#endif                          //HLOG_INTERNAL
+#endif                          //ENABLE_LOG_DEFERRED
+
+#endif                          //hlog_h
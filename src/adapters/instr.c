@@ -0,0 +1,495 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Instrumentation of adapters. See instr.h
+ */
+#include "config.h"
+#include "adapters_config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "adapters.h"
+#include <driver.h>
+#include "dop.h"
+#include "instr.h"
+#include "instr_local.h"
+#include "usdt.h"
+
+struct instr_drv instr_drvs[DEF_MAX_ADAPTERS];
+int instr_ndrvs = 0;
+
+static struct timespec t0;
+static __thread struct instr_drv *last_drv = NULL;
+
+uint64_t instr_now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)(t.tv_sec - t0.tv_sec) * 1000000000ULL +
+        t.tv_nsec - t0.tv_nsec;
+}
+
+static const char *devid_name(devid_t devid)
+{
+    switch (devid) {
+        case PARAPORT:
+            return "pp";
+        case BUSPIRATE:
+            return "bp";
+        case HIF:
+            return "hif";
+        case LXI:
+            return "lxi";
+        case SHM:
+            return "shm";
+        case REMOTE:
+            return "remote";
+        case SIM:
+            return "sim";
+        case REPLAY:
+            return "replay";
+        default:
+            return "unknown";
+    }
+}
+
+void instr_adapter_name(char *buf, size_t sz, int n)
+{
+    const struct instr_drv *d = &instr_drvs[n];
+
+    snprintf(buf, sz, "%s%d_%s", d->role == ROLE_SPI ? "spi" : "i2c",
+             d->index, devid_name(d->devid));
+}
+
+const char *instr_op_name(int op)
+{
+    switch (op) {
+        case INSTR_SYS_READ:
+            return "read";
+        case INSTR_SYS_WRITE:
+            return "write";
+        case INSTR_SYS_IOCTL:
+            return "ioctl";
+        default:
+            return dop_name(op);
+    }
+}
+
+#ifdef ENABLE_TRACE
+static void cpy(uint8_t *to, const void *from, int sz)
+{
+    if (from && sz > 0)
+        memcpy(to, from, sz < TRACE_DATA ? sz : TRACE_DATA);
+}
+#endif
+
+/***************************************************************************
+ * Interposed driverAPI methods
+ ***************************************************************************/
+static struct instr_drv *drv_of(struct ddata *ddata)
+{
+    int i;
+
+    if (last_drv && last_drv->ddata == ddata)
+        return last_drv;
+    for (i = 0; i < instr_ndrvs; i++) {
+        if (instr_drvs[i].ddata == ddata)
+            return (last_drv = &instr_drvs[i]);
+    }
+    ASSERT("Traced method called with unknown ddata" == NULL);
+    return NULL;
+}
+
+/* What the calling thread is doing. Syscalls are accounted to it. */
+struct cur {
+    uint8_t adapter;
+    struct stats_op *op;
+};
+static __thread struct cur cur = { INSTR_NOADAPTER, NULL };
+
+struct call {
+    uint64_t ts;
+    uint8_t adapter;
+    uint16_t op;
+    uint16_t arg;
+    const uint8_t *obuf;
+    int osz;
+    int isz;
+    struct cur outer;           /* What caller was doing */
+#ifdef ENABLE_TRACE
+    struct trace_event ev;
+#endif
+};
+
+static void begin(struct call *c, struct instr_drv *d, dop_t op, int arg,
+                  const uint8_t *obuf, int osz, int isz)
+{
+    int adapter = d - instr_drvs;
+
+    c->adapter = adapter;
+    c->op = op;
+    c->arg = arg;
+    c->obuf = obuf;
+    c->osz = osz;
+    c->isz = isz;
+    c->outer = cur;
+    cur.adapter = adapter;
+    cur.op = stats_op(adapter, op);
+#ifdef ENABLE_TRACE
+    if (trace_on) {
+        memset(&c->ev, 0, sizeof(c->ev));
+        c->ev.op = op;
+        c->ev.arg = arg;
+        c->ev.osz = osz;
+        c->ev.isz = isz;
+        c->ev.adapter = adapter;
+        cpy(c->ev.out, obuf, osz);
+    }
+#endif
+    USDT4(adapter_entry, adapter, op, osz, isz);
+    c->ts = instr_now();
+}
+
+static void end(struct call *c, int result, const uint8_t *ibuf)
+{
+    uint64_t dur = instr_now() - c->ts;
+
+    USDT6(adapter_return, c->adapter, c->op, c->osz, c->isz, result, dur);
+    stats_call(cur.op, c->osz, c->isz, dur);
+    cur = c->outer;
+    if (rec_on)
+        rec_put(c->adapter, c->op, c->arg, result, c->ts, dur, c->obuf,
+                c->osz, ibuf, c->isz);
+#ifdef ENABLE_TRACE
+    if (trace_on) {
+        c->ev.ts = c->ts;
+        c->ev.dur = dur;
+        c->ev.result = result;
+        cpy(c->ev.in, ibuf, c->isz);
+        trace_put(&c->ev);
+    }
+#endif
+}
+
+void instr_sys(instr_sys_t op, int fd, uint64_t ts, const void *obuf,
+               int osz, const void *ibuf, int isz, long result)
+{
+    stats_sys(cur.op, op);
+#ifdef ENABLE_TRACE
+    if (trace_on) {
+        struct trace_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.ts = ts;
+        ev.dur = instr_now() - ts;
+        ev.op = op;
+        ev.arg = fd;
+        ev.osz = osz;
+        ev.isz = isz;
+        ev.result = result;
+        ev.adapter = cur.adapter;
+        cpy(ev.out, obuf, osz);
+        cpy(ev.in, ibuf, isz);
+        trace_put(&ev);
+    }
+#endif
+}
+
+/* SPI */
+static void ispi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_SPI_SENDDATA, 0, data, sz, 0);
+    d->orig.spi.sendData(ddata, data, sz);
+    end(&c, 0, NULL);
+}
+
+static void ispi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_SPI_RECEIVEDATA, 0, NULL, 0, sz);
+    d->orig.spi.receiveData(ddata, data, sz);
+    end(&c, 0, data);
+}
+
+static void ispi_sendrecieveData(struct ddata *ddata, const uint8_t *obuf,
+                                 int osz, uint8_t *ibuf, int isz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_SPI_SENDRECIEVEDATA, 0, obuf, osz, isz);
+    d->orig.spi.sendrecieveData(ddata, obuf, osz, ibuf, isz);
+    end(&c, 0, ibuf);
+}
+
+static void ispi_sendrecieveData_ncs(struct ddata *ddata,
+                                     const uint8_t *obuf, int osz,
+                                     uint8_t *ibuf, int isz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_SPI_SENDRECIEVEDATA_NCS, 0, obuf, osz, isz);
+    d->orig.spi.sendrecieveData_ncs(ddata, obuf, osz, ibuf, isz);
+    end(&c, 0, ibuf);
+}
+
+static void ispi_setCS(struct ddata *ddata, int state)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_SPI_SETCS, state, NULL, 0, 0);
+    d->orig.spi.setCS(ddata, state);
+    end(&c, 0, NULL);
+}
+
+static uint16_t ispi_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+    uint16_t rc;
+
+    begin(&c, d, DOP_GETSTATUS, flags, NULL, 0, 0);
+    rc = d->orig.spi.getStatus(ddata, flags);
+    end(&c, rc, NULL);
+    return rc;
+}
+
+/* I2C */
+static void ii2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_RECEIVEBYTE, 0, NULL, 0, 1);
+    d->orig.i2c.receiveByte(ddata, data);
+    end(&c, 0, data);
+}
+
+static int ii2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+    int rc;
+
+    begin(&c, d, DOP_I2C_SENDBYTE, data, &data, 1, 0);
+    rc = d->orig.i2c.sendByte(ddata, data);
+    end(&c, rc, NULL);
+    return rc;
+}
+
+static void ii2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_SENDDATA, 0, data, sz, 0);
+    d->orig.i2c.sendData(ddata, data, sz);
+    end(&c, 0, NULL);
+}
+
+static void ii2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_RECEIVEDATA, 0, NULL, 0, sz);
+    d->orig.i2c.receiveData(ddata, data, sz);
+    end(&c, 0, data);
+}
+
+static void ii2c_sendrecieveData(struct ddata *ddata, const uint8_t *obuf,
+                                 int osz, uint8_t *ibuf, int isz)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_SENDRECIEVEDATA, 0, obuf, osz, isz);
+    d->orig.i2c.sendrecieveData(ddata, obuf, osz, ibuf, isz);
+    end(&c, 0, ibuf);
+}
+
+static void ii2c_start(struct ddata *ddata)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_START, 0, NULL, 0, 0);
+    d->orig.i2c.start(ddata);
+    end(&c, 0, NULL);
+}
+
+static void ii2c_stop(struct ddata *ddata)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_STOP, 0, NULL, 0, 0);
+    d->orig.i2c.stop(ddata);
+    end(&c, 0, NULL);
+}
+
+static void ii2c_autoAck(struct ddata *ddata, int state)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+
+    begin(&c, d, DOP_I2C_AUTOACK, state, NULL, 0, 0);
+    d->orig.i2c.autoAck(ddata, state);
+    end(&c, 0, NULL);
+}
+
+static int ii2c_probe(struct ddata *ddata, uint8_t addr)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+    int rc;
+
+    begin(&c, d, DOP_I2C_PROBE, addr, NULL, 0, 0);
+    rc = d->orig.i2c.probe(ddata, addr);
+    end(&c, rc, NULL);
+    return rc;
+}
+
+static int ii2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                     uint8_t *present)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+    int rc;
+
+    begin(&c, d, DOP_I2C_SCAN, first | last << 8, NULL, 0, I2C_SCAN_BYTES);
+    rc = d->orig.i2c.scan(ddata, first, last, present);
+    end(&c, rc, present);
+    return rc;
+}
+
+static uint16_t ii2c_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    struct instr_drv *d = drv_of(ddata);
+    struct call c;
+    uint16_t rc;
+
+    begin(&c, d, DOP_GETSTATUS, flags, NULL, 0, 0);
+    rc = d->orig.i2c.getStatus(ddata, flags);
+    end(&c, rc, NULL);
+    return rc;
+}
+
+/* Replace non-NULL method M of driver T with the wrapper W */
+#define INTERPOSE(T, M, W) \
+    if ((T).M) (T).M = W
+
+int instr_wrap_adapter(struct adapter *adapter)
+{
+    struct instr_drv *d;
+
+    if (adapter->role != ROLE_SPI && adapter->role != ROLE_I2C) {
+        LOGW("Role [%d] not instrumented\n", adapter->role);
+        return 0;
+    }
+    if (instr_ndrvs >= DEF_MAX_ADAPTERS || instr_ndrvs >= INSTR_NOADAPTER) {
+        LOGE("Too many adapters to instrument\n");
+        return -1;
+    }
+    d = &instr_drvs[instr_ndrvs];
+    d->role = adapter->role;
+    d->index = adapter->index;
+    d->devid = adapter->devid;
+    d->ddata = adapter->driver.any->ddata;
+    d->real = adapter->driver.any;
+
+    if (adapter->role == ROLE_SPI) {
+        memcpy(&d->orig.spi, adapter->driver.spi, sizeof(d->orig.spi));
+        d->instr.spi = d->orig.spi;
+        INTERPOSE(d->instr.spi, sendData, ispi_sendData);
+        INTERPOSE(d->instr.spi, receiveData, ispi_receiveData);
+        INTERPOSE(d->instr.spi, sendrecieveData, ispi_sendrecieveData);
+        INTERPOSE(d->instr.spi, sendrecieveData_ncs,
+                  ispi_sendrecieveData_ncs);
+        INTERPOSE(d->instr.spi, setCS, ispi_setCS);
+        INTERPOSE(d->instr.spi, getStatus, ispi_getStatus);
+        adapter->driver.spi = &d->instr.spi;
+    } else {
+        memcpy(&d->orig.i2c, adapter->driver.i2c, sizeof(d->orig.i2c));
+        d->instr.i2c = d->orig.i2c;
+        INTERPOSE(d->instr.i2c, receiveByte, ii2c_receiveByte);
+        INTERPOSE(d->instr.i2c, sendByte, ii2c_sendByte);
+        INTERPOSE(d->instr.i2c, sendData, ii2c_sendData);
+        INTERPOSE(d->instr.i2c, receiveData, ii2c_receiveData);
+        INTERPOSE(d->instr.i2c, sendrecieveData, ii2c_sendrecieveData);
+        INTERPOSE(d->instr.i2c, start, ii2c_start);
+        INTERPOSE(d->instr.i2c, stop, ii2c_stop);
+        INTERPOSE(d->instr.i2c, autoAck, ii2c_autoAck);
+        INTERPOSE(d->instr.i2c, probe, ii2c_probe);
+        INTERPOSE(d->instr.i2c, scan, ii2c_scan);
+        INTERPOSE(d->instr.i2c, getStatus, ii2c_getStatus);
+        adapter->driver.i2c = &d->instr.i2c;
+    }
+    if (rec_on)
+        rec_adapter(instr_ndrvs, d);
+    /* Publish only when complete, other threads may be looking it up */
+    __atomic_store_n(&instr_ndrvs, instr_ndrvs + 1, __ATOMIC_RELEASE);
+
+    LOGD("Instrumented adapter {%d,%d,%d} as #%d\n", adapter->devid,
+         adapter->role, adapter->index, instr_ndrvs - 1);
+    return 0;
+}
+
+void instr_unwrap_adapter(struct adapter *adapter)
+{
+    int i;
+
+    for (i = 0; i < instr_ndrvs; i++) {
+        struct instr_drv *d = &instr_drvs[i];
+
+        if (d->ddata && adapter->driver.any == &d->instr.any) {
+            adapter->driver.any = d->real;
+            /* Keep the rest, it names the adapter in statistics and trace */
+            d->ddata = NULL;
+            return;
+        }
+    }
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __instr_init(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+}
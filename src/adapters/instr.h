@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef instr_h
+#define instr_h
+/***************************************************************************
+ * Instrumentation of adapters
+ *
+ * The driverAPI methods of each adapter are interposed when the adapter is
+ * initialized, and adapter-level syscalls are made through the wrappers
+ * below. Both feed the statistics (stats.h, always) and the transaction
+ * trace (trace.h, if built with ENABLE_TRACE and started). Method calls
+ * are also recorded (record.h) if started. Both have static tracepoints
+ * (usdt.h).
+ ***************************************************************************/
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include "usdt.h"
+
+struct adapter;
+
+/* Syscall ops. Numbered above any dop_t */
+typedef enum {
+    INSTR_SYS_READ = 0x80,
+    INSTR_SYS_WRITE,
+    INSTR_SYS_IOCTL,
+    INSTR_SYS_LAST
+} instr_sys_t;
+
+/* Adapter number of whatever isn't done on behalf of an adapter */
+#define INSTR_NOADAPTER 0xFF
+
+/* Interpose the instrumented methods in adapters driver, and undo it
+ * again. Unwrap must be done before the adapter's own deinit frees its
+ * driver. */
+int instr_wrap_adapter(struct adapter *adapter);
+void instr_unwrap_adapter(struct adapter *adapter);
+
+/* Monotonic ns since start of process */
+uint64_t instr_now(void);
+
+void instr_sys(instr_sys_t op, int fd, uint64_t ts, const void *obuf,
+               int osz, const void *ibuf, int isz, long result);
+
+/* Adapter-level syscalls. Use instead of the plain ones for I/O of adapter
+ * hardware. */
+static inline ssize_t instr_read(int fd, void *buf, size_t n)
+{
+    uint64_t ts = instr_now();
+    ssize_t rc;
+
+    USDT3(syscall_entry, INSTR_SYS_READ, fd, n);
+    rc = read(fd, buf, n);
+    USDT3(syscall_return, INSTR_SYS_READ, fd, rc);
+    instr_sys(INSTR_SYS_READ, fd, ts, NULL, 0, buf, rc > 0 ? rc : 0, rc);
+    return rc;
+}
+
+static inline ssize_t instr_write(int fd, const void *buf, size_t n)
+{
+    uint64_t ts = instr_now();
+    ssize_t rc;
+
+    USDT3(syscall_entry, INSTR_SYS_WRITE, fd, n);
+    rc = write(fd, buf, n);
+    USDT3(syscall_return, INSTR_SYS_WRITE, fd, rc);
+    instr_sys(INSTR_SYS_WRITE, fd, ts, buf, n, NULL, 0, rc);
+    return rc;
+}
+
+static inline int instr_ioctl(int fd, unsigned long request, void *arg)
+{
+    uint64_t ts = instr_now();
+    int rc;
+
+    USDT3(syscall_entry, INSTR_SYS_IOCTL, fd, request);
+    rc = ioctl(fd, request, arg);
+    USDT3(syscall_return, INSTR_SYS_IOCTL, fd, rc);
+    instr_sys(INSTR_SYS_IOCTL, fd, ts, NULL, 0, NULL, 0, rc);
+    return rc;
+}
+
+#endif                          //instr_h
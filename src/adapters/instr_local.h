@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef instr_local_h
+#define instr_local_h
+/* Shared between instrumentation, statistics, transaction trace and
+ * recording */
+#include <stdint.h>
+#include <stdio.h>
+#include "adapters_config.h"
+#include "adapters.h"
+#include <driver.h>
+#include "dop.h"
+#include "instr.h"
+#include "trace.h"
+
+/* An instrumented adapter. Slots are never re-used, the number is how
+ * statistics and trace-events refer to the adapter. */
+struct instr_drv {
+    role_t role;
+    int index;
+    devid_t devid;
+    struct ddata *ddata;        /* NULL when no longer instrumented */
+    struct driverAPI_any *real; /* The adapter's own driver */
+    union {
+        struct driverAPI_spi spi;
+        struct driverAPI_i2c i2c;
+    } orig;                     /* Methods called by interposed ones */
+    union {
+        struct driverAPI_any any;
+        struct driverAPI_spi spi;
+        struct driverAPI_i2c i2c;
+    } instr;                    /* Handed to the adapter instead of real */
+};
+
+extern struct instr_drv instr_drvs[];
+extern int instr_ndrvs;
+
+/* Name of adapter n, e.g. "spi1_bp" */
+void instr_adapter_name(char *buf, size_t sz, int n);
+const char *instr_op_name(int op);
+
+/* Accounting of statistics (stats.c). s is NULL for syscalls made
+ * outside of any driverAPI call */
+struct stats_op;
+struct stats_op *stats_op(int adapter, dop_t op);
+void stats_call(struct stats_op *s, int osz, int isz, uint64_t ns);
+void stats_sys(struct stats_op *s, instr_sys_t op);
+
+/* Recording (record.c) */
+extern int rec_on;
+void rec_put(int adapter, int op, int arg, int result, uint64_t ts,
+             uint64_t dur, const void *obuf, int osz, const void *ibuf,
+             int isz);
+void rec_adapter(int adapter, const struct instr_drv *d);
+
+#ifdef ENABLE_TRACE
+struct trace_ring {
+    struct trace_ring *next;
+    uint16_t tid;
+    uint64_t head;              /* Number of events ever put. Written only by
+                                   owning thread. */
+    struct trace_event ev[TRACE_RING_EVENTS];
+};
+
+extern struct trace_ring *trace_rings;
+#endif
+
+#endif                          //instr_local_h
@@ -43,6 +43,7 @@
 #include <liblog/assure.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
+#include <instr.h>
 
 #define OUT_MSG     0
 #define IN_MSG      1
@@ -107,7 +108,7 @@ void lxii2c_stop(struct ddata *ddata)
     }
 
     /* Invoke i2c-session in kernel */
-    ASSURE(ioctl(ddata->fd, I2C_RDWR, &ddata->lxi_state.i2c.packets) >= 0);
+    ASSURE(instr_ioctl(ddata->fd, I2C_RDWR, &ddata->lxi_state.i2c.packets) >= 0);
 
     /* Epilogue: Reset state */
     if (ddata->lxi_state.i2c.outbuf) {
@@ -143,6 +144,81 @@ void lxii2c_start(struct ddata *ddata)
     ddata->lxi_state.i2c.func_0 = TO_LXI_STATE(start);
 }
 
+/* I2C_FUNCS of the adapter, read once */
+static unsigned long i2c_funcs(struct ddata *ddata)
+{
+    if (!ddata->lxi_state.i2c.have_funcs) {
+        if (instr_ioctl(ddata->fd, I2C_FUNCS,
+                        &ddata->lxi_state.i2c.funcs) < 0) {
+            LOGW("LXI: I2C_FUNCS failed: %s\n", strerror(errno));
+            ddata->lxi_state.i2c.funcs = 0;
+        }
+        ddata->lxi_state.i2c.have_funcs = 1;
+    }
+    return ddata->lxi_state.i2c.funcs;
+}
+
+/* SMBus quick write or receive byte, picked per address as i2cdetect does:
+ * quick writes can corrupt some EEPROMs (0x50-0x5F) and lock others
+ * (0x30-0x37), read those if the adapter can. Both are single ioctls,
+ * unlike start/address/stop whose ACK would only be known on stop.
+ * Addresses claimed by a kernel driver count as present. */
+static int smbus_probe(struct ddata *ddata, uint8_t addr)
+{
+    struct i2c_smbus_ioctl_data args = {.command = 0 };
+    union i2c_smbus_data data;
+    unsigned long funcs = i2c_funcs(ddata);
+    int quick = funcs & I2C_FUNC_SMBUS_QUICK;
+
+    if ((funcs & I2C_FUNC_SMBUS_READ_BYTE) &&
+        (!quick || (addr >= 0x30 && addr <= 0x37) ||
+         (addr >= 0x50 && addr <= 0x5F)))
+        quick = 0;
+    else if (!quick)
+        return -1;
+
+    if (quick) {
+        args.read_write = I2C_SMBUS_WRITE;
+        args.size = I2C_SMBUS_QUICK;
+        args.data = NULL;
+    } else {
+        args.read_write = I2C_SMBUS_READ;
+        args.size = I2C_SMBUS_BYTE;
+        args.data = &data;
+    }
+
+    if (instr_ioctl(ddata->fd, I2C_SLAVE, (void *)(uintptr_t)addr) < 0)
+        return errno == EBUSY ? 1 : -1;
+    return instr_ioctl(ddata->fd, I2C_SMBUS, &args) == 0;
+}
+
+int lxii2c_probe(struct ddata *ddata, uint8_t addr)
+{
+    ASSURE(ddata->lxi_state.i2c.func_0 == TO_LXI_STATE(state_free));
+
+    return smbus_probe(ddata, addr);
+}
+
+/* As probe, for each address. There's no batching of SMBus transfers, but
+ * each is just two ioctls and no user-space round-trip on the bus. */
+int lxii2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present)
+{
+    int a, ack, n = 0;
+
+    ASSURE(ddata->lxi_state.i2c.func_0 == TO_LXI_STATE(state_free));
+
+    for (a = first; a <= last; a++) {
+        if ((ack = smbus_probe(ddata, a)) == -1)
+            return -1;
+        if (ack) {
+            I2C_SCAN_SET(present, a);
+            n++;
+        }
+    }
+    return n;
+}
+
 /* Send one byte */
 int lxii2c_sendByte(struct ddata *ddata, uint8_t data)
 {
@@ -260,6 +336,8 @@ int lxii2c_configure(struct ddata *ddata)
     /* Indicate no pending session */
     ddata->lxi_state.i2c.func_0 = TO_LXI_STATE(state_free);
 
+    ddata->lxi_state.i2c.have_funcs = 0;
+
     return 0;
 }
 
@@ -284,53 +362,56 @@ struct ddata *lxii2c_newddata(struct adapter *adapter)
 
 /***************************************************************************
  * Configuration  api
- ***************************************************************************/
+ ***************************************************************************
+ * i2c-dev has none of these controls. Bus speed is the kernel's (device
+ * tree or module parameter).
+ */
 config_etype_t lxii2c_set_speed(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_set_power_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_set_pullups(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_set_aux_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_set_cs_active(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_get_speed(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_get_power_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_get_pullups(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_get_aux_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxii2c_get_cs_active(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
@@ -58,6 +58,7 @@ struct confi2c_pereph {
 
 struct confspi_speed {
     union {
+        uint8_t speed;          /* 0-7, 30kHz-8MHz as for Bus-pirate */
         uint8_t raw;
     };
 
@@ -72,6 +73,10 @@ struct confi2c_speed {
 
 struct confspi_bus {
     union {
+        struct {
+            uint8_t clk_pol_idle:1; /* CPOL */
+            uint8_t output_clk_edge:1;  /* 1=back, i.e. CPHA=0 */
+        } __attribute__ ((packed));
         uint8_t raw;
     };
 
@@ -102,6 +107,10 @@ struct lxi_i2c {
                                    Dummy function lxii2c_state_free is used as
                                    indication that no session is pending
                                    or initiated yet */
+
+    unsigned long funcs;        /* I2C_FUNCS of adapter, read on first
+                                   probe */
+    int have_funcs;
 };
 
 /* TBD */
@@ -112,6 +121,10 @@ struct lxi_spi {
 /* Convenience-variable pre-set with build-system configuration */
 extern struct config_SPI lxi_dflt_config_SPI;
 
+/* Parts of SPI config changed since last actuated */
+#define LXI_DIRTY_SPEED 0x01
+#define LXI_DIRTY_BUS   0x02
+
 /* Driver companion - NOTE: unique for each driver. Must NOT be public */
 struct ddata {
     int fd;
@@ -119,6 +132,7 @@ struct ddata {
         struct config_I2C i2c;
         struct config_SPI spi;
     } config;
+    unsigned dirty;             /* LXI_DIRTY_ bits */
     /* Owned by driver */
     union {
         struct driverAPI_any *any;
@@ -158,6 +172,9 @@ void lxispi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
 void lxii2c_start(struct ddata *ddata);
 void lxii2c_stop(struct ddata *ddata);
 void lxii2c_autoAck(struct ddata *ddata, int state);
+int lxii2c_probe(struct ddata *ddata, uint8_t addr);
+int lxii2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present);
 void lxii2c_receiveByte(struct ddata *ddata, uint8_t *data);
 int lxii2c_sendByte(struct ddata *ddata, uint8_t data);
 void lxii2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
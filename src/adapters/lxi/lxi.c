@@ -60,46 +60,60 @@ struct ddata;
 /* Convenience variables: */
 #ifdef LXI_ENABLE_SPI
 /*    SPI driver */
+static const struct driver_caps lxispi_caps = {
+    .max_xfer = 4096,           /* spidev bufsiz default */
+    .latency_us = 50,
+    .flags = DCAP_FULL_DUPLEX | DCAP_WRITE_READ,
+};
+
 static struct driverAPI_spi lxispi_driver = {
     .ddata = NULL,
+    .caps = &lxispi_caps,
     .sendData = NULL,           //lxispi_sendData,
     .sendrecieveData = lxispi_sendrecieveData,
     .sendrecieveData_ncs = NULL,    // lxispi_sendrecieveData_ncs,
     .setCS = NULL,              // lxispi_setCS,
     .receiveData = NULL,        // lxispi_receiveData,
     .getStatus = NULL,          // lxispi_getStatus,
-    .actuate_config = NULL,     // lxispi_configure,
-    .newddata = NULL,           // lxispi_newddata,
+    .actuate_config = lxispi_configure,
+    .newddata = lxispi_newddata,
     .config = {
                .set = {
-                       .speed = NULL,   // lxispi_set_speed,
-                       .power_on = NULL,    // lxispi_set_power_on,
-                       .pullups = NULL, // lxispi_set_pullups,
-                       .aux_on = NULL,  // lxispi_set_aux_on,
-                       .cs_active = NULL,   // lxispi_set_cs_active,
-                       .output_type = NULL, // lxispi_set_output_type,
-                       .clk_pol_idle = NULL,    // lxispi_set_clk_pol_idle,
-                       .output_clk_edge = NULL, // lxispi_set_output_clk_edge,
-                       .input_sample_end = NULL,    // lxispi_set_input_sample_end,
+                       .speed = lxispi_set_speed,
+                       .power_on = lxispi_set_power_on,
+                       .pullups = lxispi_set_pullups,
+                       .aux_on = lxispi_set_aux_on,
+                       .cs_active = lxispi_set_cs_active,
+                       .output_type = lxispi_set_output_type,
+                       .clk_pol_idle = lxispi_set_clk_pol_idle,
+                       .output_clk_edge = lxispi_set_output_clk_edge,
+                       .input_sample_end = lxispi_set_input_sample_end,
                        },
                .get = {
-                       .speed = NULL,   // lxispi_get_speed,
-                       .power_on = NULL,    // lxispi_get_power_on,
-                       .pullups = NULL, // lxispi_get_pullups,
-                       .aux_on = NULL,  // lxispi_get_aux_on,
-                       .cs_active = NULL,   //lxispi_get_cs_active,
-                       .output_type = NULL, // lxispi_get_output_type,
-                       .clk_pol_idle = NULL,    // lxispi_get_clk_pol_idle,
-                       .output_clk_edge = NULL, // lxispi_get_output_clk_edge,
-                       .input_sample_end = NULL,    // lxispi_get_input_sample_end,
+                       .speed = lxispi_get_speed,
+                       .power_on = lxispi_get_power_on,
+                       .pullups = lxispi_get_pullups,
+                       .aux_on = lxispi_get_aux_on,
+                       .cs_active = lxispi_get_cs_active,
+                       .output_type = lxispi_get_output_type,
+                       .clk_pol_idle = lxispi_get_clk_pol_idle,
+                       .output_clk_edge = lxispi_get_output_clk_edge,
+                       .input_sample_end = lxispi_get_input_sample_end,
                        },
                },
 };
 #endif
 #ifdef LXI_ENABLE_I2C
 /*    I2C driver */
+static const struct driver_caps lxii2c_caps = {
+    .max_xfer = 8192,           /* i2c-dev, per message */
+    .latency_us = 100,
+    .flags = DCAP_MULTI_MSG,    /* Executed as one I2C_RDWR on stop */
+};
+
 static struct driverAPI_i2c lxii2c_driver = {
     .ddata = NULL,
+    .caps = &lxii2c_caps,
     .sendByte = lxii2c_sendByte,
     .receiveByte = NULL,        // lxii2c_receiveByte,
     .sendData = lxii2c_sendData,
@@ -108,23 +122,25 @@ static struct driverAPI_i2c lxii2c_driver = {
     .start = lxii2c_start,
     .stop = lxii2c_stop,
     .autoAck = lxii2c_autoAck,
+    .probe = lxii2c_probe,
+    .scan = lxii2c_scan,
     .getStatus = NULL,          // lxii2c_getStatus,
     .actuate_config = NULL,     // lxii2c_configure,
     .newddata = lxii2c_newddata,
     .config = {
                .set = {
-                       .speed = NULL,   // lxii2c_set_speed,
-                       .power_on = NULL,    // lxii2c_set_power_on,
-                       .pullups = NULL, // lxii2c_set_pullups,
-                       .aux_on = NULL,  // lxii2c_set_aux_on,
-                       .cs_active = NULL,   // lxii2c_set_cs_active,
+                       .speed = lxii2c_set_speed,
+                       .power_on = lxii2c_set_power_on,
+                       .pullups = lxii2c_set_pullups,
+                       .aux_on = lxii2c_set_aux_on,
+                       .cs_active = lxii2c_set_cs_active,
                        },
                .get = {
-                       .speed = NULL,   // lxii2c_get_speed,
-                       .power_on = NULL,    // lxii2c_get_power_on,
-                       .pullups = NULL, // lxii2c_get_pullups,
-                       .aux_on = NULL,  // lxii2c_get_aux_on,
-                       .cs_active = NULL,   // lxii2c_get_cs_active,
+                       .speed = lxii2c_get_speed,
+                       .power_on = lxii2c_get_power_on,
+                       .pullups = lxii2c_get_pullups,
+                       .aux_on = lxii2c_get_aux_on,
+                       .cs_active = lxii2c_get_cs_active,
                        },
                },
 };
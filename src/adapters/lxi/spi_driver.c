@@ -33,19 +33,30 @@
 #include <stdlib.h>
 #include <liblog/assure.h>
 #include <arpa/inet.h>
+#include <linux/spi/spidev.h>
+#include <instr.h>
+#include <hlog.h>
 
 struct config_SPI lxi_dflt_config_SPI = {
     .speed = {
-              .raw = 0xD0,
+              .speed = 3,
               },
     .pereph = {
                .raw = 0xD1,
                },
     .bus = {
-            .raw = 0xD2,
+            .clk_pol_idle = 0,
+            .output_clk_edge = 1,
             },
 };
 
+/* Clock of each speed setting, same steps as Bus-pirate's */
+static const uint32_t speed_hz[] = {
+    30000, 125000, 250000, 1000000, 2000000, 2600000, 4000000, 8000000
+};
+
+#define NSPEEDS (sizeof(speed_hz) / sizeof(speed_hz[0]))
+
 /***************************************************************************
  * Main driver api
  ***************************************************************************/
@@ -96,10 +107,61 @@ uint16_t lxispi_getStatus(struct ddata *ddata, uint16_t flags)
     return flags;
 }
 
+/* Read back what spidev has, it may have been set by others */
+static void refresh(struct ddata *ddata)
+{
+    uint8_t mode;
+    uint32_t hz;
+    int i;
+
+    if (instr_ioctl(ddata->fd, SPI_IOC_RD_MODE, &mode) == 0) {
+        ddata->config.spi.bus.clk_pol_idle = !!(mode & SPI_CPOL);
+        ddata->config.spi.bus.output_clk_edge = !(mode & SPI_CPHA);
+    }
+    if (instr_ioctl(ddata->fd, SPI_IOC_RD_MAX_SPEED_HZ, &hz) == 0) {
+        for (i = NSPEEDS - 1; i > 0 && speed_hz[i] > hz; i--) ;
+        ddata->config.spi.speed.speed = i;
+    }
+}
+
+/* Actuate what has changed, one ioctl per part. ddata may be a copy (see
+ * newddata), its changes are then taken over by the adapter's own first. */
 int lxispi_configure(struct ddata *ddata)
 {
-    LOGW("LXI not supported function invoked");
+    struct ddata *live = ddata->driver.any ? ddata->driver.any->ddata : ddata;
+    uint8_t mode;
+    uint32_t hz;
+
+    if (live != ddata) {
+        if (ddata->dirty & LXI_DIRTY_SPEED)
+            live->config.spi.speed = ddata->config.spi.speed;
+        if (ddata->dirty & LXI_DIRTY_BUS)
+            live->config.spi.bus = ddata->config.spi.bus;
+        live->dirty |= ddata->dirty;
+        ddata->dirty = 0;
+    }
+    if (live->dirty & LXI_DIRTY_BUS) {
+        ASSURE_E(instr_ioctl(live->fd, SPI_IOC_RD_MODE, &mode) == 0,
+                 goto configure_err);
+        mode &= ~(SPI_CPOL | SPI_CPHA);
+        if (live->config.spi.bus.clk_pol_idle)
+            mode |= SPI_CPOL;
+        if (!live->config.spi.bus.output_clk_edge)
+            mode |= SPI_CPHA;
+        ASSURE_E(instr_ioctl(live->fd, SPI_IOC_WR_MODE, &mode) == 0,
+                 goto configure_err);
+    }
+    if (live->dirty & LXI_DIRTY_SPEED) {
+        hz = speed_hz[live->config.spi.speed.speed];
+        ASSURE_E(instr_ioctl(live->fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) == 0,
+                 goto configure_err);
+    }
+    live->dirty = 0;
+    refresh(live);
     return 0;
+configure_err:
+    LOGE("LXI: Can't configure spidev: %s\n", strerror(errno));
+    return -1;
 }
 
 /* Create a new adapter/driver-data object for external manipulation without
@@ -116,98 +178,125 @@ struct ddata *lxispi_newddata(struct adapter *adapter)
 
     memcpy(&(ddata->config.spi), &lxi_dflt_config_SPI,
            sizeof(struct config_SPI));
+    ddata->dirty = 0;
+    ddata->driver.any = NULL;
     return ddata;
 }
 
 /***************************************************************************
  * Configuration  api
- ***************************************************************************/
+ ***************************************************************************
+ * Changes ddata's configuration, actuated by actuate_config. A ddata is
+ * needed, there's nothing to affect directly. spidev has no control of
+ * power, pull-ups, AUX, CS level, pin type or sample phase.
+ */
+#define SET(PART, FIELD, MAX, DIRTY) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        if (setval < 0 || setval > (MAX)) \
+            return E_BAD_VALUE; \
+        if (dd->config.spi.PART.FIELD != setval) { \
+            dd->config.spi.PART.FIELD = setval; \
+            dd->dirty |= (DIRTY); \
+        } \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
+#define GET(PART, FIELD) \
+    do { \
+        if (dd == NULL) \
+            return E_WRONG_ORDER; \
+        *retval = dd->config.spi.PART.FIELD; \
+        return CONFIG_DRIVER_OK; \
+    } while (0)
+
 config_etype_t lxispi_set_speed(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(speed, speed, NSPEEDS - 1, LXI_DIRTY_SPEED);
 }
 
 config_etype_t lxispi_set_power_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_set_pullups(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_set_aux_on(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_set_cs_active(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_set_output_type(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_set_clk_pol_idle(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, clk_pol_idle, 1, LXI_DIRTY_BUS);
 }
 
 config_etype_t lxispi_set_output_clk_edge(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    SET(bus, output_clk_edge, 1, LXI_DIRTY_BUS);
 }
 
 config_etype_t lxispi_set_input_sample_end(int setval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_speed(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(speed, speed);
 }
 
 config_etype_t lxispi_get_power_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_pullups(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_aux_on(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_cs_active(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_output_type(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
 
 config_etype_t lxispi_get_clk_pol_idle(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, clk_pol_idle);
 }
 
 config_etype_t lxispi_get_output_clk_edge(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    GET(bus, output_clk_edge);
 }
 
 config_etype_t lxispi_get_input_sample_end(int *retval, struct ddata * dd)
 {
-    return E_UNKNOWN;
+    return E_BAD_ROLE;
 }
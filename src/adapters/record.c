@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Transaction recording. See record.h
+ */
+#include "config.h"
+#include "adapters_config.h"
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "record.h"
+#include "instr_local.h"
+
+/* The log grows by this much at a time */
+#define REC_CHUNK (1 << 20)
+
+int rec_on = 0;
+
+static int fd = -1;
+static uint8_t *map = NULL;
+static size_t mapsz = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int grow(size_t need)
+{
+    size_t sz = mapsz;
+    void *m;
+
+    while (sz < need)
+        sz += REC_CHUNK;
+    if (ftruncate(fd, sz) != 0) {
+        LOGE("Recording: Can't grow log: %s\n", strerror(errno));
+        return -1;
+    }
+    if (map)
+        munmap(map, mapsz);
+    m = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        LOGE("Recording: Can't map log: %s\n", strerror(errno));
+        map = NULL;
+        mapsz = 0;
+        return -1;
+    }
+    map = m;
+    mapsz = sz;
+    return 0;
+}
+
+void rec_put(int adapter, int op, int arg, int result, uint64_t ts,
+             uint64_t dur, const void *obuf, int osz, const void *ibuf,
+             int isz)
+{
+    struct rec_file *hdr;
+    struct rec *r;
+    size_t off;
+    uint32_t len;
+
+    if (!obuf || osz < 0)
+        osz = 0;
+    if (!ibuf || isz < 0)
+        isz = 0;
+    len = REC_ALIGN(sizeof(struct rec) + osz + isz);
+
+    pthread_mutex_lock(&lock);
+    if (!rec_on)
+        goto done;
+    hdr = (struct rec_file *)map;
+    off = sizeof(struct rec_file) + hdr->used;
+    if (off + len > mapsz) {
+        if (grow(off + len)) {
+            LOGE("Recording: Stopped, log is incomplete\n");
+            rec_on = 0;
+            goto done;
+        }
+        hdr = (struct rec_file *)map;
+    }
+    r = (struct rec *)&map[off];
+    memset(r, 0, sizeof(*r));
+    r->ts = ts;
+    r->len = len;
+    r->op = op;
+    r->arg = arg;
+    r->adapter = adapter;
+    r->result = result;
+    r->osz = osz;
+    r->isz = isz;
+    r->dur = dur;
+    if (osz)
+        memcpy((uint8_t *)rec_out(r), obuf, osz);
+    if (isz)
+        memcpy((uint8_t *)rec_in(r), ibuf, isz);
+    /* Space past the record is fresh from ftruncate, i.e. zero-padded */
+    __atomic_store_n(&hdr->used, hdr->used + len, __ATOMIC_RELEASE);
+done:
+    pthread_mutex_unlock(&lock);
+}
+
+void rec_adapter(int adapter, const struct instr_drv *d)
+{
+    struct rec_adapter ra = {
+        .role = d->role,
+        .index = d->index,
+        .devid = d->devid,
+    };
+
+    rec_put(adapter, REC_ADAPTER, 0, 0, instr_now(), 0, &ra, sizeof(ra),
+            NULL, 0);
+}
+
+int rec_start(const char *fname)
+{
+    struct rec_file *hdr;
+
+    fd = open(fname, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        LOGE("Recording: Can't open [%s]: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    if (grow(REC_CHUNK)) {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+    hdr = (struct rec_file *)map;
+    memcpy(hdr->magic, REC_MAGIC, sizeof(hdr->magic));
+    hdr->used = 0;
+    rec_on = 1;
+
+    LOGI("Recording: adapter calls to [%s]\n", fname);
+    return 0;
+}
+
+void rec_stop(void)
+{
+    uint64_t used;
+
+    pthread_mutex_lock(&lock);
+    if (fd == -1)
+        goto done;
+    rec_on = 0;
+    used = map ? ((struct rec_file *)map)->used : 0;
+    if (map)
+        munmap(map, mapsz);
+    map = NULL;
+    mapsz = 0;
+    /* Cut the unused end of the last chunk */
+    if (ftruncate(fd, sizeof(struct rec_file) + used) != 0)
+        LOGW("Recording: Can't trim log: %s\n", strerror(errno));
+    close(fd);
+    fd = -1;
+    LOGI("Recording: %" PRIu64 " bytes of records\n", used);
+done:
+    pthread_mutex_unlock(&lock);
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __fini __record_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+    rec_stop();
+}
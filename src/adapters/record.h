@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef record_h
+#define record_h
+/***************************************************************************
+ * Transaction recording
+ *
+ * Every driverAPI call of every adapter, with all its bytes out and in,
+ * result and timing, appended to a memory-mapped log (ehwe -R). The REPLAY
+ * adapter serves the calls of one adapter again from the log.
+ *
+ * The log is a struct rec_file followed by records, each a struct rec
+ * followed by osz bytes out and isz bytes in, padded to a multiple of 8.
+ * Before the first call of an adapter a REC_ADAPTER record declares it.
+ ***************************************************************************/
+#include <stdint.h>
+
+#define REC_MAGIC "EHWEREC1"
+
+/* op of a record declaring an adapter. Its out-data is a struct
+ * rec_adapter. */
+#define REC_ADAPTER 0xFFFF
+
+struct rec_file {
+    char magic[8];
+    uint64_t used;              /* Bytes of records following the header.
+                                   Updated after each record, so a log of a
+                                   crashed run is valid up to the last
+                                   complete one. */
+};
+
+/* 40 bytes */
+struct rec {
+    uint64_t ts;                /* Start, ns since start of recording run */
+    uint32_t len;               /* Of all of record, multiple of 8 */
+    uint16_t op;                /* dop_t or REC_ADAPTER */
+    uint16_t arg;               /* As in struct dop */
+    uint8_t adapter;            /* Instrumented adapter number */
+    uint8_t pad[3];
+    int32_t result;             /* Methods return-value, else 0 */
+    uint32_t osz;
+    uint32_t isz;
+    uint64_t dur;               /* ns */
+};
+
+struct rec_adapter {
+    int32_t role;               /* role_t */
+    int32_t index;
+    int32_t devid;              /* devid_t */
+};
+
+#define REC_ALIGN(N) (((N) + 7) & ~7)
+
+static inline const uint8_t *rec_out(const struct rec *r)
+{
+    return (const uint8_t *)(r + 1);
+}
+
+static inline const uint8_t *rec_in(const struct rec *r)
+{
+    return rec_out(r) + r->osz;
+}
+
+/* Start recording to fname, truncating it */
+int rec_start(const char *fname);
+
+/* Finish the log. Safe to call also if never started. */
+void rec_stop(void);
+
+#endif                          //record_h
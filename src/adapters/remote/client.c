@@ -0,0 +1,277 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Client side of remote. Ops are collected in a batch which is sent as one
+ * frame when:
+ *
+ * - An op that isn't posted is added. The caller needs its result so
+ *   there's no point waiting any longer.
+ * - The batch is full.
+ * - An op ending a transaction is added (CS release, I2C stop, CS-framed
+ *   write). Whatever the device is to see, it will, without waiting for an
+ *   op that might never come.
+ * - The oldest op in the batch is older than REMOTE_BATCH_US when next op
+ *   is added (and at deinit).
+ *
+ * Posted ops hence never wait for a round-trip and consecutive ops share
+ * frame-headers and system-calls.
+ */
+#include "config.h"
+#include "remote_config.h"
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+int remote_flush(struct ddata *ddata)
+{
+    int rc;
+
+    if (ddata->batch.nops == 0)
+        return 0;
+
+    rc = remote_send(ddata->fd, RFRAME_OPS, ddata->batch.seq,
+                     ddata->batch.nops, ddata->batch.buf, ddata->batch.len);
+    ddata->batch.nops = 0;
+    ddata->batch.len = 0;
+
+    return rc;
+}
+
+/* True if op completes what the device is to see, i.e. nothing that
+ * follows belongs to the same transaction */
+static int ends_transaction(const struct dop *dop)
+{
+    switch (dop->op) {
+        case DOP_SPI_SETCS:
+            return dop->arg != 0;
+        case DOP_I2C_STOP:
+        case DOP_SPI_SENDRECIEVEDATA:
+        case DOP_I2C_SENDRECIEVEDATA:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Wait for the result of op <seq> */
+static int remote_result(struct ddata *ddata, uint32_t seq, uint8_t *ibuf,
+                         int isz)
+{
+    uint8_t *payload = ddata->rbuf;
+    struct rframe hdr;
+    struct rresult res;
+    int len;
+
+    /* Lost connection is not recoverable from inside a driver method */
+    ASSURE((len = remote_recv(ddata->fd, &hdr, payload, sizeof(ddata->rbuf)))
+           >= (int)sizeof(res));
+    ASSURE(hdr.type == RFRAME_RESULTS && hdr.nops == 1);
+
+    memcpy(&res, payload, sizeof(res));
+    res.seq = ntohl(res.seq);
+    res.result = ntohl(res.result);
+    res.isz = ntohs(res.isz);
+    res.flags = ntohs(res.flags);
+
+    ASSURE(res.seq == seq);
+    ASSURE(res.isz == isz && len == (int)sizeof(res) + isz);
+    if (res.flags & RRESULT_POSTED_FAILED)
+        LOGW("REMOTE: Posted operation(s) before #%u failed on server\n", seq);
+    if (isz)
+        memcpy(ibuf, payload + sizeof(res), isz);
+
+    return res.result;
+}
+
+int remote_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz)
+{
+    struct dop dop = {
+        .op = op,
+        .arg = arg,
+        .osz = osz,
+        .isz = isz
+    };
+    uint32_t seq;
+
+    ASSERT(osz >= 0 && osz <= DOP_MAX_XFER);
+    ASSERT(isz >= 0 && isz <= DOP_MAX_XFER);
+
+    if (ddata->batch.nops &&
+        (ddata->batch.len + sizeof(dop) + osz > sizeof(ddata->batch.buf) ||
+         remote_now_us() - ddata->batch.t0 > REMOTE_BATCH_US))
+        ASSURE(remote_flush(ddata) == 0);
+
+    if (ddata->batch.nops == 0) {
+        ddata->batch.seq = ddata->seq;
+        ddata->batch.t0 = remote_now_us();
+    }
+    remote_dop_pack(&ddata->batch.buf[ddata->batch.len], &dop);
+    ddata->batch.len += sizeof(dop);
+    if (osz) {
+        memcpy(&ddata->batch.buf[ddata->batch.len], obuf, osz);
+        ddata->batch.len += osz;
+    }
+    ddata->batch.nops++;
+    seq = ddata->seq++;
+
+    if (dop_posted(&dop)) {
+        if (ends_transaction(&dop))
+            ASSURE(remote_flush(ddata) == 0);
+        return 0;
+    }
+
+    ASSURE(remote_flush(ddata) == 0);
+    return remote_result(ddata, seq, ibuf, isz);
+}
+
+/* Split transfers larger than one op. Only valid for operations where that
+ * doesn't change the meaning on the wire. */
+static void remote_call_chunked(struct ddata *ddata, dop_t op,
+                                const uint8_t *obuf, uint8_t *ibuf, int sz)
+{
+    int n;
+
+    for (; sz > 0; sz -= n) {
+        n = sz > DOP_MAX_XFER ? DOP_MAX_XFER : sz;
+        remote_call(ddata, op, 0, obuf, obuf ? n : 0, ibuf, ibuf ? n : 0);
+        if (obuf)
+            obuf += n;
+        if (ibuf)
+            ibuf += n;
+    }
+}
+
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void rspi_setCS(struct ddata *ddata, int state)
+{
+    remote_call(ddata, DOP_SPI_SETCS, state, NULL, 0, NULL, 0);
+}
+
+void rspi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    remote_call_chunked(ddata, DOP_SPI_RECEIVEDATA, NULL, data, sz);
+}
+
+void rspi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    remote_call_chunked(ddata, DOP_SPI_SENDDATA, data, NULL, sz);
+}
+
+uint16_t rspi_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return remote_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+/* Configuration is owned and actuated by the server */
+int rspi_configure(struct ddata *ddata)
+{
+    return 0;
+}
+
+void rspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                          int outsz, uint8_t *indata, int insz)
+{
+    remote_call(ddata, DOP_SPI_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
+
+void rspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                              int outsz, uint8_t *indata, int insz)
+{
+    remote_call(ddata, DOP_SPI_SENDRECIEVEDATA_NCS, 0, outbuf, outsz, indata,
+                insz);
+}
+
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void ri2c_start(struct ddata *ddata)
+{
+    remote_call(ddata, DOP_I2C_START, 0, NULL, 0, NULL, 0);
+}
+
+void ri2c_stop(struct ddata *ddata)
+{
+    remote_call(ddata, DOP_I2C_STOP, 0, NULL, 0, NULL, 0);
+}
+
+void ri2c_autoAck(struct ddata *ddata, int state)
+{
+    remote_call(ddata, DOP_I2C_AUTOACK, state, NULL, 0, NULL, 0);
+}
+
+/* Returns 1 if ACK:ed, -1 if the served adapter can't probe */
+int ri2c_probe(struct ddata *ddata, uint8_t addr)
+{
+    return remote_call(ddata, DOP_I2C_PROBE, addr, NULL, 0, NULL, 0);
+}
+
+/* Returns number found, -1 if the served adapter can't scan */
+int ri2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+              uint8_t *present)
+{
+    return remote_call(ddata, DOP_I2C_SCAN, first | last << 8, NULL, 0,
+                       present, I2C_SCAN_BYTES);
+}
+
+void ri2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    remote_call(ddata, DOP_I2C_RECEIVEBYTE, 0, NULL, 0, data, 1);
+}
+
+int ri2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    return remote_call(ddata, DOP_I2C_SENDBYTE, data, NULL, 0, NULL, 0);
+}
+
+void ri2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    remote_call_chunked(ddata, DOP_I2C_RECEIVEDATA, NULL, data, sz);
+}
+
+void ri2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    remote_call_chunked(ddata, DOP_I2C_SENDDATA, data, NULL, sz);
+}
+
+uint16_t ri2c_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return remote_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+/* Configuration is owned and actuated by the server */
+int ri2c_configure(struct ddata *ddata)
+{
+    return 0;
+}
+
+void ri2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                          int outsz, uint8_t *indata, int insz)
+{
+    remote_call(ddata, DOP_I2C_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
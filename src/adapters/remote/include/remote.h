@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef remote_h
+#define remote_h
+/***************************************************************************
+ * Public api
+ ***************************************************************************/
+
+/* Adapter living in another ehwe process (ehwe -L), possibly on another
+ * host. */
+struct remote {
+    clkownr_t clckownr;
+    char *peer;                 /* "host:port" or path of Unix socket */
+};
+
+/* Valid regex-i role patterns for remote */
+#define REMOTE_ROLES "SPI|I2C"
+
+/* Valid regex-i clock-owner patterns for remote */
+#define REMOTE_CLKOWNER "MASTER|SLAVE"
+
+/* Forward declaration of 'struct adapter' required to avoid mutual header
+ * inclusion */
+struct adapter;
+
+int remote_parse(const char *adapterstr, struct adapter *adapter);
+int remote_init_adapter(struct adapter *adapter);
+int remote_deinit_adapter(struct adapter *adapter);
+
+/* Server side. Serve adapters on <addr> ("[host]:port" or Unix socket
+ * path) until SIGINT or SIGTERM */
+int remote_serve(struct adapter **adapters, int nadapters, const char *addr);
+
+#endif                          //remote_h
@@ -0,0 +1,172 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef remote_local_h
+#define remote_local_h
+/***************************************************************************
+ * Module-local api
+ ***************************************************************************/
+#include <liblog/log.h>
+#include <inttypes.h>
+#include <driver.h>
+#include <dop.h>
+
+/***************************************************************************
+ * Wire format
+ *
+ * Every message is a frame: header followed by <len> bytes payload. All
+ * multi-byte fields are big-endian.
+ *
+ * OPS payload:     <nops> x (struct dop, osz bytes out-data)
+ * RESULTS payload: <nops> x (struct rresult, isz bytes in-data)
+ *
+ * Ops are numbered by a running sequence number, <seq> in an OPS header
+ * is that of the first op in the frame. Only ops that aren't posted (see
+ * dop_posted) get a result, tagged with the ops own sequence number.
+ ***************************************************************************/
+#define REMOTE_MAGIC        0x45485752  /* "EHWR" */
+#define REMOTE_VERSION      1
+#define REMOTE_MAX_PAYLOAD  (64 * 1024)
+#define REMOTE_MAX_CLIENTS  32
+
+typedef enum {
+    RFRAME_HELLO = 1,           /* Client: struct rhello */
+    RFRAME_WELCOME,             /* Server: struct rwelcome */
+    RFRAME_OPS,
+    RFRAME_RESULTS,
+} rframe_t;
+
+struct rframe {
+    uint32_t magic;
+    uint32_t seq;
+    uint16_t nops;
+    uint8_t type;               /* rframe_t */
+    uint8_t version;
+    uint32_t len;
+} __attribute__ ((packed));
+
+struct rhello {
+    int32_t role;
+    int32_t index;
+} __attribute__ ((packed));
+
+struct rwelcome {
+    int32_t status;             /* 0 or -errno */
+} __attribute__ ((packed));
+
+/* A posted op failed since the previous result */
+#define RRESULT_POSTED_FAILED 0x0001
+
+struct rresult {
+    uint32_t seq;
+    int32_t result;
+    uint16_t isz;
+    uint16_t flags;
+} __attribute__ ((packed));
+
+/* Driver companion - NOTE: unique for each driver. Must NOT be public */
+struct ddata {
+    int fd;                     /* Connection to server */
+    uint32_t seq;               /* Sequence number of next op */
+    /* Ops not sent yet */
+    struct {
+        uint32_t seq;           /* Of first op in batch */
+        int nops;
+        int len;
+        uint64_t t0;            /* us-timestamp of first op */
+        uint8_t buf[REMOTE_MAX_PAYLOAD];
+    } batch;
+    uint8_t rbuf[REMOTE_MAX_PAYLOAD];   /* Result frame being received */
+    /* Owned by driver */
+    union {
+        struct driverAPI_any *any;
+        struct driverAPI_spi *spi;
+        struct driverAPI_i2c *i2c;
+    } driver;
+};
+
+/***************************************************************************
+ * Transport helpers (transport.c)
+ ***************************************************************************/
+int remote_connect(const char *addr);
+int remote_listen(const char *addr);
+void remote_unlisten(const char *addr, int fd);
+int remote_send(int fd, rframe_t type, uint32_t seq, int nops,
+                const void *payload, int len);
+int remote_recv(int fd, struct rframe *hdr, void *payload, int maxlen);
+int remote_recv_nb(int fd, struct rframe *hdr, void *payload, int maxlen,
+                   int *got);
+uint64_t remote_now_us(void);
+
+/* Serialize/de-serialize a dop header */
+void remote_dop_pack(uint8_t *buf, const struct dop *dop);
+void remote_dop_unpack(struct dop *dop, const uint8_t *buf);
+
+/***************************************************************************
+ * Server core (server.c). The backend decides what ops are executed on,
+ * letting the same server front real adapters as well as the stand-in.
+ ***************************************************************************/
+struct remote_backend {
+    void *ctx;
+    int nbus;                   /* Bus-handles are 0..nbus-1 */
+    /* Bus-handle for role/index or -1 if none */
+    int (*attach)(void *ctx, int role, int index);
+    int (*exec)(void *ctx, int bus, const struct dop *dop,
+                const uint8_t *obuf, uint8_t *ibuf);
+};
+
+int remote_serve_backend(const char *addr, const struct remote_backend *be);
+
+/***************************************************************************
+ * Main driver apis (client.c)
+ ***************************************************************************/
+int remote_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz);
+int remote_flush(struct ddata *ddata);
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void rspi_setCS(struct ddata *ddata, int state);
+void rspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void rspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t rspi_getStatus(struct ddata *ddata, uint16_t flags);
+int rspi_configure(struct ddata *ddata);
+void rspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                          int outsz, uint8_t *indata, int insz);
+void rspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                              int outsz, uint8_t *indata, int insz);
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void ri2c_start(struct ddata *ddata);
+void ri2c_stop(struct ddata *ddata);
+void ri2c_autoAck(struct ddata *ddata, int state);
+int ri2c_probe(struct ddata *ddata, uint8_t addr);
+int ri2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+              uint8_t *present);
+void ri2c_receiveByte(struct ddata *ddata, uint8_t *data);
+int ri2c_sendByte(struct ddata *ddata, uint8_t data);
+void ri2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void ri2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t ri2c_getStatus(struct ddata *ddata, uint16_t flags);
+int ri2c_configure(struct ddata *ddata);
+void ri2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                          int outsz, uint8_t *indata, int insz);
+
+#endif                          //remote_local_h
@@ -0,0 +1,338 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include "adapters_config.h"
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <regex.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <liblog/log.h>
+#include <adapters.h>
+#include <driver.h>
+#include <remote.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+static regex_t preg;            /* Compiled regular expression for full
+                                   adapter-string parsing */
+
+#define REGEX_PATT \
+  "^(" REMOTE_ROLES \
+  "):(" INDEX \
+  "):(" ADAPTERS \
+  "):(" REMOTE_CLKOWNER \
+  "):(" FILENAME \
+")"
+
+#define REGEX_NSUB (5+1)
+
+/* Convenience variables: */
+/*    SPI driver */
+static const struct driver_caps rspi_caps = {
+    .max_xfer = DOP_MAX_XFER,
+    .latency_us = 500,
+    .flags = DCAP_WRITE_READ | DCAP_ASYNC,
+};
+
+static struct driverAPI_spi rspi_driver = {
+    .ddata = NULL,
+    .caps = &rspi_caps,
+    .sendData = rspi_sendData,
+    .sendrecieveData = rspi_sendrecieveData,
+    .sendrecieveData_ncs = rspi_sendrecieveData_ncs,
+    .setCS = rspi_setCS,
+    .receiveData = rspi_receiveData,
+    .getStatus = rspi_getStatus,
+    .actuate_config = rspi_configure,
+    .newddata = NULL,
+    /* Configuration belongs to the server */
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               },
+};
+
+/*    I2C driver */
+static const struct driver_caps ri2c_caps = {
+    .max_xfer = DOP_MAX_XFER,
+    .latency_us = 500,
+    .flags = DCAP_ASYNC,
+};
+
+static struct driverAPI_i2c ri2c_driver = {
+    .ddata = NULL,
+    .caps = &ri2c_caps,
+    .sendByte = ri2c_sendByte,
+    .receiveByte = ri2c_receiveByte,
+    .sendData = ri2c_sendData,
+    .receiveData = ri2c_receiveData,
+    .sendrecieveData = ri2c_sendrecieveData,
+    .start = ri2c_start,
+    .stop = ri2c_stop,
+    .autoAck = ri2c_autoAck,
+    .probe = ri2c_probe,
+    .scan = ri2c_scan,
+    .getStatus = ri2c_getStatus,
+    .actuate_config = ri2c_configure,
+    .newddata = NULL,
+    /* Configuration belongs to the server */
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               },
+};
+
+/* CTOR-type code-init */
+int remote_init()
+{
+    int rc;
+    char err_str[REXP_ESTRSZ];
+    static int is_init = 0;
+
+    if (is_init) {
+        LOGW("No need to run %s twice, CTOR _init has run it?\n", __func__);
+        return 0;
+    }
+    is_init = 1;
+
+    rc = regcomp(&preg, REGEX_PATT, REG_EXTENDED | REG_ICASE);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec compilation error: %s\n", err_str);
+        return rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Refined parsing of adapterstring to complete remote adapter_struct
+ *
+ * */
+int remote_parse(const char *adapterstr, struct adapter *adapter)
+{
+    int rc, i;
+    char err_str[REXP_ESTRSZ];
+    regmatch_t mtch_idxs[REGEX_NSUB];
+    char *adapterstr_cpy = strdup(adapterstr);
+    char *role_str;
+    char *index_str;
+    char *adapter_str;
+    char *clkownr_str;
+    char *filename_str;
+
+    adapter->role = ROLE_INVALID;
+    adapter->devid = DEV_INVALID;
+
+    rc = regexec(&preg, adapterstr_cpy, REGEX_NSUB, mtch_idxs, 0);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec match error: %s\n", err_str);
+        free(adapterstr_cpy);
+        return rc;
+    }
+    /* Add string terminators in substrings */
+    for (i = 1; i < REGEX_NSUB; i++) {
+        ASSURE_E(mtch_idxs[i].rm_so != -1, goto remote_parse_err);
+        adapterstr_cpy[mtch_idxs[i].rm_eo] = 0;
+    }
+
+    role_str = &adapterstr_cpy[mtch_idxs[1].rm_so];
+    index_str = &adapterstr_cpy[mtch_idxs[2].rm_so];
+    adapter_str = &adapterstr_cpy[mtch_idxs[3].rm_so];
+    clkownr_str = &adapterstr_cpy[mtch_idxs[4].rm_so];
+    filename_str = &adapterstr_cpy[mtch_idxs[5].rm_so];
+
+    LOGD("  Second level adapter-string parsing (by %s):\n", __func__);
+    LOGD("    role=%s\n", role_str);
+    LOGD("    index=%s\n", index_str);
+    LOGD("    adapter=%s\n", adapter_str);
+    LOGD("    clkownr=%s\n", clkownr_str);
+    LOGD("    filename=%s\n", filename_str);
+
+    ASSURE_E(strcasecmp(adapter_str, "remote") == 0, goto remote_parse_err);
+
+    if (strcasecmp(role_str, "spi") == 0) {
+        adapter->role = ROLE_SPI;
+    } else if (strcasecmp(role_str, "i2c") == 0) {
+        adapter->role = ROLE_I2C;
+    } else {
+        LOGE("REMOTE adapter driver can't handle role: %s\n", role_str);
+        goto remote_parse_err;
+    }
+
+    adapter->index = atoi(index_str);
+    adapter->devid = REMOTE;
+    adapter->remote = malloc(sizeof(struct remote));
+
+    if (strcasecmp(clkownr_str, "master") == 0) {
+        adapter->remote->clckownr = MASTER;
+    } else if (strcasecmp(clkownr_str, "slave") == 0) {
+        adapter->remote->clckownr = SLAVE;
+    } else {
+        LOGE("REMOTE adapter driver can't handle clkownr: %s\n", clkownr_str);
+        goto remote_parse_err;
+    }
+
+    /* Avoid need to strdup by using original which happens to terminate
+     * correctly as well. Ignore const as this string belongs to
+     * environment with process-long lifetime */
+    adapter->remote->peer = (char *)(&adapterstr[mtch_idxs[5].rm_so]);
+
+    free(adapterstr_cpy);
+    return 0;
+remote_parse_err:
+    free(adapterstr_cpy);
+    return -1;
+}
+
+int remote_init_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver;
+    struct ddata *ddata;
+    struct rhello hello = {
+        .role = htonl(adapter->role),
+        .index = htonl(adapter->index)
+    };
+    struct rwelcome welcome;
+    struct rframe hdr;
+
+    LOGI("REMOTE: Initializing adapter ID [%d]\n", adapter->devid);
+
+    ASSERT(driver = malloc(sizeof(struct driverAPI_spi)));
+    switch (adapter->role) {
+        case ROLE_SPI:
+            memcpy(driver, &rspi_driver, sizeof(struct driverAPI_spi));
+            break;
+        case ROLE_I2C:
+            memcpy(driver, &ri2c_driver, sizeof(struct driverAPI_i2c));
+            break;
+        default:
+            LOGE("Role [%d] is not supported by REMOTE\n", adapter->role);
+            free(driver);
+            return -1;
+    }
+    ASSERT(ddata = calloc(1, sizeof(struct ddata)));
+
+    ASSURE((ddata->fd = remote_connect(adapter->remote->peer)) != -1);
+    ASSURE(remote_send(ddata->fd, RFRAME_HELLO, 0, 0, &hello,
+                       sizeof(hello)) == 0);
+    ASSURE(remote_recv(ddata->fd, &hdr, &welcome, sizeof(welcome)) ==
+           sizeof(welcome));
+    ASSURE(hdr.type == RFRAME_WELCOME);
+    if (welcome.status != 0) {
+        LOGE("REMOTE: %s has no %s adapter with index %d\n",
+             adapter->remote->peer,
+             adapter->role == ROLE_SPI ? "SPI" : "I2C", adapter->index);
+        ASSURE("Server refused attach" == 0);
+    }
+
+    driver->ddata = ddata;
+    driver->adapter = adapter;
+    adapter->driver.any = driver;
+    ddata->driver.any = driver;
+
+    LOGI("REMOTE: Attached to %s via %s\n",
+         adapter->role == ROLE_SPI ? "SPI" : "I2C", adapter->remote->peer);
+    return 0;
+}
+
+int remote_deinit_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver = adapter->driver.any;
+    struct ddata *ddata = driver->ddata;
+    struct remote *remote = adapter->remote;
+
+    /* Posted ops may still be waiting for company */
+    if (remote_flush(ddata))
+        LOGW("REMOTE: Last operations could not be sent to %s\n",
+             remote->peer);
+    close(ddata->fd);
+    free(ddata);
+    free(driver);
+    free(remote);
+
+    adapter->driver.any = NULL;
+    adapter->remote = NULL;
+
+    return 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __remote_init(void)
+{
+    int rc;
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    if ((rc = remote_init())) {
+        fprintf(stderr, "Fatal error: remote_init() failed\n");
+        exit(rc);
+    }
+}
+
+void __fini __remote_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+}
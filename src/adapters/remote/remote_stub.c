@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * ehwe-remote-stub: Stand-in server for testing the REMOTE adapter (and
+ * the link to it) without any hardware.
+ *
+ * Accepts any role and index. Written data is kept in one scratch buffer
+ * per bus and read-backs return it, i.e. it behaves like a memory that is
+ * always addressed from 0. I2C bytes are always ACK:ed.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include "local.h"
+
+#define STUB_NBUS 16            /* 8 SPI + 8 I2C */
+
+struct stub_bus {
+    uint8_t mem[DOP_MAX_XFER];
+    int sz;                     /* Bytes valid in mem */
+};
+
+static struct stub_bus stub_bus[STUB_NBUS];
+
+static int stub_attach(void *ctx, int role, int index)
+{
+    if (index < 1 || index > STUB_NBUS / 2)
+        return -1;
+    switch (role) {
+        case ROLE_SPI:
+            return index - 1;
+        case ROLE_I2C:
+            return STUB_NBUS / 2 + index - 1;
+        default:
+            return -1;
+    }
+}
+
+static void stub_write(struct stub_bus *bus, const uint8_t *obuf, int sz)
+{
+    memcpy(bus->mem, obuf, sz);
+    bus->sz = sz;
+}
+
+static void stub_read(struct stub_bus *bus, uint8_t *ibuf, int sz)
+{
+    int n = sz < bus->sz ? sz : bus->sz;
+
+    memcpy(ibuf, bus->mem, n);
+    memset(ibuf + n, 0xFF, sz - n);
+}
+
+static int stub_exec(void *ctx, int busid, const struct dop *dop,
+                     const uint8_t *obuf, uint8_t *ibuf)
+{
+    struct stub_bus *bus = &stub_bus[busid];
+    int i;
+
+    LOGD("STUB: bus %d: %s arg=%d osz=%d isz=%d\n", busid, dop_name(dop->op),
+         dop->arg, dop->osz, dop->isz);
+
+    switch (dop->op) {
+        case DOP_SPI_SENDDATA:
+        case DOP_I2C_SENDDATA:
+            stub_write(bus, obuf, dop->osz);
+            break;
+        case DOP_SPI_RECEIVEDATA:
+        case DOP_I2C_RECEIVEDATA:
+            stub_read(bus, ibuf, dop->isz);
+            break;
+        case DOP_SPI_SENDRECIEVEDATA:
+        case DOP_SPI_SENDRECIEVEDATA_NCS:
+        case DOP_I2C_SENDRECIEVEDATA:
+            stub_read(bus, ibuf, dop->isz);
+            if (dop->osz)
+                stub_write(bus, obuf, dop->osz);
+            break;
+        case DOP_I2C_RECEIVEBYTE:
+            stub_read(bus, ibuf, 1);
+            break;
+        case DOP_I2C_SENDBYTE:
+            bus->mem[0] = dop->arg;
+            bus->sz = 1;
+            return 1;           /* ACK */
+        case DOP_I2C_PROBE:
+            return 1;
+        case DOP_I2C_SCAN:
+            /* Everybody's home */
+            memset(ibuf, 0, dop->isz);
+            for (i = dop->arg & 0xFF; i <= dop->arg >> 8; i++)
+                I2C_SCAN_SET(ibuf, i);
+            return (dop->arg >> 8) - (dop->arg & 0xFF) + 1;
+        case DOP_SPI_SETCS:
+        case DOP_I2C_START:
+        case DOP_I2C_STOP:
+        case DOP_I2C_AUTOACK:
+        case DOP_GETSTATUS:
+            break;
+        default:
+            return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct remote_backend be = {
+        .ctx = NULL,
+        .nbus = STUB_NBUS,
+        .attach = stub_attach,
+        .exec = stub_exec
+    };
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s [host]:port|/path/to/socket\n", argv[0]);
+        return 1;
+    }
+
+    return remote_serve_backend(argv[1], &be) ? 1 : 0;
+}
@@ -0,0 +1,422 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Server side of remote (ehwe -L). One connection per client-adapter.
+ *
+ * Frames from different clients are interleaved op by op, round-robin. A
+ * client that opens a bus-transaction (I2C start, SPI CS asserted) owns
+ * the bus until it closes it; other clients of the same bus are held back
+ * meanwhile. CS is assumed active low. Results of a frame are sent back as
+ * one frame once all its ops have run.
+ *
+ * Frames, hello included, are received without blocking and put together
+ * per client as parts arrive. A client stalling mid-frame holds back only
+ * itself.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include <remote.h>
+#include "local.h"
+
+#define MAX_BUS 64
+
+struct rclient {
+    int fd;
+    int bus;                    /* -1 until hello is answered */
+    int autoack;                /* Clients view of I2C autoAck */
+    int posted_failed;          /* Since last result */
+    /* Frame in progress, nops == 0 if none */
+    uint32_t seq;               /* Of next op */
+    int nops;                   /* Ops left */
+    int off;                    /* Of next op in payload */
+    int len;
+    /* Frame being received, <got> bytes of it so far */
+    struct rframe hdr;
+    int got;
+    uint8_t payload[REMOTE_MAX_PAYLOAD];
+    /* Results of frame in progress */
+    int nres;
+    int rlen;
+    uint8_t results[REMOTE_MAX_PAYLOAD];
+};
+
+struct rserver {
+    const struct remote_backend *be;
+    struct rclient *owner[MAX_BUS];
+    int autoack[MAX_BUS];       /* Actual I2C autoAck per bus, -1 unknown */
+    int role[MAX_BUS];          /* Role of bus, learned at attach */
+    struct rclient *clients[REMOTE_MAX_CLIENTS];
+    int nclients;
+};
+
+static volatile sig_atomic_t serving;
+
+static void stop_serving(int sig)
+{
+    serving = 0;
+}
+
+static void accept_client(struct rserver *srv, int lfd)
+{
+    struct rclient *c;
+    int fd;
+
+    if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+        LOGW("REMOTE: accept failed: %s\n", strerror(errno));
+        return;
+    }
+    if (srv->nclients >= REMOTE_MAX_CLIENTS) {
+        LOGW("REMOTE: Too many clients (%d)\n", srv->nclients);
+        close(fd);
+        return;
+    }
+
+    ASSERT(c = calloc(1, sizeof(struct rclient)));
+    c->fd = fd;
+    c->bus = -1;
+    c->autoack = 1;
+    srv->clients[srv->nclients++] = c;
+}
+
+/* Answer hello of a new client. Returns -1 if it's to be dropped. */
+static int welcome_client(struct rserver *srv, struct rclient *c)
+{
+    struct rhello hello;
+    struct rwelcome welcome = { 0 };
+    int bus = -1;
+
+    if (c->hdr.type != RFRAME_HELLO || c->hdr.len != sizeof(hello)) {
+        LOGW("REMOTE: Dropping client with bad hello\n");
+        return -1;
+    }
+    memcpy(&hello, c->payload, sizeof(hello));
+    hello.role = ntohl(hello.role);
+    hello.index = ntohl(hello.index);
+
+    if ((bus = srv->be->attach(srv->be->ctx, hello.role, hello.index)) < 0
+        || bus >= MAX_BUS) {
+        LOGW("REMOTE: Client asked for unknown adapter role=%d index=%d\n",
+             hello.role, hello.index);
+        welcome.status = -ENODEV;
+    }
+    welcome.status = htonl(welcome.status);
+    if (remote_send(c->fd, RFRAME_WELCOME, 0, 0, &welcome, sizeof(welcome))
+        || welcome.status)
+        return -1;
+
+    c->bus = bus;
+    srv->role[bus] = hello.role;
+    LOGI("REMOTE: Client [%d] attached to bus [%d] (%d clients)\n", c->fd,
+         bus, srv->nclients);
+    return 0;
+}
+
+static int exec(struct rserver *srv, int bus, const struct dop *dop,
+                const uint8_t *obuf, uint8_t *ibuf)
+{
+    return srv->be->exec(srv->be->ctx, bus, dop, obuf, ibuf);
+}
+
+/* Close any transaction a leaving client left open */
+static void release_bus(struct rserver *srv, struct rclient *c)
+{
+    struct dop dop = { 0 };
+
+    if (c->bus < 0 || srv->owner[c->bus] != c)
+        return;
+
+    LOGW("REMOTE: Client [%d] left with bus open. Closing it.\n", c->fd);
+    if (srv->role[c->bus] == ROLE_I2C) {
+        dop.op = DOP_I2C_STOP;
+    } else {
+        dop.op = DOP_SPI_SETCS;
+        dop.arg = 1;
+    }
+    exec(srv, c->bus, &dop, NULL, NULL);
+    srv->owner[c->bus] = NULL;
+}
+
+static void drop_client(struct rserver *srv, int n)
+{
+    struct rclient *c = srv->clients[n];
+
+    release_bus(srv, c);
+    LOGI("REMOTE: Client [%d] detached\n", c->fd);
+    close(c->fd);
+    free(c);
+    memmove(&srv->clients[n], &srv->clients[n + 1],
+            (srv->nclients - n - 1) * sizeof(struct rclient *));
+    srv->nclients--;
+}
+
+/* Read what has arrived of client's next frame. Returns -1 if client is
+ * gone. */
+static int read_frame(struct rserver *srv, struct rclient *c)
+{
+    int rc;
+
+    if ((rc = remote_recv_nb(c->fd, &c->hdr, c->payload, sizeof(c->payload),
+                             &c->got)) <= 0)
+        return rc;
+    if (c->bus < 0)
+        return welcome_client(srv, c);
+    if (c->hdr.type != RFRAME_OPS) {
+        LOGE("REMOTE: Client [%d] sent unexpected frame type %d\n", c->fd,
+             c->hdr.type);
+        return -1;
+    }
+    c->seq = c->hdr.seq;
+    c->nops = c->hdr.nops;
+    c->off = 0;
+    c->len = c->hdr.len;
+    c->nres = 0;
+    c->rlen = 0;
+    return 0;
+}
+
+/* Execute ops of clients current frame until done or held back by another
+ * clients transaction. Returns number of ops executed or -1 on protocol
+ * error. */
+static int serve_frame(struct rserver *srv, struct rclient *c)
+{
+    struct dop dop, ack = {.op = DOP_I2C_AUTOACK };
+    struct rresult res;
+    uint8_t scratch[DOP_MAX_XFER];
+    const uint8_t *obuf;
+    uint8_t *ibuf;
+    int n = 0, rc, posted;
+
+    while (c->nops) {
+        if (srv->owner[c->bus] && srv->owner[c->bus] != c)
+            break;
+
+        if (c->off + (int)sizeof(dop) > c->len)
+            return -1;
+        remote_dop_unpack(&dop, &c->payload[c->off]);
+        obuf = &c->payload[c->off + sizeof(dop)];
+        if (dop.osz > DOP_MAX_XFER || dop.isz > DOP_MAX_XFER ||
+            c->off + (int)sizeof(dop) + dop.osz > c->len)
+            return -1;
+
+        posted = dop_posted(&dop);
+        if (!posted &&
+            c->rlen + sizeof(res) + dop.isz > sizeof(c->results))
+            return -1;
+        ibuf = posted ? scratch : &c->results[c->rlen + sizeof(res)];
+
+        switch (dop.op) {
+            case DOP_I2C_START:
+                srv->owner[c->bus] = c;
+                break;
+            case DOP_SPI_SETCS:
+                srv->owner[c->bus] = dop.arg ? NULL : c;
+                break;
+            default:
+                break;
+        }
+
+        if (dop.op == DOP_I2C_AUTOACK) {
+            /* Per client state, actuated lazily below */
+            c->autoack = dop.arg;
+            rc = 0;
+        } else {
+            if ((dop.op == DOP_I2C_RECEIVEBYTE ||
+                 dop.op == DOP_I2C_RECEIVEDATA ||
+                 dop.op == DOP_I2C_SENDRECIEVEDATA) &&
+                srv->autoack[c->bus] != c->autoack) {
+                ack.arg = c->autoack;
+                exec(srv, c->bus, &ack, NULL, NULL);
+                srv->autoack[c->bus] = c->autoack;
+            }
+            rc = exec(srv, c->bus, &dop, obuf, ibuf);
+        }
+
+        if (dop.op == DOP_I2C_STOP)
+            srv->owner[c->bus] = NULL;
+
+        if (posted) {
+            if (rc < 0)
+                c->posted_failed = 1;
+        } else {
+            res.seq = htonl(c->seq);
+            res.result = htonl(rc);
+            res.isz = htons(dop.isz);
+            res.flags = htons(c->posted_failed ? RRESULT_POSTED_FAILED : 0);
+            c->posted_failed = 0;
+            memcpy(&c->results[c->rlen], &res, sizeof(res));
+            c->rlen += sizeof(res) + dop.isz;
+            c->nres++;
+        }
+
+        c->off += sizeof(dop) + dop.osz;
+        c->seq++;
+        c->nops--;
+        n++;
+    }
+
+    if (c->nops == 0 && c->nres) {
+        if (remote_send(c->fd, RFRAME_RESULTS, 0, c->nres, c->results,
+                        c->rlen))
+            return -1;
+        c->nres = 0;
+    }
+    return n;
+}
+
+int remote_serve_backend(const char *addr, const struct remote_backend *be)
+{
+    struct rserver *srv;
+    struct pollfd pfds[1 + REMOTE_MAX_CLIENTS];
+    struct rclient *pclients[REMOTE_MAX_CLIENTS];
+    struct sigaction sa = {.sa_handler = stop_serving };
+    int lfd, i, n, np, rc, rr = 0, progress;
+
+    ASSURE(be->nbus > 0 && be->nbus <= MAX_BUS);
+    if ((lfd = remote_listen(addr)) == -1)
+        return -1;
+
+    ASSERT(srv = calloc(1, sizeof(struct rserver)));
+    srv->be = be;
+    for (i = 0; i < MAX_BUS; i++)
+        srv->autoack[i] = -1;
+
+    /* No SA_RESTART: poll must return on signal */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    LOGI("REMOTE: Serving %d bus(es) on %s\n", be->nbus, addr);
+    serving = 1;
+    while (serving) {
+        /* Advance every client with a frame in progress, one round */
+        progress = 0;
+        n = srv->nclients;
+        for (i = 0; i < n && n == srv->nclients; i++) {
+            int k = (rr + i) % n;
+            struct rclient *c = srv->clients[k];
+
+            if (c->nops == 0)
+                continue;
+            if ((rc = serve_frame(srv, c)) < 0) {
+                LOGE("REMOTE: Protocol error from client [%d]\n", c->fd);
+                drop_client(srv, k);
+                break;
+            }
+            progress |= rc;
+        }
+        rr++;
+
+        /* Clients without a frame in progress can take a new one. Don't
+         * block in poll if some frame is still runnable. */
+        pfds[0].fd = lfd;
+        pfds[0].events = POLLIN;
+        for (i = 0, np = 0; i < srv->nclients; i++) {
+            if (srv->clients[i]->nops)
+                continue;
+            pclients[np] = srv->clients[i];
+            pfds[1 + np].fd = srv->clients[i]->fd;
+            pfds[1 + np].events = POLLIN;
+            np++;
+        }
+        if (poll(pfds, 1 + np, progress ? 0 : -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            LOGE("REMOTE: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        for (i = 0; i < np; i++) {
+            if (!pfds[1 + i].revents)
+                continue;
+            if (read_frame(srv, pclients[i]) == 0)
+                continue;
+            for (n = 0; srv->clients[n] != pclients[i]; n++) ;
+            drop_client(srv, n);
+        }
+        if (pfds[0].revents & POLLIN)
+            accept_client(srv, lfd);
+    }
+
+    LOGI("REMOTE: Stopped serving\n");
+    while (srv->nclients)
+        drop_client(srv, srv->nclients - 1);
+    remote_unlisten(addr, lfd);
+    free(srv);
+
+    return 0;
+}
+
+/***************************************************************************
+ * Backend fronting real adapters
+ ***************************************************************************/
+struct adapters_ctx {
+    struct adapter **adapters;
+    int nadapters;
+};
+
+static int adapters_attach(void *ctx, int role, int index)
+{
+    struct adapters_ctx *actx = ctx;
+    int i;
+
+    for (i = 0; i < actx->nadapters; i++) {
+        if (actx->adapters[i]->role == role &&
+            actx->adapters[i]->index == index)
+            return i;
+    }
+    return -1;
+}
+
+static int adapters_exec(void *ctx, int bus, const struct dop *dop,
+                         const uint8_t *obuf, uint8_t *ibuf)
+{
+    struct adapters_ctx *actx = ctx;
+
+    return dop_exec(actx->adapters[bus], dop, obuf, ibuf);
+}
+
+int remote_serve(struct adapter **adapters, int nadapters, const char *addr)
+{
+    struct adapters_ctx actx = {
+        .adapters = adapters,
+        .nadapters = nadapters
+    };
+    struct remote_backend be = {
+        .ctx = &actx,
+        .nbus = nadapters,
+        .attach = adapters_attach,
+        .exec = adapters_exec
+    };
+
+    return remote_serve_backend(addr, &be);
+}
@@ -0,0 +1,349 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+#define DFLT_HOST "localhost"
+
+uint64_t remote_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Anything with a '/' in it is a Unix socket, else [host]:port */
+static int is_unix(const char *addr)
+{
+    return strchr(addr, '/') != NULL;
+}
+
+static int unix_addr(const char *path, struct sockaddr_un *sa)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa->sun_path)) {
+        LOGE("REMOTE: Socket name too long: %s\n", path);
+        return -1;
+    }
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+/* Split "[host]:port" into getaddrinfo() result. Caller frees. */
+static struct addrinfo *inet_addr_info(const char *addr, int passive)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = passive ? AI_PASSIVE : 0
+    };
+    struct addrinfo *res;
+    char *host = strdup(addr);
+    char *port = strrchr(host, ':');
+    int rc;
+
+    if (port == NULL) {
+        /* Port only */
+        port = host;
+        host = NULL;
+    } else {
+        *port++ = 0;
+    }
+    if (host && host[0] == 0 && !passive) {
+        rc = getaddrinfo(DFLT_HOST, port, &hints, &res);
+    } else {
+        rc = getaddrinfo(host && host[0] ? host : NULL, port, &hints, &res);
+    }
+    free(host ? host : port);
+    if (rc) {
+        LOGE("REMOTE: Can't resolve %s: %s\n", addr, gai_strerror(rc));
+        return NULL;
+    }
+    return res;
+}
+
+/* Latency matters more than anything else on this link */
+static void tune_socket(int fd, int family)
+{
+    int one = 1;
+
+    if (family != AF_UNIX)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int remote_connect(const char *addr)
+{
+    struct addrinfo *res, *ai;
+    struct sockaddr_un sa;
+    int fd = -1;
+
+    if (is_unix(addr)) {
+        if (unix_addr(addr, &sa))
+            return -1;
+        ASSURE((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+            LOGE("REMOTE: Can't connect to %s: %s\n", addr, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    if ((res = inet_addr_info(addr, 0)) == NULL)
+        return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            tune_socket(fd, ai->ai_family);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd == -1)
+        LOGE("REMOTE: Can't connect to %s: %s\n", addr, strerror(errno));
+
+    return fd;
+}
+
+int remote_listen(const char *addr)
+{
+    struct addrinfo *res, *ai;
+    struct sockaddr_un sa;
+    int fd = -1, one = 1;
+
+    if (is_unix(addr)) {
+        if (unix_addr(addr, &sa))
+            return -1;
+        unlink(addr);
+        ASSURE((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+        if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+            goto listen_err;
+    } else {
+        if ((res = inet_addr_info(addr, 1)) == NULL)
+            return -1;
+        for (ai = res; ai; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                        ai->ai_protocol);
+            if (fd == -1)
+                continue;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd == -1)
+            goto listen_err;
+    }
+    if (listen(fd, REMOTE_MAX_CLIENTS) == -1)
+        goto listen_err;
+
+    return fd;
+listen_err:
+    LOGE("REMOTE: Can't listen on %s: %s\n", addr, strerror(errno));
+    if (fd != -1)
+        close(fd);
+    return -1;
+}
+
+void remote_unlisten(const char *addr, int fd)
+{
+    close(fd);
+    if (is_unix(addr))
+        unlink(addr);
+}
+
+/* Header and payload in one go. Returns 0 on success. */
+int remote_send(int fd, rframe_t type, uint32_t seq, int nops,
+                const void *payload, int len)
+{
+    struct rframe hdr = {
+        .magic = htonl(REMOTE_MAGIC),
+        .seq = htonl(seq),
+        .nops = htons(nops),
+        .type = type,
+        .version = REMOTE_VERSION,
+        .len = htonl(len)
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr,.iov_len = sizeof(hdr)},
+        {.iov_base = (void *)payload,.iov_len = len}
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = len ? 2 : 1
+    };
+    ssize_t rc, left = sizeof(hdr) + len;
+
+    ASSERT(len <= REMOTE_MAX_PAYLOAD);
+    while (left > 0) {
+        rc = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        left -= rc;
+        /* Partial write, skip what's gone */
+        while (rc > 0 && msg.msg_iovlen) {
+            if ((size_t)rc >= msg.msg_iov->iov_len) {
+                rc -= msg.msg_iov->iov_len;
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            } else {
+                msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + rc;
+                msg.msg_iov->iov_len -= rc;
+                rc = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, int len)
+{
+    ssize_t rc;
+    char *p = buf;
+
+    while (len > 0) {
+        rc = recv(fd, p, len, MSG_WAITALL);
+        if (rc == 0)
+            return -1;
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/* Header to host byte-order and sanity-check it. Returns 0 if OK. */
+static int unpack_hdr(struct rframe *hdr, int maxlen)
+{
+    hdr->magic = ntohl(hdr->magic);
+    hdr->seq = ntohl(hdr->seq);
+    hdr->nops = ntohs(hdr->nops);
+    hdr->len = ntohl(hdr->len);
+
+    if (hdr->magic != REMOTE_MAGIC || hdr->version != REMOTE_VERSION) {
+        LOGE("REMOTE: Bad frame (magic 0x%08X version %d)\n", hdr->magic,
+             hdr->version);
+        return -1;
+    }
+    if (hdr->len > (uint32_t)maxlen) {
+        LOGE("REMOTE: Frame too large (%u bytes)\n", hdr->len);
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive one frame. Header returned in host byte-order. Returns payload
+ * length or -1 on error/EOF. */
+int remote_recv(int fd, struct rframe *hdr, void *payload, int maxlen)
+{
+    if (recv_all(fd, hdr, sizeof(*hdr)))
+        return -1;
+    if (unpack_hdr(hdr, maxlen))
+        return -1;
+    if (hdr->len && recv_all(fd, payload, hdr->len))
+        return -1;
+
+    return hdr->len;
+}
+
+/* As remote_recv but takes only what has arrived. <got> is the number of
+ * bytes of the frame received so far, 0 when starting a new one. Returns 1
+ * when the frame is complete, 0 if more is to come or -1 on error/EOF. */
+int remote_recv_nb(int fd, struct rframe *hdr, void *payload, int maxlen,
+                   int *got)
+{
+    const int hsz = sizeof(*hdr);
+    ssize_t rc;
+
+    while (*got < hsz || *got < hsz + (int)hdr->len) {
+        if (*got < hsz)
+            rc = recv(fd, (char *)hdr + *got, hsz - *got, MSG_DONTWAIT);
+        else
+            rc = recv(fd, (char *)payload + *got - hsz,
+                      hsz + hdr->len - *got, MSG_DONTWAIT);
+        if (rc == 0)
+            return -1;
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        *got += rc;
+        if (*got == hsz && unpack_hdr(hdr, maxlen))
+            return -1;
+    }
+    *got = 0;
+    return 1;
+}
+
+void remote_dop_pack(uint8_t *buf, const struct dop *dop)
+{
+    struct dop net = {
+        .op = dop->op,
+        .flags = dop->flags,
+        .arg = htons(dop->arg),
+        .osz = htons(dop->osz),
+        .isz = htons(dop->isz)
+    };
+
+    memcpy(buf, &net, sizeof(net));
+}
+
+void remote_dop_unpack(struct dop *dop, const uint8_t *buf)
+{
+    memcpy(dop, buf, sizeof(*dop));
+    dop->arg = ntohs(dop->arg);
+    dop->osz = ntohs(dop->osz);
+    dop->isz = ntohs(dop->isz);
+}
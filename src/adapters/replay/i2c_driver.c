@@ -0,0 +1,96 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include <stdint.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+void replayi2c_start(struct ddata *ddata)
+{
+    replay_call(ddata, DOP_I2C_START, 0, NULL, 0, NULL, 0);
+}
+
+void replayi2c_stop(struct ddata *ddata)
+{
+    replay_call(ddata, DOP_I2C_STOP, 0, NULL, 0, NULL, 0);
+}
+
+void replayi2c_autoAck(struct ddata *ddata, int state)
+{
+    replay_call(ddata, DOP_I2C_AUTOACK, state, NULL, 0, NULL, 0);
+}
+
+void replayi2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    replay_call(ddata, DOP_I2C_RECEIVEBYTE, 0, NULL, 0, data, 1);
+}
+
+/* Recorded from an adapter without probe if not next, in which case the
+ * start, address and stop that were used instead follow */
+int replayi2c_probe(struct ddata *ddata, uint8_t addr)
+{
+    if (replay_next_op(ddata) != DOP_I2C_PROBE)
+        return -1;
+    return replay_call(ddata, DOP_I2C_PROBE, addr, NULL, 0, NULL, 0);
+}
+
+/* As probe, the probes used instead follow if not next */
+int replayi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                   uint8_t *present)
+{
+    if (replay_next_op(ddata) != DOP_I2C_SCAN)
+        return -1;
+    return replay_call(ddata, DOP_I2C_SCAN, first | last << 8, NULL, 0,
+                       present, I2C_SCAN_BYTES);
+}
+
+/* Returns 1 if ACK:ed */
+int replayi2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    return replay_call(ddata, DOP_I2C_SENDBYTE, data, &data, 1, NULL, 0);
+}
+
+void replayi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    replay_call(ddata, DOP_I2C_SENDDATA, 0, data, sz, NULL, 0);
+}
+
+void replayi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    replay_call(ddata, DOP_I2C_RECEIVEDATA, 0, NULL, 0, data, sz);
+}
+
+void replayi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                               int outsz, uint8_t *indata, int insz)
+{
+    replay_call(ddata, DOP_I2C_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
+
+uint16_t replayi2c_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return replay_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+int replayi2c_configure(struct ddata *ddata)
+{
+    return 0;
+}
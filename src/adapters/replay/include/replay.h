@@ -0,0 +1,48 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef replay_h
+#define replay_h
+/***************************************************************************
+ * Public api
+ ***************************************************************************/
+
+/* Replay adapter. Serves the calls of the adapter with the same role and
+ * index in a log recorded by ehwe -R (see record.h). A call not matching
+ * the recorded one, in method, arguments or bytes out, is a divergence and
+ * ends the process. */
+struct replay {
+    char *fname;                /* Recorded log */
+};
+
+/* Valid regex-i role patterns for replay */
+#define REPLAY_ROLES "SPI|I2C"
+
+/* Exit status on divergence */
+#define REPLAY_EXIT_DIVERGED 3
+
+/* Forward declaration of 'struct adapter' required to avoid mutual header
+ * inclusion */
+struct adapter;
+
+int replay_parse(const char *adapterstr, struct adapter *adapter);
+int replay_init_adapter(struct adapter *adapter);
+int replay_deinit_adapter(struct adapter *adapter);
+
+#endif                          //replay_h
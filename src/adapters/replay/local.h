@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef replay_local_h
+#define replay_local_h
+/***************************************************************************
+ * Module-local api
+ ***************************************************************************/
+#include <liblog/log.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <driver.h>
+#include <dop.h>
+#include <record.h>
+
+/* Driver companion - NOTE: unique for each driver. Must NOT be public */
+struct ddata {
+    const char *fname;
+    const uint8_t *map;         /* All of log, read-only */
+    size_t mapsz;
+    const uint8_t *cur;         /* Next record to look at */
+    const uint8_t *end;         /* End of records */
+    int adapter;                /* Recorded adapter number served */
+    unsigned long ncalls;       /* Calls served */
+    /* Owned by driver */
+    union {
+        struct driverAPI_any *any;
+        struct driverAPI_spi *spi;
+        struct driverAPI_i2c *i2c;
+    } driver;
+};
+
+/***************************************************************************
+ * Log (replay.c)
+ ***************************************************************************/
+/* Serve one call from the log. Returns the recorded result, in-data is
+ * copied to ibuf. Does not return on divergence. */
+int replay_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz);
+
+/* Op of the call replay_call would serve next, DOP_NONE if none */
+dop_t replay_next_op(struct ddata *ddata);
+
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void replayspi_setCS(struct ddata *ddata, int state);
+void replayspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void replayspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t replayspi_getStatus(struct ddata *ddata, uint16_t flags);
+int replayspi_configure(struct ddata *ddata);
+void replayspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                               int outsz, uint8_t *indata, int insz);
+void replayspi_sendrecieveData_ncs(struct ddata *ddata,
+                                   const uint8_t *outbuf, int outsz,
+                                   uint8_t *indata, int insz);
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void replayi2c_start(struct ddata *ddata);
+void replayi2c_stop(struct ddata *ddata);
+void replayi2c_autoAck(struct ddata *ddata, int state);
+int replayi2c_probe(struct ddata *ddata, uint8_t addr);
+int replayi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                   uint8_t *present);
+void replayi2c_receiveByte(struct ddata *ddata, uint8_t *data);
+int replayi2c_sendByte(struct ddata *ddata, uint8_t data);
+void replayi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void replayi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+void replayi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                               int outsz, uint8_t *indata, int insz);
+uint16_t replayi2c_getStatus(struct ddata *ddata, uint16_t flags);
+int replayi2c_configure(struct ddata *ddata);
+
+#endif                          //replay_local_h
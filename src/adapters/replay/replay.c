@@ -0,0 +1,471 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include "adapters_config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <liblog/log.h>
+#include <adapters.h>
+#include <driver.h>
+#include <replay.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+static regex_t preg;            /* Compiled regular expression for full
+                                   adapter-string parsing */
+
+#define REGEX_PATT \
+  "^(" REPLAY_ROLES \
+  "):(" INDEX \
+  "):(" ADAPTERS \
+  "):(" FILENAME \
+")$"
+
+#define REGEX_NSUB (4+1)
+
+/* Convenience variables: */
+/*    SPI driver */
+static const struct driver_caps replayspi_caps = {
+    .latency_us = 1,
+    .flags = DCAP_WRITE_READ,
+};
+
+static struct driverAPI_spi replayspi_driver = {
+    .ddata = NULL,
+    .caps = &replayspi_caps,
+    .sendData = replayspi_sendData,
+    .sendrecieveData = replayspi_sendrecieveData,
+    .sendrecieveData_ncs = replayspi_sendrecieveData_ncs,
+    .setCS = replayspi_setCS,
+    .receiveData = replayspi_receiveData,
+    .getStatus = replayspi_getStatus,
+    .actuate_config = replayspi_configure,
+    .newddata = NULL,
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               },
+};
+
+/*    I2C driver */
+static const struct driver_caps replayi2c_caps = {
+    .latency_us = 1,
+};
+
+static struct driverAPI_i2c replayi2c_driver = {
+    .ddata = NULL,
+    .caps = &replayi2c_caps,
+    .sendByte = replayi2c_sendByte,
+    .receiveByte = replayi2c_receiveByte,
+    .sendData = replayi2c_sendData,
+    .receiveData = replayi2c_receiveData,
+    .sendrecieveData = replayi2c_sendrecieveData,
+    .start = replayi2c_start,
+    .stop = replayi2c_stop,
+    .autoAck = replayi2c_autoAck,
+    .probe = replayi2c_probe,
+    .scan = replayi2c_scan,
+    .getStatus = replayi2c_getStatus,
+    .actuate_config = replayi2c_configure,
+    .newddata = NULL,
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               },
+};
+
+/***************************************************************************
+ * Log
+ ***************************************************************************/
+/* Next record at or after ddata->cur, NULL if none. Stops at a truncated
+ * or damaged record as if the log ended there. */
+static const struct rec *next_rec(struct ddata *ddata, const uint8_t **pos)
+{
+    const struct rec *r;
+
+    if (*pos + sizeof(struct rec) > ddata->end)
+        return NULL;
+    r = (const struct rec *)*pos;
+    if (r->len < REC_ALIGN(sizeof(struct rec) + r->osz + r->isz) ||
+        r->len > (size_t)(ddata->end - *pos))
+        return NULL;
+    *pos += r->len;
+    return r;
+}
+
+/* Next call of the served adapter */
+static const struct rec *next_call(struct ddata *ddata)
+{
+    const struct rec *r;
+
+    while ((r = next_rec(ddata, &ddata->cur))) {
+        if (r->adapter == ddata->adapter && r->op != REC_ADAPTER)
+            return r;
+    }
+    return NULL;
+}
+
+static void hex(char *buf, size_t sz, const uint8_t *data, int n)
+{
+    int i;
+
+    buf[0] = 0;
+    for (i = 0; i < n && (size_t)(i * 3 + 4) < sz; i++)
+        sprintf(&buf[i * 3], "%02x ", data[i]);
+    if (i < n)
+        strcpy(&buf[i * 3], "...");
+}
+
+static void diverged(struct ddata *ddata, const struct rec *r, dop_t op,
+                     int arg, const uint8_t *obuf, int osz, int isz)
+{
+    char want[52], got[52];
+
+    LOGE("REPLAY: [%s] diverged at call #%lu\n", ddata->fname,
+         ddata->ncalls + 1);
+    if (r) {
+        hex(want, sizeof(want), rec_out(r), r->osz);
+        LOGE("REPLAY:   recorded: %s arg=%u osz=%u isz=%u out=[%s]\n",
+             dop_name(r->op), r->arg, r->osz, r->isz, want);
+    } else {
+        LOGE("REPLAY:   recorded: nothing, end of log\n");
+    }
+    hex(got, sizeof(got), obuf, obuf ? osz : 0);
+    LOGE("REPLAY:   called:   %s arg=%u osz=%d isz=%d out=[%s]\n",
+         dop_name(op), (uint16_t)arg, osz, isz, got);
+    exit(REPLAY_EXIT_DIVERGED);
+}
+
+dop_t replay_next_op(struct ddata *ddata)
+{
+    const uint8_t *pos = ddata->cur;
+    const struct rec *r;
+
+    while ((r = next_rec(ddata, &pos))) {
+        if (r->adapter == ddata->adapter && r->op != REC_ADAPTER)
+            return r->op;
+    }
+    return DOP_NONE;
+}
+
+int replay_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz)
+{
+    const struct rec *r = next_call(ddata);
+
+    if (!obuf)
+        osz = 0;
+    if (!r || r->op != op || r->arg != (uint16_t)arg ||
+        r->osz != (uint32_t)osz || r->isz != (uint32_t)(ibuf ? isz : 0) ||
+        memcmp(rec_out(r), obuf ? obuf : rec_out(r), osz) != 0)
+        diverged(ddata, r, op, arg, obuf, osz, isz);
+
+    if (r->isz)
+        memcpy(ibuf, rec_in(r), r->isz);
+    ddata->ncalls++;
+    return r->result;
+}
+
+/* Open log and position it at the recorded adapter with adapters role and
+ * index */
+static int open_log(struct ddata *ddata, struct adapter *adapter)
+{
+    const struct rec_file *hdr;
+    const struct rec *r;
+    const uint8_t *pos;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(ddata->fname, O_RDONLY | O_CLOEXEC)) == -1) {
+        LOGE("REPLAY: Can't open [%s]: %s\n", ddata->fname, strerror(errno));
+        return -1;
+    }
+    ASSURE_E(fstat(fd, &st) == 0, goto open_log_err);
+    if ((size_t)st.st_size < sizeof(struct rec_file)) {
+        LOGE("REPLAY: [%s] is not a recording\n", ddata->fname);
+        goto open_log_err;
+    }
+    ddata->mapsz = st.st_size;
+    ddata->map = mmap(NULL, ddata->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+    ASSURE_E(ddata->map != MAP_FAILED, goto open_log_err);
+    close(fd);
+    fd = -1;
+
+    hdr = (const struct rec_file *)ddata->map;
+    if (memcmp(hdr->magic, REC_MAGIC, sizeof(hdr->magic)) != 0) {
+        LOGE("REPLAY: [%s] is not a recording\n", ddata->fname);
+        goto open_log_err;
+    }
+    ddata->end = ddata->map + sizeof(struct rec_file);
+    if (hdr->used <= ddata->mapsz - sizeof(struct rec_file))
+        ddata->end += hdr->used;
+    else
+        LOGW("REPLAY: [%s] is truncated\n", ddata->fname);
+
+    pos = ddata->map + sizeof(struct rec_file);
+    while ((r = next_rec(ddata, &pos))) {
+        const struct rec_adapter *ra = (const void *)rec_out(r);
+
+        if (r->op == REC_ADAPTER && r->osz >= sizeof(*ra) &&
+            ra->role == adapter->role && ra->index == adapter->index) {
+            ddata->adapter = r->adapter;
+            ddata->cur = pos;
+            LOGI("REPLAY: Serving recorded adapter #%d (devid %d) of [%s]\n",
+                 r->adapter, ra->devid, ddata->fname);
+            return 0;
+        }
+    }
+    LOGE("REPLAY: No %s%d adapter recorded in [%s]\n",
+         adapter->role == ROLE_SPI ? "spi" : "i2c", adapter->index,
+         ddata->fname);
+open_log_err:
+    if (fd != -1)
+        close(fd);
+    if (ddata->map && ddata->map != MAP_FAILED)
+        munmap((void *)ddata->map, ddata->mapsz);
+    ddata->map = NULL;
+    return -1;
+}
+
+/***************************************************************************
+ * Adapter
+ ***************************************************************************/
+/* CTOR-type code-init */
+int replay_init()
+{
+    int rc;
+    char err_str[REXP_ESTRSZ];
+    static int is_init = 0;
+
+    if (is_init) {
+        LOGW("No need to run %s twice, CTOR _init has run it?\n", __func__);
+        return 0;
+    }
+    is_init = 1;
+
+    rc = regcomp(&preg, REGEX_PATT, REG_EXTENDED | REG_ICASE);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec compilation error: %s\n", err_str);
+        return rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Refined parsing of adapterstring to complete replay adapter_struct
+ *
+ * */
+int replay_parse(const char *adapterstr, struct adapter *adapter)
+{
+    int rc, i;
+    char err_str[REXP_ESTRSZ];
+    regmatch_t mtch_idxs[REGEX_NSUB];
+    char *adapterstr_cpy = strdup(adapterstr);
+    char *role_str;
+    char *index_str;
+    char *adapter_str;
+    char *fname_str;
+
+    adapter->role = ROLE_INVALID;
+    adapter->devid = DEV_INVALID;
+
+    rc = regexec(&preg, adapterstr_cpy, REGEX_NSUB, mtch_idxs, 0);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec match error: %s\n", err_str);
+        free(adapterstr_cpy);
+        return rc;
+    }
+    /* Add string terminators in substrings */
+    for (i = 1; i < REGEX_NSUB; i++) {
+        ASSURE_E(mtch_idxs[i].rm_so != -1, goto replay_parse_err);
+        adapterstr_cpy[mtch_idxs[i].rm_eo] = 0;
+    }
+
+    role_str = &adapterstr_cpy[mtch_idxs[1].rm_so];
+    index_str = &adapterstr_cpy[mtch_idxs[2].rm_so];
+    adapter_str = &adapterstr_cpy[mtch_idxs[3].rm_so];
+    fname_str = &adapterstr_cpy[mtch_idxs[4].rm_so];
+
+    LOGD("  Second level adapter-string parsing (by %s):\n", __func__);
+    LOGD("    role=%s\n", role_str);
+    LOGD("    index=%s\n", index_str);
+    LOGD("    adapter=%s\n", adapter_str);
+    LOGD("    fname=%s\n", fname_str);
+
+    ASSURE_E(strcasecmp(adapter_str, "replay") == 0, goto replay_parse_err);
+    ASSURE_E(strlen(fname_str) > 0, goto replay_parse_err);
+
+    if (strcasecmp(role_str, "spi") == 0) {
+        adapter->role = ROLE_SPI;
+    } else if (strcasecmp(role_str, "i2c") == 0) {
+        adapter->role = ROLE_I2C;
+    } else {
+        LOGE("REPLAY adapter driver can't handle role: %s\n", role_str);
+        goto replay_parse_err;
+    }
+
+    adapter->index = atoi(index_str);
+    adapter->devid = REPLAY;
+    adapter->replay = malloc(sizeof(struct replay));
+
+    /* Avoid need to strdup by using original which happens to terminate
+     * correctly as well. Ignore const as this string belongs to
+     * environment with process-long lifetime */
+    adapter->replay->fname = (char *)(&adapterstr[mtch_idxs[4].rm_so]);
+
+    free(adapterstr_cpy);
+    return 0;
+replay_parse_err:
+    free(adapterstr_cpy);
+    return -1;
+}
+
+int replay_init_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver;
+    struct ddata *ddata;
+
+    LOGI("REPLAY: Initializing adapter ID [%d]\n", adapter->devid);
+
+    ASSERT(driver = malloc(sizeof(struct driverAPI_spi)));
+    switch (adapter->role) {
+        case ROLE_SPI:
+            memcpy(driver, &replayspi_driver, sizeof(struct driverAPI_spi));
+            break;
+        case ROLE_I2C:
+            memcpy(driver, &replayi2c_driver, sizeof(struct driverAPI_i2c));
+            break;
+        default:
+            LOGE("Role [%d] is not supported by REPLAY\n", adapter->role);
+            free(driver);
+            return -1;
+    }
+    ASSERT(ddata = calloc(1, sizeof(struct ddata)));
+    ddata->fname = adapter->replay->fname;
+    if (open_log(ddata, adapter)) {
+        free(ddata);
+        free(driver);
+        return -1;
+    }
+
+    driver->ddata = ddata;
+    driver->adapter = adapter;
+    adapter->driver.any = driver;
+    ddata->driver.any = driver;
+
+    return 0;
+}
+
+int replay_deinit_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver = adapter->driver.any;
+    struct ddata *ddata = driver->ddata;
+    struct replay *replay = adapter->replay;
+    unsigned long left = 0;
+
+    while (next_call(ddata))
+        left++;
+    if (left)
+        LOGW("REPLAY: [%s] %lu calls served, %lu recorded ones never made\n",
+             ddata->fname, ddata->ncalls, left);
+    else
+        LOGI("REPLAY: [%s] %lu calls served\n", ddata->fname, ddata->ncalls);
+
+    munmap((void *)ddata->map, ddata->mapsz);
+    free(ddata);
+    free(driver);
+    free(replay);
+
+    adapter->driver.any = NULL;
+    adapter->replay = NULL;
+
+    return 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __replay_init(void)
+{
+    int rc;
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    if ((rc = replay_init())) {
+        fprintf(stderr, "Fatal error: replay_init() failed\n");
+        exit(rc);
+    }
+}
+
+void __fini __replay_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+}
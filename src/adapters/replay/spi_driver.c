@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include <stdint.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+void replayspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                               int outsz, uint8_t *indata, int insz)
+{
+    replay_call(ddata, DOP_SPI_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
+
+void replayspi_sendrecieveData_ncs(struct ddata *ddata,
+                                   const uint8_t *outbuf, int outsz,
+                                   uint8_t *indata, int insz)
+{
+    replay_call(ddata, DOP_SPI_SENDRECIEVEDATA_NCS, 0, outbuf, outsz,
+                indata, insz);
+}
+
+void replayspi_setCS(struct ddata *ddata, int state)
+{
+    ASSERT((state == 0) || (state == 1));
+    replay_call(ddata, DOP_SPI_SETCS, state, NULL, 0, NULL, 0);
+}
+
+void replayspi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    replay_call(ddata, DOP_SPI_SENDDATA, 0, data, sz, NULL, 0);
+}
+
+void replayspi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    replay_call(ddata, DOP_SPI_RECEIVEDATA, 0, NULL, 0, data, sz);
+}
+
+uint16_t replayspi_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return replay_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+int replayspi_configure(struct ddata *ddata)
+{
+    return 0;
+}
@@ -0,0 +1,249 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Client side of shmbus. Every driverAPI method becomes one dop in the
+ * request ring. Posted operations return as soon as they are queued, the
+ * rest wait for the matching entry in the response ring. Responses come in
+ * request order as the daemon executes a clients operations in sequence.
+ */
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+void shmbus_doorbell(int fd)
+{
+    char c = 0;
+
+    /* Socket may be full of doorbells already, which is just as good */
+    if (write(fd, &c, 1) == -1 && errno != EAGAIN)
+        LOGW("SHM: doorbell failed: %s\n", strerror(errno));
+}
+
+static int can_write(struct shmbus_ring *r)
+{
+    return ring_wslot(r) != NULL;
+}
+
+static int can_read(struct shmbus_ring *r)
+{
+    return ring_rslot(r) != NULL;
+}
+
+/* Wait until <ready> is true for ring. Spins briefly first as the daemon
+ * typically turns an operation around faster than a sleep/wake-up. */
+static void ring_wait(int fd, struct shmbus_ring *r,
+                      int (*ready)(struct shmbus_ring *))
+{
+    int i;
+    char c;
+
+    for (i = 0; i < SHMBUS_SPIN; i++) {
+        if (ready(r))
+            return;
+        cpu_relax();
+    }
+
+    for (;;) {
+        ring_arm(r);
+        if (ready(r)) {
+            ring_disarm(r);
+            return;
+        }
+        /* EOF means the daemon is gone. Nothing sensible to do but bail */
+        ASSURE(read(fd, &c, 1) == 1);
+        if (ready(r))
+            return;
+    }
+}
+
+int shmbus_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz)
+{
+    struct shmbus_ring *req = &ddata->shm->req;
+    struct shmbus_ring *rsp = &ddata->shm->rsp;
+    struct shmbus_slot *slot;
+    int posted, rc;
+
+    ASSERT(osz >= 0 && osz <= DOP_MAX_XFER);
+    ASSERT(isz >= 0 && isz <= DOP_MAX_XFER);
+
+    ring_wait(ddata->fd, req, can_write);
+    slot = ring_wslot(req);
+    slot->dop.op = op;
+    slot->dop.flags = 0;
+    slot->dop.arg = arg;
+    slot->dop.osz = osz;
+    slot->dop.isz = isz;
+    if (osz)
+        memcpy(slot->data, obuf, osz);
+
+    /* Decide before publishing, slot belongs to the daemon after that */
+    posted = dop_posted(&slot->dop);
+    if (ring_push(req))
+        shmbus_doorbell(ddata->fd);
+    if (posted)
+        return 0;
+
+    ring_wait(ddata->fd, rsp, can_read);
+    slot = ring_rslot(rsp);
+    ASSERT(slot->dop.op == op);
+    rc = slot->result;
+    if (isz)
+        memcpy(ibuf, slot->data, isz);
+    if (ring_pop(rsp))
+        shmbus_doorbell(ddata->fd);
+
+    return rc;
+}
+
+/* Split transfers larger than one slot. Only valid for operations where
+ * that doesn't change the meaning on the wire (i.e. not inside a
+ * sendrecieveData where CS wraps the whole thing). */
+static void shmbus_call_chunked(struct ddata *ddata, dop_t op,
+                                const uint8_t *obuf, uint8_t *ibuf, int sz)
+{
+    int n;
+
+    for (; sz > 0; sz -= n) {
+        n = sz > DOP_MAX_XFER ? DOP_MAX_XFER : sz;
+        shmbus_call(ddata, op, 0, obuf, obuf ? n : 0, ibuf, ibuf ? n : 0);
+        if (obuf)
+            obuf += n;
+        if (ibuf)
+            ibuf += n;
+    }
+}
+
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void shmspi_setCS(struct ddata *ddata, int state)
+{
+    shmbus_call(ddata, DOP_SPI_SETCS, state, NULL, 0, NULL, 0);
+}
+
+void shmspi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    shmbus_call_chunked(ddata, DOP_SPI_RECEIVEDATA, NULL, data, sz);
+}
+
+void shmspi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    shmbus_call_chunked(ddata, DOP_SPI_SENDDATA, data, NULL, sz);
+}
+
+uint16_t shmspi_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return shmbus_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+/* Configuration is owned and actuated by the daemon */
+int shmspi_configure(struct ddata *ddata)
+{
+    return 0;
+}
+
+void shmspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz)
+{
+    shmbus_call(ddata, DOP_SPI_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
+
+void shmspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz)
+{
+    shmbus_call(ddata, DOP_SPI_SENDRECIEVEDATA_NCS, 0, outbuf, outsz, indata,
+                insz);
+}
+
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void shmi2c_start(struct ddata *ddata)
+{
+    shmbus_call(ddata, DOP_I2C_START, 0, NULL, 0, NULL, 0);
+}
+
+void shmi2c_stop(struct ddata *ddata)
+{
+    shmbus_call(ddata, DOP_I2C_STOP, 0, NULL, 0, NULL, 0);
+}
+
+void shmi2c_autoAck(struct ddata *ddata, int state)
+{
+    shmbus_call(ddata, DOP_I2C_AUTOACK, state, NULL, 0, NULL, 0);
+}
+
+/* Returns 1 if ACK:ed, -1 if the served adapter can't probe */
+int shmi2c_probe(struct ddata *ddata, uint8_t addr)
+{
+    return shmbus_call(ddata, DOP_I2C_PROBE, addr, NULL, 0, NULL, 0);
+}
+
+/* Returns number found, -1 if the served adapter can't scan */
+int shmi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present)
+{
+    return shmbus_call(ddata, DOP_I2C_SCAN, first | last << 8, NULL, 0,
+                       present, I2C_SCAN_BYTES);
+}
+
+void shmi2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    shmbus_call(ddata, DOP_I2C_RECEIVEBYTE, 0, NULL, 0, data, 1);
+}
+
+int shmi2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    return shmbus_call(ddata, DOP_I2C_SENDBYTE, data, NULL, 0, NULL, 0);
+}
+
+void shmi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    shmbus_call_chunked(ddata, DOP_I2C_RECEIVEDATA, NULL, data, sz);
+}
+
+void shmi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    shmbus_call_chunked(ddata, DOP_I2C_SENDDATA, data, NULL, sz);
+}
+
+uint16_t shmi2c_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return shmbus_call(ddata, DOP_GETSTATUS, flags, NULL, 0, NULL, 0);
+}
+
+/* Configuration is owned and actuated by the daemon */
+int shmi2c_configure(struct ddata *ddata)
+{
+    return 0;
+}
+
+void shmi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz)
+{
+    shmbus_call(ddata, DOP_I2C_SENDRECIEVEDATA, 0, outbuf, outsz, indata,
+                insz);
+}
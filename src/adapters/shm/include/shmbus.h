@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef shmbus_h
+#define shmbus_h
+/***************************************************************************
+ * Public api
+ ***************************************************************************/
+
+/* Client of an ehwe adapter daemon (ehwe -z). The daemon owns the physical
+ * adapter, this side only forwards operations to it. */
+struct shmbus {
+    clkownr_t clckownr;
+    char *sockname;             /* Path to the daemons Unix socket */
+};
+
+/* Valid regex-i role patterns for shmbus */
+#define SHM_ROLES "SPI|I2C"
+
+/* Valid regex-i clock-owner patterns for shmbus */
+#define SHM_CLKOWNER "MASTER|SLAVE"
+
+/* Forward declaration of 'struct adapter' required to avoid mutual header
+ * inclusion */
+struct adapter;
+
+int shmbus_parse(const char *adapterstr, struct adapter *adapter);
+int shmbus_init_adapter(struct adapter *adapter);
+int shmbus_deinit_adapter(struct adapter *adapter);
+
+/* Daemon side. Serve adapters to clients until SIGINT or SIGTERM */
+int shmbus_serve(struct adapter **adapters, int nadapters,
+                 const char *sockname);
+
+#endif                          //shmbus_h
@@ -0,0 +1,187 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef shm_local_h
+#define shm_local_h
+/***************************************************************************
+ * Module-local api
+ ***************************************************************************/
+#include <liblog/log.h>
+#include <inttypes.h>
+#include <driver.h>
+#include <dop.h>
+
+#define SHMBUS_MAGIC        0x45485745  /* "EHWE" */
+#define SHMBUS_VERSION      1
+#define SHMBUS_SLOTS        8   /* Depth of each ring */
+#define SHMBUS_MAX_CLIENTS  32
+#define SHMBUS_SPIN         200 /* Polls of a ring before blocking on the
+                                   doorbell */
+
+struct shmbus_slot {
+    struct dop dop;
+    int32_t result;             /* Return-value of the method (rsp only) */
+    uint8_t data[DOP_MAX_XFER];
+};
+
+/* Single producer, single consumer ring. <head> is written by producer
+ * only, <tail> by consumer only. Indexes are free-running.
+ *
+ * <waiter> is set by the side about to block on the doorbell (consumer on
+ * empty, producer on full - never both at the same time). The other side
+ * swaps it out after moving its index and rings the doorbell if it was
+ * set. The doorbell is one byte on the Unix socket. */
+struct shmbus_ring {
+    uint32_t head __attribute__ ((aligned(64)));
+    uint32_t tail __attribute__ ((aligned(64)));
+    uint32_t waiter __attribute__ ((aligned(64)));
+    struct shmbus_slot slot[SHMBUS_SLOTS];
+};
+
+/* Memory shared between daemon and one client-adapter */
+struct shmbus_shm {
+    uint32_t magic;
+    uint32_t version;
+    struct shmbus_ring req;     /* Client -> daemon */
+    struct shmbus_ring rsp;     /* Daemon -> client */
+};
+
+/* Sent by client on connect */
+struct shmbus_hello {
+    uint32_t magic;
+    uint32_t version;
+    int32_t role;
+    int32_t index;
+};
+
+/* Reply from daemon. If status is 0 the fd of the shared memory follows as
+ * SCM_RIGHTS ancillary data. */
+struct shmbus_welcome {
+    uint32_t magic;
+    int32_t status;
+};
+
+/* Driver companion - NOTE: unique for each driver. Must NOT be public */
+struct ddata {
+    int fd;                     /* Socket to daemon */
+    struct shmbus_shm *shm;
+    /* Owned by driver */
+    union {
+        struct driverAPI_any *any;
+        struct driverAPI_spi *spi;
+        struct driverAPI_i2c *i2c;
+    } driver;
+};
+
+/***************************************************************************
+ * Ring primitives
+ ***************************************************************************/
+/* Slot to fill or NULL if ring is full */
+static inline struct shmbus_slot *ring_wslot(struct shmbus_ring *r)
+{
+    uint32_t head = r->head;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= SHMBUS_SLOTS)
+        return NULL;
+    return &r->slot[head % SHMBUS_SLOTS];
+}
+
+/* Slot to consume or NULL if ring is empty */
+static inline struct shmbus_slot *ring_rslot(struct shmbus_ring *r)
+{
+    uint32_t tail = r->tail;
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+        return NULL;
+    return &r->slot[tail % SHMBUS_SLOTS];
+}
+
+/* Publish filled slot. Returns true if consumer needs a doorbell. */
+static inline int ring_push(struct shmbus_ring *r)
+{
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_SEQ_CST);
+    return __atomic_exchange_n(&r->waiter, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Release consumed slot. Returns true if producer needs a doorbell. */
+static inline int ring_pop(struct shmbus_ring *r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_SEQ_CST);
+    return __atomic_exchange_n(&r->waiter, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    __asm__ __volatile__("":::"memory");
+#endif
+}
+
+static inline void ring_arm(struct shmbus_ring *r)
+{
+    __atomic_store_n(&r->waiter, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void ring_disarm(struct shmbus_ring *r)
+{
+    __atomic_store_n(&r->waiter, 0, __ATOMIC_SEQ_CST);
+}
+
+void shmbus_doorbell(int fd);
+
+/***************************************************************************
+ * Main driver apis
+ ***************************************************************************/
+int shmbus_call(struct ddata *ddata, dop_t op, int arg, const uint8_t *obuf,
+                int osz, uint8_t *ibuf, int isz);
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void shmspi_setCS(struct ddata *ddata, int state);
+void shmspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void shmspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t shmspi_getStatus(struct ddata *ddata, uint16_t flags);
+int shmspi_configure(struct ddata *ddata);
+void shmspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz);
+void shmspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz);
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void shmi2c_start(struct ddata *ddata);
+void shmi2c_stop(struct ddata *ddata);
+void shmi2c_autoAck(struct ddata *ddata, int state);
+int shmi2c_probe(struct ddata *ddata, uint8_t addr);
+int shmi2c_scan(struct ddata *ddata, uint8_t first, uint8_t last,
+                uint8_t *present);
+void shmi2c_receiveByte(struct ddata *ddata, uint8_t *data);
+int shmi2c_sendByte(struct ddata *ddata, uint8_t data);
+void shmi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void shmi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t shmi2c_getStatus(struct ddata *ddata, uint16_t flags);
+int shmi2c_configure(struct ddata *ddata);
+void shmi2c_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz);
+
+#endif                          //shm_local_h
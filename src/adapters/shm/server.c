@@ -0,0 +1,409 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Daemon side of shmbus (ehwe -z). Owns the physical adapters and executes
+ * operations queued by any number of client processes.
+ *
+ * Scheduling is round-robin, one operation per client and round, so no
+ * client can starve the others with large transfers. A client that opens a
+ * bus-transaction (I2C start, SPI CS asserted) owns that adapter until it
+ * closes it (I2C stop, SPI CS de-asserted); other clients of the same
+ * adapter are held back meanwhile. CS is assumed active low, which is the
+ * default of all current adapters.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "adapters_config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include <driver.h>
+#include <shmbus.h>
+#include "local.h"
+
+struct client {
+    int fd;
+    struct shmbus_shm *shm;
+    int aidx;                   /* Index in served adapters */
+    int autoack;                /* Clients view of I2C autoAck */
+};
+
+struct server {
+    struct adapter **adapters;
+    int nadapters;
+    struct client *owner[DEF_MAX_ADAPTERS]; /* Current transaction owner */
+    int autoack[DEF_MAX_ADAPTERS];  /* Adapters actual I2C autoAck */
+    struct client clients[SHMBUS_MAX_CLIENTS];
+    int nclients;
+};
+
+static volatile sig_atomic_t serving;
+
+static void stop_serving(int sig)
+{
+    serving = 0;
+}
+
+static int send_welcome(int fd, int status, int memfd)
+{
+    struct shmbus_welcome welcome = {
+        .magic = SHMBUS_MAGIC,
+        .status = status
+    };
+    struct iovec iov = {
+        .iov_base = &welcome,
+        .iov_len = sizeof(welcome)
+    };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    struct cmsghdr *cmsg;
+
+    if (memfd != -1) {
+        msg.msg_control = cbuf.buf;
+        msg.msg_controllen = sizeof(cbuf.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(welcome) ? 0 : -1;
+}
+
+static int find_adapter(struct server *srv, int role, int index)
+{
+    int i;
+
+    for (i = 0; i < srv->nadapters; i++) {
+        if (srv->adapters[i]->role == role && srv->adapters[i]->index == index)
+            return i;
+    }
+    return -1;
+}
+
+static void accept_client(struct server *srv, int lfd)
+{
+    struct shmbus_hello hello;
+    struct client *c;
+    int fd, memfd, aidx;
+    void *shm;
+
+    if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+        LOGW("SHM: accept failed: %s\n", strerror(errno));
+        return;
+    }
+    if (recv(fd, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello) ||
+        hello.magic != SHMBUS_MAGIC || hello.version != SHMBUS_VERSION) {
+        LOGW("SHM: Dropping client with bad hello\n");
+        close(fd);
+        return;
+    }
+    if (srv->nclients >= SHMBUS_MAX_CLIENTS) {
+        LOGW("SHM: Too many clients (%d)\n", srv->nclients);
+        send_welcome(fd, -EBUSY, -1);
+        close(fd);
+        return;
+    }
+    if ((aidx = find_adapter(srv, hello.role, hello.index)) == -1) {
+        LOGW("SHM: Client asked for unknown adapter role=%d index=%d\n",
+             hello.role, hello.index);
+        send_welcome(fd, -ENODEV, -1);
+        close(fd);
+        return;
+    }
+
+    ASSURE((memfd = memfd_create("ehwe-shmbus", MFD_CLOEXEC)) != -1);
+    ASSURE(ftruncate(memfd, sizeof(struct shmbus_shm)) == 0);
+    shm = mmap(NULL, sizeof(struct shmbus_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, memfd, 0);
+    ASSURE(shm != MAP_FAILED);
+
+    c = &srv->clients[srv->nclients];
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->shm = shm;
+    c->aidx = aidx;
+    c->autoack = 1;
+    c->shm->magic = SHMBUS_MAGIC;
+    c->shm->version = SHMBUS_VERSION;
+
+    if (send_welcome(fd, 0, memfd) != 0) {
+        LOGW("SHM: Client left during attach\n");
+        munmap(shm, sizeof(struct shmbus_shm));
+        close(memfd);
+        close(fd);
+        return;
+    }
+    close(memfd);
+    /* Doorbells are drained from poll-loop, never block on them */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    srv->nclients++;
+    LOGI("SHM: Client [%d] attached to adapter [%d] (%d clients)\n", fd,
+         aidx, srv->nclients);
+}
+
+/* Close any transaction a leaving client left open */
+static void release_bus(struct server *srv, struct client *c)
+{
+    struct adapter *adapter = srv->adapters[c->aidx];
+    struct ddata *ddata = adapter->driver.any->ddata;
+
+    if (srv->owner[c->aidx] != c)
+        return;
+
+    LOGW("SHM: Client [%d] left with bus open. Closing it.\n", c->fd);
+    if (adapter->role == ROLE_I2C)
+        adapter->driver.i2c->stop(ddata);
+    else
+        adapter->driver.spi->setCS(ddata, 1);
+    srv->owner[c->aidx] = NULL;
+}
+
+static void drop_client(struct server *srv, int n)
+{
+    struct client *c = &srv->clients[n];
+    int i;
+
+    release_bus(srv, c);
+    LOGI("SHM: Client [%d] detached\n", c->fd);
+    munmap(c->shm, sizeof(struct shmbus_shm));
+    close(c->fd);
+
+    /* Compact, keeping owner-pointers valid */
+    for (i = n; i < srv->nclients - 1; i++) {
+        srv->clients[i] = srv->clients[i + 1];
+        if (srv->owner[srv->clients[i].aidx] == &srv->clients[i + 1])
+            srv->owner[srv->clients[i].aidx] = &srv->clients[i];
+    }
+    srv->nclients--;
+}
+
+/* Next op of client can be run now */
+static int is_runnable(struct server *srv, struct client *c)
+{
+    struct shmbus_slot *slot = ring_rslot(&c->shm->req);
+
+    if (slot == NULL)
+        return 0;
+    if (srv->owner[c->aidx] != NULL && srv->owner[c->aidx] != c)
+        return 0;
+    if (!dop_posted(&slot->dop) && ring_wslot(&c->shm->rsp) == NULL)
+        return 0;
+    return 1;
+}
+
+/* Execute one operation from client if possible. Returns true if it did. */
+static int serve_one(struct server *srv, struct client *c)
+{
+    struct adapter *adapter = srv->adapters[c->aidx];
+    struct shmbus_slot *req, *rsp = NULL;
+    uint8_t scratch[DOP_MAX_XFER];
+    const struct dop *dop;
+    int rc;
+
+    if (!is_runnable(srv, c))
+        return 0;
+
+    req = ring_rslot(&c->shm->req);
+    dop = &req->dop;
+    if (!dop_posted(dop))
+        rsp = ring_wslot(&c->shm->rsp);
+
+    if (dop->osz > DOP_MAX_XFER || dop->isz > DOP_MAX_XFER) {
+        LOGE("SHM: Client [%d] sent bad sizes for %s\n", c->fd,
+             dop_name(dop->op));
+        rc = -1;
+        goto done;
+    }
+
+    switch (dop->op) {
+        case DOP_I2C_START:
+            srv->owner[c->aidx] = c;
+            break;
+        case DOP_SPI_SETCS:
+            srv->owner[c->aidx] = dop->arg ? NULL : c;
+            break;
+        case DOP_I2C_AUTOACK:
+            /* Per client state, actuated lazily below */
+            c->autoack = dop->arg;
+            rc = 0;
+            goto done;
+        default:
+            break;
+    }
+
+    /* Receiving is the only thing autoAck affects */
+    if (adapter->role == ROLE_I2C &&
+        (dop->op == DOP_I2C_RECEIVEBYTE || dop->op == DOP_I2C_RECEIVEDATA ||
+         dop->op == DOP_I2C_SENDRECIEVEDATA) &&
+        srv->autoack[c->aidx] != c->autoack &&
+        adapter->driver.i2c->autoAck != NULL) {
+        adapter->driver.i2c->autoAck(adapter->driver.any->ddata, c->autoack);
+        srv->autoack[c->aidx] = c->autoack;
+    }
+
+    rc = dop_exec(adapter, dop, req->data, rsp ? rsp->data : scratch);
+
+    if (dop->op == DOP_I2C_STOP)
+        srv->owner[c->aidx] = NULL;
+
+ done:
+    if (rsp) {
+        rsp->dop = *dop;
+        rsp->result = rc;
+        if (ring_push(&c->shm->rsp))
+            shmbus_doorbell(c->fd);
+    }
+    if (ring_pop(&c->shm->req))
+        shmbus_doorbell(c->fd);
+    return 1;
+}
+
+/* Read doorbells. Returns -1 on hang-up */
+static int drain(int fd)
+{
+    char buf[64];
+    int rc;
+
+    while ((rc = read(fd, buf, sizeof(buf))) > 0) ;
+    if (rc == 0 || (rc == -1 && errno != EAGAIN && errno != EINTR))
+        return -1;
+    return 0;
+}
+
+static int listen_on(const char *sockname)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(sockname) >= sizeof(addr.sun_path)) {
+        LOGE("SHM: Socket name too long: %s\n", sockname);
+        return -1;
+    }
+    strcpy(addr.sun_path, sockname);
+    unlink(sockname);
+
+    ASSURE((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(fd, SHMBUS_MAX_CLIENTS) == -1) {
+        LOGE("SHM: Can't listen on %s: %s\n", sockname, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int shmbus_serve(struct adapter **adapters, int nadapters,
+                 const char *sockname)
+{
+    struct server *srv;
+    struct pollfd pfds[1 + SHMBUS_MAX_CLIENTS];
+    struct sigaction sa = {.sa_handler = stop_serving };
+    int lfd, i, n, rr = 0, progress;
+
+    ASSURE(nadapters > 0 && nadapters <= DEF_MAX_ADAPTERS);
+    if ((lfd = listen_on(sockname)) == -1)
+        return -1;
+
+    ASSERT(srv = calloc(1, sizeof(struct server)));
+    srv->adapters = adapters;
+    srv->nadapters = nadapters;
+    for (i = 0; i < nadapters; i++)
+        srv->autoack[i] = -1;   /* Unknown, actuate on first use */
+
+    /* No SA_RESTART: poll must return on signal */
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    LOGI("SHM: Serving %d adapter(s) on %s\n", nadapters, sockname);
+    serving = 1;
+    while (serving) {
+        progress = 0;
+        for (i = 0; i < srv->nclients; i++)
+            progress |= serve_one(srv,
+                                  &srv->clients[(rr + i) % srv->nclients]);
+        rr++;
+        if (progress)
+            continue;
+
+        /* Idle. Ask for doorbells, then re-check to close the race with a
+         * client that queued before seeing the flag. */
+        for (i = 0; i < srv->nclients; i++)
+            ring_arm(&srv->clients[i].shm->req);
+        for (i = 0, progress = 0; i < srv->nclients; i++)
+            progress |= is_runnable(srv, &srv->clients[i]);
+        if (progress) {
+            for (i = 0; i < srv->nclients; i++)
+                ring_disarm(&srv->clients[i].shm->req);
+            continue;
+        }
+
+        pfds[0].fd = lfd;
+        pfds[0].events = POLLIN;
+        for (i = 0; i < srv->nclients; i++) {
+            pfds[1 + i].fd = srv->clients[i].fd;
+            pfds[1 + i].events = POLLIN;
+        }
+        n = srv->nclients;
+        if (poll(pfds, 1 + n, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            LOGE("SHM: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        /* Backwards as drop_client compacts the array */
+        for (i = n - 1; i >= 0; i--) {
+            if (pfds[1 + i].revents && drain(pfds[1 + i].fd) == -1)
+                drop_client(srv, i);
+        }
+        if (pfds[0].revents & POLLIN)
+            accept_client(srv, lfd);
+    }
+
+    LOGI("SHM: Stopped serving\n");
+    while (srv->nclients)
+        drop_client(srv, srv->nclients - 1);
+    close(lfd);
+    unlink(sockname);
+    free(srv);
+
+    return 0;
+}
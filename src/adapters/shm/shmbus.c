@@ -0,0 +1,385 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include "adapters_config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <regex.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <liblog/log.h>
+#include <adapters.h>
+#include <driver.h>
+#include <shmbus.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+static regex_t preg;            /* Compiled regular expression for full
+                                   adapter-string parsing */
+
+#define REGEX_PATT \
+  "^(" SHM_ROLES \
+  "):(" INDEX \
+  "):(" ADAPTERS \
+  "):(" SHM_CLKOWNER \
+  "):(" FILENAME \
+")"
+
+#define REGEX_NSUB (5+1)
+
+/* Convenience variables: */
+/*    SPI driver */
+static const struct driver_caps shmspi_caps = {
+    .max_xfer = DOP_MAX_XFER,
+    .latency_us = 20,
+    .flags = DCAP_WRITE_READ,
+};
+
+static struct driverAPI_spi shmspi_driver = {
+    .ddata = NULL,
+    .caps = &shmspi_caps,
+    .sendData = shmspi_sendData,
+    .sendrecieveData = shmspi_sendrecieveData,
+    .sendrecieveData_ncs = shmspi_sendrecieveData_ncs,
+    .setCS = shmspi_setCS,
+    .receiveData = shmspi_receiveData,
+    .getStatus = shmspi_getStatus,
+    .actuate_config = shmspi_configure,
+    .newddata = NULL,
+    /* Configuration belongs to the daemon */
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               },
+};
+
+/*    I2C driver */
+static const struct driver_caps shmi2c_caps = {
+    .max_xfer = DOP_MAX_XFER,
+    .latency_us = 20,
+};
+
+static struct driverAPI_i2c shmi2c_driver = {
+    .ddata = NULL,
+    .caps = &shmi2c_caps,
+    .sendByte = shmi2c_sendByte,
+    .receiveByte = shmi2c_receiveByte,
+    .sendData = shmi2c_sendData,
+    .receiveData = shmi2c_receiveData,
+    .sendrecieveData = shmi2c_sendrecieveData,
+    .start = shmi2c_start,
+    .stop = shmi2c_stop,
+    .autoAck = shmi2c_autoAck,
+    .probe = shmi2c_probe,
+    .scan = shmi2c_scan,
+    .getStatus = shmi2c_getStatus,
+    .actuate_config = shmi2c_configure,
+    .newddata = NULL,
+    /* Configuration belongs to the daemon */
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               },
+};
+
+/* CTOR-type code-init */
+int shmbus_init()
+{
+    int rc;
+    char err_str[REXP_ESTRSZ];
+    static int is_init = 0;
+
+    if (is_init) {
+        LOGW("No need to run %s twice, CTOR _init has run it?\n", __func__);
+        return 0;
+    }
+    is_init = 1;
+
+    rc = regcomp(&preg, REGEX_PATT, REG_EXTENDED | REG_ICASE);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec compilation error: %s\n", err_str);
+        return rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Refined parsing of adapterstring to complete shmbus adapter_struct
+ *
+ * */
+int shmbus_parse(const char *adapterstr, struct adapter *adapter)
+{
+    int rc, i;
+    char err_str[REXP_ESTRSZ];
+    regmatch_t mtch_idxs[REGEX_NSUB];
+    char *adapterstr_cpy = strdup(adapterstr);
+    char *role_str;
+    char *index_str;
+    char *adapter_str;
+    char *clkownr_str;
+    char *filename_str;
+
+    adapter->role = ROLE_INVALID;
+    adapter->devid = DEV_INVALID;
+
+    rc = regexec(&preg, adapterstr_cpy, REGEX_NSUB, mtch_idxs, 0);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec match error: %s\n", err_str);
+        free(adapterstr_cpy);
+        return rc;
+    }
+    /* Add string terminators in substrings */
+    for (i = 1; i < REGEX_NSUB; i++) {
+        ASSURE_E(mtch_idxs[i].rm_so != -1, goto shmbus_parse_err);
+        adapterstr_cpy[mtch_idxs[i].rm_eo] = 0;
+    }
+
+    role_str = &adapterstr_cpy[mtch_idxs[1].rm_so];
+    index_str = &adapterstr_cpy[mtch_idxs[2].rm_so];
+    adapter_str = &adapterstr_cpy[mtch_idxs[3].rm_so];
+    clkownr_str = &adapterstr_cpy[mtch_idxs[4].rm_so];
+    filename_str = &adapterstr_cpy[mtch_idxs[5].rm_so];
+
+    LOGD("  Second level adapter-string parsing (by %s):\n", __func__);
+    LOGD("    role=%s\n", role_str);
+    LOGD("    index=%s\n", index_str);
+    LOGD("    adapter=%s\n", adapter_str);
+    LOGD("    clkownr=%s\n", clkownr_str);
+    LOGD("    filename=%s\n", filename_str);
+
+    ASSURE_E(strcasecmp(adapter_str, "shm") == 0, goto shmbus_parse_err);
+
+    if (strcasecmp(role_str, "spi") == 0) {
+        adapter->role = ROLE_SPI;
+    } else if (strcasecmp(role_str, "i2c") == 0) {
+        adapter->role = ROLE_I2C;
+    } else {
+        LOGE("SHM adapter driver can't handle role: %s\n", role_str);
+        goto shmbus_parse_err;
+    }
+
+    adapter->index = atoi(index_str);
+    adapter->devid = SHM;
+    adapter->shmbus = malloc(sizeof(struct shmbus));
+
+    if (strcasecmp(clkownr_str, "master") == 0) {
+        adapter->shmbus->clckownr = MASTER;
+    } else if (strcasecmp(clkownr_str, "slave") == 0) {
+        adapter->shmbus->clckownr = SLAVE;
+    } else {
+        LOGE("SHM adapter driver can't handle clkownr: %s\n", clkownr_str);
+        goto shmbus_parse_err;
+    }
+
+    /* Avoid need to strdup by using original which happens to terminate
+     * correctly as well. Ignore const as this string belongs to
+     * environment with process-long lifetime */
+    adapter->shmbus->sockname = (char *)(&adapterstr[mtch_idxs[5].rm_so]);
+
+    free(adapterstr_cpy);
+    return 0;
+shmbus_parse_err:
+    free(adapterstr_cpy);
+    return -1;
+}
+
+/* Receive welcome and the memory-fd passed with it */
+static int recv_welcome(int fd, struct shmbus_welcome *welcome, int *memfd)
+{
+    struct iovec iov = {
+        .iov_base = welcome,
+        .iov_len = sizeof(*welcome)
+    };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } cbuf;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cbuf.buf,
+        .msg_controllen = sizeof(cbuf.buf)
+    };
+    struct cmsghdr *cmsg;
+
+    *memfd = -1;
+    if (recvmsg(fd, &msg, MSG_WAITALL) != sizeof(*welcome))
+        return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return 0;
+}
+
+int shmbus_init_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver;
+    struct ddata *ddata;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX };
+    struct shmbus_hello hello = {
+        .magic = SHMBUS_MAGIC,
+        .version = SHMBUS_VERSION,
+        .role = adapter->role,
+        .index = adapter->index
+    };
+    struct shmbus_welcome welcome;
+    int memfd;
+    void *shm;
+
+    LOGI("SHM: Initializing adapter ID [%d]\n", adapter->devid);
+
+    ASSERT(driver = malloc(sizeof(struct driverAPI_spi)));
+    switch (adapter->role) {
+        case ROLE_SPI:
+            memcpy(driver, &shmspi_driver, sizeof(struct driverAPI_spi));
+            break;
+        case ROLE_I2C:
+            memcpy(driver, &shmi2c_driver, sizeof(struct driverAPI_i2c));
+            break;
+        default:
+            LOGE("Role [%d] is not supported by SHM\n", adapter->role);
+            free(driver);
+            return -1;
+    }
+    ASSERT(ddata = calloc(1, sizeof(struct ddata)));
+
+    ASSURE(strlen(adapter->shmbus->sockname) < sizeof(addr.sun_path));
+    strcpy(addr.sun_path, adapter->shmbus->sockname);
+
+    ASSURE((ddata->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1);
+    if (connect(ddata->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        LOGE("SHM: No daemon listening at %s: %s\n",
+             adapter->shmbus->sockname, strerror(errno));
+        ASSURE("Can't connect to daemon" == 0);
+    }
+    ASSURE(write(ddata->fd, &hello, sizeof(hello)) == sizeof(hello));
+    ASSURE(recv_welcome(ddata->fd, &welcome, &memfd) == 0);
+    ASSURE(welcome.magic == SHMBUS_MAGIC);
+    if (welcome.status != 0 || memfd == -1) {
+        LOGE("SHM: Daemon has no %s adapter with index %d\n",
+             adapter->role == ROLE_SPI ? "SPI" : "I2C", adapter->index);
+        ASSURE("Daemon refused attach" == 0);
+    }
+
+    shm = mmap(NULL, sizeof(struct shmbus_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED, memfd, 0);
+    close(memfd);
+    ASSURE(shm != MAP_FAILED);
+    ddata->shm = shm;
+    ASSURE(ddata->shm->magic == SHMBUS_MAGIC);
+    ASSURE(ddata->shm->version == SHMBUS_VERSION);
+
+    driver->ddata = ddata;
+    driver->adapter = adapter;
+    adapter->driver.any = driver;
+    ddata->driver.any = driver;
+
+    LOGI("SHM: Attached to %s via %s\n",
+         adapter->role == ROLE_SPI ? "SPI" : "I2C", adapter->shmbus->sockname);
+    return 0;
+}
+
+int shmbus_deinit_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver = adapter->driver.any;
+    struct ddata *ddata = driver->ddata;
+    struct shmbus *shmbus = adapter->shmbus;
+
+    /* Daemon releases the bus if a transaction was left open */
+    munmap(ddata->shm, sizeof(struct shmbus_shm));
+    close(ddata->fd);
+    free(ddata);
+    free(driver);
+    free(shmbus);
+
+    adapter->driver.any = NULL;
+    adapter->shmbus = NULL;
+
+    return 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __shmbus_init(void)
+{
+    int rc;
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    if ((rc = shmbus_init())) {
+        fprintf(stderr, "Fatal error: shmbus_init() failed\n");
+        exit(rc);
+    }
+}
+
+void __fini __shmbus_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+}
@@ -0,0 +1,172 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * I2C EEPROM model, 24Cxx family. Up to 2048 bytes (24C16) use one address
+ * byte, the bits above it taken from the low bits of the device address,
+ * so that e.g. a 24C16 at 0x50 answers to 0x50-0x57. Larger ones (24C32
+ * and up) use two address bytes and one device address. Page-writes wrap within the page and are
+ * committed on stop, after which the device is busy (NACKs its address)
+ * for EEPROM_BUSY_POLLS address attempts to model the write-cycle.
+ *
+ * Argument: size in bytes or "24cNNN", e.g. eeprom@50=24c512
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <sim_model.h>
+
+#define DFLT_SIZE           (32 * 1024)     /* 24C256 */
+#define EEPROM_BUSY_POLLS   2
+
+struct sim_dev {
+    uint8_t *mem;
+    uint32_t size;
+    int alen;                   /* Address bytes */
+    int blocks;                 /* Device addresses taken, 256 bytes each */
+    int page;                   /* Page size */
+    uint32_t ptr;               /* Current address */
+    int busy;                   /* Address attempts left to NACK */
+    /* Write in progress */
+    int nbytes;                 /* Address bytes left to receive */
+    int writing;
+    uint32_t wbase;
+    int wlen;
+    uint8_t *wbuf;
+};
+
+/* Page size by capacity, as for Atmel/Microchip parts */
+static int page_size(uint32_t size)
+{
+    if (size <= 256)
+        return 8;
+    if (size <= 2048)
+        return 16;
+    if (size <= 8192)
+        return 32;
+    if (size <= 32768)
+        return 64;
+    if (size <= 65536)
+        return 128;
+    return 256;
+}
+
+static struct sim_dev *eeprom_create(const char *arg)
+{
+    struct sim_dev *dev;
+    long size;
+
+    if (arg && strncasecmp(arg, "24c", 3) == 0)
+        size = strtol(arg + 3, NULL, 10) * 1024 / 8;
+    else
+        size = sim_model_size(arg, DFLT_SIZE);
+
+    if (size < 128 || size > 65536 || (size & (size - 1)))
+        return NULL;
+
+    ASSERT(dev = calloc(1, sizeof(struct sim_dev)));
+    ASSERT(dev->mem = malloc(size));
+    memset(dev->mem, 0xFF, size);
+    dev->size = size;
+    dev->alen = size > 2048 ? 2 : 1;
+    dev->blocks = dev->alen == 1 && size > 256 ? size / 256 : 1;
+    dev->page = page_size(size);
+    ASSERT(dev->wbuf = malloc(dev->page));
+
+    return dev;
+}
+
+static void eeprom_destroy(struct sim_dev *dev)
+{
+    free(dev->wbuf);
+    free(dev->mem);
+    free(dev);
+}
+
+static int eeprom_start(struct sim_dev *dev, int addr, int read)
+{
+    if (dev->busy) {
+        dev->busy--;
+        return 0;
+    }
+    dev->writing = 0;
+    dev->wlen = 0;
+    if (!read) {
+        dev->nbytes = dev->alen;
+        /* Block bits, the address byte is shifted in below them */
+        dev->ptr = addr & (dev->blocks - 1);
+    }
+    return 1;
+}
+
+static int eeprom_write(struct sim_dev *dev, uint8_t data)
+{
+    if (dev->nbytes) {
+        dev->ptr = ((dev->ptr << 8) | data) & (dev->size - 1);
+        if (--dev->nbytes == 0) {
+            dev->wbase = dev->ptr & ~(dev->page - 1);
+            memcpy(dev->wbuf, &dev->mem[dev->wbase], dev->page);
+        }
+        return 1;
+    }
+    dev->writing = 1;
+    dev->wbuf[dev->ptr & (dev->page - 1)] = data;
+    dev->ptr = dev->wbase + ((dev->ptr + 1) & (dev->page - 1));
+    dev->wlen++;
+    return 1;
+}
+
+static uint8_t eeprom_read(struct sim_dev *dev, int ack)
+{
+    uint8_t data = dev->mem[dev->ptr];
+
+    dev->ptr = (dev->ptr + 1) & (dev->size - 1);
+    return data;
+}
+
+static int eeprom_addrs(struct sim_dev *dev)
+{
+    return dev->blocks;
+}
+
+static void eeprom_stop(struct sim_dev *dev)
+{
+    if (dev->writing) {
+        memcpy(&dev->mem[dev->wbase], dev->wbuf, dev->page);
+        dev->busy = EEPROM_BUSY_POLLS;
+    }
+    dev->writing = 0;
+    dev->nbytes = 0;
+}
+
+const struct sim_model sim_model_eeprom = {
+    .name = "eeprom",
+    .buses = SIM_I2C,
+    .dflt_addr = 0x50,
+    .create = eeprom_create,
+    .destroy = eeprom_destroy,
+    .i2c_start = eeprom_start,
+    .i2c_write = eeprom_write,
+    .i2c_read = eeprom_read,
+    .i2c_stop = eeprom_stop,
+    .i2c_addrs = eeprom_addrs,
+};
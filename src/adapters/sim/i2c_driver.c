@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+#define I2C ddata->i2c
+
+void simi2c_start(struct ddata *ddata)
+{
+    /* Repeated start goes to the same device, it just sees a new start */
+    I2C.state = SIMI2C_ADDR;
+}
+
+void simi2c_stop(struct ddata *ddata)
+{
+    if (I2C.cur && I2C.cur->model->i2c_stop)
+        I2C.cur->model->i2c_stop(I2C.cur->dev);
+    I2C.cur = NULL;
+    I2C.state = SIMI2C_IDLE;
+}
+
+void simi2c_autoAck(struct ddata *ddata, int state)
+{
+    I2C.autoAck = state;
+}
+
+static uint8_t read_byte(struct ddata *ddata, int ack)
+{
+    if (I2C.state != SIMI2C_READ) {
+        /* Nobody drives SDA */
+        return 0xFF;
+    }
+    return I2C.cur->model->i2c_read(I2C.cur->dev, ack);
+}
+
+void simi2c_receiveByte(struct ddata *ddata, uint8_t *data)
+{
+    *data = read_byte(ddata, I2C.autoAck);
+}
+
+/* Returns 1 if ACK:ed */
+int simi2c_sendByte(struct ddata *ddata, uint8_t data)
+{
+    struct sim_inst *inst;
+
+    switch (I2C.state) {
+        case SIMI2C_ADDR:
+            inst = I2C.addr[data >> 1];
+            if (inst == NULL ||
+                !inst->model->i2c_start(inst->dev, data >> 1, data & 1)) {
+                I2C.cur = NULL;
+                I2C.state = SIMI2C_NACKED;
+                return 0;
+            }
+            I2C.cur = inst;
+            I2C.state = (data & 1) ? SIMI2C_READ : SIMI2C_WRITE;
+            return 1;
+        case SIMI2C_WRITE:
+            return I2C.cur->model->i2c_write(I2C.cur->dev, data);
+        default:
+            return 0;
+    }
+}
+
+void simi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    int i;
+
+    for (i = 0; i < sz; i++) {
+        if (!simi2c_sendByte(ddata, data[i])) {
+            LOGW("SIM: I2C recipient didn't ACK as expected. %s ended "
+                 "prematurely %d(%d)\n", __func__, i, sz);
+            break;
+        }
+    }
+}
+
+/* As the Bus Pirate: last byte is NACK:ed */
+void simi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    int i;
+
+    for (i = 0; i < sz; i++)
+        data[i] = read_byte(ddata, (i < sz - 1) ? I2C.autoAck : 0);
+}
+
+uint16_t simi2c_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return flags;
+}
+
+int simi2c_configure(struct ddata *ddata)
+{
+    I2C.autoAck = 1;
+    I2C.state = SIMI2C_IDLE;
+    return 0;
+}
@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef sim_h
+#define sim_h
+/***************************************************************************
+ * Public api
+ ***************************************************************************/
+
+/* Simulated adapter. Transfers are served in-process by device models, see
+ * sim_model.h */
+struct sim {
+    clkownr_t clckownr;
+    char *models;               /* Model specification, e.g.
+                                   "eeprom@50,sensor@1e" */
+};
+
+/* Valid regex-i role patterns for sim */
+#define SIM_ROLES "SPI|I2C"
+
+/* Valid regex-i clock-owner patterns for sim */
+#define SIM_CLKOWNER "MASTER|SLAVE"
+
+/* Valid regex-i model specification */
+#define SIM_MODELS "[[:alnum:]@=,_.-]*"
+
+/* Forward declaration of 'struct adapter' required to avoid mutual header
+ * inclusion */
+struct adapter;
+
+int sim_parse(const char *adapterstr, struct adapter *adapter);
+int sim_init_adapter(struct adapter *adapter);
+int sim_deinit_adapter(struct adapter *adapter);
+
+#endif                          //sim_h
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef sim_model_h
+#define sim_model_h
+/***************************************************************************
+ * Device models for the SIM adapter
+ *
+ * A model is a set of callbacks acting as the device side of a bus. SPI
+ * models see chip-select and full-duplex byte streams, I2C models see
+ * being addressed, bytes and stop. All callbacks run in the callers
+ * context at memory speed.
+ ***************************************************************************/
+#include <stdint.h>
+
+struct sim_dev;                 /* Model instance, private to model */
+
+#define SIM_SPI (1 << 0)
+#define SIM_I2C (1 << 1)
+
+struct sim_model {
+    const char *name;
+    int buses;                  /* SIM_SPI | SIM_I2C */
+    int dflt_addr;              /* I2C 7-bit address if none given */
+
+    /* <arg> is text after '=' in specification or NULL */
+    struct sim_dev *(*create) (const char *arg);
+    void (*destroy) (struct sim_dev * dev);
+
+    /* SPI. CS asserted (selected=1) and de-asserted (selected=0) */
+    void (*select) (struct sim_dev * dev, int selected);
+    /* Full-duplex. <out> NULL clocks 0xFF, <in> NULL discards */
+    void (*xfer) (struct sim_dev * dev, const uint8_t *out, uint8_t *in,
+                  int sz);
+
+    /* I2C. Return 1 for ACK, 0 for NACK. <addr> is the 7-bit address the
+     * device was addressed at, one of the i2c_addrs() it answers to */
+    int (*i2c_start) (struct sim_dev * dev, int addr, int read);
+    int (*i2c_write) (struct sim_dev * dev, uint8_t data);
+    uint8_t(*i2c_read) (struct sim_dev * dev, int ack);
+    void (*i2c_stop) (struct sim_dev * dev);
+    /* Number of consecutive I2C addresses the device answers to, from its
+     * (aligned) base address. NULL if just the one */
+    int (*i2c_addrs) (struct sim_dev * dev);
+};
+
+/* Make model available by name. Returns 0 on success. */
+int sim_model_register(const struct sim_model *model);
+const struct sim_model *sim_model_find(const char *name);
+
+/* Register the built-in models. Safe to call more than once. */
+void sim_models_init(void);
+
+/* Create a device from "name[@addr][=arg]" for a <bus> (SIM_SPI or
+ * SIM_I2C). The model and the I2C address (model default if no @addr) are
+ * returned in <model> and <addr>. Returns NULL on error. */
+struct sim_dev *sim_model_create(const char *spec, int bus,
+                                 const struct sim_model **model, int *addr);
+
+/* Number of I2C addresses taken by <dev>, starting at its base address */
+int sim_model_i2c_addrs(const struct sim_model *model, struct sim_dev *dev);
+
+/* Parse a size argument like "4096", "64K" or "16M". Returns <dflt> if
+ * arg is NULL, -1 if malformed. */
+long sim_model_size(const char *arg, long dflt);
+
+/* Built-in models */
+extern const struct sim_model sim_model_nor;
+extern const struct sim_model sim_model_eeprom;
+extern const struct sim_model sim_model_regfile;
+
+#endif                          //sim_model_h
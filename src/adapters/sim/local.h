@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef sim_local_h
+#define sim_local_h
+/***************************************************************************
+ * Module-local api
+ ***************************************************************************/
+#include <liblog/log.h>
+#include <inttypes.h>
+#include <driver.h>
+#include <sim_model.h>
+
+#define SIM_MAX_MODELS  16      /* Registered models */
+#define SIM_MAX_DEVS    16      /* Instances per adapter */
+#define SIM_I2C_ADDRS   128
+
+struct sim_inst {
+    const struct sim_model *model;
+    struct sim_dev *dev;
+    int addr;                   /* I2C 7-bit address */
+};
+
+typedef enum {
+    SIMI2C_IDLE = 0,            /* After stop */
+    SIMI2C_ADDR,                /* After start, expecting address */
+    SIMI2C_WRITE,               /* Addressed for write */
+    SIMI2C_READ,                /* Addressed for read */
+    SIMI2C_NACKED               /* Nobody answered, ignore until stop */
+} simi2c_state_t;
+
+/* Driver companion - NOTE: unique for each driver. Must NOT be public */
+struct ddata {
+    struct sim_inst inst[SIM_MAX_DEVS];
+    int ninst;
+    union {
+        struct {
+            struct sim_inst *dev;   /* Device on CS, NULL if none */
+            int cs;             /* Electrical level, low is selected */
+        } spi;
+        struct {
+            struct sim_inst *addr[SIM_I2C_ADDRS];   /* By 7-bit address */
+            struct sim_inst *cur;   /* Addressed device */
+            simi2c_state_t state;
+            int autoAck;
+        } i2c;
+    };
+    /* Owned by driver */
+    union {
+        struct driverAPI_any *any;
+        struct driverAPI_spi *spi;
+        struct driverAPI_i2c *i2c;
+    } driver;
+};
+
+/***************************************************************************
+ * Models (models.c)
+ ***************************************************************************/
+int sim_models_attach(struct ddata *ddata, int bus, const char *spec);
+void sim_models_detach(struct ddata *ddata);
+
+/***************************************************************************
+ * SPI
+ ***************************************************************************/
+void simspi_setCS(struct ddata *ddata, int state);
+void simspi_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void simspi_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t simspi_getStatus(struct ddata *ddata, uint16_t flags);
+int simspi_configure(struct ddata *ddata);
+void simspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz);
+void simspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz);
+/***************************************************************************
+ * I2C
+ ***************************************************************************/
+void simi2c_start(struct ddata *ddata);
+void simi2c_stop(struct ddata *ddata);
+void simi2c_autoAck(struct ddata *ddata, int state);
+void simi2c_receiveByte(struct ddata *ddata, uint8_t *data);
+int simi2c_sendByte(struct ddata *ddata, uint8_t data);
+void simi2c_receiveData(struct ddata *ddata, uint8_t *data, int sz);
+void simi2c_sendData(struct ddata *ddata, const uint8_t *data, int sz);
+uint16_t simi2c_getStatus(struct ddata *ddata, uint16_t flags);
+int simi2c_configure(struct ddata *ddata);
+
+#endif                          //sim_local_h
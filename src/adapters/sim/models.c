@@ -0,0 +1,212 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+static const struct sim_model *models[SIM_MAX_MODELS];
+static int nmodels;
+
+int sim_model_register(const struct sim_model *model)
+{
+    if (sim_model_find(model->name)) {
+        LOGW("SIM: Model %s already registered\n", model->name);
+        return 0;
+    }
+    if (nmodels >= SIM_MAX_MODELS) {
+        LOGE("SIM: Too many models, can't register %s\n", model->name);
+        return -1;
+    }
+    models[nmodels++] = model;
+    return 0;
+}
+
+const struct sim_model *sim_model_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nmodels; i++) {
+        if (strcasecmp(models[i]->name, name) == 0)
+            return models[i];
+    }
+    return NULL;
+}
+
+long sim_model_size(const char *arg, long dflt)
+{
+    char *end;
+    long sz;
+
+    if (arg == NULL || arg[0] == 0)
+        return dflt;
+
+    sz = strtol(arg, &end, 0);
+    switch (*end) {
+        case 'k':
+        case 'K':
+            sz *= 1024;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            sz *= 1024 * 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*end != 0 || sz <= 0)
+        return -1;
+    return sz;
+}
+
+void sim_models_init(void)
+{
+    static int is_init = 0;
+
+    if (is_init)
+        return;
+    is_init = 1;
+    sim_model_register(&sim_model_nor);
+    sim_model_register(&sim_model_eeprom);
+    sim_model_register(&sim_model_regfile);
+}
+
+struct sim_dev *sim_model_create(const char *spec, int bus,
+                                 const struct sim_model **model, int *addr)
+{
+    char *cpy = strdup(spec);
+    char *at, *eq;
+    struct sim_dev *dev = NULL;
+    int n;
+
+    if ((eq = strchr(cpy, '=')))
+        *eq++ = 0;
+    if ((at = strchr(cpy, '@')))
+        *at++ = 0;
+
+    if ((*model = sim_model_find(cpy)) == NULL) {
+        LOGE("SIM: Unknown model: %s\n", cpy);
+        goto out;
+    }
+    if (!((*model)->buses & bus)) {
+        LOGE("SIM: Model %s can't sit on a %s bus\n", cpy,
+             bus == SIM_SPI ? "SPI" : "I2C");
+        goto out;
+    }
+    *addr = at ? strtol(at, NULL, 16) : (*model)->dflt_addr;
+    if (bus == SIM_I2C && (*addr < 0 || *addr >= SIM_I2C_ADDRS)) {
+        LOGE("SIM: Bad I2C address 0x%02X for %s\n", *addr, cpy);
+        goto out;
+    }
+    if ((dev = (*model)->create(eq)) == NULL) {
+        LOGE("SIM: Model %s rejected argument: %s\n", cpy, eq ? eq : "");
+        goto out;
+    }
+    if (bus == SIM_I2C) {
+        n = sim_model_i2c_addrs(*model, dev);
+        if ((*addr & (n - 1)) || *addr + n > SIM_I2C_ADDRS) {
+            LOGE("SIM: %s takes %d addresses, 0x%02X isn't a base for them\n",
+                 cpy, n, *addr);
+            (*model)->destroy(dev);
+            dev = NULL;
+        }
+    }
+out:
+    free(cpy);
+    return dev;
+}
+
+int sim_model_i2c_addrs(const struct sim_model *model, struct sim_dev *dev)
+{
+    return model->i2c_addrs ? model->i2c_addrs(dev) : 1;
+}
+
+/* Create one instance from "name[@addr][=arg]" */
+static int attach_one(struct ddata *ddata, int bus, char *item)
+{
+    struct sim_inst *inst;
+    int i, n;
+
+    if (ddata->ninst >= SIM_MAX_DEVS) {
+        LOGE("SIM: Too many devices (max %d)\n", SIM_MAX_DEVS);
+        return -1;
+    }
+    inst = &ddata->inst[ddata->ninst];
+
+    if ((inst->dev = sim_model_create(item, bus, &inst->model,
+                                      &inst->addr)) == NULL)
+        return -1;
+    n = bus == SIM_I2C ? sim_model_i2c_addrs(inst->model, inst->dev) : 0;
+    for (i = 0; i < n; i++) {
+        if (ddata->i2c.addr[inst->addr + i]) {
+            LOGE("SIM: I2C address 0x%02X is taken\n", inst->addr + i);
+            inst->model->destroy(inst->dev);
+            return -1;
+        }
+    }
+
+    if (bus == SIM_SPI) {
+        if (ddata->spi.dev) {
+            LOGE("SIM: Only one device per SPI adapter (CS)\n");
+            inst->model->destroy(inst->dev);
+            return -1;
+        }
+        ddata->spi.dev = inst;
+    } else {
+        for (i = 0; i < n; i++)
+            ddata->i2c.addr[inst->addr + i] = inst;
+    }
+    ddata->ninst++;
+
+    if (bus == SIM_I2C)
+        LOGI("SIM: %s attached at 0x%02X\n", inst->model->name, inst->addr);
+    else
+        LOGI("SIM: %s attached\n", inst->model->name);
+    return 0;
+}
+
+/* Instantiate all models in <spec>, e.g. "eeprom@50,sensor@1e" */
+int sim_models_attach(struct ddata *ddata, int bus, const char *spec)
+{
+    char *cpy = strdup(spec);
+    char *item, *saveptr = NULL;
+    int rc = 0;
+
+    for (item = strtok_r(cpy, ",", &saveptr); item && rc == 0;
+         item = strtok_r(NULL, ",", &saveptr))
+        rc = attach_one(ddata, bus, item);
+
+    free(cpy);
+    return rc;
+}
+
+void sim_models_detach(struct ddata *ddata)
+{
+    int i;
+
+    for (i = 0; i < ddata->ninst; i++)
+        ddata->inst[i].model->destroy(ddata->inst[i].dev);
+    ddata->ninst = 0;
+}
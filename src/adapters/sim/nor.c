@@ -0,0 +1,363 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * SPI NOR flash model. Behaves as a Winbond W25Qxx of the given size
+ * (default 16M): JEDEC-ID, SFDP, normal/fast/dual/quad output read (data
+ * is shifted out on MISO only), page-program, 4K/32K/64K sector-erase,
+ * chip-erase and status register with WEL. Erase and program complete
+ * instantly, WIP is never seen set.
+ *
+ * Argument: size, e.g. nor=4M
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <sim_model.h>
+
+#define DFLT_SIZE       (16 * 1024 * 1024)
+#define MAX_SIZE        (16 * 1024 * 1024)  /* 3-byte addressing */
+#define PAGE_SIZE       256
+#define JEDEC_MANUF     0xEF    /* Winbond */
+#define JEDEC_TYPE      0x40    /* W25Q, SPI */
+
+#define SR_WIP          0x01
+#define SR_WEL          0x02
+
+typedef enum {
+    CMD_NOP = 0x00,
+    CMD_WRSR = 0x01,
+    CMD_PP = 0x02,
+    CMD_READ = 0x03,
+    CMD_WRDI = 0x04,
+    CMD_RDSR = 0x05,
+    CMD_WREN = 0x06,
+    CMD_FAST_READ = 0x0B,
+    CMD_SE = 0x20,
+    CMD_DOR = 0x3B,
+    CMD_BE32 = 0x52,
+    CMD_SFDP = 0x5A,
+    CMD_CE = 0x60,
+    CMD_QOR = 0x6B,
+    CMD_RDID = 0x9F,
+    CMD_RDP = 0xAB,
+    CMD_DP = 0xB9,
+    CMD_CE2 = 0xC7,
+    CMD_BE = 0xD8,
+} nor_cmd_t;
+
+typedef enum {
+    ST_CMD = 0,                 /* Next byte is a command */
+    ST_ADDR,                    /* Collecting address */
+    ST_DUMMY,                   /* Dummy cycles before data */
+    ST_DATA,                    /* Data-phase of command */
+    ST_IGNORE                   /* Unknown command, ignore until CS */
+} nor_state_t;
+
+struct sim_dev {
+    uint8_t *mem;
+    uint32_t size;
+    uint8_t sr;
+    uint8_t sfdp[0x54];
+    /* Current command */
+    nor_state_t state;
+    uint8_t cmd;
+    int nbytes;                 /* Address or dummy bytes left */
+    uint32_t addr;
+    int pos;                    /* Data-phase byte counter */
+    int erase;                  /* Pending erase (actuated on CS high) */
+};
+
+static int ilog2(uint32_t v)
+{
+    int n = 0;
+
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+/* Minimal SFDP: header + JEDEC basic flash parameter table, 9 DWORDs */
+static void sfdp_build(struct sim_dev *dev)
+{
+    uint8_t *p = dev->sfdp;
+    uint32_t bits = dev->size * 8 - 1;
+
+    memset(p, 0xFF, sizeof(dev->sfdp));
+    memcpy(p, "SFDP", 4);
+    p[4] = 0x00;                /* Minor rev */
+    p[5] = 0x01;                /* Major rev */
+    p[6] = 0x00;                /* NPH-1 */
+    p[7] = 0xFF;
+    /* Parameter header 0: JEDEC basic */
+    p[8] = 0x00;                /* ID LSB */
+    p[9] = 0x00;                /* Minor rev */
+    p[10] = 0x01;               /* Major rev */
+    p[11] = 9;                  /* Length in DWORDs */
+    p[12] = 0x30;               /* Table pointer */
+    p[13] = 0x00;
+    p[14] = 0x00;
+    p[15] = 0xFF;               /* ID MSB */
+    /* DWORD1: 4K erase supported, opcode 0x20, 3-byte addr, 1-1-2 & 1-1-4
+     * fast read supported */
+    p[0x30] = 0xE5;
+    p[0x31] = CMD_SE;
+    p[0x32] = 0x41;
+    p[0x33] = 0xFF;
+    /* DWORD2: density in bits - 1 */
+    p[0x34] = bits;
+    p[0x35] = bits >> 8;
+    p[0x36] = bits >> 16;
+    p[0x37] = bits >> 24;
+    /* DWORD8-9: sector types 4K/0x20, 32K/0x52, 64K/0xD8 */
+    p[0x4C] = 12;
+    p[0x4D] = CMD_SE;
+    p[0x4E] = 15;
+    p[0x4F] = CMD_BE32;
+    p[0x50] = 16;
+    p[0x51] = CMD_BE;
+}
+
+static struct sim_dev *nor_create(const char *arg)
+{
+    struct sim_dev *dev;
+    long size = sim_model_size(arg, DFLT_SIZE);
+
+    if (size < PAGE_SIZE || size > MAX_SIZE || (size & (size - 1)))
+        return NULL;
+
+    ASSERT(dev = calloc(1, sizeof(struct sim_dev)));
+    ASSERT(dev->mem = malloc(size));
+    memset(dev->mem, 0xFF, size);
+    dev->size = size;
+    sfdp_build(dev);
+
+    return dev;
+}
+
+static void nor_destroy(struct sim_dev *dev)
+{
+    free(dev->mem);
+    free(dev);
+}
+
+static void nor_select(struct sim_dev *dev, int selected)
+{
+    uint32_t base, len = 0;
+
+    if (selected) {
+        dev->state = ST_CMD;
+        return;
+    }
+
+    /* Deselect actuates and ends any write-type command */
+    if (dev->erase && dev->nbytes == 0) {
+        switch (dev->cmd) {
+            case CMD_SE:
+                len = 4 * 1024;
+                break;
+            case CMD_BE32:
+                len = 32 * 1024;
+                break;
+            case CMD_BE:
+                len = 64 * 1024;
+                break;
+            default:
+                len = dev->size;
+                dev->addr = 0;
+                break;
+        }
+        base = dev->addr & ~(len - 1) & (dev->size - 1);
+        memset(&dev->mem[base], 0xFF, len);
+    }
+    if (dev->cmd == CMD_PP || dev->erase || dev->cmd == CMD_WRSR)
+        dev->sr &= ~SR_WEL;
+    dev->erase = 0;
+    dev->cmd = 0;
+    dev->state = ST_CMD;
+}
+
+static void nor_command(struct sim_dev *dev, uint8_t cmd)
+{
+    dev->cmd = cmd;
+    dev->addr = 0;
+    dev->pos = 0;
+    dev->nbytes = 0;
+    dev->state = ST_DATA;
+
+    switch (cmd) {
+        case CMD_READ:
+            dev->nbytes = 3;
+            dev->state = ST_ADDR;
+            break;
+        case CMD_FAST_READ:
+        case CMD_DOR:
+        case CMD_QOR:
+        case CMD_SFDP:
+            dev->nbytes = 3;
+            dev->state = ST_ADDR;
+            break;
+        case CMD_PP:
+            dev->nbytes = 3;
+            dev->state = (dev->sr & SR_WEL) ? ST_ADDR : ST_IGNORE;
+            break;
+        case CMD_SE:
+        case CMD_BE32:
+        case CMD_BE:
+            dev->nbytes = 3;
+            dev->state = (dev->sr & SR_WEL) ? ST_ADDR : ST_IGNORE;
+            dev->erase = (dev->sr & SR_WEL) != 0;
+            break;
+        case CMD_CE:
+        case CMD_CE2:
+            dev->erase = (dev->sr & SR_WEL) != 0;
+            dev->state = ST_IGNORE;
+            break;
+        case CMD_WREN:
+            dev->sr |= SR_WEL;
+            dev->state = ST_IGNORE;
+            break;
+        case CMD_WRDI:
+            dev->sr &= ~SR_WEL;
+            dev->state = ST_IGNORE;
+            break;
+        case CMD_RDSR:
+        case CMD_RDID:
+        case CMD_WRSR:
+            break;
+        case CMD_NOP:
+        case CMD_RDP:
+        case CMD_DP:
+            dev->state = ST_IGNORE;
+            break;
+        default:
+            LOGW("SIM nor: Unsupported command 0x%02X\n", cmd);
+            dev->state = ST_IGNORE;
+            break;
+    }
+}
+
+/* Returns byte shifted out on MISO */
+static uint8_t nor_data(struct sim_dev *dev, uint8_t out)
+{
+    uint8_t in = 0xFF;
+    uint32_t page;
+
+    switch (dev->cmd) {
+        case CMD_READ:
+        case CMD_FAST_READ:
+        case CMD_DOR:
+        case CMD_QOR:
+            in = dev->mem[dev->addr];
+            dev->addr = (dev->addr + 1) & (dev->size - 1);
+            break;
+        case CMD_SFDP:
+            in = dev->addr < sizeof(dev->sfdp) ? dev->sfdp[dev->addr] : 0xFF;
+            dev->addr++;
+            break;
+        case CMD_PP:
+            /* Wraps within page, can only clear bits */
+            page = dev->addr & ~(PAGE_SIZE - 1);
+            dev->mem[page + ((dev->addr + dev->pos) & (PAGE_SIZE - 1))] &= out;
+            break;
+        case CMD_RDSR:
+            in = dev->sr;
+            break;
+        case CMD_RDID:
+            in = dev->pos == 0 ? JEDEC_MANUF :
+                dev->pos == 1 ? JEDEC_TYPE :
+                dev->pos == 2 ? ilog2(dev->size) : 0xFF;
+            break;
+        case CMD_WRSR:
+            /* Protection bits are not modelled */
+            break;
+        default:
+            break;
+    }
+    dev->pos++;
+    return in;
+}
+
+static void nor_xfer(struct sim_dev *dev, const uint8_t *out, uint8_t *in,
+                     int sz)
+{
+    int i, n;
+    uint8_t o, r;
+
+    for (i = 0; i < sz; i++) {
+        /* Fast path: bulk read */
+        if (dev->state == ST_DATA && in &&
+            (dev->cmd == CMD_READ || dev->cmd == CMD_FAST_READ ||
+             dev->cmd == CMD_DOR || dev->cmd == CMD_QOR)) {
+            n = sz - i;
+            if (n > (int)(dev->size - dev->addr))
+                n = dev->size - dev->addr;
+            memcpy(&in[i], &dev->mem[dev->addr], n);
+            dev->addr = (dev->addr + n) & (dev->size - 1);
+            i += n - 1;
+            continue;
+        }
+
+        o = out ? out[i] : 0xFF;
+        r = 0xFF;
+        switch (dev->state) {
+            case ST_CMD:
+                nor_command(dev, o);
+                break;
+            case ST_ADDR:
+                dev->addr = (dev->addr << 8) | o;
+                if (--dev->nbytes == 0) {
+                    if (dev->cmd != CMD_SFDP)
+                        dev->addr &= dev->size - 1;
+                    if (dev->cmd == CMD_READ || dev->cmd == CMD_PP)
+                        dev->state = ST_DATA;
+                    else if (dev->erase)
+                        dev->state = ST_IGNORE;
+                    else {
+                        dev->nbytes = 1;
+                        dev->state = ST_DUMMY;
+                    }
+                }
+                break;
+            case ST_DUMMY:
+                if (--dev->nbytes == 0)
+                    dev->state = ST_DATA;
+                break;
+            case ST_DATA:
+                r = nor_data(dev, o);
+                break;
+            case ST_IGNORE:
+                break;
+        }
+        if (in)
+            in[i] = r;
+    }
+}
+
+const struct sim_model sim_model_nor = {
+    .name = "nor",
+    .buses = SIM_SPI,
+    .dflt_addr = -1,
+    .create = nor_create,
+    .destroy = nor_destroy,
+    .select = nor_select,
+    .xfer = nor_xfer,
+};
@@ -0,0 +1,158 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Generic register-file sensor model, laid out like the ST MEMS sensors:
+ * 256 8-bit registers with auto-incrementing register pointer.
+ *
+ * - 0x0F (WHO_AM_I) is read-only and holds the argument (default 0x33)
+ * - 0x28-0x2D hold X/Y/Z samples (16-bit little-endian). A new sample is
+ *   latched each time 0x28 is read: a running counter per axis.
+ *
+ * I2C: first byte written after the address sets the register pointer.
+ * SPI: first byte is the register, bit 7 set for read.
+ *
+ * Argument: WHO_AM_I value in hex, e.g. sensor@1e=3d
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <sim_model.h>
+
+#define REG_WHO_AM_I    0x0F
+#define REG_OUT_X_L     0x28
+#define DFLT_WHO_AM_I   0x33
+
+struct sim_dev {
+    uint8_t reg[256];
+    uint8_t ptr;
+    int first;                  /* Next byte is register pointer */
+    int spi_read;
+    uint16_t sample;
+};
+
+static struct sim_dev *regfile_create(const char *arg)
+{
+    struct sim_dev *dev;
+
+    ASSERT(dev = calloc(1, sizeof(struct sim_dev)));
+    dev->reg[REG_WHO_AM_I] = arg ? strtol(arg, NULL, 16) : DFLT_WHO_AM_I;
+    return dev;
+}
+
+static void regfile_destroy(struct sim_dev *dev)
+{
+    free(dev);
+}
+
+static uint8_t reg_read(struct sim_dev *dev)
+{
+    int i;
+
+    if (dev->ptr == REG_OUT_X_L) {
+        dev->sample++;
+        for (i = 0; i < 3; i++) {
+            uint16_t v = dev->sample * (i + 1);
+
+            dev->reg[REG_OUT_X_L + 2 * i] = v;
+            dev->reg[REG_OUT_X_L + 2 * i + 1] = v >> 8;
+        }
+    }
+    return dev->reg[dev->ptr++];
+}
+
+static void reg_write(struct sim_dev *dev, uint8_t data)
+{
+    if (dev->ptr != REG_WHO_AM_I)
+        dev->reg[dev->ptr] = data;
+    dev->ptr++;
+}
+
+/* SPI */
+static void regfile_select(struct sim_dev *dev, int selected)
+{
+    dev->first = selected;
+}
+
+static void regfile_xfer(struct sim_dev *dev, const uint8_t *out,
+                         uint8_t *in, int sz)
+{
+    int i;
+    uint8_t o, r;
+
+    for (i = 0; i < sz; i++) {
+        o = out ? out[i] : 0xFF;
+        r = 0xFF;
+        if (dev->first) {
+            dev->ptr = o & 0x7F;
+            dev->spi_read = o & 0x80;
+            dev->first = 0;
+        } else if (dev->spi_read) {
+            r = reg_read(dev);
+        } else {
+            reg_write(dev, o);
+        }
+        if (in)
+            in[i] = r;
+    }
+}
+
+/* I2C */
+static int regfile_start(struct sim_dev *dev, int addr, int read)
+{
+    dev->first = !read;
+    return 1;
+}
+
+static int regfile_write(struct sim_dev *dev, uint8_t data)
+{
+    if (dev->first) {
+        dev->ptr = data;
+        dev->first = 0;
+    } else {
+        reg_write(dev, data);
+    }
+    return 1;
+}
+
+static uint8_t regfile_read(struct sim_dev *dev, int ack)
+{
+    return reg_read(dev);
+}
+
+static void regfile_stop(struct sim_dev *dev)
+{
+    dev->first = 0;
+}
+
+const struct sim_model sim_model_regfile = {
+    .name = "sensor",
+    .buses = SIM_SPI | SIM_I2C,
+    .dflt_addr = 0x1E,
+    .create = regfile_create,
+    .destroy = regfile_destroy,
+    .select = regfile_select,
+    .xfer = regfile_xfer,
+    .i2c_start = regfile_start,
+    .i2c_write = regfile_write,
+    .i2c_read = regfile_read,
+    .i2c_stop = regfile_stop,
+};
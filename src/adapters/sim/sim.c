@@ -0,0 +1,320 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include "adapters_config.h"
+#include <sys/types.h>
+#include <regex.h>
+#include <stdint.h>
+#include <liblog/log.h>
+#include <adapters.h>
+#include <driver.h>
+#include <sim.h>
+#include <string.h>
+#include <stdlib.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+static regex_t preg;            /* Compiled regular expression for full
+                                   adapter-string parsing */
+
+#define REGEX_PATT \
+  "^(" SIM_ROLES \
+  "):(" INDEX \
+  "):(" ADAPTERS \
+  "):(" SIM_CLKOWNER \
+  "):(" SIM_MODELS \
+")"
+
+#define REGEX_NSUB (5+1)
+
+/* Convenience variables: */
+/*    SPI driver */
+static const struct driver_caps simspi_caps = {
+    .latency_us = 1,
+    .flags = DCAP_WRITE_READ,
+};
+
+static struct driverAPI_spi simspi_driver = {
+    .ddata = NULL,
+    .caps = &simspi_caps,
+    .sendData = simspi_sendData,
+    .sendrecieveData = simspi_sendrecieveData,
+    .sendrecieveData_ncs = simspi_sendrecieveData_ncs,
+    .setCS = simspi_setCS,
+    .receiveData = simspi_receiveData,
+    .getStatus = simspi_getStatus,
+    .actuate_config = simspi_configure,
+    .newddata = NULL,
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       .output_type = NULL,
+                       .clk_pol_idle = NULL,
+                       .output_clk_edge = NULL,
+                       .input_sample_end = NULL,
+                       },
+               },
+};
+
+/*    I2C driver */
+static const struct driver_caps simi2c_caps = {
+    .latency_us = 1,
+};
+
+static struct driverAPI_i2c simi2c_driver = {
+    .ddata = NULL,
+    .caps = &simi2c_caps,
+    .sendByte = simi2c_sendByte,
+    .receiveByte = simi2c_receiveByte,
+    .sendData = simi2c_sendData,
+    .receiveData = simi2c_receiveData,
+    .sendrecieveData = NULL,
+    .start = simi2c_start,
+    .stop = simi2c_stop,
+    .autoAck = simi2c_autoAck,
+    .getStatus = simi2c_getStatus,
+    .actuate_config = simi2c_configure,
+    .newddata = NULL,
+    .config = {
+               .set = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               .get = {
+                       .speed = NULL,
+                       .power_on = NULL,
+                       .pullups = NULL,
+                       .aux_on = NULL,
+                       .cs_active = NULL,
+                       },
+               },
+};
+
+/* CTOR-type code-init */
+int sim_init()
+{
+    int rc;
+    char err_str[REXP_ESTRSZ];
+    static int is_init = 0;
+
+    if (is_init) {
+        LOGW("No need to run %s twice, CTOR _init has run it?\n", __func__);
+        return 0;
+    }
+    is_init = 1;
+
+    rc = regcomp(&preg, REGEX_PATT, REG_EXTENDED | REG_ICASE);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec compilation error: %s\n", err_str);
+        return rc;
+    }
+    sim_models_init();
+
+    return 0;
+}
+
+/*
+ * Refined parsing of adapterstring to complete sim adapter_struct
+ *
+ * */
+int sim_parse(const char *adapterstr, struct adapter *adapter)
+{
+    int rc, i;
+    char err_str[REXP_ESTRSZ];
+    regmatch_t mtch_idxs[REGEX_NSUB];
+    char *adapterstr_cpy = strdup(adapterstr);
+    char *role_str;
+    char *index_str;
+    char *adapter_str;
+    char *clkownr_str;
+    char *models_str;
+
+    adapter->role = ROLE_INVALID;
+    adapter->devid = DEV_INVALID;
+
+    rc = regexec(&preg, adapterstr_cpy, REGEX_NSUB, mtch_idxs, 0);
+    if (rc) {
+        regerror(rc, &preg, err_str, REXP_ESTRSZ);
+        LOGE("Regexec match error: %s\n", err_str);
+        free(adapterstr_cpy);
+        return rc;
+    }
+    /* Add string terminators in substrings */
+    for (i = 1; i < REGEX_NSUB; i++) {
+        ASSURE_E(mtch_idxs[i].rm_so != -1, goto sim_parse_err);
+        adapterstr_cpy[mtch_idxs[i].rm_eo] = 0;
+    }
+
+    role_str = &adapterstr_cpy[mtch_idxs[1].rm_so];
+    index_str = &adapterstr_cpy[mtch_idxs[2].rm_so];
+    adapter_str = &adapterstr_cpy[mtch_idxs[3].rm_so];
+    clkownr_str = &adapterstr_cpy[mtch_idxs[4].rm_so];
+    models_str = &adapterstr_cpy[mtch_idxs[5].rm_so];
+
+    LOGD("  Second level adapter-string parsing (by %s):\n", __func__);
+    LOGD("    role=%s\n", role_str);
+    LOGD("    index=%s\n", index_str);
+    LOGD("    adapter=%s\n", adapter_str);
+    LOGD("    clkownr=%s\n", clkownr_str);
+    LOGD("    models=%s\n", models_str);
+
+    ASSURE_E(strcasecmp(adapter_str, "sim") == 0, goto sim_parse_err);
+
+    if (strcasecmp(role_str, "spi") == 0) {
+        adapter->role = ROLE_SPI;
+    } else if (strcasecmp(role_str, "i2c") == 0) {
+        adapter->role = ROLE_I2C;
+    } else {
+        LOGE("SIM adapter driver can't handle role: %s\n", role_str);
+        goto sim_parse_err;
+    }
+
+    adapter->index = atoi(index_str);
+    adapter->devid = SIM;
+    adapter->sim = malloc(sizeof(struct sim));
+
+    if (strcasecmp(clkownr_str, "master") == 0) {
+        adapter->sim->clckownr = MASTER;
+    } else if (strcasecmp(clkownr_str, "slave") == 0) {
+        adapter->sim->clckownr = SLAVE;
+    } else {
+        LOGE("SIM adapter driver can't handle clkownr: %s\n", clkownr_str);
+        goto sim_parse_err;
+    }
+
+    /* Avoid need to strdup by using original which happens to terminate
+     * correctly as well. Ignore const as this string belongs to
+     * environment with process-long lifetime */
+    adapter->sim->models = (char *)(&adapterstr[mtch_idxs[5].rm_so]);
+
+    free(adapterstr_cpy);
+    return 0;
+sim_parse_err:
+    free(adapterstr_cpy);
+    return -1;
+}
+
+int sim_init_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver;
+    struct ddata *ddata;
+    int bus;
+
+    LOGI("SIM: Initializing adapter ID [%d]\n", adapter->devid);
+
+    ASSERT(driver = malloc(sizeof(struct driverAPI_spi)));
+    switch (adapter->role) {
+        case ROLE_SPI:
+            memcpy(driver, &simspi_driver, sizeof(struct driverAPI_spi));
+            bus = SIM_SPI;
+            break;
+        case ROLE_I2C:
+            memcpy(driver, &simi2c_driver, sizeof(struct driverAPI_i2c));
+            bus = SIM_I2C;
+            break;
+        default:
+            LOGE("Role [%d] is not supported by SIM\n", adapter->role);
+            free(driver);
+            return -1;
+    }
+    ASSERT(ddata = calloc(1, sizeof(struct ddata)));
+
+    driver->ddata = ddata;
+    driver->adapter = adapter;
+    adapter->driver.any = driver;
+    ddata->driver.any = driver;
+
+    switch (adapter->role) {
+        case ROLE_SPI:
+            ASSURE(simspi_configure(ddata) == 0);
+            break;
+        case ROLE_I2C:
+            ASSURE(simi2c_configure(ddata) == 0);
+            break;
+        default:
+            break;
+    }
+    ASSURE(sim_models_attach(ddata, bus, adapter->sim->models) == 0);
+
+    return 0;
+}
+
+int sim_deinit_adapter(struct adapter *adapter)
+{
+    struct driverAPI_any *driver = adapter->driver.any;
+    struct ddata *ddata = driver->ddata;
+    struct sim *sim = adapter->sim;
+
+    sim_models_detach(ddata);
+    free(ddata);
+    free(driver);
+    free(sim);
+
+    adapter->driver.any = NULL;
+    adapter->sim = NULL;
+
+    return 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __init __sim_init(void)
+{
+    int rc;
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism ====\n");
+#endif
+    if ((rc = sim_init())) {
+        fprintf(stderr, "Fatal error: sim_init() failed\n");
+        exit(rc);
+    }
+}
+
+void __fini __sim_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "local.h"
+
+/* Same semantics as the Bus Pirate: CS is electrical (low selects) and
+ * sendData/receiveData are complete CS-framed transactions. */
+
+static void select_dev(struct ddata *ddata, int cs)
+{
+    struct sim_inst *inst = ddata->spi.dev;
+
+    if (cs == ddata->spi.cs)
+        return;
+    ddata->spi.cs = cs;
+    if (inst && inst->model->select)
+        inst->model->select(inst->dev, cs == 0);
+}
+
+static void xfer(struct ddata *ddata, const uint8_t *out, uint8_t *in,
+                 int sz)
+{
+    struct sim_inst *inst = ddata->spi.dev;
+
+    if (sz <= 0)
+        return;
+    if (inst && ddata->spi.cs == 0) {
+        inst->model->xfer(inst->dev, out, in, sz);
+    } else if (in) {
+        /* Nobody drives MISO */
+        memset(in, 0xFF, sz);
+    }
+}
+
+void simspi_sendrecieveData(struct ddata *ddata, const uint8_t *outbuf,
+                            int outsz, uint8_t *indata, int insz)
+{
+    select_dev(ddata, 0);
+    xfer(ddata, outbuf, NULL, outsz);
+    xfer(ddata, NULL, indata, insz);
+    select_dev(ddata, 1);
+}
+
+void simspi_sendrecieveData_ncs(struct ddata *ddata, const uint8_t *outbuf,
+                                int outsz, uint8_t *indata, int insz)
+{
+    xfer(ddata, outbuf, NULL, outsz);
+    xfer(ddata, NULL, indata, insz);
+}
+
+void simspi_setCS(struct ddata *ddata, int state)
+{
+    ASSERT((state == 0) || (state == 1));
+    select_dev(ddata, state);
+}
+
+void simspi_sendData(struct ddata *ddata, const uint8_t *data, int sz)
+{
+    simspi_sendrecieveData(ddata, data, sz, NULL, 0);
+}
+
+void simspi_receiveData(struct ddata *ddata, uint8_t *data, int sz)
+{
+    simspi_sendrecieveData(ddata, NULL, 0, data, sz);
+}
+
+uint16_t simspi_getStatus(struct ddata *ddata, uint16_t flags)
+{
+    return flags;
+}
+
+int simspi_configure(struct ddata *ddata)
+{
+    ddata->spi.cs = 1;
+    return 0;
+}
@@ -0,0 +1,331 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Adapter statistics. See stats.h
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "adapters_config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "stats.h"
+#include "instr_local.h"
+
+struct stats_op {
+    uint64_t calls;
+    uint64_t obytes;
+    uint64_t ibytes;
+    uint64_t syscalls;
+    uint64_t ns;
+    uint64_t hist[STATS_BUCKETS];
+};
+
+static struct stats_op ops[DEF_MAX_ADAPTERS][DOP_LAST];
+
+/* Syscalls made outside of driverAPI calls, e.g. when initializing */
+static uint64_t other_syscalls[INSTR_SYS_LAST - INSTR_SYS_READ];
+
+static int sigpipe[2] = { -1, -1 };
+static int lsock = -1;
+static struct sockaddr_un laddr;
+
+#define ADD(V, N) __atomic_fetch_add(&(V), (N), __ATOMIC_RELAXED)
+#define GET(V) __atomic_load_n(&(V), __ATOMIC_RELAXED)
+
+/***************************************************************************
+ * Accounting (instr.c)
+ ***************************************************************************/
+struct stats_op *stats_op(int adapter, dop_t op)
+{
+    return &ops[adapter][op];
+}
+
+static int bucket(uint64_t ns)
+{
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+void stats_call(struct stats_op *s, int osz, int isz, uint64_t ns)
+{
+    ADD(s->calls, 1);
+    if (osz > 0)
+        ADD(s->obytes, osz);
+    if (isz > 0)
+        ADD(s->ibytes, isz);
+    ADD(s->ns, ns);
+    ADD(s->hist[bucket(ns)], 1);
+}
+
+void stats_sys(struct stats_op *s, instr_sys_t op)
+{
+    if (s)
+        ADD(s->syscalls, 1);
+    else
+        ADD(other_syscalls[op - INSTR_SYS_READ], 1);
+}
+
+/***************************************************************************
+ * Output
+ ***************************************************************************/
+/* Upper bound in us of the bucket where fraction q of calls are reached */
+static double quantile_us(const struct stats_op *s, uint64_t calls, double q)
+{
+    uint64_t sum = 0;
+    int b;
+
+    for (b = 0; b < STATS_BUCKETS; b++) {
+        sum += GET(s->hist[b]);
+        if (sum >= q * calls)
+            break;
+    }
+    return (double)(1ULL << b) / 1000.0;
+}
+
+void stats_dump(FILE *f)
+{
+    char name[40];
+    int a, op, i;
+
+    if (instr_ndrvs == 0)
+        return;
+
+    fprintf(f, "Adapter statistics, %.3fs since start (latency in us, "
+            "percentiles are bucket upper bounds):\n", instr_now() / 1e9);
+    fprintf(f, "%-14s %-24s %10s %12s %12s %10s %10s %10s %10s\n",
+            "adapter", "op", "calls", "bytes-out", "bytes-in", "syscalls",
+            "mean", "p50", "p99");
+    for (a = 0; a < instr_ndrvs; a++) {
+        instr_adapter_name(name, sizeof(name), a);
+        for (op = 0; op < DOP_LAST; op++) {
+            struct stats_op *s = &ops[a][op];
+            uint64_t calls = GET(s->calls);
+
+            if (calls == 0)
+                continue;
+            fprintf(f, "%-14s %-24s %10" PRIu64 " %12" PRIu64 " %12" PRIu64
+                    " %10" PRIu64 " %10.1f %10.1f %10.1f\n", name,
+                    dop_name(op), calls, GET(s->obytes), GET(s->ibytes),
+                    GET(s->syscalls), GET(s->ns) / 1000.0 / calls,
+                    quantile_us(s, calls, 0.5), quantile_us(s, calls, 0.99));
+        }
+    }
+    for (i = 0; i < INSTR_SYS_LAST - INSTR_SYS_READ; i++) {
+        if (GET(other_syscalls[i]))
+            fprintf(f, "%-14s %-24s %10s %12s %12s %10" PRIu64 "\n", "-",
+                    instr_op_name(INSTR_SYS_READ + i), "", "", "",
+                    GET(other_syscalls[i]));
+    }
+    fflush(f);
+}
+
+void stats_prometheus(FILE *f)
+{
+    char name[40];
+    int a, op, b;
+
+#define HEAD(M, T, H) fprintf(f, "# HELP " M " " H "\n# TYPE " M " " T "\n")
+#define EACH(BODY) \
+    for (a = 0; a < instr_ndrvs; a++) { \
+        instr_adapter_name(name, sizeof(name), a); \
+        for (op = 0; op < DOP_LAST; op++) { \
+            struct stats_op *s = &ops[a][op]; \
+            uint64_t calls = GET(s->calls); \
+            if (calls == 0) \
+                continue; \
+            BODY; \
+        } \
+    }
+#define LABELS "adapter=\"%s\",op=\"%s\""
+
+    HEAD("ehwe_adapter_calls_total", "counter", "driverAPI calls");
+    EACH(fprintf(f, "ehwe_adapter_calls_total{" LABELS "} %" PRIu64 "\n",
+                 name, dop_name(op), calls));
+
+    HEAD("ehwe_adapter_bytes_total", "counter", "Bytes moved");
+    EACH(fprintf(f, "ehwe_adapter_bytes_total{" LABELS ",direction=\"out\"} "
+                 "%" PRIu64 "\n", name, dop_name(op), GET(s->obytes));
+         fprintf(f, "ehwe_adapter_bytes_total{" LABELS ",direction=\"in\"} "
+                 "%" PRIu64 "\n", name, dop_name(op), GET(s->ibytes)));
+
+    HEAD("ehwe_adapter_syscalls_total", "counter",
+         "Syscalls made by driverAPI calls");
+    EACH(fprintf(f, "ehwe_adapter_syscalls_total{" LABELS "} %" PRIu64 "\n",
+                 name, dop_name(op), GET(s->syscalls)));
+
+    HEAD("ehwe_adapter_latency_seconds", "histogram",
+         "Duration of driverAPI calls");
+    EACH(uint64_t cum = 0;
+         for (b = 0; b < STATS_BUCKETS - 1; b++) {
+             cum += GET(s->hist[b]);
+             fprintf(f, "ehwe_adapter_latency_seconds_bucket{" LABELS
+                     ",le=\"%.9g\"} %" PRIu64 "\n", name, dop_name(op),
+                     (double)(1ULL << b) / 1e9, cum);
+         }
+         fprintf(f, "ehwe_adapter_latency_seconds_bucket{" LABELS
+                 ",le=\"+Inf\"} %" PRIu64 "\n", name, dop_name(op), calls);
+         fprintf(f, "ehwe_adapter_latency_seconds_sum{" LABELS "} %.9f\n",
+                 name, dop_name(op), GET(s->ns) / 1e9);
+         fprintf(f, "ehwe_adapter_latency_seconds_count{" LABELS "} %"
+                 PRIu64 "\n", name, dop_name(op), calls));
+#undef LABELS
+#undef EACH
+#undef HEAD
+}
+
+/***************************************************************************
+ * Service thread
+ ***************************************************************************/
+static void on_sigusr1(int sig)
+{
+    int e = errno;
+
+    if (write(sigpipe[1], "", 1) == -1) {
+        /* Pipe full, a dump is pending anyway */
+    }
+    errno = e;
+}
+
+/* One scrape. Answers HTTP if asked, else just the text (e.g. socat) */
+static void serve(int fd)
+{
+    struct pollfd pfd = {.fd = fd,.events = POLLIN };
+    char req[512];
+    int http = 0;
+    FILE *f;
+
+    if (poll(&pfd, 1, 100) == 1)
+        http = read(fd, req, sizeof(req)) >= 3 && memcmp(req, "GET", 3) == 0;
+    if ((f = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        return;
+    }
+    if (http)
+        fprintf(f, "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Connection: close\r\n\r\n");
+    stats_prometheus(f);
+    fclose(f);
+}
+
+static void *stats_thread(void *arg)
+{
+    struct pollfd pfd[2] = {
+        {.fd = sigpipe[0],.events = POLLIN},
+        {.fd = lsock,.events = POLLIN},
+    };
+    char c;
+    int fd;
+
+    while (1) {
+        if (poll(pfd, lsock == -1 ? 1 : 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            LOGE("Statistics: poll failed: %s\n", strerror(errno));
+            return NULL;
+        }
+        if (pfd[0].revents & POLLIN) {
+            while (read(sigpipe[0], &c, 1) == 1) ;
+            stats_dump(stderr);
+        }
+        if (lsock != -1 && (pfd[1].revents & POLLIN)) {
+            if ((fd = accept(lsock, NULL, NULL)) != -1)
+                serve(fd);
+        }
+    }
+    return NULL;
+}
+
+static int listen_unix(const char *sockname)
+{
+    if (strlen(sockname) >= sizeof(laddr.sun_path)) {
+        LOGE("Statistics: socket name too long [%s]\n", sockname);
+        return -1;
+    }
+    laddr.sun_family = AF_UNIX;
+    strcpy(laddr.sun_path, sockname);
+    unlink(sockname);
+
+    ASSURE_E((lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) != -1,
+             goto listen_err);
+    ASSURE_E(bind(lsock, (struct sockaddr *)&laddr, sizeof(laddr)) == 0,
+             goto listen_err);
+    ASSURE_E(listen(lsock, 4) == 0, goto listen_err);
+    LOGI("Statistics: serving Prometheus text on [%s]\n", sockname);
+    return 0;
+listen_err:
+    LOGE("Statistics: can't listen on [%s]: %s\n", sockname,
+         strerror(errno));
+    if (lsock != -1)
+        close(lsock);
+    lsock = -1;
+    return -1;
+}
+
+int stats_start(const char *sockname)
+{
+    struct sigaction sa = {.sa_handler = on_sigusr1,.sa_flags = SA_RESTART };
+    pthread_t thread;
+
+    ASSURE_E(pipe2(sigpipe, O_NONBLOCK | O_CLOEXEC) == 0, return -1);
+    if (sockname) {
+        if (listen_unix(sockname))
+            return -1;
+        /* Scrapers hanging up mid-answer mustn't kill us */
+        signal(SIGPIPE, SIG_IGN);
+    }
+    ASSURE_E(pthread_create(&thread, NULL, stats_thread, NULL) == 0,
+             return -1);
+    pthread_detach(thread);
+
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    return 0;
+}
+
+/***************************************************************************
+ * INIT/FINI mechanism
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+#define __fini __attribute__((destructor))
+
+void __fini __stats_fini(void)
+{
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _fini in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+    if (lsock != -1)
+        unlink(laddr.sun_path);
+}
@@ -0,0 +1,45 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef stats_h
+#define stats_h
+/***************************************************************************
+ * Adapter statistics
+ *
+ * Per adapter and driverAPI method: calls, bytes in and out, syscalls made
+ * and a latency histogram with power-of-2 ns buckets. Always collected
+ * (see instr.h), at the cost of a few atomic adds per call.
+ ***************************************************************************/
+#include <stdio.h>
+
+/* Latency buckets. Bucket b counts calls of less than 2^b ns, the last
+ * one everything longer. */
+#define STATS_BUCKETS 32
+
+/* Dump statistics on SIGUSR1 and, if sockname isn't NULL, serve them as
+ * Prometheus text on a Unix socket. Both from a thread of its own. */
+int stats_start(const char *sockname);
+
+/* Human readable table of all adapters used */
+void stats_dump(FILE *f);
+
+/* Prometheus text exposition format */
+void stats_prometheus(FILE *f);
+
+#endif                          //stats_h
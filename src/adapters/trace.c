@@ -0,0 +1,83 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Recording side of the transaction trace. See trace.h
+ */
+#include "config.h"
+#include "adapters_config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "adapters.h"
+#include <driver.h>
+#include "dop.h"
+#include "instr_local.h"
+
+#if (TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) != 0
+#error TRACE_RING_EVENTS must be a power of 2
+#endif
+
+int trace_on = 0;
+
+struct trace_ring *trace_rings = NULL;  /* All rings, newest first */
+
+static uint16_t nrings = 0;
+static __thread struct trace_ring *ring = NULL;
+
+int trace_start(void)
+{
+    trace_on = 1;
+    LOGI("Tracing: %d events per thread\n", TRACE_RING_EVENTS);
+    return 0;
+}
+
+/* First event of a thread. Ring is never freed so that it can be exported
+ * after the thread has ended. */
+static struct trace_ring *new_ring(void)
+{
+    struct trace_ring *r;
+
+    r = calloc(1, sizeof(struct trace_ring));
+    if (r == NULL) {
+        LOGE("Tracing: No memory for ring, thread not traced\n");
+        return NULL;
+    }
+    r->tid = __atomic_fetch_add(&nrings, 1, __ATOMIC_RELAXED);
+    r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) ;
+    return r;
+}
+
+/* Copy ev into the ring and publish it. Events are built outside of the
+ * ring so that syscalls nested in a driverAPI call get slots of their own. */
+void trace_put(struct trace_event *ev)
+{
+    uint64_t head;
+
+    if (ring == NULL && (ring = new_ring()) == NULL)
+        return;
+    ev->tid = ring->tid;
+    head = ring->head;
+    memcpy(&ring->ev[head & (TRACE_RING_EVENTS - 1)], ev, sizeof(*ev));
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef trace_h
+#define trace_h
+/***************************************************************************
+ * Transaction trace
+ *
+ * Every driverAPI call and every adapter-level syscall (see instr.h)
+ * recorded as a fixed size binary event into a ring per thread. Only the
+ * owning thread writes its ring, the exporter reads them without locking.
+ * When a ring is full the oldest events are overwritten.
+ *
+ * Compiled in by ENABLE_TRACE and active once trace_start() has been
+ * called (ehwe -x).
+ ***************************************************************************/
+#include <stdint.h>
+#include "adapters_config.h"
+#include "instr.h"
+
+/* Bytes of out- and in-data kept per event */
+#define TRACE_DATA 18
+
+/* One event, 64 bytes */
+struct trace_event {
+    uint64_t ts;                /* Start, ns (instr_now()) */
+    uint32_t dur;               /* Duration, ns */
+    int32_t result;             /* Methods/syscalls return-value, else 0 */
+    uint16_t op;                /* dop_t or instr_sys_t */
+    uint16_t arg;               /* As in struct dop. fd for syscalls */
+    uint16_t osz;               /* Number of bytes out */
+    uint16_t isz;               /* Number of bytes in */
+    uint16_t tid;               /* Ring (i.e. thread) number */
+    uint8_t adapter;            /* Instrumented adapter number or
+                                   INSTR_NOADAPTER */
+    uint8_t pad;
+    uint8_t out[TRACE_DATA];    /* First bytes out */
+    uint8_t in[TRACE_DATA];     /* First bytes in */
+};
+
+#ifdef ENABLE_TRACE
+extern int trace_on;
+
+/* Start recording */
+int trace_start(void);
+
+/* Put a complete event in the calling thread's ring */
+void trace_put(struct trace_event *ev);
+
+/* Export all rings to fname. Chrome trace JSON (chrome://tracing,
+ * Perfetto) unless fname ends with .vcd, in which case VCD. */
+int trace_export(const char *fname);
+#else
+static inline int trace_start(void)
+{
+    return -1;
+}
+
+static inline int trace_export(const char *fname)
+{
+    return 0;
+}
+#endif
+
+#endif                          //trace_h
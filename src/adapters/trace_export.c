@@ -0,0 +1,311 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Export of the transaction trace to Chrome trace JSON or VCD
+ */
+#include "config.h"
+#include "adapters_config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include "adapters.h"
+#include "dop.h"
+#include "instr_local.h"
+
+/***************************************************************************
+ * Gather
+ ***************************************************************************/
+static int cmp_event(const void *a, const void *b)
+{
+    const struct trace_event *ea = a, *eb = b;
+
+    if (ea->ts != eb->ts)
+        return ea->ts < eb->ts ? -1 : 1;
+    if (ea->tid != eb->tid)
+        return ea->tid < eb->tid ? -1 : 1;
+    /* Enclosing call before what it encloses */
+    if (ea->dur != eb->dur)
+        return ea->dur > eb->dur ? -1 : 1;
+    return 0;
+}
+
+/* Copy out all rings, sorted on time. Rings may still be written to while
+ * copied: slots a writer may have reached during the copy are dropped. */
+static struct trace_event *gather(size_t *n)
+{
+    struct trace_ring *r;
+    struct trace_event *evs = NULL;
+    size_t nevs = 0;
+
+    for (r = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        uint64_t h1, h2, lo, i;
+
+        h1 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        lo = h1 > TRACE_RING_EVENTS ? h1 - TRACE_RING_EVENTS : 0;
+        ASSERT(evs = realloc(evs, (nevs + (h1 - lo)) *
+                             sizeof(struct trace_event)));
+        for (i = lo; i < h1; i++)
+            evs[nevs + i - lo] = r->ev[i & (TRACE_RING_EVENTS - 1)];
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        h2 = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        if (h2 + 1 > lo + TRACE_RING_EVENTS) {
+            uint64_t skip = h2 + 1 - TRACE_RING_EVENTS - lo;
+
+            if (skip > h1 - lo)
+                skip = h1 - lo;
+            memmove(&evs[nevs], &evs[nevs + skip],
+                    (h1 - lo - skip) * sizeof(struct trace_event));
+            lo += skip;
+        }
+        nevs += h1 - lo;
+    }
+    if (nevs)
+        qsort(evs, nevs, sizeof(struct trace_event), cmp_event);
+    *n = nevs;
+    return evs;
+}
+
+/***************************************************************************
+ * Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+ ***************************************************************************/
+static void json_hex(FILE *f, const char *key, const uint8_t *data, int sz)
+{
+    int i;
+
+    if (sz > TRACE_DATA)
+        sz = TRACE_DATA;
+    if (sz <= 0)
+        return;
+    fprintf(f, ",\"%s\":\"", key);
+    for (i = 0; i < sz; i++)
+        fprintf(f, "%02x", data[i]);
+    fprintf(f, "\"");
+}
+
+static int export_json(FILE *f, const struct trace_event *evs, size_t n)
+{
+    char name[40];
+    size_t i;
+    int a;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+            "\"args\":{\"name\":\"%s\"}}", PROJ_NAME);
+    for (a = 0; a < instr_ndrvs; a++) {
+        instr_adapter_name(name, sizeof(name), a);
+        fprintf(f, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", a + 1, name);
+    }
+    for (i = 0; i < n; i++) {
+        const struct trace_event *ev = &evs[i];
+        int sys = ev->op >= INSTR_SYS_READ;
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                "\"ts\":%" PRIu64 ".%03u,\"dur\":%u.%03u,"
+                "\"pid\":%d,\"tid\":%u,\"args\":{\"%s\":%u,"
+                "\"osz\":%u,\"isz\":%u,\"result\":%d",
+                instr_op_name(ev->op), sys ? "syscall" : "driver",
+                ev->ts / 1000, (unsigned)(ev->ts % 1000),
+                ev->dur / 1000, ev->dur % 1000,
+                ev->adapter == INSTR_NOADAPTER ? 0 : ev->adapter + 1,
+                ev->tid, sys ? "fd" : "arg", ev->arg, ev->osz, ev->isz,
+                ev->result);
+        json_hex(f, "out", ev->out, ev->osz);
+        json_hex(f, "in", ev->in, ev->isz);
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    return 0;
+}
+
+/***************************************************************************
+ * VCD
+ *
+ * Per adapter: busy while in a driverAPI method, op is its dop_t, sys while
+ * in an adapter-level syscall. SPI adapters also get cs, as set by setCS
+ * or implied by the CS-framed methods.
+ ***************************************************************************/
+enum { V_BUSY, V_OP, V_SYS, V_CS, V_PER_ADAPTER };
+
+/* Variable of adapter a. Syscalls of no adapter use the last V_SYS. */
+#define VAR(a, v) ((a) * V_PER_ADAPTER + (v))
+
+struct change {
+    uint64_t t;
+    uint32_t seq;
+    uint16_t var;
+    uint16_t val;
+};
+
+static int cmp_change(const void *a, const void *b)
+{
+    const struct change *ca = a, *cb = b;
+
+    if (ca->t != cb->t)
+        return ca->t < cb->t ? -1 : 1;
+    return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+static void vcd_id(char *buf, int var)
+{
+    do {
+        *buf++ = '!' + var % 94;
+        var /= 94;
+    } while (var);
+    *buf = 0;
+}
+
+static void vcd_val(FILE *f, int var, int val)
+{
+    char id[8];
+    int b;
+
+    vcd_id(id, var);
+    if (var % V_PER_ADAPTER != V_OP) {
+        fprintf(f, "%d%s\n", val, id);
+        return;
+    }
+    fprintf(f, "b");
+    for (b = 7; b >= 0; b--)
+        fprintf(f, "%d", (val >> b) & 1);
+    fprintf(f, " %s\n", id);
+}
+
+static int export_vcd(FILE *f, const struct trace_event *evs, size_t n)
+{
+    struct change *chg;
+    size_t i, nchg = 0;
+    uint64_t t = UINT64_MAX;
+    char name[40], id[8];
+    int a;
+
+    /* At most 6 changes per event: busy, op and cs on and off */
+    ASSERT(chg = malloc((6 * n + 1) * sizeof(struct change)));
+
+#define CHANGE(T, V, X) \
+    chg[nchg] = (struct change){(T), nchg, (V), (X)}; nchg++
+
+    for (i = 0; i < n; i++) {
+        const struct trace_event *ev = &evs[i];
+        uint64_t te = ev->ts + ev->dur;
+        int an = ev->adapter == INSTR_NOADAPTER ? instr_ndrvs : ev->adapter;
+
+        if (ev->op >= INSTR_SYS_READ) {
+            CHANGE(ev->ts, VAR(an, V_SYS), 1);
+            CHANGE(te, VAR(an, V_SYS), 0);
+            continue;
+        }
+        CHANGE(ev->ts, VAR(an, V_BUSY), 1);
+        CHANGE(ev->ts, VAR(an, V_OP), ev->op);
+        CHANGE(te, VAR(an, V_BUSY), 0);
+        CHANGE(te, VAR(an, V_OP), 0);
+
+        switch (ev->op) {
+            case DOP_SPI_SETCS:
+                CHANGE(te, VAR(an, V_CS), ev->arg);
+                break;
+            case DOP_SPI_SENDDATA:
+            case DOP_SPI_RECEIVEDATA:
+            case DOP_SPI_SENDRECIEVEDATA:
+                CHANGE(ev->ts, VAR(an, V_CS), 0);
+                CHANGE(te, VAR(an, V_CS), 1);
+                break;
+            default:
+                break;
+        }
+    }
+#undef CHANGE
+    qsort(chg, nchg, sizeof(struct change), cmp_change);
+
+    fprintf(f, "$version %s %s $end\n", PROJ_NAME, VERSION);
+    fprintf(f, "$timescale 1ns $end\n");
+    fprintf(f, "$scope module %s $end\n", PROJ_NAME);
+    for (a = 0; a < instr_ndrvs; a++) {
+        instr_adapter_name(name, sizeof(name), a);
+        fprintf(f, "$scope module %s $end\n", name);
+        vcd_id(id, VAR(a, V_BUSY));
+        fprintf(f, "$var wire 1 %s busy $end\n", id);
+        vcd_id(id, VAR(a, V_OP));
+        fprintf(f, "$var wire 8 %s op $end\n", id);
+        vcd_id(id, VAR(a, V_SYS));
+        fprintf(f, "$var wire 1 %s sys $end\n", id);
+        if (instr_drvs[a].role == ROLE_SPI) {
+            vcd_id(id, VAR(a, V_CS));
+            fprintf(f, "$var wire 1 %s cs $end\n", id);
+        }
+        fprintf(f, "$upscope $end\n");
+    }
+    vcd_id(id, VAR(instr_ndrvs, V_SYS));
+    fprintf(f, "$var wire 1 %s sys $end\n", id);
+    fprintf(f, "$upscope $end\n");
+    fprintf(f, "$enddefinitions $end\n");
+
+    fprintf(f, "#0\n$dumpvars\n");
+    for (a = 0; a < instr_ndrvs; a++) {
+        vcd_val(f, VAR(a, V_BUSY), 0);
+        vcd_val(f, VAR(a, V_OP), 0);
+        vcd_val(f, VAR(a, V_SYS), 0);
+        if (instr_drvs[a].role == ROLE_SPI)
+            vcd_val(f, VAR(a, V_CS), 1);
+    }
+    vcd_val(f, VAR(instr_ndrvs, V_SYS), 0);
+    fprintf(f, "$end\n");
+
+    for (i = 0; i < nchg; i++) {
+        if (chg[i].t != t) {
+            t = chg[i].t;
+            fprintf(f, "#%" PRIu64 "\n", t);
+        }
+        vcd_val(f, chg[i].var, chg[i].val);
+    }
+    free(chg);
+    return 0;
+}
+
+int trace_export(const char *fname)
+{
+    struct trace_event *evs;
+    size_t n, len = strlen(fname);
+    FILE *f;
+    int rc;
+
+    if (!trace_on)
+        return 0;
+    if ((f = fopen(fname, "w")) == NULL) {
+        LOGE("Tracing: Can't open [%s]: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    evs = gather(&n);
+    if (len > 4 && strcmp(&fname[len - 4], ".vcd") == 0)
+        rc = export_vcd(f, evs, n);
+    else
+        rc = export_json(f, evs, n);
+    free(evs);
+    fclose(f);
+
+    LOGI("Tracing: %zu events exported to [%s]\n", n, fname);
+    return rc;
+}
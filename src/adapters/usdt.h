@@ -0,0 +1,59 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef usdt_h
+#define usdt_h
+/***************************************************************************
+ * Static tracepoints (USDT) for perf, bpftrace, SystemTap
+ *
+ * A probe is a nop and a note in the binary until a tracer attaches, i.e.
+ * it can stay in production builds. Built in with ENABLE_USDT, else the
+ * macros are empty. All probes are of provider "ehwe":
+ *
+ * adapter_entry(adapter, op, osz, isz)
+ * adapter_return(adapter, op, osz, isz, result, ns)
+ *      driverAPI call of any adapter (instr.c). adapter is the number in
+ *      statistics and trace, op a dop_t.
+ * syscall_entry(op, fd, size)
+ * syscall_return(op, fd, result)
+ *      Adapter-level syscall (instr.h). op is an instr_sys_t.
+ * api_entry(layer, fn, index, addr, osz, isz)
+ * api_return(layer, fn, index, addr)
+ *      API functions. layer and fn are strings, e.g. "stm32" and
+ *      "SPI_I2S_SendReceiveData". index is the adapter's number in its
+ *      role, addr the I2C address or -1.
+ ***************************************************************************/
+#include "config.h"
+
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define USDT3(n, a1, a2, a3) \
+    DTRACE_PROBE3(ehwe, n, a1, a2, a3)
+#define USDT4(n, a1, a2, a3, a4) \
+    DTRACE_PROBE4(ehwe, n, a1, a2, a3, a4)
+#define USDT6(n, a1, a2, a3, a4, a5, a6) \
+    DTRACE_PROBE6(ehwe, n, a1, a2, a3, a4, a5, a6)
+#else
+#define USDT3(n, a1, a2, a3) do { } while (0)
+#define USDT4(n, a1, a2, a3, a4) do { } while (0)
+#define USDT6(n, a1, a2, a3, a4, a5, a6) do { } while (0)
+#endif
+
+#endif                          //usdt_h
@@ -28,6 +28,8 @@
 #include "stm32.h"
 #include "ehwe.h"
 #include "ehwe_i2c_device.h"
+#include "ehwe_i2c_eeprom.h"
+#include "ehwe_spi_device.h"
 #include "adapters.h"
 
 int apis_init()
@@ -54,6 +56,12 @@ int apis_init_api(const struct adapter *adapter)
     ASSURE_E((rc =
               i2c_device_init_api(adapter)) == 0,
              goto apis_init_api_err);
+    ASSURE_E((rc =
+              i2c_eeprom_init_api(adapter)) == 0,
+             goto apis_init_api_err);
+    ASSURE_E((rc =
+              spi_device_init_api(adapter)) == 0,
+             goto apis_init_api_err);
 #endif
 
 #ifdef ENABLE_API_STM32
@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * CRC32C. Table driven, slicing by 8, unless the CPU has instructions for
+ * it. Choice of implementation is made once, on module init.
+ */
+#include <config.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ehwe_crc32c.h>
+
+#ifdef ENABLE_CRC32C_HW
+#  if defined(__x86_64__) || defined(__i386__)
+#    include <nmmintrin.h>
+#    define HAVE_CRC32C_SSE42
+#  elif defined(__aarch64__) && defined(__linux__)
+#    include <arm_acle.h>
+#    include <sys/auxv.h>
+#    include <asm/hwcap.h>
+#    define HAVE_CRC32C_ARMV8
+#  endif
+#endif
+
+#define POLY 0x82F63B78         /* Reflected */
+
+static uint32_t table[8][256];
+
+static uint32_t crc_sw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint32_t lo, hi;
+
+    for (; n && ((uintptr_t)p & 7); n--)
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    for (; n >= 8; n -= 8, p += 8) {
+        lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+            table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+            table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+    }
+    while (n--)
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef HAVE_CRC32C_SSE42
+__attribute__ ((target("sse4.2")))
+static uint32_t crc_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+#  ifdef __x86_64__
+    uint64_t v;
+
+    for (; n && ((uintptr_t)p & 7); n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        crc = (uint32_t)_mm_crc32_u64(crc, v);
+    }
+#  else
+    uint32_t v;
+
+    for (; n && ((uintptr_t)p & 3); n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    for (; n >= 4; n -= 4, p += 4) {
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+#  endif
+    while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+
+static int have_hw(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+#ifdef HAVE_CRC32C_ARMV8
+__attribute__ ((target("+crc")))
+static uint32_t crc_hw(uint32_t crc, const uint8_t *p, size_t n)
+{
+    uint64_t v;
+
+    for (; n && ((uintptr_t)p & 7); n--)
+        crc = __crc32cb(crc, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    while (n--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+
+static int have_hw(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+static uint32_t (*crc_fn) (uint32_t crc, const uint8_t *p, size_t n) =
+    crc_sw;
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    return ~crc_fn(~crc, buf, len);
+}
+
+/***************************************************************************
+ *   INIT/FINI CTOR/DTOR mechanism                                         *
+ ***************************************************************************/
+#define __init __attribute__((constructor))
+
+void __init __crc32c_init(void)
+{
+    uint32_t crc;
+    int i, j;
+
+#ifdef ENABLE_INITFINI_SHOWEXEC
+    fprintf(stderr, ">>> Running module _init in [" __FILE__ "]\n"
+            ">>> using CTORS/DTORS mechanism\n");
+#endif
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (POLY & -(crc & 1));
+        table[0][i] = crc;
+    }
+    for (i = 0; i < 256; i++)
+        for (j = 1; j < 8; j++)
+            table[j][i] = table[0][table[j - 1][i] & 0xFF] ^
+                (table[j - 1][i] >> 8);
+
+#if defined(HAVE_CRC32C_SSE42) || defined(HAVE_CRC32C_ARMV8)
+    if (have_hw())
+        crc_fn = crc_hw;
+#endif
+}
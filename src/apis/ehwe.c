@@ -35,14 +35,26 @@
 #include <string.h>
 #include <stdlib.h>
 #include <liblog/assure.h>
-#include "../adapters/buspirate/local.h"
+#include <usdt.h>
 
+/* The bus is the adapters driverAPI */
 #define DDATA( B ) (B->ddata)
-#define DD( B ) (DDATA(B)->driver.i2c)
+#define DD( B ) (B)
 #define DEV( B ) (DD(B)->adapter)
 #define WRITE_ADDR( A ) (A<<1)
 #define READ_ADDR( A ) ((A<<1) | 0x01)
 
+/* Longest message bus B takes in one go, 0 if unlimited. An I2C message
+ * can't be split without changing what's on the wire. */
+#define MAX_MSG( B ) (driver_caps(B)->max_xfer)
+#define MSG_FITS( B, L ) (MAX_MSG(B) == 0 || (L) <= MAX_MSG(B))
+
+/* Static tracepoints, see usdt.h */
+#define API_ENTRY(B, A, OSZ, ISZ) \
+    USDT6(api_entry, "ehwe", __func__, DEV(B)->index, A, OSZ, ISZ)
+#define API_RETURN(B, A) \
+    USDT4(api_return, "ehwe", __func__, DEV(B)->index, A)
+
 void i2c_write(I2C_TypeDef * bus, uint8_t adapter_addr, const uint8_t *buffer,
                int len, int send_stop)
 {
@@ -50,6 +62,8 @@ void i2c_write(I2C_TypeDef * bus, uint8_t adapter_addr, const uint8_t *buffer,
 
     assert(adapter_addr < 0x80);
     assert(DEV(bus)->role == ROLE_I2C);
+    assert(MSG_FITS(bus, len) && "Message too long for adapter");
+    API_ENTRY(bus, adapter_addr, len, 0);
 
     /* Send START condition */
     DD(bus)->start(DDATA(bus));
@@ -68,6 +82,7 @@ void i2c_write(I2C_TypeDef * bus, uint8_t adapter_addr, const uint8_t *buffer,
         /* Close Communication */
         DD(bus)->stop(DDATA(bus));
     }
+    API_RETURN(bus, adapter_addr);
 }
 
 void i2c_read(I2C_TypeDef * bus, uint8_t adapter_addr, uint8_t *buffer, int len)
@@ -76,6 +91,8 @@ void i2c_read(I2C_TypeDef * bus, uint8_t adapter_addr, uint8_t *buffer, int len)
 
     assert(adapter_addr < 0x80);
     assert(DEV(bus)->role == ROLE_I2C);
+    assert(MSG_FITS(bus, len) && "Message too long for adapter");
+    API_ENTRY(bus, adapter_addr, 0, len);
 
     /* Send START condition */
     DD(bus)->start(DDATA(bus));
@@ -89,6 +106,43 @@ void i2c_read(I2C_TypeDef * bus, uint8_t adapter_addr, uint8_t *buffer, int len)
 
     /* Close Communication */
     DD(bus)->stop(DDATA(bus));
+    API_RETURN(bus, adapter_addr);
+}
+
+int i2c_probe(I2C_TypeDef * bus, uint8_t adapter_addr)
+{
+    int ack = -1;
+
+    assert(adapter_addr < 0x80);
+    assert(DEV(bus)->role == ROLE_I2C);
+    API_ENTRY(bus, adapter_addr, 0, 0);
+
+    if (DD(bus)->probe)
+        ack = DD(bus)->probe(DDATA(bus), adapter_addr);
+
+    /* Zero-length write. Adapters queueing messages until stop don't know
+     * of any ACK before that. */
+    if (ack == -1 && !(driver_caps(bus)->flags & DCAP_MULTI_MSG)) {
+        DD(bus)->start(DDATA(bus));
+        ack = DD(bus)->sendByte(DDATA(bus), WRITE_ADDR(adapter_addr));
+        DD(bus)->stop(DDATA(bus));
+    }
+
+    API_RETURN(bus, adapter_addr);
+    return ack;
+}
+
+int i2c_scan(I2C_TypeDef * bus, uint8_t *present)
+{
+    int n;
+
+    assert(DEV(bus)->role == ROLE_I2C);
+    API_ENTRY(bus, -1, 0, I2C_SCAN_BYTES);
+
+    n = adapters_i2c_scan(DEV(bus), I2C_SCAN_FIRST, I2C_SCAN_LAST, present);
+
+    API_RETURN(bus, -1);
+    return n;
 }
 
 int ehwe_init_api(const struct adapter *adapter)
@@ -30,4 +30,13 @@ void i2c_write(I2C_TypeDef * bus, uint8_t adapter_addr, const uint8_t *buffer,
                int len, int send_stop);
 void i2c_read(I2C_TypeDef * bus, uint8_t adapter_addr, uint8_t *buffer, int len);
 
+/* Probe for device at adapter_addr. Returns 1 if it ACK:s, 0 if not, -1 if
+ * the adapter can't tell */
+int i2c_probe(I2C_TypeDef * bus, uint8_t adapter_addr);
+
+/* Probe all addresses but the reserved ones (I2C_SCAN_FIRST..LAST). Bits
+ * of those present are set in present (I2C_SCAN_BYTES). Returns number
+ * found, -1 if the adapter can't tell */
+int i2c_scan(I2C_TypeDef * bus, uint8_t *present);
+
 #endif                          //ehwe_h
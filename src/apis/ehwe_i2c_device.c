@@ -26,11 +26,24 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <liblog/assure.h>
 
 #include <ehwe.h>
 #include <ehwe_i2c_device.h>
+#include <ehwe_sample.h>
+#include <adapters.h>
+#include <driver.h>
+#include <usdt.h>
+
+/* Static tracepoints, see usdt.h */
+#define API_ENTRY(D, OSZ, ISZ) \
+    USDT6(api_entry, "i2c_device", __func__, (D)->bus->adapter->index, \
+          (D)->addr, OSZ, ISZ)
+#define API_RETURN(D) \
+    USDT4(api_return, "i2c_device", __func__, (D)->bus->adapter->index, \
+          (D)->addr)
 
 /* Forward declaration of layout for device registers.
    Layout differs from IC to IC and is thus unknown to this
@@ -87,6 +100,12 @@ uint8_t i2c_device_addr(i2c_device_hndl i2c_device)
     return i2c_device->addr;
 }
 
+const struct driver_caps *i2c_device_caps(i2c_device_hndl i2c_device)
+{
+    assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
+    return driver_caps(i2c_device->bus);
+}
+
 /* Destroy i2c-device instance */
 void i2c_device_close(i2c_device_hndl i2c_device)
 {
@@ -107,33 +126,35 @@ void i2c_device_read_bytes(i2c_device_hndl i2c_device, uint8_t reg,
 {
 
     assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
+    API_ENTRY(i2c_device, 1, count);
 
     /* Send which register to start access, omit STOP */
     i2c_write(i2c_device->bus, i2c_device->addr, (uint8_t[]) {
               reg}, 1, 0);
 
     i2c_read(i2c_device->bus, i2c_device->addr, buf, count);
+    API_RETURN(i2c_device);
 }
 
 void i2c_device_write_bytes(i2c_device_hndl i2c_device, uint8_t reg,
                             uint8_t *buf, uint8_t count)
 {
-    uint8_t *tbuf;
+    /* count is at most 255, no need to allocate */
+    uint8_t tbuf[UINT8_MAX + 1];
 
     assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
 
-    ASSURE(tbuf = malloc(count + 1));
-    memset(tbuf, 0, count + 1);
-
-    /* Put both register and payload in new buffer */
+    /* Put both register and payload in one message */
     tbuf[0] = reg;
     if (buf && count) {
         memcpy(&tbuf[1], buf, count);
+    } else {
+        memset(&tbuf[1], 0, count);
     }
 
+    API_ENTRY(i2c_device, count + 1, 0);
     i2c_write(i2c_device->bus, i2c_device->addr, tbuf, count + 1, 1);
-
-    free(tbuf);
+    API_RETURN(i2c_device);
 }
 
 uint8_t i2c_device_read_uint8(i2c_device_hndl i2c_device, uint8_t reg)
@@ -163,7 +184,7 @@ uint16_t i2c_device_read_uint16(i2c_device_hndl i2c_device, uint8_t reg)
               reg}, 1, 0);
 
     i2c_read(i2c_device->bus, i2c_device->addr, buf, sizeof(val));
-    val = *(uint16_t *)buf;
+    memcpy(&val, buf, sizeof(val));
 
     return val;
 }
@@ -180,7 +201,7 @@ uint32_t i2c_device_read_uint32(i2c_device_hndl i2c_device, uint8_t reg)
               reg}, 1, 0);
 
     i2c_read(i2c_device->bus, i2c_device->addr, buf, sizeof(val));
-    val = *(uint32_t *)buf;
+    memcpy(&val, buf, sizeof(val));
 
     return val;
 }
@@ -200,7 +221,7 @@ void i2c_device_write_uint16(i2c_device_hndl i2c_device, uint8_t reg,
 {
     uint8_t buf[sizeof(val) + 1];
     buf[0] = reg;
-    *(uint16_t *)(&buf[1]) = val;
+    memcpy(&buf[1], &val, sizeof(val));
 
     assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
 
@@ -214,7 +235,7 @@ void i2c_device_write_uint32(i2c_device_hndl i2c_device, uint8_t reg,
 {
     uint8_t buf[sizeof(val) + 1];
     buf[0] = reg;
-    *(uint32_t *)(&buf[1]) = val;
+    memcpy(&buf[1], &val, sizeof(val));
 
     assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
 
@@ -223,6 +244,43 @@ void i2c_device_write_uint32(i2c_device_hndl i2c_device, uint8_t reg,
     i2c_write(i2c_device->bus, i2c_device->addr, buf, sizeof(val) + 1, 1);
 }
 
+void i2c_device_read_fifo(i2c_device_hndl i2c_device, uint8_t reg,
+                          uint8_t *buf, uint32_t len)
+{
+    uint32_t n;
+    int max;
+
+    assert(i2c_device != NULL && "Error: Bad i2c-device descriptor");
+    API_ENTRY(i2c_device, 1, len);
+    max = driver_caps(i2c_device->bus)->max_xfer;
+
+    /* Send which register to access once, omit STOP. The FIFO stays
+     * addressed between reads. */
+    i2c_write(i2c_device->bus, i2c_device->addr, (uint8_t[]) {
+              reg}, 1, 0);
+
+    for (; len; buf += n, len -= n) {
+        n = max && len > (uint32_t)max ? (uint32_t)max : len;
+        i2c_read(i2c_device->bus, i2c_device->addr, buf, n);
+    }
+    API_RETURN(i2c_device);
+}
+
+void i2c_device_read_fifo_s16(i2c_device_hndl i2c_device, uint8_t reg,
+                              int16_t *out, uint32_t n, int be, int bits)
+{
+    /* Decoded in place */
+    i2c_device_read_fifo(i2c_device, reg, (uint8_t *)out, n * sizeof(*out));
+    sample_decode_s16(out, out, n, be, bits);
+}
+
+void i2c_device_read_fifo_s32(i2c_device_hndl i2c_device, uint8_t reg,
+                              int32_t *out, uint32_t n, int be, int bits)
+{
+    i2c_device_read_fifo(i2c_device, reg, (uint8_t *)out, n * sizeof(*out));
+    sample_decode_s32(out, out, n, be, bits);
+}
+
 /* Does nothing but is needed for linker not to optimize away functions */
 int i2c_device_init_api(const struct adapter *device)
 {
@@ -0,0 +1,353 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Device level I2C EEPROM (24Cxx) abstraction
+ *
+ * Builds on the i2c-device layer. Write-cycles are waited for by ACK
+ * polling, i.e. probing the device until it answers its address again,
+ * unless the adapter can't tell ACK from NACK. Then the worst case
+ * write-cycle time is slept instead.
+ *
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+
+#include <ehwe.h>
+#include <ehwe_i2c_device.h>
+#include <ehwe_i2c_eeprom.h>
+#include <adapters.h>
+#include <driver.h>
+#include <usdt.h>
+
+/* Static tracepoints, see usdt.h */
+#define API_ENTRY(E, A, OSZ, ISZ) \
+    USDT6(api_entry, "i2c_eeprom", __func__, (E)->bus->adapter->index, \
+          A, OSZ, ISZ)
+#define API_RETURN(E, A) \
+    USDT4(api_return, "i2c_eeprom", __func__, (E)->bus->adapter->index, A)
+
+/* Write-cycle, worst case for any 24Cxx (tWR) and when to give up polling */
+#define TWR_US          5000
+#define TWR_TIMEOUT_MS  50
+
+/* No page collected */
+#define NO_PAGE UINT32_MAX
+
+struct i2c_eeprom_struct {
+    i2c_device_hndl dev;
+    I2C_TypeDef *bus;
+    uint8_t addr;
+
+    /* this-pointer */
+    struct i2c_eeprom_struct *self;
+
+    uint32_t size;
+    uint32_t page;
+    int alen;                   /* Address bytes */
+
+    /* Page being collected: base address, and the dirty part [lo, hi) */
+    uint8_t *pbuf;
+    uint32_t pbase;
+    uint32_t lo, hi;
+
+    /* Cleared if the adapter can't tell ACK, sleep instead */
+    int ack_poll;
+};
+
+/* Page size of Microchip parts */
+static uint32_t dflt_page(uint32_t size)
+{
+    if (size <= 256)
+        return 8;
+    if (size <= 2048)
+        return 16;
+    if (size <= 8192)
+        return 32;
+    if (size <= 32768)
+        return 64;
+    if (size <= 65536)
+        return 128;
+    return 256;
+}
+
+/* Device address for memory address a */
+static uint8_t dev_addr(struct i2c_eeprom_struct *e, uint32_t a)
+{
+    return e->addr | ((a >> (8 * e->alen)) & 0x07);
+}
+
+static int put_addr(struct i2c_eeprom_struct *e, uint8_t *p, uint32_t a)
+{
+    int i;
+
+    for (i = 0; i < e->alen; i++)
+        p[i] = a >> (8 * (e->alen - 1 - i));
+    return e->alen;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Wait for write-cycle of device at a to end */
+static int wait_ready(struct i2c_eeprom_struct *e, uint32_t a)
+{
+    uint64_t deadline = now_ms() + TWR_TIMEOUT_MS;
+    int ack;
+
+    while (e->ack_poll) {
+        if ((ack = i2c_probe(e->bus, dev_addr(e, a))) == 1)
+            return 0;
+        if (ack == -1) {
+            LOGD("I2C EEPROM: No ACK polling on adapter %d, using %dus "
+                 "write-cycles\n", e->bus->adapter->index, TWR_US);
+            e->ack_poll = 0;
+            break;
+        }
+        if (now_ms() > deadline) {
+            LOGE("I2C EEPROM: 0x%02X still busy after %dms\n",
+                 dev_addr(e, a), TWR_TIMEOUT_MS);
+            return -1;
+        }
+    }
+    usleep(TWR_US);
+    return 0;
+}
+
+/* One page-write, within a page. As i2c_write, but a NACK of the device
+ * address (device gone, or still in a write-cycle) fails the write instead
+ * of being asserted */
+static int write_page(struct i2c_eeprom_struct *e, uint32_t a,
+                      const uint8_t *buf, uint32_t n)
+{
+    uint8_t tbuf[4 + 256];
+    int hsz, ack;
+
+    assert(n <= e->page && n <= 256);
+    hsz = put_addr(e, tbuf, a);
+    memcpy(&tbuf[hsz], buf, n);
+
+    e->bus->start(e->bus->ddata);
+    if ((ack = e->bus->sendByte(e->bus->ddata, dev_addr(e, a) << 1)) == 1)
+        e->bus->sendData(e->bus->ddata, tbuf, hsz + n);
+    e->bus->stop(e->bus->ddata);
+    if (ack != 1) {
+        LOGE("I2C EEPROM: 0x%02X doesn't ACK write of %u at 0x%X\n",
+             dev_addr(e, a), n, a);
+        return -1;
+    }
+    return wait_ready(e, a);
+}
+
+static void read_raw(struct i2c_eeprom_struct *e, uint32_t a, uint8_t *buf,
+                     uint32_t len)
+{
+    const struct driver_caps *caps = driver_caps(e->bus);
+    uint8_t da = dev_addr(e, a), hdr[4];
+    int n;
+
+    /* Address once, the device's counter takes it from there */
+    i2c_write(e->bus, da, hdr, put_addr(e, hdr, a), 0);
+    while (len) {
+        n = driver_chunk(caps, len > INT32_MAX ? INT32_MAX : len);
+        i2c_read(e->bus, da, buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Creates an i2c-eeprom instance, and returns handle to it. */
+i2c_eeprom_hndl i2c_eeprom_open(I2C_TypeDef * bus, uint8_t addr,
+                                uint32_t size, uint32_t page)
+{
+    struct i2c_eeprom_struct *i2c_eeprom;
+
+    assert(addr < 0x80);
+    assert(size >= 128 && size <= 8 * 65536 && (size & (size - 1)) == 0);
+    if (page == 0)
+        page = dflt_page(size);
+    assert(page <= 256 && (page & (page - 1)) == 0);
+
+    /* Smaller aligned page-writes do as well, if adapter can't take it */
+    while (driver_caps(bus)->max_xfer &&
+           page + (size <= 2048 ? 1 : 2) > driver_caps(bus)->max_xfer)
+        page >>= 1;
+
+    i2c_eeprom = calloc(1, sizeof(struct i2c_eeprom_struct));
+    assert(i2c_eeprom != NULL);
+
+    i2c_eeprom->self = i2c_eeprom;
+    i2c_eeprom->dev = i2c_device_open(bus, addr);
+    i2c_eeprom->bus = bus;
+    i2c_eeprom->addr = addr;
+    i2c_eeprom->size = size;
+    i2c_eeprom->page = page;
+    i2c_eeprom->alen = size <= 2048 ? 1 : 2;
+    i2c_eeprom->pbuf = malloc(page);
+    assert(i2c_eeprom->pbuf != NULL);
+    i2c_eeprom->pbase = NO_PAGE;
+    i2c_eeprom->ack_poll = 1;
+
+    return i2c_eeprom;
+}
+
+i2c_device_hndl i2c_eeprom_device(i2c_eeprom_hndl i2c_eeprom)
+{
+    assert(i2c_eeprom != NULL && "Error: Bad i2c-eeprom descriptor");
+    return i2c_eeprom->dev;
+}
+
+uint32_t i2c_eeprom_size(i2c_eeprom_hndl i2c_eeprom)
+{
+    assert(i2c_eeprom != NULL && "Error: Bad i2c-eeprom descriptor");
+    return i2c_eeprom->size;
+}
+
+uint32_t i2c_eeprom_page_size(i2c_eeprom_hndl i2c_eeprom)
+{
+    assert(i2c_eeprom != NULL && "Error: Bad i2c-eeprom descriptor");
+    return i2c_eeprom->page;
+}
+
+/* Destroy i2c-eeprom instance */
+void i2c_eeprom_close(i2c_eeprom_hndl i2c_eeprom)
+{
+    assert(i2c_eeprom != NULL && "Error: Bad i2c-eeprom descriptor");
+
+    i2c_eeprom_flush(i2c_eeprom);
+    i2c_device_close(i2c_eeprom->dev);
+    free(i2c_eeprom->pbuf);
+
+    i2c_eeprom->self = NULL;
+    i2c_eeprom->dev = NULL;
+    i2c_eeprom->pbuf = NULL;
+
+    free(i2c_eeprom);
+}
+
+int i2c_eeprom_flush(i2c_eeprom_hndl i2c_eeprom)
+{
+    struct i2c_eeprom_struct *e = i2c_eeprom;
+    uint32_t a;
+    int rc;
+
+    assert(e != NULL && "Error: Bad i2c-eeprom descriptor");
+    if (e->pbase == NO_PAGE)
+        return 0;
+
+    a = e->pbase + e->lo;
+    API_ENTRY(e, a, e->hi - e->lo, 0);
+    rc = write_page(e, a, &e->pbuf[e->lo], e->hi - e->lo);
+    e->pbase = NO_PAGE;
+    API_RETURN(e, a);
+    return rc;
+}
+
+int i2c_eeprom_read(i2c_eeprom_hndl i2c_eeprom, uint32_t addr, uint8_t *buf,
+                    uint32_t len)
+{
+    struct i2c_eeprom_struct *e = i2c_eeprom;
+
+    assert(e != NULL && "Error: Bad i2c-eeprom descriptor");
+    assert(buf != NULL || len == 0);
+    if (addr > e->size || len > e->size - addr) {
+        LOGE("I2C EEPROM: Read of %u at 0x%X is beyond end of device\n", len,
+             addr);
+        return -1;
+    }
+    if (len == 0)
+        return 0;
+
+    /* Reads see what's written */
+    if (i2c_eeprom_flush(e) != 0)
+        return -1;
+
+    API_ENTRY(e, addr, 0, len);
+    read_raw(e, addr, buf, len);
+    API_RETURN(e, addr);
+    return 0;
+}
+
+int i2c_eeprom_write(i2c_eeprom_hndl i2c_eeprom, uint32_t addr,
+                     const uint8_t *buf, uint32_t len)
+{
+    struct i2c_eeprom_struct *e = i2c_eeprom;
+    uint32_t pa, off, n;
+    int rc = 0;
+
+    assert(e != NULL && "Error: Bad i2c-eeprom descriptor");
+    assert(buf != NULL || len == 0);
+    if (addr > e->size || len > e->size - addr) {
+        LOGE("I2C EEPROM: Write of %u at 0x%X is beyond end of device\n",
+             len, addr);
+        return -1;
+    }
+    API_ENTRY(e, addr, len, 0);
+
+    for (; len && rc == 0; addr += n, buf += n, len -= n) {
+        pa = addr & ~(e->page - 1);
+        off = addr - pa;
+        n = e->page - off < len ? e->page - off : len;
+
+        if (e->pbase != pa) {
+            if ((rc = i2c_eeprom_flush(e)) != 0)
+                break;
+            if (n == e->page) {
+                rc = write_page(e, addr, buf, n);
+                continue;
+            }
+            e->pbase = pa;
+            e->lo = off;
+            e->hi = off + n;
+            memcpy(&e->pbuf[off], buf, n);
+            continue;
+        }
+
+        /* A page-write is of consecutive bytes. Fill gaps to what's
+         * collected with what's there. */
+        if (off > e->hi)
+            read_raw(e, pa + e->hi, &e->pbuf[e->hi], off - e->hi);
+        if (off + n < e->lo)
+            read_raw(e, pa + off + n, &e->pbuf[off + n], e->lo - off - n);
+        memcpy(&e->pbuf[off], buf, n);
+        if (off < e->lo)
+            e->lo = off;
+        if (off + n > e->hi)
+            e->hi = off + n;
+    }
+    API_RETURN(e, addr);
+    return rc;
+}
+
+/* Does nothing but is needed for linker not to optimize away functions */
+int i2c_eeprom_init_api(const struct adapter *device)
+{
+    return 0;
+}
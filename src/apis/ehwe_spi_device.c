@@ -0,0 +1,1202 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Device level SPI NOR flash, i.e. chip level, abstraction
+ *
+ * Covers JEDEC SPI NOR flash in single-IO command mode. Geometry is probed
+ * from the JEDEC basic flash parameter table (SFDP, JESD216) when the chip
+ * has one, otherwise from the JEDEC-ID capacity byte using the erase types
+ * common to all 25-series parts.
+ *
+ */
+#define _GNU_SOURCE
+#include <config.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_USERFAULTFD
+#  include <poll.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <linux/userfaultfd.h>
+#endif
+#include <liblog/log.h>
+#include <liblog/assure.h>
+
+#include <ehwe.h>
+#include <ehwe_spi_device.h>
+#include <ehwe_crc32c.h>
+#include <adapters.h>
+#include <driver.h>
+#include <usdt.h>
+
+/* Static tracepoints, see usdt.h */
+#define API_ENTRY(D, A, OSZ, ISZ) \
+    USDT6(api_entry, "spi_device", __func__, (D)->bus->adapter->index, \
+          A, OSZ, ISZ)
+#define API_RETURN(D, A) \
+    USDT4(api_return, "spi_device", __func__, (D)->bus->adapter->index, A)
+
+#define DDATA( B ) (B->ddata)
+#define DD( B ) (B)
+
+/* Commands */
+#define CMD_PP          0x02
+#define CMD_RDSR        0x05
+#define CMD_WREN        0x06
+#define CMD_FAST_READ   0x0B
+#define CMD_DOR         0x3B
+#define CMD_SFDP        0x5A
+#define CMD_QOR         0x6B
+#define CMD_RDID        0x9F
+#define CMD_EN4B        0xB7
+#define CMD_CE          0xC7
+#define CMD_EX4B        0xE9
+
+/* Status register */
+#define SR_WIP          0x01
+
+/* Worst case times, from the slowest parts around */
+#define PROGRAM_TIMEOUT_MS  10
+#define ERASE_TIMEOUT_MS    4000
+#define CHIP_ERASE_MS_PER_MB 12000
+/* Adapter round-trips allowed on top of those, the status is only seen
+ * that late on a slow or remote adapter */
+#define TIMEOUT_ROUNDTRIPS  4
+
+/* Erase types kept, most a basic parameter table can tell */
+#define MAX_ERASE_TYPES 4
+
+/* Longest command header: command, 4 address bytes, 1 dummy byte */
+#define MAX_HDR 6
+
+struct spi_device_struct {
+    /* HW-bus: SPI1-SPIn */
+    SPI_TypeDef *bus;
+
+    /* this-pointer */
+    struct spi_device_struct *self;
+
+    /* Probed geometry */
+    uint32_t jedec_id;
+    uint32_t size;
+    uint32_t page_size;
+
+    /* 3 or 4. en4b set if 4-byte mode was entered on open */
+    int addr_bytes;
+    int en4b;
+
+    /* Fast-read command in use */
+    uint8_t read_cmd;
+
+    /* Erase types, largest first */
+    int nerase;
+    struct {
+        uint32_t size;
+        uint8_t cmd;
+    } erase[MAX_ERASE_TYPES];
+
+    /* Command header + one page */
+    uint8_t *pbuf;
+
+    /* Lazy memory-mapped view, NULL if none */
+    struct spi_device_map *map;
+};
+
+/***************************************************************************
+ * Commands
+ ***************************************************************************/
+/* Put command and address in p, returns number of bytes */
+static int cmd_hdr(struct spi_device_struct *d, uint8_t *p, uint8_t cmd,
+                   uint32_t addr)
+{
+    int i, n = 0;
+
+    p[n++] = cmd;
+    for (i = d->addr_bytes - 1; i >= 0; i--)
+        p[n++] = addr >> (8 * i);
+    return n;
+}
+
+static void cmd_simple(struct spi_device_struct *d, uint8_t cmd)
+{
+    DD(d->bus)->sendData(DDATA(d->bus), &cmd, 1);
+}
+
+static uint8_t rdsr(struct spi_device_struct *d)
+{
+    uint8_t sr = 0xFF;
+
+    DD(d->bus)->sendrecieveData(DDATA(d->bus), (uint8_t[]) {
+                                CMD_RDSR}, 1, &sr, 1);
+    return sr;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Poll until not busy. Page-programs are done in less time than an adapter
+ * round-trip takes, so poll_us is 0 for those. The time is taken before
+ * each status read, so that the last one is from after the deadline and a
+ * part that got done while the poll was on its way isn't failed. */
+static int wait_ready(struct spi_device_struct *d, int poll_us,
+                      uint32_t timeout_ms)
+{
+    int latency_us = driver_caps(d->bus)->latency_us;
+    uint64_t deadline;
+    int expired;
+
+    timeout_ms += (TIMEOUT_ROUNDTRIPS * latency_us + 999) / 1000;
+    deadline = now_ms() + timeout_ms;
+    for (;;) {
+        expired = now_ms() > deadline;
+        if (!(rdsr(d) & SR_WIP))
+            return 0;
+        if (expired) {
+            LOGE("SPI flash: still busy after %ums\n", timeout_ms);
+            return -1;
+        }
+        if (poll_us)
+            usleep(poll_us);
+    }
+}
+
+/***************************************************************************
+ * Probing
+ ***************************************************************************/
+static void sfdp_read(struct spi_device_struct *d, uint32_t addr,
+                      uint8_t *buf, int len)
+{
+    uint8_t hdr[] = { CMD_SFDP, addr >> 16, addr >> 8, addr, 0 };
+
+    DD(d->bus)->sendrecieveData(DDATA(d->bus), hdr, sizeof(hdr), buf, len);
+}
+
+static uint32_t dword(const uint8_t *p, int i)
+{
+    p += 4 * i;
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void add_erase(struct spi_device_struct *d, int exp, uint8_t cmd)
+{
+    int i;
+
+    /* Size 2^0 means unused, 0xFF is an unprogrammed table */
+    if (exp == 0 || exp >= 32 || d->nerase == MAX_ERASE_TYPES)
+        return;
+    for (i = d->nerase; i > 0 && d->erase[i - 1].size < (1u << exp); i--)
+        d->erase[i] = d->erase[i - 1];
+    d->erase[i].size = 1u << exp;
+    d->erase[i].cmd = cmd;
+    d->nerase++;
+}
+
+/* Parse JEDEC basic flash parameter table. Returns 0 if found and sane. */
+static int probe_sfdp(struct spi_device_struct *d, int *dual, int *quad)
+{
+    uint8_t hdr[8], ph[8], tbl[16 * 4];
+    uint32_t dw, ptp;
+    int i, nph, len;
+
+    sfdp_read(d, 0, hdr, sizeof(hdr));
+    if (memcmp(hdr, "SFDP", 4) != 0)
+        return -1;
+
+    /* Find the basic table (ID 0xFF00) among the parameter headers */
+    nph = hdr[6] + 1;
+    for (i = 0; i < nph; i++) {
+        sfdp_read(d, 8 + 8 * i, ph, sizeof(ph));
+        if (ph[0] == 0x00 && ph[7] == 0xFF && ph[2] == 1)
+            break;
+    }
+    if (i == nph)
+        return -1;
+
+    len = ph[3];
+    if (len < 9)
+        return -1;
+    if (len > (int)sizeof(tbl) / 4)
+        len = sizeof(tbl) / 4;
+    ptp = ph[4] | ph[5] << 8 | ph[6] << 16;
+    sfdp_read(d, ptp, tbl, len * 4);
+
+    dw = dword(tbl, 0);
+    *dual = (dw >> 16) & 1;
+    *quad = (dw >> 22) & 1;
+    d->addr_bytes = ((dw >> 17) & 3) == 2 ? 4 : 3;
+
+    dw = dword(tbl, 1);
+    if (dw & 0x80000000) {
+        if ((dw & 0x7FFFFFFF) < 3 || (dw & 0x7FFFFFFF) > 34)
+            return -1;
+        d->size = 1u << ((dw & 0x7FFFFFFF) - 3);
+    } else {
+        d->size = (dw >> 3) + 1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        dw = dword(tbl, 7 + i / 2);
+        add_erase(d, (dw >> (16 * (i % 2))) & 0xFF,
+                  (dw >> (16 * (i % 2) + 8)) & 0xFF);
+    }
+    /* 4K erase of DWORD1 only, if no erase types are listed */
+    dw = dword(tbl, 0);
+    if (d->nerase == 0 && (dw & 3) == 1)
+        add_erase(d, 12, (dw >> 8) & 0xFF);
+
+    if (len >= 11)
+        d->page_size = 1u << ((dword(tbl, 10) >> 4) & 0xF);
+
+    return d->nerase ? 0 : -1;
+}
+
+/* No SFDP: capacity byte is log2 of size for all 25-series of note */
+static int probe_jedec(struct spi_device_struct *d)
+{
+    int cap = d->jedec_id & 0xFF;
+
+    if (cap < 0x10 || cap > 0x20)
+        return -1;
+    d->size = 1u << cap;
+    d->addr_bytes = 3;
+    d->nerase = 0;
+    add_erase(d, 16, 0xD8);
+    add_erase(d, 15, 0x52);
+    add_erase(d, 12, 0x20);
+    return 0;
+}
+
+/***************************************************************************
+ * API
+ ***************************************************************************/
+/* Creates a spi-device instance, and returns handle to it. */
+spi_device_hndl spi_device_open(SPI_TypeDef * bus)
+{
+    struct spi_device_struct *spi_device;
+    const struct driver_caps *caps;
+    uint8_t id[3];
+    int dual = 0, quad = 0;
+
+    assert(bus != NULL);
+    assert(bus->adapter->role == ROLE_SPI);
+
+    spi_device = calloc(1, sizeof(struct spi_device_struct));
+    assert(spi_device != NULL);
+
+    spi_device->self = spi_device;
+    spi_device->bus = bus;
+    spi_device->page_size = 256;
+
+    DD(bus)->sendrecieveData(DDATA(bus), (uint8_t[]) {
+                             CMD_RDID}, 1, id, sizeof(id));
+    spi_device->jedec_id = id[0] << 16 | id[1] << 8 | id[2];
+    if (spi_device->jedec_id == 0 || spi_device->jedec_id == 0xFFFFFF) {
+        LOGE("SPI flash: No device answering on adapter %d\n",
+             bus->adapter->index);
+        goto spi_device_open_err;
+    }
+
+    if (probe_sfdp(spi_device, &dual, &quad) != 0) {
+        LOGD("SPI flash: No usable SFDP, using JEDEC-ID %06X\n",
+             spi_device->jedec_id);
+        dual = quad = 0;
+        if (probe_jedec(spi_device) != 0) {
+            LOGE("SPI flash: Unknown capacity of JEDEC-ID %06X\n",
+                 spi_device->jedec_id);
+            goto spi_device_open_err;
+        }
+    }
+
+    /* Above 16M, switch to 4-byte addressing unless it's all there is */
+    if (spi_device->size > (1u << 24) && spi_device->addr_bytes == 3) {
+        cmd_simple(spi_device, CMD_WREN);
+        cmd_simple(spi_device, CMD_EN4B);
+        spi_device->addr_bytes = 4;
+        spi_device->en4b = 1;
+    }
+
+    /* Multi-IO reads only if both ends can */
+    caps = driver_caps(bus);
+    if (quad && (caps->flags & DCAP_QUAD_IO))
+        spi_device->read_cmd = CMD_QOR;
+    else if (dual && (caps->flags & DCAP_DUAL_IO))
+        spi_device->read_cmd = CMD_DOR;
+    else
+        spi_device->read_cmd = CMD_FAST_READ;
+
+    spi_device->pbuf = malloc(MAX_HDR + spi_device->page_size);
+    assert(spi_device->pbuf != NULL);
+
+    LOGI("SPI flash: %06X, %uK, page %u, smallest erase %uK, read 0x%02X\n",
+         spi_device->jedec_id, spi_device->size / 1024,
+         spi_device->page_size,
+         spi_device->erase[spi_device->nerase - 1].size / 1024,
+         spi_device->read_cmd);
+    return spi_device;
+
+spi_device_open_err:
+    free(spi_device);
+    return NULL;
+}
+
+SPI_TypeDef *spi_device_bus(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return spi_device->bus;
+}
+
+const struct driver_caps *spi_device_caps(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return driver_caps(spi_device->bus);
+}
+
+uint32_t spi_device_jedec_id(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return spi_device->jedec_id;
+}
+
+uint32_t spi_device_size(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return spi_device->size;
+}
+
+uint32_t spi_device_page_size(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return spi_device->page_size;
+}
+
+uint32_t spi_device_erase_size(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    return spi_device->erase[spi_device->nerase - 1].size;
+}
+
+/* Destroy spi-device instance */
+void spi_device_close(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+
+    spi_device_unmap(spi_device);
+
+    /* Leave it as found, for whatever expects 3-byte addressing */
+    if (spi_device->en4b)
+        cmd_simple(spi_device, CMD_EX4B);
+
+    free(spi_device->pbuf);
+    spi_device->self = NULL;
+    spi_device->pbuf = NULL;
+
+    free(spi_device);
+}
+
+int spi_device_read(spi_device_hndl spi_device, uint32_t addr, uint8_t *buf,
+                    uint32_t len)
+{
+    const struct driver_caps *caps;
+    uint8_t hdr[MAX_HDR];
+    int n, hsz;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    assert(buf != NULL || len == 0);
+    if (addr > spi_device->size || len > spi_device->size - addr) {
+        LOGE("SPI flash: Read of %u at 0x%X is beyond end of device\n", len,
+             addr);
+        return -1;
+    }
+    caps = driver_caps(spi_device->bus);
+    API_ENTRY(spi_device, addr, 0, len);
+
+    /* One command per chunk, each as long as the adapter takes */
+    while (len) {
+        hsz = cmd_hdr(spi_device, hdr, spi_device->read_cmd, addr);
+        hdr[hsz++] = 0;         /* Dummy, 8 clocks */
+        n = driver_chunk(caps, len > INT32_MAX ? INT32_MAX : len);
+        DD(spi_device->bus)->sendrecieveData(DDATA(spi_device->bus), hdr,
+                                             hsz, buf, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+    API_RETURN(spi_device, addr);
+    return 0;
+}
+
+int spi_device_erase(spi_device_hndl spi_device, uint32_t addr, uint32_t len)
+{
+    uint8_t hdr[MAX_HDR];
+    uint32_t min;
+    int i, hsz, rc = 0;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    min = spi_device->erase[spi_device->nerase - 1].size;
+    if ((addr | len) & (min - 1)) {
+        LOGE("SPI flash: Erase of %u at 0x%X not aligned to %u\n", len, addr,
+             min);
+        return -1;
+    }
+    if (addr > spi_device->size || len > spi_device->size - addr) {
+        LOGE("SPI flash: Erase of %u at 0x%X is beyond end of device\n", len,
+             addr);
+        return -1;
+    }
+    API_ENTRY(spi_device, addr, 0, 0);
+
+    if (addr == 0 && len == spi_device->size && len > min) {
+        cmd_simple(spi_device, CMD_WREN);
+        cmd_simple(spi_device, CMD_CE);
+        rc = wait_ready(spi_device, 100000, ERASE_TIMEOUT_MS +
+                        CHIP_ERASE_MS_PER_MB * (spi_device->size >> 20));
+        API_RETURN(spi_device, addr);
+        return rc;
+    }
+
+    /* Sizes are powers of 2, so the largest type that is aligned and fits
+     * at each step gives the fewest erases */
+    while (len && rc == 0) {
+        for (i = 0; i < spi_device->nerase - 1; i++) {
+            if ((addr & (spi_device->erase[i].size - 1)) == 0 &&
+                len >= spi_device->erase[i].size)
+                break;
+        }
+        cmd_simple(spi_device, CMD_WREN);
+        hsz = cmd_hdr(spi_device, hdr, spi_device->erase[i].cmd, addr);
+        DD(spi_device->bus)->sendData(DDATA(spi_device->bus), hdr, hsz);
+        rc = wait_ready(spi_device, 1000, ERASE_TIMEOUT_MS);
+        addr += spi_device->erase[i].size;
+        len -= spi_device->erase[i].size;
+    }
+    API_RETURN(spi_device, addr);
+    return rc;
+}
+
+int spi_device_program(spi_device_hndl spi_device, uint32_t addr,
+                       const uint8_t *buf, uint32_t len)
+{
+    const struct driver_caps *caps;
+    uint32_t n, max;
+    int hsz, rc = 0;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    assert(buf != NULL || len == 0);
+    if (addr > spi_device->size || len > spi_device->size - addr) {
+        LOGE("SPI flash: Program of %u at 0x%X is beyond end of device\n",
+             len, addr);
+        return -1;
+    }
+    caps = driver_caps(spi_device->bus);
+    max = caps->max_xfer ? caps->max_xfer - MAX_HDR : spi_device->page_size;
+    API_ENTRY(spi_device, addr, len, 0);
+
+    /* WREN and PP return nothing and are posted by asynchronous adapters
+     * (DCAP_ASYNC), so on those each page costs one round-trip: that of
+     * the status poll. Synchronous adapters complete every call, i.e. take
+     * three per page as ever. */
+    while (len && rc == 0) {
+        n = spi_device->page_size - (addr & (spi_device->page_size - 1));
+        if (n > len)
+            n = len;
+        if (n > max)
+            n = max;
+
+        cmd_simple(spi_device, CMD_WREN);
+        hsz = cmd_hdr(spi_device, spi_device->pbuf, CMD_PP, addr);
+        memcpy(&spi_device->pbuf[hsz], buf, n);
+        DD(spi_device->bus)->sendData(DDATA(spi_device->bus),
+                                      spi_device->pbuf, hsz + n);
+        rc = wait_ready(spi_device, 0, PROGRAM_TIMEOUT_MS);
+
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+    API_RETURN(spi_device, addr);
+    return rc;
+}
+
+/***************************************************************************
+ * Differential programming
+ ***************************************************************************/
+static int is_erased(const uint8_t *p, uint32_t n)
+{
+    while (n--)
+        if (*p++ != 0xFF)
+            return 0;
+    return 1;
+}
+
+/* Program the pages of want differing from cur, or if cur is NULL (just
+ * erased) those not blank. addr is page aligned. */
+static int program_changed(struct spi_device_struct *d, uint32_t addr,
+                           const uint8_t *want, const uint8_t *cur,
+                           uint32_t len)
+{
+    uint32_t off, page = d->page_size;
+
+    for (off = 0; off < len; off += page) {
+        if (cur ? memcmp(&want[off], &cur[off], page) == 0 :
+            is_erased(&want[off], page))
+            continue;
+        if (spi_device_program(d, addr + off, &want[off], page) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int spi_device_update(spi_device_hndl spi_device, uint32_t addr,
+                      const uint8_t *image, uint32_t len)
+{
+    uint8_t *cur, *want, *run = NULL;
+    uint32_t sec, lo, hi, i, run_start = 0, run_len = 0;
+    unsigned same = 0, prog = 0, erased = 0;
+    uint64_t s, end;
+    int rc = 0;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    assert(image != NULL || len == 0);
+    if (addr > spi_device->size || len > spi_device->size - addr) {
+        LOGE("SPI flash: Update of %u at 0x%X is beyond end of device\n",
+             len, addr);
+        return -1;
+    }
+    if (len == 0)
+        return 0;
+    sec = spi_device_erase_size(spi_device);
+    end = ((uint64_t)addr + len + sec - 1) & ~(uint64_t)(sec - 1);
+    API_ENTRY(spi_device, addr, len, 0);
+
+    cur = malloc(sec);
+    want = malloc(sec);
+    assert(cur != NULL && want != NULL);
+
+/* Erase the run of sectors collected and program what isn't blank */
+#define FLUSH_RUN() \
+    if (run_len) { \
+        if (rc == 0) \
+            rc = spi_device_erase(spi_device, run_start, run_len); \
+        if (rc == 0) \
+            rc = program_changed(spi_device, run_start, run, NULL, run_len); \
+        run_len = 0; \
+    }
+
+    for (s = addr & ~(sec - 1); s < end && rc == 0; s += sec) {
+        if ((rc = spi_device_read(spi_device, s, cur, sec)) != 0)
+            break;
+
+        /* Wanted content: as is, with the part of image in this sector */
+        lo = s < addr ? addr : s;
+        hi = s + sec < (uint64_t)addr + len ? s + sec : addr + len;
+        memcpy(want, cur, sec);
+        memcpy(&want[lo - s], &image[lo - addr], hi - lo);
+
+        if (memcmp(want, cur, sec) == 0) {
+            FLUSH_RUN();
+            same++;
+            continue;
+        }
+
+        /* Programming can only clear bits */
+        for (i = 0; i < sec && (cur[i] & want[i]) == want[i]; i++) ;
+        if (i == sec) {
+            FLUSH_RUN();
+            if (rc == 0)
+                rc = program_changed(spi_device, s, want, cur, sec);
+            prog++;
+            continue;
+        }
+
+        /* Needs erase. Collect, so adjacent sectors can go in larger erase
+         * blocks */
+        if (run_len == 0)
+            run_start = s;
+        run = realloc(run, run_len + sec);
+        assert(run != NULL);
+        memcpy(&run[run_len], want, sec);
+        run_len += sec;
+        erased++;
+    }
+    FLUSH_RUN();
+#undef FLUSH_RUN
+
+    free(run);
+    free(want);
+    free(cur);
+
+    LOGI("SPI flash: Update of %u at 0x%X: %u sectors unchanged, "
+         "%u programmed, %u erased and programmed\n", len, addr, same, prog,
+         erased);
+    API_RETURN(spi_device, addr);
+    return rc;
+}
+
+/* Memory-map file fname, read-only. An empty file gives NULL. */
+static int map_image(const char *fname, const uint8_t **image, uint32_t *len)
+{
+    struct stat st;
+    void *p = NULL;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) == -1) {
+        LOGE("SPI flash: Can't open [%s]: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    ASSURE_E(fstat(fd, &st) == 0, goto map_image_err);
+    if ((uint64_t)st.st_size > UINT32_MAX) {
+        LOGE("SPI flash: [%s] is too large\n", fname);
+        goto map_image_err;
+    }
+    if (st.st_size) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ASSURE_E(p != MAP_FAILED, goto map_image_err);
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    *image = p;
+    *len = st.st_size;
+    return 0;
+
+map_image_err:
+    close(fd);
+    return -1;
+}
+
+static void unmap_image(const uint8_t *image, uint32_t len)
+{
+    if (image)
+        munmap((void *)image, len);
+}
+
+int spi_device_update_file(spi_device_hndl spi_device, uint32_t addr,
+                           const char *fname)
+{
+    const uint8_t *image;
+    uint32_t len;
+    int rc;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    if (map_image(fname, &image, &len) != 0)
+        return -1;
+    rc = spi_device_update(spi_device, addr, image, len);
+    unmap_image(image, len);
+    return rc;
+}
+
+/***************************************************************************
+ * Verify
+ *
+ * The calling thread reads from the flash into a ring of buffers, a thread
+ * of its own checks them. Checking thus overlaps with adapter I/O.
+ ***************************************************************************/
+/* Buffers in the ring, and bytes read into each (rounded up to erase
+ * size) */
+#define VERIFY_SLOTS 4
+#define VERIFY_UNIT (64 * 1024)
+
+struct verify {
+    struct spi_device_struct *d;
+    const uint8_t *image;
+    uint32_t addr;              /* Where image goes */
+    uint32_t sec;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct {
+        uint32_t addr;
+        uint32_t len;
+        uint8_t *buf;
+    } slot[VERIFY_SLOTS];
+    unsigned head;              /* Slots filled */
+    unsigned tail;              /* Slots checked */
+    int end;                    /* Nothing more to fill */
+
+    uint32_t crc;               /* Of all read */
+    unsigned bad;               /* Sectors mismatching */
+};
+
+/* Compare per sector, or part of sector at ends of range */
+static void verify_check(struct verify *v, const uint8_t *buf,
+                         uint32_t addr, uint32_t len)
+{
+    uint32_t n, crc_read, crc_image;
+
+    v->crc = crc32c(v->crc, buf, len);
+    for (; len; addr += n, buf += n, len -= n) {
+        n = v->sec - (addr & (v->sec - 1));
+        if (n > len)
+            n = len;
+        crc_read = crc32c(0, buf, n);
+        crc_image = crc32c(0, &v->image[addr - v->addr], n);
+        if (crc_read != crc_image) {
+            LOGW("SPI flash: Verify mismatch in sector 0x%X "
+                 "(CRC32C %08X, image %08X)\n", addr & ~(v->sec - 1),
+                 crc_read, crc_image);
+            v->bad++;
+        }
+    }
+}
+
+static void *verify_thread(void *arg)
+{
+    struct verify *v = arg;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&v->mutex);
+        while (v->head == v->tail && !v->end)
+            pthread_cond_wait(&v->cond, &v->mutex);
+        if (v->head == v->tail) {
+            pthread_mutex_unlock(&v->mutex);
+            return NULL;
+        }
+        i = v->tail % VERIFY_SLOTS;
+        pthread_mutex_unlock(&v->mutex);
+
+        verify_check(v, v->slot[i].buf, v->slot[i].addr, v->slot[i].len);
+
+        pthread_mutex_lock(&v->mutex);
+        v->tail++;
+        pthread_cond_broadcast(&v->cond);
+        pthread_mutex_unlock(&v->mutex);
+    }
+}
+
+int spi_device_verify(spi_device_hndl spi_device, uint32_t addr,
+                      const uint8_t *image, uint32_t len, uint32_t *crc)
+{
+    struct verify v = {
+        .d = spi_device,
+        .image = image,
+        .addr = addr,
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    pthread_t thread;
+    uint32_t unit, a, n;
+    int i, rc = 0;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    assert(image != NULL || len == 0);
+    if (addr > spi_device->size || len > spi_device->size - addr) {
+        LOGE("SPI flash: Verify of %u at 0x%X is beyond end of device\n",
+             len, addr);
+        return -1;
+    }
+    v.sec = spi_device_erase_size(spi_device);
+    unit = VERIFY_UNIT < v.sec ? v.sec : VERIFY_UNIT;
+    API_ENTRY(spi_device, addr, 0, len);
+
+    for (i = 0; i < VERIFY_SLOTS; i++) {
+        v.slot[i].buf = malloc(unit);
+        assert(v.slot[i].buf != NULL);
+    }
+    ASSURE_E(pthread_create(&thread, NULL, verify_thread, &v) == 0,
+             rc = -1; goto verify_err);
+
+    /* Reads aligned to unit, each taking as few transfers as can be */
+    for (a = addr; a - addr < len && rc == 0; a += n) {
+        n = unit - (a & (unit - 1));
+        if (n > len - (a - addr))
+            n = len - (a - addr);
+
+        pthread_mutex_lock(&v.mutex);
+        while (v.head - v.tail == VERIFY_SLOTS)
+            pthread_cond_wait(&v.cond, &v.mutex);
+        i = v.head % VERIFY_SLOTS;
+        pthread_mutex_unlock(&v.mutex);
+
+        rc = spi_device_read(spi_device, a, v.slot[i].buf, n);
+        v.slot[i].addr = a;
+        v.slot[i].len = n;
+
+        pthread_mutex_lock(&v.mutex);
+        if (rc == 0)
+            v.head++;
+        pthread_cond_broadcast(&v.cond);
+        pthread_mutex_unlock(&v.mutex);
+    }
+
+    pthread_mutex_lock(&v.mutex);
+    v.end = 1;
+    pthread_cond_broadcast(&v.cond);
+    pthread_mutex_unlock(&v.mutex);
+    pthread_join(thread, NULL);
+
+    if (rc == 0) {
+        if (v.bad)
+            LOGE("SPI flash: Verify of %u at 0x%X: %u sectors differ\n",
+                 len, addr, v.bad);
+        if (crc)
+            *crc = v.crc;
+    }
+
+verify_err:
+    for (i = 0; i < VERIFY_SLOTS; i++)
+        free(v.slot[i].buf);
+    pthread_mutex_destroy(&v.mutex);
+    pthread_cond_destroy(&v.cond);
+    API_RETURN(spi_device, addr);
+    return rc ? -1 : (int)v.bad;
+}
+
+int spi_device_verify_file(spi_device_hndl spi_device, uint32_t addr,
+                           const char *fname, uint32_t *crc)
+{
+    const uint8_t *image;
+    uint32_t len;
+    int rc;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    if (map_image(fname, &image, &len) != 0)
+        return -1;
+    rc = spi_device_verify(spi_device, addr, image, len, crc);
+    unmap_image(image, len);
+    return rc;
+}
+
+/***************************************************************************
+ * Gang programming
+ *
+ * A thread per target, each with a device of its own on its own adapter.
+ * They share nothing but the read-only image.
+ ***************************************************************************/
+struct gang_target {
+    uint32_t addr;
+    const uint8_t *image;
+    uint32_t len;
+    struct spi_gang_result *res;
+    pthread_t thread;
+    int started;
+};
+
+static void *gang_worker(void *arg)
+{
+    struct gang_target *t = arg;
+    struct spi_gang_result *res = t->res;
+    spi_device_hndl d;
+    uint64_t t0 = now_ms();
+
+    if ((d = spi_device_open(res->adapter->driver.spi)) == NULL) {
+        res->failed = "probe";
+        goto done;
+    }
+    res->jedec_id = spi_device_jedec_id(d);
+    if (t->addr > spi_device_size(d) ||
+        t->len > spi_device_size(d) - t->addr) {
+        LOGE("SPI flash: Image doesn't fit flash of adapter %d\n",
+             res->adapter->index);
+        res->failed = "size";
+    } else if (spi_device_update(d, t->addr, t->image, t->len) != 0) {
+        res->failed = "program";
+    } else if ((res->bad = spi_device_verify(d, t->addr, t->image, t->len,
+                                             &res->crc)) != 0) {
+        res->failed = "verify";
+    }
+    spi_device_close(d);
+done:
+    res->rc = res->failed ? -1 : 0;
+    res->ms = now_ms() - t0;
+    return NULL;
+}
+
+int spi_device_gang(struct adapter **adapters, int n, uint32_t addr,
+                    const char *fname, struct spi_gang_result *res)
+{
+    struct gang_target *t;
+    const uint8_t *image;
+    uint32_t len;
+    int i, err, nfailed = 0;
+
+    if (map_image(fname, &image, &len) != 0)
+        return -1;
+    t = calloc(n, sizeof(struct gang_target));
+    assert(t != NULL);
+
+    for (i = 0; i < n; i++) {
+        memset(&res[i], 0, sizeof(struct spi_gang_result));
+        res[i].adapter = adapters[i];
+        res[i].bad = -1;
+        t[i].addr = addr;
+        t[i].image = image;
+        t[i].len = len;
+        t[i].res = &res[i];
+        if (adapters[i]->role != ROLE_SPI) {
+            res[i].failed = "role";
+            res[i].rc = -1;
+            continue;
+        }
+        if ((err = pthread_create(&t[i].thread, NULL, gang_worker,
+                                  &t[i])) != 0) {
+            LOGE("SPI flash: Can't start worker for adapter %d: %s\n",
+                 adapters[i]->index, strerror(err));
+            res[i].failed = "thread";
+            res[i].rc = -1;
+            continue;
+        }
+        t[i].started = 1;
+    }
+    for (i = 0; i < n; i++) {
+        if (t[i].started)
+            pthread_join(t[i].thread, NULL);
+        if (res[i].rc != 0)
+            nfailed++;
+    }
+
+    free(t);
+    unmap_image(image, len);
+    return nfailed;
+}
+
+/***************************************************************************
+ * Lazy memory-mapped view
+ *
+ * An anonymous mapping registered with userfaultfd. A thread of its own
+ * serves its page-faults by reading from the flash and copying into the
+ * pages faulting. Sequential faults grow the read window, up to
+ * MAP_READAHEAD_MAX.
+ ***************************************************************************/
+#ifdef HAVE_USERFAULTFD
+#define MAP_READAHEAD_MAX (256 * 1024)
+
+struct spi_device_map {
+    uint8_t *base;
+    uint32_t len;               /* Size of device, rounded up to pages */
+    uint32_t page;
+
+    int uffd;
+    int stop[2];                /* Pipe telling thread to stop */
+    pthread_t thread;
+
+    uint8_t *present;           /* Per page, set once copied in */
+    uint8_t *bounce;            /* MAP_READAHEAD_MAX */
+
+    uint32_t next;              /* Where a sequential fault would be */
+    uint32_t window;            /* Current read-ahead */
+};
+
+/* Serve fault at off (page aligned) */
+static void map_fetch(struct spi_device_struct *d, struct spi_device_map *m,
+                      uint32_t off)
+{
+    struct uffdio_copy copy;
+    struct uffdio_range range;
+    uint32_t chunk, n, i;
+
+    /* At least what the adapter does in one go */
+    chunk = driver_chunk(driver_caps(d->bus), MAP_READAHEAD_MAX) &
+        ~(m->page - 1);
+    if (chunk < m->page)
+        chunk = m->page;
+    if (off == m->next && m->window < MAP_READAHEAD_MAX)
+        m->window *= 2;
+    else if (off != m->next)
+        m->window = 0;
+    if (m->window < chunk)
+        m->window = chunk;
+    if (m->window > MAP_READAHEAD_MAX)
+        m->window = MAP_READAHEAD_MAX;
+
+    /* Up to the next page already there. Nothing if another thread's
+     * fault on the same page got it first, just wake. */
+    n = m->window < m->len - off ? m->window : m->len - off;
+    for (i = 0; i < n && !m->present[(off + i) / m->page]; i += m->page) ;
+    n = i;
+    if (n == 0) {
+        range.start = (uintptr_t)&m->base[off];
+        range.len = m->page;
+        ioctl(m->uffd, UFFDIO_WAKE, &range);
+        return;
+    }
+
+    memset(m->bounce, 0xFF, n);
+    if (spi_device_read(d, off, m->bounce,
+                        off + n > d->size ? d->size - off : n) != 0)
+        LOGE("SPI flash: Map read of %u at 0x%X failed, seen as erased\n",
+             n, off);
+
+    copy.dst = (uintptr_t)&m->base[off];
+    copy.src = (uintptr_t)m->bounce;
+    copy.len = n;
+    copy.mode = 0;
+    copy.copy = 0;
+    if (ioctl(m->uffd, UFFDIO_COPY, &copy) == -1 && errno != EEXIST)
+        LOGE("SPI flash: UFFDIO_COPY at 0x%X failed: %s\n", off,
+             strerror(errno));
+    for (i = 0; i < n; i += m->page)
+        m->present[(off + i) / m->page] = 1;
+    m->next = off + n;
+}
+
+static void *map_thread(void *arg)
+{
+    struct spi_device_struct *d = arg;
+    struct spi_device_map *m = d->map;
+    struct pollfd pfd[2] = {
+        {.fd = m->uffd,.events = POLLIN},
+        {.fd = m->stop[0],.events = POLLIN},
+    };
+    struct uffd_msg msg;
+    uintptr_t a;
+
+    while (1) {
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            LOGE("SPI flash: Map poll failed: %s\n", strerror(errno));
+            return NULL;
+        }
+        if (pfd[1].revents)
+            return NULL;
+        if (read(m->uffd, &msg, sizeof(msg)) != sizeof(msg))
+            continue;
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+        a = msg.arg.pagefault.address - (uintptr_t)m->base;
+        map_fetch(d, m, a & ~(uintptr_t)(m->page - 1));
+    }
+}
+
+/* Faults of the kernel too if allowed, so the mapping can be passed to
+ * syscalls. Else user-mode only faults, which need no privileges but make
+ * syscalls on pages not yet touched fail with EFAULT. */
+static int uffd_open(void)
+{
+    int fd;
+
+    fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef UFFD_USER_MODE_ONLY
+    if (fd == -1) {
+        fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK |
+                     UFFD_USER_MODE_ONLY);
+        if (fd != -1)
+            LOGW("SPI flash: Map has user-mode faults only, touch pages "
+                 "before passing them to syscalls\n");
+    }
+#endif
+    return fd;
+}
+
+const uint8_t *spi_device_map(spi_device_hndl spi_device)
+{
+    struct spi_device_map *m;
+    struct uffdio_api api = {.api = UFFD_API };
+    struct uffdio_register reg;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    if (spi_device->map)
+        return spi_device->map->base;
+
+    m = calloc(1, sizeof(struct spi_device_map));
+    assert(m != NULL);
+    m->uffd = m->stop[0] = m->stop[1] = -1;
+    m->page = sysconf(_SC_PAGESIZE);
+    m->len = (spi_device->size + m->page - 1) & ~(m->page - 1);
+    m->present = calloc(m->len / m->page, 1);
+    m->bounce = malloc(MAP_READAHEAD_MAX);
+    assert(m->present != NULL && m->bounce != NULL);
+
+    if ((m->uffd = uffd_open()) == -1) {
+        LOGE("SPI flash: Can't map, no userfaultfd: %s\n", strerror(errno));
+        goto map_err;
+    }
+    ASSURE_E(ioctl(m->uffd, UFFDIO_API, &api) == 0, goto map_err);
+
+    m->base = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    ASSURE_E(m->base != MAP_FAILED, goto map_err);
+    reg.range.start = (uintptr_t)m->base;
+    reg.range.len = m->len;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    ASSURE_E(ioctl(m->uffd, UFFDIO_REGISTER, &reg) == 0, goto map_err);
+
+    ASSURE_E(pipe2(m->stop, O_CLOEXEC) == 0, goto map_err);
+    spi_device->map = m;
+    ASSURE_E(pthread_create(&m->thread, NULL, map_thread, spi_device) == 0,
+             spi_device->map = NULL; goto map_err);
+
+    return m->base;
+
+map_err:
+    if (m->base && m->base != MAP_FAILED)
+        munmap(m->base, m->len);
+    if (m->stop[0] != -1) {
+        close(m->stop[0]);
+        close(m->stop[1]);
+    }
+    if (m->uffd != -1)
+        close(m->uffd);
+    free(m->bounce);
+    free(m->present);
+    free(m);
+    return NULL;
+}
+
+void spi_device_unmap(spi_device_hndl spi_device)
+{
+    struct spi_device_map *m;
+
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    if ((m = spi_device->map) == NULL)
+        return;
+
+    if (write(m->stop[1], "", 1) == 1)
+        pthread_join(m->thread, NULL);
+    munmap(m->base, m->len);
+    close(m->stop[0]);
+    close(m->stop[1]);
+    close(m->uffd);
+    free(m->bounce);
+    free(m->present);
+    free(m);
+    spi_device->map = NULL;
+}
+#else
+const uint8_t *spi_device_map(spi_device_hndl spi_device)
+{
+    assert(spi_device != NULL && "Error: Bad spi-device descriptor");
+    LOGE("SPI flash: Can't map, built without userfaultfd\n");
+    return NULL;
+}
+
+void spi_device_unmap(spi_device_hndl spi_device)
+{
+}
+#endif                          //HAVE_USERFAULTFD
+
+/* Does nothing but is needed for linker not to optimize away functions */
+int spi_device_init_api(const struct adapter *device)
+{
+    return 0;
+}
@@ -0,0 +1,31 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ehwe_crc32c_h
+#define ehwe_crc32c_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli, as in iSCSI/ext4) of len bytes at buf, continuing
+ * from crc. Start with crc 0. Uses SSE4.2 or ARMv8 CRC instructions when
+ * built with ENABLE_CRC32C_HW and the CPU has them. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif                          //ehwe_crc32c_h
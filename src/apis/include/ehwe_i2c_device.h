@@ -28,6 +28,7 @@
 #include <stm32f10x.h>
 
 struct adapter;
+struct driver_caps;
 
 /* Module initialization */
 int i2c_device_init_api(const struct adapter *device);
@@ -43,6 +44,10 @@ void i2c_device_close(i2c_device_hndl i2c_device);
 I2C_TypeDef *i2c_device_bus(i2c_device_hndl i2c_device);
 uint8_t i2c_device_addr(i2c_device_hndl i2c_device);
 
+/* Capabilities of the device's adapter (see driver.h), for picking chunk
+ * sizes and batching of device level drivers */
+const struct driver_caps *i2c_device_caps(i2c_device_hndl i2c_device);
+
 /* Adapter access for byte-chunks */
 void i2c_device_read_bytes(i2c_device_hndl i2c_device, uint8_t reg,
                            uint8_t *buf, uint8_t count);
@@ -57,4 +62,17 @@ void i2c_device_write_uint8(i2c_device_hndl, uint8_t reg, uint8_t val);
 void i2c_device_write_uint16(i2c_device_hndl, uint8_t reg, uint16_t val);
 void i2c_device_write_uint32(i2c_device_hndl, uint8_t reg, uint32_t val);
 
+/* Drain a FIFO register: read len bytes from reg, addressed once and then
+ * read in as large transfers as the adapter takes. The device must not
+ * auto-increment its register address (often a bit in reg or a setting). */
+void i2c_device_read_fifo(i2c_device_hndl, uint8_t reg, uint8_t *buf,
+                          uint32_t len);
+
+/* As above, n samples decoded into out. See ehwe_sample.h for be and
+ * bits */
+void i2c_device_read_fifo_s16(i2c_device_hndl, uint8_t reg, int16_t *out,
+                              uint32_t n, int be, int bits);
+void i2c_device_read_fifo_s32(i2c_device_hndl, uint8_t reg, int32_t *out,
+                              uint32_t n, int be, int bits);
+
 #endif                          //ehwe_i2c_device_h
@@ -0,0 +1,60 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ehwe_i2c_eeprom_h
+#define ehwe_i2c_eeprom_h
+
+#include <stdint.h>
+#include <ehwe_i2c_device.h>
+
+/* Module initialization */
+int i2c_eeprom_init_api(const struct adapter *device);
+
+/* Forward declaration - hide unneeded details*/
+struct i2c_eeprom_struct;
+typedef struct i2c_eeprom_struct *i2c_eeprom_hndl;
+
+/* Open/close - Creates/destroys an instance for a 24Cxx EEPROM of size
+ * bytes at addr (7-bit, A2-A0 as strapped). Parts up to 2K (24C16) take
+ * one address byte, higher address bits going in the device address, as do
+ * bits above 16 of the largest. page is the page-write size, 0 for that of
+ * Microchip parts of the size. Closing writes what's pending. */
+i2c_eeprom_hndl i2c_eeprom_open(I2C_TypeDef * bus, uint8_t addr,
+                                uint32_t size, uint32_t page);
+void i2c_eeprom_close(i2c_eeprom_hndl i2c_eeprom);
+
+i2c_device_hndl i2c_eeprom_device(i2c_eeprom_hndl i2c_eeprom);
+uint32_t i2c_eeprom_size(i2c_eeprom_hndl i2c_eeprom);
+uint32_t i2c_eeprom_page_size(i2c_eeprom_hndl i2c_eeprom);
+
+/* Sequential read, in as few messages as the adapter allows. Returns 0 on
+ * success. */
+int i2c_eeprom_read(i2c_eeprom_hndl i2c_eeprom, uint32_t addr, uint8_t *buf,
+                    uint32_t len);
+
+/* Write of any length and alignment. Whole pages are written at once,
+ * partial ones are collected and written as one page-write when another
+ * page is written to, or on read, flush or close. Returns 0 on success. */
+int i2c_eeprom_write(i2c_eeprom_hndl i2c_eeprom, uint32_t addr,
+                     const uint8_t *buf, uint32_t len);
+
+/* Write what's been collected and wait for its write-cycle */
+int i2c_eeprom_flush(i2c_eeprom_hndl i2c_eeprom);
+
+#endif                          //ehwe_i2c_eeprom_h
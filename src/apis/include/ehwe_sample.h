@@ -0,0 +1,36 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ehwe_sample_h
+#define ehwe_sample_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Decode n samples of sensor data at buf, 16 or 32-bit two's complement
+ * and big endian if be, else little, into host order. Samples are bits
+ * wide, right-justified, and sign-extended from bit bits-1 (16 or 32 if
+ * full width). out may be buf. Vectorized (SSE2/NEON) when built with
+ * ENABLE_SAMPLE_SIMD and the CPU has it. */
+void sample_decode_s16(int16_t *out, const void *buf, size_t n, int be,
+                       int bits);
+void sample_decode_s32(int32_t *out, const void *buf, size_t n, int be,
+                       int bits);
+
+#endif                          //ehwe_sample_h
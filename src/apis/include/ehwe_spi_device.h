@@ -0,0 +1,130 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ehwe_spi_device_h
+#define ehwe_spi_device_h
+
+#include <stdint.h>
+
+/* See ehwe_i2c_device.h */
+#include <stm32f10x.h>
+
+struct adapter;
+struct driver_caps;
+
+/* Module initialization */
+int spi_device_init_api(const struct adapter *device);
+
+/* Forward declaration - hide unneeded details*/
+struct spi_device_struct;
+typedef struct spi_device_struct *spi_device_hndl;
+
+/* Open/close - Creates/destroys a spi-device instance for the JEDEC SPI NOR
+ * flash on bus. Geometry is probed by SFDP, or by JEDEC-ID if the flash
+ * hasn't got SFDP. Returns NULL if no flash answers. */
+spi_device_hndl spi_device_open(SPI_TypeDef * bus);
+void spi_device_close(spi_device_hndl spi_device);
+
+SPI_TypeDef *spi_device_bus(spi_device_hndl spi_device);
+
+/* Capabilities of the device's adapter (see driver.h) */
+const struct driver_caps *spi_device_caps(spi_device_hndl spi_device);
+
+/* Probed geometry. Manufacturer, type and capacity bytes of the JEDEC-ID
+ * as 0xMMTTCC. Erase size is that of the smallest erase type. */
+uint32_t spi_device_jedec_id(spi_device_hndl spi_device);
+uint32_t spi_device_size(spi_device_hndl spi_device);
+uint32_t spi_device_page_size(spi_device_hndl spi_device);
+uint32_t spi_device_erase_size(spi_device_hndl spi_device);
+
+/* Fast-read of len bytes at addr, in as few transfers as the adapter
+ * allows. Returns 0 on success. */
+int spi_device_read(spi_device_hndl spi_device, uint32_t addr, uint8_t *buf,
+                    uint32_t len);
+
+/* Erase [addr, addr+len), both aligned to the erase size, using the fewest
+ * erase commands. Returns 0 on success. */
+int spi_device_erase(spi_device_hndl spi_device, uint32_t addr, uint32_t len);
+
+/* Program len bytes at addr (erased beforehand), split at page boundaries.
+ * Returns 0 on success. */
+int spi_device_program(spi_device_hndl spi_device, uint32_t addr,
+                       const uint8_t *buf, uint32_t len);
+
+/* Differential programming: make [addr, addr+len) hold image, touching
+ * only what differs. Each erase-size sector is read back and compared;
+ * sectors needing only bits cleared are programmed without erase, others
+ * are erased (adjacent ones together) and programmed. Pages already as
+ * wanted are skipped. Content outside the range is kept. Returns 0 on
+ * success. */
+int spi_device_update(spi_device_hndl spi_device, uint32_t addr,
+                      const uint8_t *image, uint32_t len);
+
+/* As above with the image being the file fname, memory-mapped */
+int spi_device_update_file(spi_device_hndl spi_device, uint32_t addr,
+                           const char *fname);
+
+/* Verify that [addr, addr+len) holds image. Reading and checking overlap,
+ * mismatches are logged per erase-size sector. If crc isn't NULL it's set
+ * to the CRC32C (see ehwe_crc32c.h) of what was read. Returns the number
+ * of sectors differing, or -1 on failure. */
+int spi_device_verify(spi_device_hndl spi_device, uint32_t addr,
+                      const uint8_t *image, uint32_t len, uint32_t *crc);
+
+/* As above with the image being the file fname, memory-mapped */
+int spi_device_verify_file(spi_device_hndl spi_device, uint32_t addr,
+                           const char *fname, uint32_t *crc);
+
+/* Result of one target of spi_device_gang */
+struct spi_gang_result {
+    struct adapter *adapter;
+    int rc;                     /* 0 if programmed and verified */
+    const char *failed;         /* Step that failed (probe, size, program,
+                                   verify), NULL if none */
+    uint32_t jedec_id;
+    int bad;                    /* Sectors differing after programming, -1
+                                   if not verified */
+    uint32_t crc;               /* CRC32C of what was read back */
+    uint64_t ms;                /* Time taken */
+};
+
+/* Gang programming: update and verify (as above) the flash on each of n
+ * SPI adapters with the file fname at addr, all at once with a thread per
+ * adapter. The image is mapped once and shared. A target failing doesn't
+ * stop the others, results are in res[i] for adapters[i]. Returns the
+ * number of targets failed, -1 if the image can't be mapped. */
+int spi_device_gang(struct adapter **adapters, int n, uint32_t addr,
+                    const char *fname, struct spi_gang_result *res);
+
+/* Read-only mapping of the whole flash. Pages are read from the flash
+ * when first touched and kept, with read-ahead while access is sequential.
+ * Faults are served by a thread of its own using the device, so other
+ * threads must not use the device (or its adapter) while touching the
+ * mapping. Mapping again returns the same. Linux only (userfaultfd),
+ * returns NULL if not possible. Where only user-mode faults are permitted
+ * (vm.unprivileged_userfaultfd=0 and no CAP_SYS_PTRACE), syscalls given
+ * pages of the mapping not yet touched fail with EFAULT: read them first,
+ * e.g. by copying, before passing them to write() and the like. */
+const uint8_t *spi_device_map(spi_device_hndl spi_device);
+
+/* Unmap, also done by spi_device_close. Content written to the flash after
+ * mapping isn't seen in pages already touched: unmap and map again. */
+void spi_device_unmap(spi_device_hndl spi_device);
+
+#endif                          //ehwe_spi_device_h
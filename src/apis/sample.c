@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Decoding of sensor samples. Byte-swap and sign-extension, 8 or 4
+ * samples at a time with SSE2 (x86) or NEON (AArch64), which are part of
+ * the base ISA of each, with a scalar tail.
+ */
+#include <config.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <ehwe_sample.h>
+
+#ifdef ENABLE_SAMPLE_SIMD
+#  if defined(__SSE2__)
+#    include <emmintrin.h>
+#    define HAVE_SAMPLE_SSE2
+#  elif defined(__aarch64__)
+#    include <arm_neon.h>
+#    define HAVE_SAMPLE_NEON
+#  endif
+#endif
+
+/* Samples need a swap if their order isn't the host's */
+#define NEED_SWAP( BE ) (!!(BE) != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__))
+
+void sample_decode_s16(int16_t *out, const void *buf, size_t n, int be,
+                       int bits)
+{
+    const uint8_t *p = buf;
+    int swap = NEED_SWAP(be), s = 16 - bits;
+    size_t i = 0;
+    uint16_t v;
+
+    assert(bits > 0 && bits <= 16);
+#ifdef HAVE_SAMPLE_SSE2
+    {
+        __m128i cnt = _mm_cvtsi32_si128(s), x;
+
+        for (; i + 8 <= n; i += 8) {
+            x = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+            if (swap)
+                x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+            x = _mm_sra_epi16(_mm_sll_epi16(x, cnt), cnt);
+            _mm_storeu_si128((__m128i *)(out + i), x);
+        }
+    }
+#endif
+#ifdef HAVE_SAMPLE_NEON
+    {
+        int16x8_t l = vdupq_n_s16(s), r = vdupq_n_s16(-s);
+        uint8x16_t x;
+
+        for (; i + 8 <= n; i += 8) {
+            x = vld1q_u8(p + 2 * i);
+            if (swap)
+                x = vrev16q_u8(x);
+            vst1q_s16(out + i, vshlq_s16(vshlq_s16(vreinterpretq_s16_u8(x),
+                                                   l), r));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        memcpy(&v, p + 2 * i, 2);
+        if (swap)
+            v = __builtin_bswap16(v);
+        out[i] = (int16_t)(uint16_t)(v << s) >> s;
+    }
+}
+
+void sample_decode_s32(int32_t *out, const void *buf, size_t n, int be,
+                       int bits)
+{
+    const uint8_t *p = buf;
+    int swap = NEED_SWAP(be), s = 32 - bits;
+    size_t i = 0;
+    uint32_t v;
+
+    assert(bits > 0 && bits <= 32);
+#ifdef HAVE_SAMPLE_SSE2
+    {
+        __m128i cnt = _mm_cvtsi32_si128(s), x;
+
+        for (; i + 4 <= n; i += 4) {
+            x = _mm_loadu_si128((const __m128i *)(p + 4 * i));
+            if (swap) {
+                /* Swap halves, then bytes in each */
+                x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+                x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+            }
+            x = _mm_sra_epi32(_mm_sll_epi32(x, cnt), cnt);
+            _mm_storeu_si128((__m128i *)(out + i), x);
+        }
+    }
+#endif
+#ifdef HAVE_SAMPLE_NEON
+    {
+        int32x4_t l = vdupq_n_s32(s), r = vdupq_n_s32(-s);
+        uint8x16_t x;
+
+        for (; i + 4 <= n; i += 4) {
+            x = vld1q_u8(p + 4 * i);
+            if (swap)
+                x = vrev32q_u8(x);
+            vst1q_s32(out + i, vshlq_s32(vshlq_s32(vreinterpretq_s32_u8(x),
+                                                   l), r));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        memcpy(&v, p + 4 * i, 4);
+        if (swap)
+            v = __builtin_bswap32(v);
+        out[i] = (int32_t)(v << s) >> s;
+    }
+}
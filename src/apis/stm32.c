@@ -28,6 +28,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <liblog/assure.h>
+#include <usdt.h>
+
+/* Static tracepoints of API calls on bus B, see usdt.h */
+#define API_ENTRY(B, OSZ, ISZ) \
+    USDT6(api_entry, "stm32", __func__, (B)->adapter->index, -1, OSZ, ISZ)
+#define API_RETURN(B) \
+    USDT4(api_return, "stm32", __func__, (B)->adapter->index, -1)
 
 SPI_TypeDef *SPI_stm32_drv[MAX_SPI_ADAPTERS];
 I2C_TypeDef *I2C_stm32_drv[MAX_I2C_ADAPTERS];
@@ -165,6 +172,86 @@ int stm32_init_api(const struct adapter *adapter)
             if_init = 1;
             break;
 #endif
+#ifdef ADAPTER_SHM
+        case SHM:
+            switch (adapter->role) {
+                case ROLE_SPI:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_SPI_ADAPTERS);
+                    SPI_stm32_drv[adapter->index - 1] = adapter->driver.spi;
+                    break;
+                case ROLE_I2C:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_I2C_ADAPTERS);
+                    I2C_stm32_drv[adapter->index - 1] = adapter->driver.i2c;
+                    break;
+                default:
+                    ASSERT("Role not supported for SHM driver" == NULL);
+            }
+
+            if_init = 1;
+            break;
+#endif
+#ifdef ADAPTER_REMOTE
+        case REMOTE:
+            switch (adapter->role) {
+                case ROLE_SPI:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_SPI_ADAPTERS);
+                    SPI_stm32_drv[adapter->index - 1] = adapter->driver.spi;
+                    break;
+                case ROLE_I2C:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_I2C_ADAPTERS);
+                    I2C_stm32_drv[adapter->index - 1] = adapter->driver.i2c;
+                    break;
+                default:
+                    ASSERT("Role not supported for REMOTE driver" == NULL);
+            }
+
+            if_init = 1;
+            break;
+#endif
+#ifdef ADAPTER_SIM
+        case SIM:
+            switch (adapter->role) {
+                case ROLE_SPI:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_SPI_ADAPTERS);
+                    SPI_stm32_drv[adapter->index - 1] = adapter->driver.spi;
+                    break;
+                case ROLE_I2C:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_I2C_ADAPTERS);
+                    I2C_stm32_drv[adapter->index - 1] = adapter->driver.i2c;
+                    break;
+                default:
+                    ASSERT("Role not supported for SIM driver" == NULL);
+            }
+
+            if_init = 1;
+            break;
+#endif
+#ifdef ADAPTER_REPLAY
+        case REPLAY:
+            switch (adapter->role) {
+                case ROLE_SPI:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_SPI_ADAPTERS);
+                    SPI_stm32_drv[adapter->index - 1] = adapter->driver.spi;
+                    break;
+                case ROLE_I2C:
+                    ASSERT(adapter->index > 0
+                           && adapter->index <= MAX_I2C_ADAPTERS);
+                    I2C_stm32_drv[adapter->index - 1] = adapter->driver.i2c;
+                    break;
+                default:
+                    ASSERT("Role not supported for REPLAY driver" == NULL);
+            }
+
+            if_init = 1;
+            break;
+#endif
         default:
             LOGE("Unsupported adapter [%d] in [%s]\n", adapter->devid, __func__);
 
@@ -193,7 +280,9 @@ void SPI_I2S_SendData(SPI_TypeDef * SPIx, uint16_t Data)
     uint8_t ldata = Data;       /*Intentional truncation to 8-bit */
     struct ddata *ddata = SPIx->ddata;
 
+    API_ENTRY(SPIx, 1, 0);
     SPIx->sendData(ddata, &ldata, 1);
+    API_RETURN(SPIx);
 }
 
 /**
@@ -208,7 +297,9 @@ uint16_t SPI_I2S_ReceiveData(SPI_TypeDef * SPIx)
     uint8_t ldata;
     struct ddata *ddata = SPIx->ddata;
 
+    API_ENTRY(SPIx, 0, 1);
     SPIx->receiveData(ddata, &ldata, 1);
+    API_RETURN(SPIx);
     return ldata;
 }
 
@@ -418,51 +509,91 @@ FlagStatus I2C_GetFlagStatus(I2C_TypeDef * I2Cx, uint32_t I2C_FLAG)
 /***************************************************************************
  * These don't exist in stdperf but are added for testing ehwe             *
  ***************************************************************************/
+/* Write osz then read isz bytes, in chunks the adapter takes (see
+ * driver_caps). If cs, CS is held active over all of it as over a single
+ * sendrecieveData. */
+static void spi_xfer(SPI_TypeDef * SPIx, const uint8_t *obuffer, int osz,
+                     uint8_t *ibuffer, int isz, int cs)
+{
+    const struct driver_caps *caps = driver_caps(SPIx);
+    struct ddata *ddata = SPIx->ddata;
+    int n;
+
+    if (driver_chunk(caps, osz) == osz && driver_chunk(caps, isz) == isz) {
+        if (cs)
+            SPIx->sendrecieveData(ddata, obuffer, osz, ibuffer, isz);
+        else
+            SPIx->sendrecieveData_ncs(ddata, obuffer, osz, ibuffer, isz);
+        return;
+    }
+
+    if (cs)
+        SPIx->setCS(ddata, 0);
+    for (; osz > 0; osz -= n, obuffer += n) {
+        n = driver_chunk(caps, osz);
+        SPIx->sendrecieveData_ncs(ddata, obuffer, n, NULL, 0);
+    }
+    for (; isz > 0; isz -= n, ibuffer += n) {
+        n = driver_chunk(caps, isz);
+        SPIx->sendrecieveData_ncs(ddata, NULL, 0, ibuffer, n);
+    }
+    if (cs)
+        SPIx->setCS(ddata, 1);
+}
+
 void SPI_I2S_SendReceiveData(SPI_TypeDef * SPIx, const uint8_t *obuffer,
                              int osz, uint8_t *ibuffer, int isz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData(ddata, obuffer, osz, ibuffer, isz);
+    API_ENTRY(SPIx, osz, isz);
+    spi_xfer(SPIx, obuffer, osz, ibuffer, isz, 1);
+    API_RETURN(SPIx);
 
 }
 
 void SPI_I2S_SendReceiveData_ncs(SPI_TypeDef * SPIx, const uint8_t *obuffer,
                                  int osz, uint8_t *ibuffer, int isz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData_ncs(ddata, obuffer, osz, ibuffer, isz);
+    API_ENTRY(SPIx, osz, isz);
+    spi_xfer(SPIx, obuffer, osz, ibuffer, isz, 0);
+    API_RETURN(SPIx);
 
 }
 
 void SPI_I2S_SendDataArray(SPI_TypeDef * SPIx, const uint8_t *buffer, int sz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData(ddata, buffer, sz, NULL, 0);
+    API_ENTRY(SPIx, sz, 0);
+    spi_xfer(SPIx, buffer, sz, NULL, 0, 1);
+    API_RETURN(SPIx);
 }
 
 void SPI_I2S_SendDataArray_ncs(SPI_TypeDef * SPIx, const uint8_t *buffer,
                                int sz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData_ncs(ddata, buffer, sz, NULL, 0);
+    API_ENTRY(SPIx, sz, 0);
+    spi_xfer(SPIx, buffer, sz, NULL, 0, 0);
+    API_RETURN(SPIx);
 }
 
 void SPI_I2S_ReceiveDataArray(SPI_TypeDef * SPIx, uint8_t *buffer, int sz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData(ddata, NULL, 0, buffer, sz);
+    API_ENTRY(SPIx, 0, sz);
+    spi_xfer(SPIx, NULL, 0, buffer, sz, 1);
+    API_RETURN(SPIx);
 }
 
 void SPI_I2S_ReceiveDataArray_ncs(SPI_TypeDef * SPIx, uint8_t *buffer, int sz)
 {
-    struct ddata *ddata = SPIx->ddata;
-    SPIx->sendrecieveData_ncs(ddata, NULL, 0, buffer, sz);
+    API_ENTRY(SPIx, 0, sz);
+    spi_xfer(SPIx, NULL, 0, buffer, sz, 0);
+    API_RETURN(SPIx);
 }
 
 void SPI_I2S_SetCS(SPI_TypeDef * SPIx, int state)
 {
     struct ddata *ddata = SPIx->ddata;
+    API_ENTRY(SPIx, 0, 0);
     SPIx->setCS(ddata, state);
+    API_RETURN(SPIx);
 }
 
 void SPI_I2S_SendData_ncs(SPI_TypeDef * SPIx, uint16_t Data)
@@ -470,7 +601,9 @@ void SPI_I2S_SendData_ncs(SPI_TypeDef * SPIx, uint16_t Data)
     uint8_t ldata = Data;       /*Intentional truncation to 8-bit */
     struct ddata *ddata = SPIx->ddata;
 
+    API_ENTRY(SPIx, 1, 0);
     SPIx->sendrecieveData_ncs(ddata, &ldata, 1, NULL, 0);
+    API_RETURN(SPIx);
 }
 
 uint16_t SPI_I2S_ReceiveData_ncs(SPI_TypeDef * SPIx)
@@ -478,7 +611,9 @@ uint16_t SPI_I2S_ReceiveData_ncs(SPI_TypeDef * SPIx)
     uint8_t ldata;
     struct ddata *ddata = SPIx->ddata;
 
+    API_ENTRY(SPIx, 0, 1);
     SPIx->sendrecieveData_ncs(ddata, NULL, 0, &ldata, 1);
+    API_RETURN(SPIx);
     return ldata;
 }
 
@@ -0,0 +1,523 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Michael Ambrus                                  *
+ *   michael@helsinova.se                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * ehwe-bench: Throughput and latency of adapters through each API layer.
+ *
+ * Each adapter given with -d is driven through the layers that apply to
+ * its role:
+ *
+ *   drv     driverAPI_spi/driverAPI_i2c directly (SPI and I2C)
+ *   stm32   STM32 shim, SPI_I2S_* (SPI)
+ *   nordic  i2c_write/i2c_read (I2C)
+ *   dev     ehwe_i2c_device register access (I2C)
+ *
+ * One operation is one transaction of <size> payload bytes: a read is a
+ * read-command or register address followed by <size> bytes read, a write
+ * is <size> bytes written (0x00 on SPI, i.e. NOP to most flashes). Writes
+ * are real writes, the default mix is therefore reads only.
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <liblog/log.h>
+#include <liblog/assure.h>
+#include <adapters.h>
+#include <driver.h>
+#include <apis.h>
+#ifdef ENABLE_API_STM32
+#include <stm32f10x.h>
+#endif
+#ifdef ENABLE_API_HIGH_LVL
+#include <ehwe.h>
+#include <ehwe_i2c_device.h>
+#endif
+
+#define BENCH_MAX_ADAPTERS 16
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_XFER 4095     /* Largest transfer all drivers take */
+#define BENCH_DFLT_SIZES "1,16,256"
+#define BENCH_DFLT_OPS 1000
+#define BENCH_DFLT_WARMUP 10
+#define BENCH_DFLT_I2C_ADDR 0x50
+#define BENCH_SPI_READ 0x03     /* SPI NOR "read data", 24-bit address */
+
+typedef enum {
+    LAYER_DRV = 1 << 0,
+    LAYER_STM32 = 1 << 1,
+    LAYER_NORDIC = 1 << 2,
+    LAYER_DEV = 1 << 3,
+    LAYER_ALL = 0xF
+} layer_t;
+
+static const struct {
+    layer_t layer;
+    const char *name;
+    int roles;                  /* Bit (1 << role) for each role it drives */
+} layers[] = {
+    {LAYER_DRV, "drv", (1 << ROLE_SPI) | (1 << ROLE_I2C)},
+#ifdef ENABLE_API_STM32
+    {LAYER_STM32, "stm32", 1 << ROLE_SPI},
+#endif
+#ifdef ENABLE_API_HIGH_LVL
+    {LAYER_NORDIC, "nordic", 1 << ROLE_I2C},
+    {LAYER_DEV, "dev", 1 << ROLE_I2C},
+#endif
+};
+
+#define NLAYERS (sizeof(layers) / sizeof(layers[0]))
+
+struct bench_opts {
+    const char *adapter_strs[BENCH_MAX_ADAPTERS];
+    int nadapters;
+    int layers;                 /* layer_t mask */
+    int sizes[BENCH_MAX_SIZES];
+    int nsizes;
+    int nops;
+    int warmup;
+    double seconds;             /* Per case, 0 is no limit */
+    int read_pct;               /* Share of operations being reads */
+    uint8_t i2c_addr;
+    uint8_t i2c_reg;
+    int csv;
+};
+
+/* One benchmark case: adapter x layer x size */
+struct bench_case {
+    struct adapter *adapter;
+    layer_t layer;
+    int size;
+    uint8_t addr;               /* I2C */
+    uint8_t reg;
+    uint8_t *obuf;
+    uint8_t *ibuf;
+#ifdef ENABLE_API_HIGH_LVL
+    i2c_device_hndl i2c_device;
+#endif
+};
+
+struct bench_result {
+    int nops;
+    double seconds;
+    uint64_t bytes;
+    uint64_t p50, p99, p999;    /* ns */
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Deterministic operation mix, same sequence every run */
+static uint32_t bench_rand(uint32_t * state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/***************************************************************************
+ * Layers. One call is one operation.
+ ***************************************************************************/
+static void op_drv(struct bench_case *bc, int read)
+{
+    struct adapter *adapter = bc->adapter;
+    uint8_t cmd[4] = { BENCH_SPI_READ, 0, 0, 0 };
+
+    if (adapter->role == ROLE_SPI) {
+        struct driverAPI_spi *spi = adapter->driver.spi;
+
+        if (read)
+            spi->sendrecieveData(spi->ddata, cmd, sizeof(cmd), bc->ibuf,
+                                 bc->size);
+        else
+            spi->sendData(spi->ddata, bc->obuf, bc->size);
+    } else {
+        struct driverAPI_i2c *i2c = adapter->driver.i2c;
+
+        i2c->start(i2c->ddata);
+        if (read) {
+            i2c->sendByte(i2c->ddata, (bc->addr << 1) | 1);
+            i2c->receiveData(i2c->ddata, bc->ibuf, bc->size);
+        } else {
+            i2c->sendByte(i2c->ddata, bc->addr << 1);
+            i2c->sendData(i2c->ddata, bc->obuf, bc->size);
+        }
+        i2c->stop(i2c->ddata);
+    }
+}
+
+#ifdef ENABLE_API_STM32
+static void op_stm32(struct bench_case *bc, int read)
+{
+    SPI_TypeDef *spi = SPI_stm32_drv[bc->adapter->index - 1];
+
+    if (read)
+        SPI_I2S_SendReceiveData(spi, (uint8_t[]) {
+                                BENCH_SPI_READ, 0, 0, 0}, 4, bc->ibuf,
+                                bc->size);
+    else
+        SPI_I2S_SendDataArray(spi, bc->obuf, bc->size);
+}
+#endif
+
+#ifdef ENABLE_API_HIGH_LVL
+static void op_nordic(struct bench_case *bc, int read)
+{
+    I2C_TypeDef *i2c = I2C_stm32_drv[bc->adapter->index - 1];
+
+    if (read)
+        i2c_read(i2c, bc->addr, bc->ibuf, bc->size);
+    else
+        i2c_write(i2c, bc->addr, bc->obuf, bc->size, 1);
+}
+
+static void op_dev(struct bench_case *bc, int read)
+{
+    if (read)
+        i2c_device_read_bytes(bc->i2c_device, bc->reg, bc->ibuf, bc->size);
+    else
+        i2c_device_write_bytes(bc->i2c_device, bc->reg, bc->obuf, bc->size);
+}
+#endif
+
+static void bench_op(struct bench_case *bc, int read)
+{
+    switch (bc->layer) {
+        case LAYER_DRV:
+            op_drv(bc, read);
+            break;
+#ifdef ENABLE_API_STM32
+        case LAYER_STM32:
+            op_stm32(bc, read);
+            break;
+#endif
+#ifdef ENABLE_API_HIGH_LVL
+        case LAYER_NORDIC:
+            op_nordic(bc, read);
+            break;
+        case LAYER_DEV:
+            op_dev(bc, read);
+            break;
+#endif
+        default:
+            ASSERT("Bad layer" == NULL);
+    }
+}
+
+/***************************************************************************
+ * Measurement
+ ***************************************************************************/
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const uint64_t * sorted, int n, double p)
+{
+    int i = (int)(p * n);
+
+    return sorted[i < n ? i : n - 1];
+}
+
+static void bench_run(struct bench_case *bc, const struct bench_opts *o,
+                      struct bench_result *res)
+{
+    uint64_t *lat, t0, t1, tstart, tmax;
+    uint32_t rnd = 0x2545F491;
+    int i, read;
+
+    ASSERT(lat = malloc(o->nops * sizeof(uint64_t)));
+
+    for (i = 0; i < o->warmup; i++)
+        bench_op(bc, (int)(bench_rand(&rnd) % 100) < o->read_pct);
+
+    memset(res, 0, sizeof(*res));
+    tmax = o->seconds > 0 ? (uint64_t)(o->seconds * 1e9) : UINT64_MAX;
+    tstart = t1 = now_ns();
+    for (i = 0; i < o->nops && t1 - tstart < tmax; i++) {
+        read = (int)(bench_rand(&rnd) % 100) < o->read_pct;
+        t0 = now_ns();
+        bench_op(bc, read);
+        t1 = now_ns();
+        lat[i] = t1 - t0;
+        res->bytes += bc->size;
+    }
+    res->nops = i;
+    res->seconds = (t1 - tstart) / 1e9;
+
+    if (res->nops) {
+        qsort(lat, res->nops, sizeof(uint64_t), cmp_u64);
+        res->p50 = percentile(lat, res->nops, 0.50);
+        res->p99 = percentile(lat, res->nops, 0.99);
+        res->p999 = percentile(lat, res->nops, 0.999);
+    }
+    free(lat);
+}
+
+static void bench_header(const struct bench_opts *o)
+{
+    if (o->csv)
+        printf("adapter,layer,size,read_pct,ops,ops_s,mb_s,p50_us,p99_us,"
+               "p999_us\n");
+    else
+        printf("%-32s %-6s %5s %4s %7s %10s %8s %9s %9s %9s\n", "adapter",
+               "layer", "size", "rd%", "ops", "ops/s", "MB/s", "p50[us]",
+               "p99[us]", "p999[us]");
+}
+
+static void bench_report(const char *adapter_str, const char *layer,
+                         const struct bench_case *bc,
+                         const struct bench_opts *o,
+                         const struct bench_result *r)
+{
+    double ops_s = r->seconds > 0 ? r->nops / r->seconds : 0;
+    double mb_s = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+
+    printf(o->csv ? "%s,%s,%d,%d,%d,%.1f,%.3f,%.1f,%.1f,%.1f\n" :
+           "%-32s %-6s %5d %4d %7d %10.1f %8.3f %9.1f %9.1f %9.1f\n",
+           adapter_str, layer, bc->size, o->read_pct, r->nops, ops_s, mb_s,
+           r->p50 / 1e3, r->p99 / 1e3, r->p999 / 1e3);
+    fflush(stdout);
+}
+
+static void bench_adapter(struct adapter *adapter, const char *adapter_str,
+                          const struct bench_opts *o)
+{
+    struct bench_case bc = {
+        .adapter = adapter,
+        .addr = o->i2c_addr,
+        .reg = o->i2c_reg
+    };
+    struct bench_result res;
+    int l, s;
+
+    ASSERT(bc.obuf = calloc(1, BENCH_MAX_XFER));
+    ASSERT(bc.ibuf = malloc(BENCH_MAX_XFER));
+
+    for (l = 0; l < NLAYERS; l++) {
+        if (!(o->layers & layers[l].layer) ||
+            !(layers[l].roles & (1 << adapter->role)))
+            continue;
+        bc.layer = layers[l].layer;
+#ifdef ENABLE_API_HIGH_LVL
+        if (bc.layer == LAYER_DEV)
+            bc.i2c_device =
+                i2c_device_open(I2C_stm32_drv[adapter->index - 1],
+                                o->i2c_addr);
+#endif
+        for (s = 0; s < o->nsizes; s++) {
+            bc.size = o->sizes[s];
+#ifdef ENABLE_API_HIGH_LVL
+            /* Register access counts in uint8_t */
+            if (bc.layer == LAYER_DEV && bc.size > 255) {
+                LOGW("Size %d too large for layer dev, skipped\n", bc.size);
+                continue;
+            }
+#endif
+            bench_run(&bc, o, &res);
+            bench_report(adapter_str, layers[l].name, &bc, o, &res);
+        }
+#ifdef ENABLE_API_HIGH_LVL
+        if (bc.layer == LAYER_DEV)
+            i2c_device_close(bc.i2c_device);
+#endif
+    }
+    free(bc.obuf);
+    free(bc.ibuf);
+}
+
+/***************************************************************************
+ * Options
+ ***************************************************************************/
+static int parse_layers(const char *str)
+{
+    char *cpy = strdup(str), *tok, *saveptr = NULL;
+    int l, mask = 0;
+
+    for (tok = strtok_r(cpy, ",", &saveptr); tok;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        if (strcasecmp(tok, "all") == 0) {
+            mask |= LAYER_ALL;
+            continue;
+        }
+        for (l = 0; l < NLAYERS; l++) {
+            if (strcasecmp(tok, layers[l].name) == 0)
+                break;
+        }
+        if (l == NLAYERS) {
+            LOGE("Unknown (or not built) layer: %s\n", tok);
+            mask = -1;
+            break;
+        }
+        mask |= layers[l].layer;
+    }
+    free(cpy);
+    return mask;
+}
+
+static int parse_sizes(const char *str, struct bench_opts *o)
+{
+    char *cpy = strdup(str), *tok, *saveptr = NULL;
+    int rc = 0;
+
+    o->nsizes = 0;
+    for (tok = strtok_r(cpy, ",", &saveptr); tok;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        if (o->nsizes >= BENCH_MAX_SIZES) {
+            LOGE("Too many sizes (max %d)\n", BENCH_MAX_SIZES);
+            rc = -1;
+            break;
+        }
+        o->sizes[o->nsizes] = atoi(tok);
+        if (o->sizes[o->nsizes] < 1 || o->sizes[o->nsizes] > BENCH_MAX_XFER) {
+            LOGE("Size must be 1-%d: %s\n", BENCH_MAX_XFER, tok);
+            rc = -1;
+            break;
+        }
+        o->nsizes++;
+    }
+    free(cpy);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s -d ADAPTER [-d ADAPTER ...] [options]\n"
+            "  -d ADAPTER  Adapter, as for ehwe (e.g. spi:1:sim:master:nor)\n"
+            "  -l LAYERS   drv,stm32,nordic,dev or all (default all)\n"
+            "  -s SIZES    Payload sizes, comma separated (default %s)\n"
+            "  -n OPS      Operations per case (default %d)\n"
+            "  -t SECONDS  Time limit per case (default none)\n"
+            "  -w OPS      Warm-up operations per case (default %d)\n"
+            "  -r PCT      Percentage of reads, rest are writes (default 100)\n"
+            "  -a ADDR     I2C device address, hex (default %02X)\n"
+            "  -R REG      I2C register for layer dev, hex (default 00)\n"
+            "  -c          CSV output\n"
+            "  -v LEVEL    Log level (default warning)\n", prog,
+            BENCH_DFLT_SIZES, BENCH_DFLT_OPS, BENCH_DFLT_WARMUP,
+            BENCH_DFLT_I2C_ADDR);
+}
+
+extern log_level log_filter_level;
+
+int main(int argc, char **argv)
+{
+    static struct bench_opts o = {
+        .layers = LAYER_ALL,
+        .nops = BENCH_DFLT_OPS,
+        .warmup = BENCH_DFLT_WARMUP,
+        .read_pct = 100,
+        .i2c_addr = BENCH_DFLT_I2C_ADDR,
+    };
+    static struct adapter adapters[BENCH_MAX_ADAPTERS];
+    int c, i, ok, rc = 0, ninit = 0;
+
+    log_filter_level = LOG_LEVEL_WARNING;
+    parse_sizes(BENCH_DFLT_SIZES, &o);
+
+    while ((c = getopt(argc, argv, "d:l:s:n:t:w:r:a:R:cv:h")) != -1) {
+        switch (c) {
+            case 'd':
+                if (o.nadapters >= BENCH_MAX_ADAPTERS) {
+                    LOGE("Too many adapters (max %d)\n", BENCH_MAX_ADAPTERS);
+                    return 1;
+                }
+                o.adapter_strs[o.nadapters++] = optarg;
+                break;
+            case 'l':
+                if ((o.layers = parse_layers(optarg)) <= 0)
+                    return 1;
+                break;
+            case 's':
+                if (parse_sizes(optarg, &o))
+                    return 1;
+                break;
+            case 'n':
+                o.nops = atoi(optarg);
+                break;
+            case 't':
+                o.seconds = atof(optarg);
+                break;
+            case 'w':
+                o.warmup = atoi(optarg);
+                break;
+            case 'r':
+                o.read_pct = atoi(optarg);
+                break;
+            case 'a':
+                o.i2c_addr = strtol(optarg, NULL, 16) & 0x7F;
+                break;
+            case 'R':
+                o.i2c_reg = strtol(optarg, NULL, 16);
+                break;
+            case 'c':
+                o.csv = 1;
+                break;
+            case 'v':
+                log_filter_level = str2loglevel(optarg, &ok);
+                if (!ok) {
+                    LOGE("Bad log level: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if (o.nadapters == 0 || o.nops < 1 || o.read_pct < 0 ||
+        o.read_pct > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < o.nadapters; i++) {
+        ASSURE_E(adapters_parse(o.adapter_strs[i], &adapters[i]) == 0,
+                 goto err);
+        ASSURE_E(adapters_init_adapter(&adapters[i]) == 0, goto err);
+        ninit++;
+        ASSURE_E(apis_init_api(&adapters[i]) == 0, goto err);
+    }
+
+    bench_header(&o);
+    for (i = 0; i < o.nadapters; i++)
+        bench_adapter(&adapters[i], o.adapter_strs[i], &o);
+
+    goto out;
+err:
+    LOGE("Bad or failing adapter: %s\n", o.adapter_strs[i]);
+    rc = 1;
+out:
+    for (i = 0; i < ninit; i++)
+        adapters_deinit_adapter(&adapters[i]);
+    return rc;
+}
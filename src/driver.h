@@ -33,13 +33,68 @@ typedef enum {
     E_BAD_VALUE
 } config_etype_t;
 
+/* Driver capabilities. What a driver does well, for upper layers to pick
+ * chunk sizes and batching from instead of assuming the least capable
+ * adapter. */
+#define DCAP_FULL_DUPLEX    0x01    /* SPI: bytes in are clocked while bytes
+                                       out are, not after */
+#define DCAP_WRITE_READ     0x02    /* sendrecieveData is one transaction */
+#define DCAP_MULTI_MSG      0x04    /* I2C: start to stop, restarts included,
+                                       is one transaction */
+#define DCAP_ASYNC          0x08    /* Calls not returning data may return
+                                       before done (e.g. batched) */
+#define DCAP_DUAL_IO        0x10    /* SPI: receives on two data lines,
+                                       e.g. for 1-1-2 reads (0x3B) */
+#define DCAP_QUAD_IO        0x20    /* SPI: ditto four lines (0x6B) */
+
+struct driver_caps {
+    int max_xfer;               /* Largest single transfer either way
+                                   (bytes), 0 if unlimited */
+    int bulk_size;              /* Transfer size the adapter is most
+                                   efficient at, 0 if same as max_xfer */
+    int latency_us;             /* Typical time of one transaction */
+    unsigned flags;             /* DCAP_* */
+};
+
+/* Presence bitmap of an I2C scan, one bit per 7-bit address. What's
+ * scanned by default leaves out the reserved addresses, as i2cdetect. */
+#define I2C_SCAN_BYTES 16
+#define I2C_SCAN_FIRST 0x08
+#define I2C_SCAN_LAST  0x77
+#define I2C_SCAN_SET( P, A ) ((P)[(A) >> 3] |= 1 << ((A) & 7))
+#define I2C_SCAN_HAS( P, A ) (((P)[(A) >> 3] >> ((A) & 7)) & 1)
+
 /* Driver abstract type common to all drivers */
 struct driverAPI_any {
     /*------------ Data -----------*/
     struct adapter *adapter;      /* Belongs to this adapter */
     struct ddata *ddata;        /* Adapter specific Driver-Data */
+    const struct driver_caps *caps; /* NULL: nothing known, see driver_caps */
 };
 
+/* Capabilities of any driver. Drivers not telling get a conservative
+ * default. */
+static inline const struct driver_caps *driver_caps(const void *driver)
+{
+    static const struct driver_caps dflt = {
+        .max_xfer = 4095,
+        .bulk_size = 0,
+        .latency_us = 1000,
+        .flags = 0
+    };
+    const struct driverAPI_any *any = driver;
+
+    return any->caps ? any->caps : &dflt;
+}
+
+/* Chunk size to use for a transfer of sz bytes */
+static inline int driver_chunk(const struct driver_caps *caps, int sz)
+{
+    int n = caps->bulk_size ? caps->bulk_size : caps->max_xfer;
+
+    return (n && sz > n) ? n : sz;
+}
+
 struct configAPI_spi {
     /* If second argument is NULL: access and affect directly (if permitted
      * by driver). */
@@ -73,6 +128,7 @@ struct driverAPI_spi {
     /*------------ Data -----------*/
     struct adapter *adapter;      /* Belongs to this adapter */
     struct ddata *ddata;        /* Adapter specific Driver-Data */
+    const struct driver_caps *caps;
 
     /*---------- Methods ----------*/
     void (*sendData) (struct ddata * ddata, const uint8_t *data, int sz);
@@ -134,6 +190,7 @@ struct driverAPI_i2c {
     /*------------ Data -----------*/
     struct adapter *adapter;      /* Belongs to this adapter */
     struct ddata *ddata;        /* Adapter specific Driver-Data */
+    const struct driver_caps *caps;
 
     /*---------- Methods ----------*/
     void (*receiveByte) (struct ddata * ddata, uint8_t *data);
@@ -156,6 +213,20 @@ struct driverAPI_i2c {
      */
     void (*autoAck) (struct ddata * ddata, int state);
 
+    /* Probe for a device at 7-bit address addr, by the cheapest means the
+       adapter has. Returns 1 if ACK:ed, 0 if not, -1 if it can't tell. May
+       be NULL: use start, address and stop instead (see i2c_probe())
+     */
+    int (*probe) (struct ddata * ddata, uint8_t addr);
+
+    /* Probe all addresses first..last at once. Sets the bit of each that
+       ACK:s in present (see I2C_SCAN_SET), returns the
+       number found or -1 if it can't tell. May be NULL: probe one by one
+       instead (see adapters_i2c_scan())
+     */
+    int (*scan) (struct ddata * ddata, uint8_t first, uint8_t last,
+                 uint8_t *present);
+
     uint16_t (*getStatus) (struct ddata * ddata, uint16_t);
     int (*actuate_config) (struct ddata * ddata);   /* Actuate configuration */
 
@@ -36,14 +36,29 @@
 #include <mlist.h>
 #include <adapters.h>
 #include <apis.h>
+#include <driver.h>
+#ifdef ENABLE_API_HIGH_LVL
+#include <ehwe_spi_device.h>
+#endif
+#include <trace.h>
+#include <stats.h>
+#include <record.h>
 #include <stdlib.h>
+#include <string.h>
 
 extern log_level log_filter_level;
 
 struct opts opts = {
 /* *INDENT-OFF* */
     .loglevel       = &log_filter_level,
-    .daemon         = 0
+    .daemon         = 0,
+    .socket         = ADAPTERS_DFLT_SOCKET,
+    .listen         = NULL,
+    .trace          = NULL,
+    .metrics        = NULL,
+    .record         = NULL,
+    .scan           = 0,
+    .program        = NULL
 /* *INDENT-ON* */
 };
 
@@ -59,13 +74,123 @@ void ehwe_exit(int status)
 {
     LOGD("ehwe_exit initiated\n");
 
+    stats_dump(stderr);
+    if (opts.trace)
+        trace_export(opts.trace);
+    rec_stop();
+
     free(opts.req_opts);
     exit(status);
 }
 
+/* Print present devices of each I2C adapter, as i2cdetect does. Returns
+ * 0 if all could be scanned. */
+static int scan_adapters(void)
+{
+    uint8_t present[I2C_SCAN_BYTES];
+    int a, n, rc = 0;
+
+#undef LDATA
+#define LDATA struct adapter
+    ITERATE(ehwe.adapters) {
+        struct adapter *adapter = CREF(ehwe.adapters);
+
+        if (adapter->role != ROLE_I2C)
+            continue;
+        if ((n = adapters_i2c_scan(adapter, I2C_SCAN_FIRST, I2C_SCAN_LAST,
+                                   present)) == -1) {
+            LOGE("I2C adapter [%d] can't tell if addresses ACK\n",
+                 adapter->index);
+            rc = -1;
+            continue;
+        }
+        printf("i2c:%d, %d found\n", adapter->index, n);
+        printf("     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f");
+        for (a = 0; a < 0x80; a++) {
+            if ((a & 0x0F) == 0)
+                printf("\n%02x:", a);
+            if (a < I2C_SCAN_FIRST || a > I2C_SCAN_LAST)
+                printf("   ");
+            else if (I2C_SCAN_HAS(present, a))
+                printf(" %02x", a);
+            else
+                printf(" --");
+        }
+        printf("\n");
+    }
+#undef LDATA
+    fflush(stdout);
+    return rc;
+}
+
+/* Program and verify the SPI flash of all SPI adapters at once. Returns
+ * 0 if all succeeded. */
+static int program_adapters(const char *arg)
+{
+#ifdef ENABLE_API_HIGH_LVL
+    struct adapter **targets = NULL;
+    struct spi_gang_result *res;
+    char *fname, *at, *end;
+    uint32_t addr = 0;
+    int i, n = 0, nfailed;
+
+    /* FILE[@ADDR] */
+    ASSURE(fname = strdup(arg));
+    if ((at = strrchr(fname, '@')) != NULL) {
+        addr = strtoul(at + 1, &end, 0);
+        if (at[1] && *end == 0)
+            *at = 0;
+        else
+            addr = 0;
+    }
+
+#undef LDATA
+#define LDATA struct adapter
+    ITERATE(ehwe.adapters) {
+        if (CDATA(ehwe.adapters).role != ROLE_SPI)
+            continue;
+        ASSURE(targets = realloc(targets, (n + 1) * sizeof(struct adapter *)));
+        targets[n++] = CREF(ehwe.adapters);
+    }
+#undef LDATA
+    if (n == 0) {
+        LOGE("Programming (-P) needs SPI adapters (-d)\n");
+        free(fname);
+        return -1;
+    }
+
+    ASSURE(res = calloc(n, sizeof(struct spi_gang_result)));
+    LOGI("Programming [%s] at 0x%X on %d targets\n", fname, addr, n);
+    nfailed = spi_device_gang(targets, n, addr, fname, res);
+
+    for (i = 0; nfailed != -1 && i < n; i++) {
+        printf("spi:%d: %06X %-8s %6.1fs", res[i].adapter->index,
+               res[i].jedec_id, res[i].rc ? "FAILED" : "OK",
+               res[i].ms / 1000.0);
+        if (res[i].rc == 0)
+            printf(" crc32c %08X\n", res[i].crc);
+        else if (res[i].bad > 0)
+            printf(" %s, %d sectors differ\n", res[i].failed, res[i].bad);
+        else
+            printf(" %s\n", res[i].failed);
+    }
+    if (nfailed > 0)
+        printf("%d of %d targets failed\n", nfailed, n);
+    fflush(stdout);
+
+    free(res);
+    free(targets);
+    free(fname);
+    return nfailed == 0 ? 0 : -1;
+#else
+    LOGE("Programming (-P) requires build option ENABLE_API_HIGH_LVL\n");
+    return -1;
+#endif
+}
+
 int main(int argc, char **argv)
 {
-    int rc, new_argc = argc;
+    int rc, status = 0, new_argc = argc;
     char **new_argv = argv;
     LOGI("\"ehwe\" version v%s \n", VERSION);
 
@@ -81,6 +206,15 @@ int main(int argc, char **argv)
     ASSURE_E(opts_check(&opts) == OPT_OK, goto err);
     LOGI("Option passed rule-check OK\n", rc);
 
+    if (opts.trace && trace_start() != 0) {
+        LOGE("Tracing (-x) requires build option ENABLE_TRACE\n");
+        opts.trace = NULL;
+        goto err;
+    }
+    ASSURE_E(stats_start(opts.metrics) == 0, goto err);
+    if (opts.record && rec_start(opts.record) != 0)
+        goto err;
+
     /* Storage for adapter-specification strings */
     ASSURE((rc =
             mlist_opencreate(sizeof(struct adapter), NULL, &ehwe.adapters)) == 0);
@@ -119,10 +253,33 @@ int main(int argc, char **argv)
     }
 #undef LDATA
 
-    /* Call the workbench */
-    LOGI("Executing workbench\n");
-    rc = embedded_main(new_argc, new_argv);
-    LOGI("Workbench ended\n");
+    if (opts.scan) {
+        status = scan_adapters() == 0 ? 0 : 1;
+    } else if (opts.program) {
+        status = program_adapters(opts.program) == 0 ? 0 : 1;
+    } else if (opts.daemon || opts.listen) {
+        /* Other ehwe-processes run the workbenches, we only serve them */
+        struct adapter **served = NULL;
+        int nserved = 0;
+
+#define LDATA struct adapter
+        ITERATE(ehwe.adapters) {
+            ASSURE(served =
+                   realloc(served, (nserved + 1) * sizeof(struct adapter *)));
+            served[nserved++] = CREF(ehwe.adapters);
+        }
+#undef LDATA
+        if (opts.listen)
+            rc = adapters_serve_remote(served, nserved, opts.listen);
+        else
+            rc = adapters_serve(served, nserved, opts.socket);
+        free(served);
+    } else {
+        /* Call the workbench */
+        LOGI("Executing workbench\n");
+        rc = embedded_main(new_argc, new_argv);
+        LOGI("Workbench ended\n");
+    }
 
     LOGD("De-initializing adapters:\n");
 #define LDATA struct adapter
@@ -137,7 +294,8 @@ int main(int argc, char **argv)
      * variable. */
     ASSURE((rc = mlist_close(ehwe.adapters)) == 0);
 
-    ehwe_exit(rc);
+    /* Of -s or -P, the workbench's own is its business */
+    ehwe_exit(status);
 err2:
     LOGE("Current rc: %d\n", rc);
     ASSURE((rc = mlist_close(ehwe.adapters)) == 0);
@@ -70,6 +70,34 @@ static int opts_parse_opt(const char *cmd,
             _req_opt('z')->cnt++;
             opts->daemon = 1;
             break;
+        case 'S':
+            _req_opt('S')->cnt++;
+            opts->socket = arg;
+            break;
+        case 'L':
+            _req_opt('L')->cnt++;
+            opts->listen = arg;
+            break;
+        case 'x':
+            _req_opt('x')->cnt++;
+            opts->trace = arg;
+            break;
+        case 'M':
+            _req_opt('M')->cnt++;
+            opts->metrics = arg;
+            break;
+        case 'R':
+            _req_opt('R')->cnt++;
+            opts->record = arg;
+            break;
+        case 's':
+            _req_opt('s')->cnt++;
+            opts->scan = 1;
+            break;
+        case 'P':
+            _req_opt('P')->cnt++;
+            opts->program = arg;
+            break;
         case 'u':
             _req_opt('u')->cnt++;
             opts_help(stdout, HELP_USAGE | HELP_EXIT);
@@ -117,6 +145,13 @@ static struct option long_options[] = {
     {"verbosity",      required_argument,  0,  'v'},
 
     {"daemon",         no_argument,        0,  'z'},
+    {"socket",         required_argument,  0,  'S'},
+    {"listen",         required_argument,  0,  'L'},
+    {"trace",          required_argument,  0,  'x'},
+    {"metrics",        required_argument,  0,  'M'},
+    {"record",         required_argument,  0,  'R'},
+    {"scan",           no_argument,        0,  's'},
+    {"program",        required_argument,  0,  'P'},
     {"device",         required_argument,  0,  'd'},
     {"documentation",  no_argument,        0,  'D'},
     {"help",           no_argument,        0,  'h'},
@@ -134,6 +169,13 @@ static struct req_opt req_opts[] = {
     {'v',  not_req,    at_least,   0},
 
     {'z',  not_req,    precisely,  0},
+    {'S',  not_req,    precisely,  0},
+    {'L',  not_req,    precisely,  0},
+    {'x',  not_req,    precisely,  0},
+    {'M',  not_req,    precisely,  0},
+    {'R',  not_req,    precisely,  0},
+    {'s',  not_req,    precisely,  0},
+    {'P',  not_req,    precisely,  0},
     {'d',  mandatory,  at_least,   0},
     {'D',  not_req,    at_least,   0},
     {'h',  not_req,    at_least,   0},
@@ -285,7 +327,7 @@ int opts_parse(int *pargc, char ***pargv, struct opts *opts)
     while (1) {
         int option_index = 0;
         int c = getopt_long(*pargc, *pargv,
-                            "v:zd:DuhV",
+                            "v:zS:L:x:M:R:sP:d:DuhV",
                             long_options,
                             &option_index);
         /* Detect the end of the options. */
@@ -77,6 +77,14 @@ struct req_opt {
 struct opts {
     log_level *loglevel;        /* Verbosity level */
     int daemon;                 /* If to become a daemon or not */
+    char *socket;               /* Daemons Unix socket (serve or attach) */
+    char *listen;               /* Serve REMOTE clients here if set */
+    char *trace;                /* Export transaction trace here at exit */
+    char *metrics;              /* Serve Prometheus text here if set */
+    char *record;               /* Record adapter calls here if set */
+    int scan;                   /* Scan I2C adapters instead of workbench */
+    char *program;              /* Gang-program this image (FILE[@ADDR])
+                                   instead of workbench */
     handle_t adapter_strs;          /* Adapter specifications list. */
 
     struct req_opt *req_opts;   /* Deep copy of the req_opts list. Used to
@@ -30,6 +30,7 @@
 #include "opts.h"
 #include "main.h"
 #include "config.h"
+#include <adapters.h>
 
 const char *program_version = "ehwe " VERSION;
 
@@ -37,7 +38,12 @@ void opts_help(FILE *file, int flags)
 {
     if (file && flags & HELP_USAGE) {
         fprintf(file, "%s",
-                "Usage: ehwe [-zDuhV]\n"
+                "Usage: ehwe [-zsDuhV] [-S path] [--socket=path]\n"
+                "            [-L addr] [--listen=addr]\n"
+                "            [-x file] [--trace=file]\n"
+                "            [-M path] [--metrics=path]\n"
+                "            [-R file] [--record=file]\n"
+                "            [--scan] [-P file[@addr]] [--program=file[@addr]]\n"
                 "            [-v level] [--verbosity=level] \n"
                 "            [--documentation]\n"
                 "            [--help] [--usage] [--version]\n");
@@ -58,7 +64,32 @@ void opts_help(FILE *file, int flags)
                 "  -v, --verbosity            Set the verbosity level.\n"
                 "                             Levels, listed in increasing verbosity, are:\n"
                 "                             critical, error, warning, info, debug, verbose\n"
-                "Special:\n" "  -z, --daemon               Run as a daemon\n"
+                "Special:\n" "  -z, --daemon               Run as a daemon serving the adapters given\n"
+                "                             by -d to other ehwe processes. These attach\n"
+                "                             with adapter SHM.\n"
+                "  -S PATH, --socket PATH     Unix socket the daemon listens on. Default is\n"
+                "                             " ADAPTERS_DFLT_SOCKET "\n"
+                "  -L ADDR, --listen ADDR     Serve the adapters given by -d to REMOTE\n"
+                "                             adapters of other ehwe processes instead of\n"
+                "                             running the workbench. ADDR is [host]:port or\n"
+                "                             the path of a Unix socket.\n"
+                "  -x FILE, --trace FILE      Trace adapter calls and syscalls, export to\n"
+                "                             FILE at exit. Chrome trace JSON unless FILE\n"
+                "                             ends with .vcd (needs ENABLE_TRACE).\n"
+                "  -M PATH, --metrics PATH    Serve adapter statistics as Prometheus text\n"
+                "                             on Unix socket PATH. Statistics are also\n"
+                "                             printed on SIGUSR1 and at exit.\n"
+                "  -R FILE, --record FILE     Record all adapter calls with their data to\n"
+                "                             FILE, for the replay adapter.\n"
+                "  -s, --scan                 Probe every address of each I2C adapter given\n"
+                "                             by -d, print those answering and exit\n"
+                "                             instead of running the workbench.\n"
+                "  -P FILE[@ADDR], --program FILE[@ADDR]\n"
+                "                             Program and verify FILE at ADDR (default 0)\n"
+                "                             of the SPI flash on every SPI adapter given\n"
+                "                             by -d, all at once. Print the result per\n"
+                "                             adapter and exit instead of running the\n"
+                "                             workbench.\n"
                 "  -h, --help                 Print this help\n"
                 "  -u, --usage                Give a short usage message\n"
                 "  -V, --version              Print program version\n" "\n"